@@ -11,7 +11,9 @@
 #include "../debug.c"
 #include "../error.c"
 #include "../gcmem.c"
+#include "../heapsnap.c"
 #include "../libarray.c"
+#include "../libbuffer.c"
 #include "../libclass.c"
 #include "../libcore.c"
 #include "../libfiber.c"
@@ -22,9 +24,14 @@
 #include "../libmodule.c"
 #include "../libobject.c"
 #include "../librange.c"
+#include "../libserial.c"
+#include "../libtypedarray.c"
 #include "../libstring.c"
+#include "../libworker.c"
 #include "../main.c"
+#include "../profiler.c"
 #include "../state.c"
+#include "../threadpool.c"
 #include "../util.c"
 #include "../value.c"
 #include "../vm.c"
@@ -0,0 +1,259 @@
+#!/usr/bin/ruby
+
+# runs the scripts in benches/ (plus a few of the older ones in tests/) as benchmarks.
+#
+#   ruby benches/bench.rb [options]
+#
+# every benchmark runs --warmup times untimed, then --runs times; the median and p95
+# wall time and the peak RSS go to the terminal, and everything to --json.
+# with --compare (another build of 'run') or --baseline (an earlier --json), each
+# median is checked against the other side, and anything slower by more than
+# --threshold percent is a regression, which makes the exit status 1.
+
+require "optparse"
+require "json"
+require "tmpdir"
+require "rbconfig"
+
+BENCHDIR = File.dirname(File.expand_path(__FILE__))
+ROOTDIR = File.dirname(BENCHDIR)
+
+# the older benchmarks, that also serve as tests
+EXTRA_BENCHMARKS = [
+  "tests/fib.lit",
+  "tests/binary_trees.lit",
+  "sha1.lit",
+  "mandel1.lit",
+]
+
+# wait4() gives the peak RSS of exactly the child that was waited for; ruby itself
+# only has Process.wait, so it is called through fiddle where possible.
+module Rusage
+  begin
+    require "fiddle"
+    LIBC = Fiddle.dlopen(nil)
+    WAIT4 = Fiddle::Function.new(LIBC["wait4"],
+      [Fiddle::TYPE_INT, Fiddle::TYPE_VOIDP, Fiddle::TYPE_INT, Fiddle::TYPE_VOIDP], Fiddle::TYPE_INT)
+    # struct rusage starts with two struct timevals, then ru_maxrss
+    MAXRSS_OFFSET = 2 * (Fiddle::SIZEOF_LONG * 2)
+    AVAILABLE = true
+  rescue LoadError, Fiddle::DLError
+    AVAILABLE = false
+  end
+
+  # returns [exit status, peak rss in kilobytes, or nil]
+  def self.wait(pid)
+    if !AVAILABLE then
+      _, status = Process.wait2(pid)
+      return [status.exitstatus, nil]
+    end
+    status = Fiddle::Pointer.malloc(Fiddle::SIZEOF_INT, Fiddle::RUBY_FREE)
+    usage = Fiddle::Pointer.malloc(256, Fiddle::RUBY_FREE)
+    if WAIT4.call(pid, status, 0, usage) != pid then
+      return [nil, nil]
+    end
+    raw = status[0, Fiddle::SIZEOF_INT].unpack1("i")
+    exitstatus = ((raw & 0x7f) == 0) ? ((raw >> 8) & 0xff) : nil
+    maxrss = usage[MAXRSS_OFFSET, Fiddle::SIZEOF_LONG].unpack1("l!")
+    # linux reports kilobytes, macos bytes
+    if RbConfig::CONFIG["host_os"] =~ /darwin/ then
+      maxrss /= 1024
+    end
+    return [exitstatus, maxrss]
+  end
+end
+
+Benchmark = Struct.new(:name, :args)
+
+def find_benchmarks(tmpdir)
+  list = []
+  Dir.glob(File.join(BENCHDIR, "*.lit")).sort.each do |path|
+    list.push(Benchmark.new(File.basename(path, ".lit"), [path]))
+  end
+  EXTRA_BENCHMARKS.each do |rel|
+    path = File.join(ROOTDIR, rel)
+    if File.file?(path) then
+      list.push(Benchmark.new(File.basename(rel, ".lit"), [path]))
+    end
+  end
+  list.push(Benchmark.new("compile_time", ["-o", File.join(tmpdir, "compile_time.lbc"), make_compile_source(tmpdir)]))
+  return list
+end
+
+# compile time: a large generated source that is compiled to bytecode, but never run
+def make_compile_source(tmpdir)
+  path = File.join(tmpdir, "compile_time.lit")
+  File.open(path, "w") do |out|
+    10000.times do |i|
+      out.printf("class Generated%d {\n", i)
+      out.printf("\tconstructor(a, b) {\n\t\tthis.a = a\n\t\tthis.b = b\n\t}\n\n")
+      out.printf("\tsum(k) {\n\t\tvar total = 0\n")
+      out.printf("\t\tfor (var i in 0 .. k) {\n\t\t\tif (i %% 2 == 0) {\n\t\t\t\ttotal += this.a * i\n")
+      out.printf("\t\t\t} else {\n\t\t\t\ttotal -= this.b + %d\n\t\t\t}\n\t\t}\n", i)
+      out.printf("\t\treturn $\"{total} of %d\"\n\t}\n}\n\n", i)
+      out.printf("function helper%d(x, y) {\n\treturn [ x, y, { first = x, second = y } ]\n}\n\n", i)
+    end
+  end
+  return path
+end
+
+# the older scripts print how long they took, which differs every time
+def stable_output(output)
+  return output.lines.reject { |l| l =~ /elapsed|: [0-9.e-]+$/ }.join
+end
+
+# one run; returns [seconds, peak rss in kb, stdout], or raises when the script fails
+def run_once(binary, bench)
+  reader, writer = IO.pipe
+  started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  pid = Process.spawn(binary, *bench.args, :out => writer, :err => File::NULL, :chdir => ROOTDIR)
+  writer.close
+  output = reader.read
+  reader.close
+  exitstatus, maxrss = Rusage.wait(pid)
+  elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - started
+  if exitstatus != 0 then
+    raise(sprintf("%s: '%s' exited with %p", bench.name, binary, exitstatus))
+  end
+  return [elapsed, maxrss, stable_output(output)]
+end
+
+# nearest-rank percentile, of a sorted list
+def percentile(sorted, pct)
+  rank = ((pct / 100.0) * sorted.length).ceil - 1
+  return sorted[[[rank, 0].max, sorted.length - 1].min]
+end
+
+def summarize(times, rss)
+  sorted = times.sort
+  mid = sorted.length / 2
+  median = (sorted.length.odd?) ? sorted[mid] : (sorted[mid - 1] + sorted[mid]) / 2.0
+  return {
+    "runs" => sorted.length,
+    "median" => median,
+    "p95" => percentile(sorted, 95),
+    "min" => sorted.first,
+    "max" => sorted.last,
+    "peak_rss_kb" => rss.compact.max,
+  }
+end
+
+# runs each binary in turn, so that drift (thermal, other load) hits both sides alike
+def measure(binaries, bench, opts)
+  times = binaries.map { [] }
+  rss = binaries.map { [] }
+  outputs = binaries.map { nil }
+  (opts.warmup + opts.runs).times do |iter|
+    binaries.each_with_index do |binary, i|
+      elapsed, maxrss, output = run_once(binary, bench)
+      if outputs[i] != nil && outputs[i] != output then
+        $stderr.printf("warning: %s: output of '%s' changed between runs\n", bench.name, binary)
+      end
+      outputs[i] = output
+      if iter >= opts.warmup then
+        times[i].push(elapsed)
+        rss[i].push(maxrss)
+      end
+    end
+  end
+  if binaries.length > 1 && outputs.uniq.length > 1 then
+    $stderr.printf("warning: %s: the builds print different results\n", bench.name)
+  end
+  return binaries.each_index.map { |i| summarize(times[i], rss[i]) }
+end
+
+def fmt_rss(kb)
+  return (kb == nil) ? "-" : sprintf("%.1fM", kb / 1024.0)
+end
+
+def fmt_change(now, before)
+  return sprintf("%+.1f%%", (now - before) / before * 100.0)
+end
+
+def main
+  opts = Struct.new(:binary, :runs, :warmup, :json, :compare, :baseline, :threshold, :filter).new
+  opts.binary = File.join(ROOTDIR, "run")
+  opts.runs = 5
+  opts.warmup = 1
+  opts.json = File.join(BENCHDIR, "results.json")
+  opts.threshold = 5.0
+  OptionParser.new { |prs|
+    prs.banner = "usage: bench.rb [options]"
+    prs.on("-b", "--binary=PATH", "the build to measure (default: ./run)") { |v| opts.binary = File.expand_path(v) }
+    prs.on("-n", "--runs=N", Integer, "timed runs per benchmark (default: #{opts.runs})") { |v| opts.runs = [v, 1].max }
+    prs.on("-w", "--warmup=N", Integer, "untimed runs before those (default: #{opts.warmup})") { |v| opts.warmup = [v, 0].max }
+    prs.on("-j", "--json=FILE", "where to write the results (default: benches/results.json)") { |v| opts.json = v }
+    prs.on("-c", "--compare=PATH", "another build of 'run' to compare against, measured alongside") { |v| opts.compare = File.expand_path(v) }
+    prs.on("-B", "--baseline=FILE", "results from an earlier --json to compare against") { |v| opts.baseline = v }
+    prs.on("-t", "--threshold=PCT", Float, "how much slower a median may get (default: #{opts.threshold}%)") { |v| opts.threshold = v }
+    prs.on("-f", "--filter=REGEX", "only run benchmarks whose name matches") { |v| opts.filter = Regexp.new(v) }
+  }.parse!
+  binaries = [opts.binary]
+  if opts.compare != nil then
+    binaries.push(opts.compare)
+  end
+  binaries.each do |bin|
+    if !File.executable?(bin) then
+      $stderr.printf("error: '%s' is not an executable (run 'make' first?)\n", bin)
+      exit(2)
+    end
+  end
+  baseline = nil
+  if opts.baseline != nil then
+    baseline = JSON.parse(File.read(opts.baseline))["benchmarks"]
+  end
+  results = {}
+  regressions = []
+  Dir.mktmpdir("litbench") do |tmpdir|
+    benchmarks = find_benchmarks(tmpdir).select { |b| opts.filter == nil || b.name =~ opts.filter }
+    printf("%-18s %10s %10s %9s", "benchmark", "median", "p95", "rss")
+    if binaries.length > 1 || baseline != nil then
+      printf(" %10s %9s", "other", "change")
+    end
+    printf("\n")
+    benchmarks.each do |bench|
+      stats = measure(binaries, bench, opts)
+      results[bench.name] = stats[0]
+      printf("%-18s %9.3fs %9.3fs %9s", bench.name, stats[0]["median"], stats[0]["p95"], fmt_rss(stats[0]["peak_rss_kb"]))
+      other = nil
+      if binaries.length > 1 then
+        other = stats[1]
+        results[bench.name]["compare"] = other
+      elsif baseline != nil then
+        other = baseline[bench.name]
+      end
+      if other != nil then
+        change = fmt_change(stats[0]["median"], other["median"])
+        printf(" %9.3fs %9s", other["median"], change)
+        if stats[0]["median"] > other["median"] * (1 + opts.threshold / 100.0) then
+          regressions.push(sprintf("%s: %.3fs -> %.3fs (%s)", bench.name, other["median"], stats[0]["median"], change))
+          printf("  REGRESSION")
+        end
+      end
+      printf("\n")
+      $stdout.flush
+    end
+  end
+  File.write(opts.json, JSON.pretty_generate({
+    "binary" => opts.binary,
+    "compare" => opts.compare,
+    "runs" => opts.runs,
+    "warmup" => opts.warmup,
+    "threshold" => opts.threshold,
+    "benchmarks" => results,
+    "regressions" => regressions,
+  }))
+  printf("results written to %s\n", opts.json)
+  if !regressions.empty? then
+    $stderr.printf("%d regression(s) beyond %g%%:\n", regressions.length, opts.threshold)
+    regressions.each { |r| $stderr.printf("  %s\n", r) }
+    exit(1)
+  end
+end
+
+begin
+  main
+rescue RuntimeError => e
+  $stderr.printf("error: %s\n", e.message)
+  exit(2)
+end
@@ -1,359 +1,156 @@
 
 #include "lit.h"
 
-void lit_exprlist_init(LitAstExprList* array)
-{
-    array->values = NULL;
-    array->capacity = 0;
-    array->count = 0;
-}
+/* blocks are at least this big; the first one is kept around for the next compilation */
+#define LIT_AST_ARENA_BLOCK (32 * 1024)
 
-void lit_exprlist_destroy(LitState* state, LitAstExprList* array)
-{
-    LIT_FREE_ARRAY(state, sizeof(LitAstExpression*), array->values, array->capacity);
-    lit_exprlist_init(array);
-}
-
-void lit_exprlist_push(LitState* state, LitAstExprList* array, LitAstExpression* value)
-{
-    if(array->capacity < array->count + 1)
-    {
-        size_t old_capacity = array->capacity;
-        array->capacity = LIT_GROW_CAPACITY(old_capacity);
-        array->values = LIT_GROW_ARRAY(state, array->values, sizeof(LitAstExpression*), old_capacity, array->capacity);
-    }
-    array->values[array->count] = value;
-    array->count++;
-}
+/* keeps every allocation aligned for any of the node types */
+#define LIT_AST_ARENA_ALIGN(size) (((size) + 15) & ~(size_t)15)
 
-void lit_paramlist_init(LitAstParamList* array)
-{
-    array->values = NULL;
-    array->capacity = 0;
-    array->count = 0;
-}
+#define LIT_AST_ARENA_HEADER LIT_AST_ARENA_ALIGN(sizeof(LitAstArenaBlock))
 
-void lit_paramlist_destroy(LitState* state, LitAstParamList* array)
+void lit_astarena_init(LitAstArena* arena)
 {
-    LIT_FREE_ARRAY(state, sizeof(LitAstParameter), array->values, array->capacity);
-    lit_paramlist_init(array);
+    arena->current = NULL;
 }
 
-void lit_paramlist_push(LitState* state, LitAstParamList* array, LitAstParameter value)
+void lit_astarena_destroy(LitAstArena* arena)
 {
-    if(array->capacity < array->count + 1)
+    LitAstArenaBlock* block;
+    while(arena->current != NULL)
     {
-        size_t old_capacity = array->capacity;
-        array->capacity = LIT_GROW_CAPACITY(old_capacity);
-        array->values = LIT_GROW_ARRAY(state, array->values, sizeof(LitAstParameter), old_capacity, array->capacity);
+        block = arena->current;
+        arena->current = block->previous;
+        free(block);
     }
-    array->values[array->count] = value;
-    array->count++;
 }
 
-void lit_paramlist_destroyvalues(LitState* state, LitAstParamList* parameters)
+void* lit_astarena_alloc(LitState* state, size_t size)
 {
-    size_t i;
-    for(i = 0; i < parameters->count; i++)
+    size_t capacity;
+    LitAstArenaBlock* block;
+    size = LIT_AST_ARENA_ALIGN(size);
+    block = state->astarena.current;
+    if(block == NULL || block->used + size > block->capacity)
     {
-        lit_ast_destroyexpression(state, parameters->values[i].default_value);
+        capacity = size > LIT_AST_ARENA_BLOCK ? size : LIT_AST_ARENA_BLOCK;
+        block = (LitAstArenaBlock*)malloc(LIT_AST_ARENA_HEADER + capacity);
+        if(block == NULL)
+        {
+            fprintf(stderr, "fatal error: failed to allocate %zu bytes for the ast\n", capacity);
+            abort();
+        }
+        block->previous = state->astarena.current;
+        block->capacity = capacity;
+        block->used = 0;
+        state->astarena.current = block;
     }
-
-    lit_paramlist_destroy(state, parameters);
+    block->used += size;
+    return (char*)block + LIT_AST_ARENA_HEADER + block->used - size;
 }
 
-void lit_ast_destroyexprlist(LitState* state, LitAstExprList* expressions)
+/*
+* grows the last allocation in place when it can, copies it over otherwise.
+*/
+static void* lit_astarena_grow(LitState* state, void* pointer, size_t old_size, size_t new_size)
 {
-    if(expressions == NULL)
+    char* end;
+    void* result;
+    LitAstArenaBlock* block;
+    block = state->astarena.current;
+    if(pointer != NULL && block != NULL)
     {
-        return;
+        end = (char*)block + LIT_AST_ARENA_HEADER + block->used;
+        if((char*)pointer + LIT_AST_ARENA_ALIGN(old_size) == end
+           && block->used - LIT_AST_ARENA_ALIGN(old_size) + LIT_AST_ARENA_ALIGN(new_size) <= block->capacity)
+        {
+            block->used += LIT_AST_ARENA_ALIGN(new_size) - LIT_AST_ARENA_ALIGN(old_size);
+            return pointer;
+        }
     }
-
-    for(size_t i = 0; i < expressions->count; i++)
+    result = lit_astarena_alloc(state, new_size);
+    if(pointer != NULL)
     {
-        lit_ast_destroyexpression(state, expressions->values[i]);
+        memcpy(result, pointer, old_size);
     }
+    return result;
+}
 
-    lit_exprlist_destroy(state, expressions);
+LitAstArenaMark lit_astarena_mark(LitState* state)
+{
+    LitAstArenaMark mark;
+    mark.block = state->astarena.current;
+    mark.used = mark.block == NULL ? 0 : mark.block->used;
+    return mark;
 }
 
-void lit_ast_destroystmtlist(LitState* state, LitAstExprList* statements)
+/*
+* drops everything allocated since the mark was taken.
+*/
+void lit_astarena_rewind(LitState* state, LitAstArenaMark mark)
 {
-    if(statements == NULL)
+    LitAstArenaBlock* block;
+    while(state->astarena.current != mark.block)
     {
-        return;
+        block = state->astarena.current;
+        if(block->previous == NULL && mark.block == NULL)
+        {
+            block->used = 0;
+            return;
+        }
+        state->astarena.current = block->previous;
+        free(block);
     }
-
-    for(size_t i = 0; i < statements->count; i++)
+    if(mark.block != NULL)
     {
-        lit_ast_destroyexpression(state, statements->values[i]);
+        mark.block->used = mark.used;
     }
+}
 
-    lit_exprlist_destroy(state, statements);
+void lit_exprlist_init(LitAstExprList* array)
+{
+    array->values = NULL;
+    array->capacity = 0;
+    array->count = 0;
 }
 
-void lit_ast_destroyexpression(LitState* state, LitAstExpression* expression)
+void lit_exprlist_push(LitState* state, LitAstExprList* array, LitAstExpression* value)
 {
-    if(expression == NULL)
+    if(array->capacity < array->count + 1)
     {
-        return;
+        size_t old_capacity = array->capacity;
+        array->capacity = LIT_GROW_CAPACITY(old_capacity);
+        array->values = (LitAstExpression**)lit_astarena_grow(state, array->values, old_capacity * sizeof(LitAstExpression*),
+                                                              array->capacity * sizeof(LitAstExpression*));
     }
+    array->values[array->count] = value;
+    array->count++;
+}
 
-    switch(expression->type)
-    {
-        case LITEXPR_LITERAL:
-        {
-            lit_gcmem_memrealloc(state, expression, sizeof(LitAstLiteralExpr), 0);
-            break;
-        }
-
-        case LITEXPR_BINARY:
-        {
-            LitAstBinaryExpr* expr = (LitAstBinaryExpr*)expression;
-
-            if(!expr->ignore_left)
-            {
-                lit_ast_destroyexpression(state, expr->left);
-            }
-
-            lit_ast_destroyexpression(state, expr->right);
-
-            lit_gcmem_memrealloc(state, expression, sizeof(LitAstBinaryExpr), 0);
-            break;
-        }
-
-        case LITEXPR_UNARY:
-        {
-            lit_ast_destroyexpression(state, ((LitAstUnaryExpr*)expression)->right);
-            lit_gcmem_memrealloc(state, expression, sizeof(LitAstUnaryExpr), 0);
-
-            break;
-        }
-
-        case LITEXPR_VAREXPR:
-        {
-            lit_gcmem_memrealloc(state, expression, sizeof(LitAstVarExpr), 0);
-            break;
-        }
-
-        case LITEXPR_ASSIGN:
-        {
-            LitAstAssignExpr* expr = (LitAstAssignExpr*)expression;
-
-            lit_ast_destroyexpression(state, expr->to);
-            lit_ast_destroyexpression(state, expr->value);
-
-            lit_gcmem_memrealloc(state, expression, sizeof(LitAstAssignExpr), 0);
-            break;
-        }
-
-        case LITEXPR_CALL:
-        {
-            LitAstCallExpr* expr = (LitAstCallExpr*)expression;
-
-            lit_ast_destroyexpression(state, expr->callee);
-            lit_ast_destroyexpression(state, expr->init);
-
-            lit_ast_destroyexprlist(state, &expr->args);
-
-            lit_gcmem_memrealloc(state, expression, sizeof(LitAstCallExpr), 0);
-            break;
-        }
-
-        case LITEXPR_GET:
-        {
-            lit_ast_destroyexpression(state, ((LitAstGetExpr*)expression)->where);
-            lit_gcmem_memrealloc(state, expression, sizeof(LitAstGetExpr), 0);
-            break;
-        }
-
-        case LITEXPR_SET:
-        {
-            LitAstSetExpr* expr = (LitAstSetExpr*)expression;
-
-            lit_ast_destroyexpression(state, expr->where);
-            lit_ast_destroyexpression(state, expr->value);
-
-            lit_gcmem_memrealloc(state, expression, sizeof(LitAstSetExpr), 0);
-            break;
-        }
+void lit_paramlist_init(LitAstParamList* array)
+{
+    array->values = NULL;
+    array->capacity = 0;
+    array->count = 0;
+}
 
-        case LITEXPR_LAMBDA:
-            {
-                LitAstLambdaExpr* expr = (LitAstLambdaExpr*)expression;
-                lit_paramlist_destroyvalues(state, &expr->parameters);
-                lit_ast_destroyexpression(state, expr->body);
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstLambdaExpr), 0);
-            }
-            break;
-        case LITEXPR_ARRAY:
-            {
-                lit_ast_destroyexprlist(state, &((LitAstArrayExpr*)expression)->values);
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstArrayExpr), 0);
-            }
-            break;
-        case LITEXPR_OBJECT:
-            {
-                LitAstObjectExpr* map = (LitAstObjectExpr*)expression;
-                lit_vallist_destroy(state, &map->keys);
-                lit_ast_destroyexprlist(state, &map->values);
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstObjectExpr), 0);
-            }
-            break;
-        case LITEXPR_SUBSCRIPT:
-            {
-                LitAstIndexExpr* expr = (LitAstIndexExpr*)expression;
-                lit_ast_destroyexpression(state, expr->array);
-                lit_ast_destroyexpression(state, expr->index);
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstIndexExpr), 0);
-            }
-            break;
-        case LITEXPR_THIS:
-            {
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstThisExpr), 0);
-            }
-            break;
-        case LITEXPR_SUPER:
-            {
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstSuperExpr), 0);
-            }
-            break;
-        case LITEXPR_RANGE:
-            {
-                LitAstRangeExpr* expr = (LitAstRangeExpr*)expression;
-                lit_ast_destroyexpression(state, expr->from);
-                lit_ast_destroyexpression(state, expr->to);
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstRangeExpr), 0);
-            }
-            break;
-        case LITEXPR_TERNARY:
-            {
-                LitAstTernaryExpr* expr = (LitAstTernaryExpr*)expression;
-                lit_ast_destroyexpression(state, expr->condition);
-                lit_ast_destroyexpression(state, expr->if_branch);
-                lit_ast_destroyexpression(state, expr->else_branch);
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstTernaryExpr), 0);
-            }
-            break;
-        case LITEXPR_INTERPOLATION:
-            {
-                lit_ast_destroyexprlist(state, &((LitAstStrInterExpr*)expression)->expressions);
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstStrInterExpr), 0);
-            }
-            break;
-        case LITEXPR_REFERENCE:
-            {
-                lit_ast_destroyexpression(state, ((LitAstRefExpr*)expression)->to);
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstRefExpr), 0);
-            }
-            break;
-        case LITEXPR_EXPRESSION:
-            {
-                lit_ast_destroyexpression(state, ((LitAstExprExpr*)expression)->expression);
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstExprExpr), 0);
-            }
-            break;
-        case LITEXPR_BLOCK:
-            {
-                lit_ast_destroystmtlist(state, &((LitAstBlockExpr*)expression)->statements);
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstBlockExpr), 0);
-            }
-            break;
-        case LITEXPR_VARSTMT:
-            {
-                lit_ast_destroyexpression(state, ((LitAstAssignVarExpr*)expression)->init);
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstAssignVarExpr), 0);
-            }
-            break;
-        case LITEXPR_IFSTMT:
-            {
-                LitAstIfExpr* stmt = (LitAstIfExpr*)expression;
-                lit_ast_destroyexpression(state, stmt->condition);
-                lit_ast_destroyexpression(state, stmt->if_branch);
-                lit_ast_destroy_allocdexprlist(state, stmt->elseif_conditions);
-                lit_ast_destry_allocdstmtlist(state, stmt->elseif_branches);
-                lit_ast_destroyexpression(state, stmt->else_branch);
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstIfExpr), 0);
-            }
-            break;
-        case LITEXPR_WHILE:
-            {
-                LitAstWhileExpr* stmt = (LitAstWhileExpr*)expression;
-                lit_ast_destroyexpression(state, stmt->condition);
-                lit_ast_destroyexpression(state, stmt->body);
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstWhileExpr), 0);
-            }
-            break;
-        case LITEXPR_FOR:
-            {
-                LitAstForExpr* stmt = (LitAstForExpr*)expression;
-                lit_ast_destroyexpression(state, stmt->increment);
-                lit_ast_destroyexpression(state, stmt->condition);
-                lit_ast_destroyexpression(state, stmt->init);
-
-                lit_ast_destroyexpression(state, stmt->var);
-                lit_ast_destroyexpression(state, stmt->body);
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstForExpr), 0);
-            }
-            break;
-        case LITEXPR_CONTINUE:
-            {
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstContinueExpr), 0);
-            }
-            break;
-        case LITEXPR_BREAK:
-            {
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstBreakExpr), 0);
-            }
-            break;
-        case LITEXPR_FUNCTION:
-            {
-                LitAstFunctionExpr* stmt = (LitAstFunctionExpr*)expression;
-                lit_ast_destroyexpression(state, stmt->body);
-                lit_paramlist_destroyvalues(state, &stmt->parameters);
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstFunctionExpr), 0);
-            }
-            break;
-        case LITEXPR_RETURN:
-            {
-                lit_ast_destroyexpression(state, ((LitAstReturnExpr*)expression)->expression);
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstReturnExpr), 0);
-            }
-            break;
-        case LITEXPR_METHOD:
-            {
-                LitAstMethodExpr* stmt = (LitAstMethodExpr*)expression;
-                lit_paramlist_destroyvalues(state, &stmt->parameters);
-                lit_ast_destroyexpression(state, stmt->body);
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstMethodExpr), 0);
-            }
-            break;
-        case LITEXPR_CLASS:
-            {
-                lit_ast_destroystmtlist(state, &((LitAstClassExpr*)expression)->fields);
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstClassExpr), 0);
-            }
-            break;
-        case LITEXPR_FIELD:
-            {
-                LitAstFieldExpr* stmt = (LitAstFieldExpr*)expression;
-                lit_ast_destroyexpression(state, stmt->getter);
-                lit_ast_destroyexpression(state, stmt->setter);
-                lit_gcmem_memrealloc(state, expression, sizeof(LitAstFieldExpr), 0);
-            }
-            break;
-        default:
-            {
-                lit_state_raiseerror(state, COMPILE_ERROR, "Unknown expression type %d", (int)expression->type);
-            }
-            break;
+void lit_paramlist_push(LitState* state, LitAstParamList* array, LitAstParameter value)
+{
+    if(array->capacity < array->count + 1)
+    {
+        size_t old_capacity = array->capacity;
+        array->capacity = LIT_GROW_CAPACITY(old_capacity);
+        array->values = (LitAstParameter*)lit_astarena_grow(state, array->values, old_capacity * sizeof(LitAstParameter),
+                                                            array->capacity * sizeof(LitAstParameter));
     }
+    array->values[array->count] = value;
+    array->count++;
 }
 
 static LitAstExpression* lit_ast_allocexpr(LitState* state, uint64_t line, size_t size, LitExprType type)
 {
     LitAstExpression* object;
-    object = (LitAstExpression*)lit_gcmem_memrealloc(state, NULL, 0, size);
+    object = (LitAstExpression*)lit_astarena_alloc(state, size);
     object->type = type;
     object->line = line;
     return object;
@@ -460,7 +257,7 @@ LitAstObjectExpr* lit_ast_make_objectexpr(LitState* state, size_t line)
 {
     LitAstObjectExpr* expression;
     expression = (LitAstObjectExpr*)lit_ast_allocexpr(state, line, sizeof(LitAstObjectExpr), LITEXPR_OBJECT);
-    lit_vallist_init(&expression->keys);
+    lit_exprlist_init(&expression->keys);
     lit_exprlist_init(&expression->values);
     return expression;
 }
@@ -530,7 +327,7 @@ LitAstRefExpr* lit_ast_make_referenceexpr(LitState* state, size_t line, LitAstEx
 static LitAstExpression* lit_ast_allocstmt(LitState* state, uint64_t line, size_t size, LitExprType type)
 {
     LitAstExpression* object;
-    object = (LitAstExpression*)lit_gcmem_memrealloc(state, NULL, 0, size);
+    object = (LitAstExpression*)lit_astarena_alloc(state, size);
     object->type = type;
     object->line = line;
     return object;
@@ -675,45 +472,15 @@ LitAstFieldExpr* lit_ast_make_fieldexpr(LitState* state, size_t line, LitString*
 LitAstExprList* lit_ast_allocexprlist(LitState* state)
 {
     LitAstExprList* expressions;
-    expressions = (LitAstExprList*)lit_gcmem_memrealloc(state, NULL, 0, sizeof(LitAstExprList));
+    expressions = (LitAstExprList*)lit_astarena_alloc(state, sizeof(LitAstExprList));
     lit_exprlist_init(expressions);
     return expressions;
 }
 
-void lit_ast_destroy_allocdexprlist(LitState* state, LitAstExprList* expressions)
-{
-    size_t i;
-    if(expressions == NULL)
-    {
-        return;
-    }
-    for(i = 0; i < expressions->count; i++)
-    {
-        lit_ast_destroyexpression(state, expressions->values[i]);
-    }
-    lit_exprlist_destroy(state, expressions);
-    lit_gcmem_memrealloc(state, expressions, sizeof(LitAstExprList), 0);
-}
-
 LitAstExprList* lit_ast_allocate_stmtlist(LitState* state)
 {
     LitAstExprList* statements;
-    statements = (LitAstExprList*)lit_gcmem_memrealloc(state, NULL, 0, sizeof(LitAstExprList));
+    statements = (LitAstExprList*)lit_astarena_alloc(state, sizeof(LitAstExprList));
     lit_exprlist_init(statements);
     return statements;
 }
-
-void lit_ast_destry_allocdstmtlist(LitState* state, LitAstExprList* statements)
-{
-    size_t i;
-    if(statements == NULL)
-    {
-        return;
-    }
-    for(i = 0; i < statements->count; i++)
-    {
-        lit_ast_destroyexpression(state, statements->values[i]);
-    }
-    lit_exprlist_destroy(state, statements);
-    lit_gcmem_memrealloc(state, statements, sizeof(LitAstExprList), 0);
-}
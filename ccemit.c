@@ -94,6 +94,8 @@ void lit_emitter_init(LitState* state, LitEmitter* emitter)
     emitter->state = state;
     emitter->loop_start = 0;
     emitter->emit_reference = 0;
+    emitter->last_call = NULL;
+    emitter->last_call_offset = 0;
     emitter->class_name = NULL;
     emitter->compiler = NULL;
     emitter->chunk = NULL;
@@ -213,6 +215,7 @@ static void lit_emitter_emitbyteorshort(LitEmitter* emitter, uint16_t line, uint
 static void lit_compiler_compiler(LitEmitter* emitter, LitCompiler* compiler, LitFuncType type)
 {
     lit_loclist_init(&compiler->locals);
+    lit_uintlist_init(&compiler->captures);
 
     compiler->type = type;
     compiler->scope_depth = 0;
@@ -232,18 +235,18 @@ static void lit_compiler_compiler(LitEmitter* emitter, LitCompiler* compiler, Li
 
     emitter->chunk = &compiler->function->chunk;
 
-    if(lit_astopt_isoptenabled(LITOPTSTATE_LINE_INFO))
+    if(lit_astopt_isoptenabled(emitter->state, LITOPTSTATE_LINE_INFO))
     {
         emitter->chunk->has_line_info = false;
     }
 
     if(type == LITFUNC_METHOD || type == LITFUNC_STATIC_METHOD || type == LITFUNC_CONSTRUCTOR)
     {
-        lit_loclist_push(emitter->state, &compiler->locals, (LitLocal){ "this", 4, -1, false, false });
+        lit_loclist_push(emitter->state, &compiler->locals, (LitLocal){ "this", 4, -1, false, false, false });
     }
     else
     {
-        lit_loclist_push(emitter->state, &compiler->locals, (LitLocal){ "", 0, -1, false, false });
+        lit_loclist_push(emitter->state, &compiler->locals, (LitLocal){ "", 0, -1, false, false, false });
     }
 
     compiler->slots = 1;
@@ -268,6 +271,39 @@ static void lit_emitter_emitreturn(LitEmitter* emitter, size_t line)
     }
 }
 
+/*
+* the locals from `from` up are going out of scope, so everything that could assign to them
+* has been emitted. closures that captured one that never got reassigned can simply copy
+* its value, instead of boxing it into an upvalue.
+*/
+static void lit_emitter_resolvecaptures(LitCompiler* compiler, size_t from)
+{
+    size_t i;
+    size_t offset;
+    size_t slot;
+    size_t count;
+    uint8_t* code;
+    code = compiler->function->chunk.code;
+    i = 0;
+    while(i < lit_uintlist_count(&compiler->captures))
+    {
+        offset = lit_uintlist_get(&compiler->captures, i);
+        slot = code[offset + 1];
+        if(slot < from)
+        {
+            i++;
+            continue;
+        }
+        if(!compiler->locals.values[slot].reassigned)
+        {
+            code[offset] |= LIT_CAPTURE_BYVALUE;
+        }
+        count = lit_uintlist_count(&compiler->captures);
+        lit_datalist_set(&compiler->captures.list, i, lit_uintlist_get(&compiler->captures, count - 1));
+        lit_datalist_deccount(&compiler->captures.list);
+    }
+}
+
 static LitFunction* lit_compiler_end(LitEmitter* emitter, LitString* name)
 {
     if(!emitter->compiler->skip_return)
@@ -278,7 +314,10 @@ static LitFunction* lit_compiler_end(LitEmitter* emitter, LitString* name)
 
     LitFunction* function = emitter->compiler->function;
 
+    lit_emitter_resolvecaptures(emitter->compiler, 0);
+    lit_uintlist_destroy(emitter->state, &emitter->compiler->captures);
     lit_loclist_destroy(emitter->state, &emitter->compiler->locals);
+    lit_chunk_dropconstindex(emitter->state, &function->chunk);
 
     emitter->compiler = (LitCompiler*)emitter->compiler->enclosing;
     emitter->chunk = emitter->compiler == NULL ? NULL : &emitter->compiler->function->chunk;
@@ -306,10 +345,19 @@ static void lit_emitter_endscope(LitEmitter* emitter, uint16_t line)
 
     LitCompiler* compiler = emitter->compiler;
     LitLocList* locals = &compiler->locals;
+    size_t from = locals->count;
+
+    while(from > 0 && locals->values[from - 1].depth > compiler->scope_depth)
+    {
+        from--;
+    }
+
+    lit_emitter_resolvecaptures(compiler, from);
 
     while(locals->count > 0 && locals->values[locals->count - 1].depth > compiler->scope_depth)
     {
-        if(locals->values[locals->count - 1].captured)
+        // locals that were only captured by value have no upvalue to close
+        if(locals->values[locals->count - 1].captured && locals->values[locals->count - 1].reassigned)
         {
             lit_emitter_emit1op(emitter, line, OP_CLOSE_UPVALUE);
         }
@@ -363,6 +411,31 @@ static size_t lit_emitter_emitconstant(LitEmitter* emitter, size_t line, LitValu
     return constant;
 }
 
+/*
+* called right after lit_compiler_end(), with `compiler` being the function that just ended.
+* the capture operands are remembered, so that lit_emitter_resolvecaptures() can later
+* decide whether each one needs a box.
+*/
+static void lit_emitter_emitclosure(LitEmitter* emitter, LitCompiler* compiler, LitFunction* function)
+{
+    size_t i;
+    if(function->upvalue_count == 0)
+    {
+        lit_emitter_emitconstant(emitter, emitter->last_line, lit_value_objectvalue(function));
+        return;
+    }
+    lit_emitter_emit1op(emitter, emitter->last_line, OP_CLOSURE);
+    lit_emitter_emitshort(emitter, emitter->last_line, lit_emitter_addconstant(emitter, emitter->last_line, lit_value_objectvalue(function)));
+    for(i = 0; i < function->upvalue_count; i++)
+    {
+        if(compiler->upvalues[i].isLocal)
+        {
+            lit_uintlist_push(emitter->state, &emitter->compiler->captures, emitter->chunk->count);
+        }
+        lit_emitter_emit2bytes(emitter, emitter->last_line, compiler->upvalues[i].isLocal ? LIT_CAPTURE_LOCAL : 0, compiler->upvalues[i].index);
+    }
+}
+
 static int lit_emitter_addprivate(LitEmitter* emitter, const char* name, size_t length, size_t line, bool constant)
 {
     LitPrivList* privates = &emitter->privates;
@@ -373,7 +446,7 @@ static int lit_emitter_addprivate(LitEmitter* emitter, const char* name, size_t
     }
 
     LitTable* private_names = &emitter->module->private_names->values;
-    LitString* key = lit_table_find_string(private_names, name, length, lit_util_hashstring(name, length));
+    LitString* key = lit_table_find_string(private_names, name, length, lit_util_hashstring(emitter->state, name, length));
 
     if(key != NULL)
     {
@@ -399,7 +472,7 @@ static int lit_emitter_addprivate(LitEmitter* emitter, const char* name, size_t
 static int lit_emitter_resolveprivate(LitEmitter* emitter, const char* name, size_t length, size_t line)
 {
     LitTable* private_names = &emitter->module->private_names->values;
-    LitString* key = lit_table_find_string(private_names, name, length, lit_util_hashstring(name, length));
+    LitString* key = lit_table_find_string(private_names, name, length, lit_util_hashstring(emitter->state, name, length));
 
     if(key != NULL)
     {
@@ -444,7 +517,7 @@ static int lit_emitter_addlocal(LitEmitter* emitter, const char* name, size_t le
         }
     }
 
-    lit_loclist_push(emitter->state, locals, (LitLocal){ name, length, UINT16_MAX, false, constant });
+    lit_loclist_push(emitter->state, locals, (LitLocal){ name, length, UINT16_MAX, false, constant, false });
 
     return (int)locals->count - 1;
 }
@@ -463,6 +536,10 @@ static int lit_emitter_resolvelocal(LitEmitter* emitter, LitCompiler* compiler,
             {
                 lit_emitter_raiseerror(emitter, line, LITERROR_VARIABLE_USED_IN_INIT, length, name);
             }
+            if(length == 3 && memcmp(name, "...", 3) == 0)
+            {
+                compiler->function->vararg_used = true;
+            }
 
             return i;
         }
@@ -522,6 +599,23 @@ static int lit_emitter_resolveupvalue(LitEmitter* emitter, LitCompiler* compiler
     return -1;
 }
 
+/* something assigns to the upvalue `index` of compiler: find the local it captures and flag it */
+static void lit_emitter_markupvaluereassigned(LitCompiler* compiler, int index)
+{
+    LitCompilerUpvalue* upvalue;
+    while(compiler->enclosing != NULL)
+    {
+        upvalue = &compiler->upvalues[index];
+        compiler = (LitCompiler*)compiler->enclosing;
+        if(upvalue->isLocal)
+        {
+            compiler->locals.values[upvalue->index].reassigned = true;
+            return;
+        }
+        index = upvalue->index;
+    }
+}
+
 static void lit_emitter_marklocalinit(LitEmitter* emitter, size_t index)
 {
     emitter->compiler->locals.values[index].depth = emitter->compiler->scope_depth;
@@ -608,6 +702,11 @@ static bool lit_emitter_emitparamlist(LitEmitter* emitter, LitAstParamList* para
 
 static void lit_emitter_resolvestmt(LitEmitter* emitter, LitAstExpression* statement)
 {
+    // the optimizer leaves NULL behind for statements it removed
+    if(statement == NULL)
+    {
+        return;
+    }
     switch(statement->type)
     {
         case LITEXPR_VARSTMT:
@@ -912,6 +1011,10 @@ static bool lit_emitter_emitexpression(LitEmitter* emitter, LitAstExpression* ex
                     }
                     else
                     {
+                        if(ref)
+                        {
+                            lit_emitter_markupvaluereassigned(emitter->compiler, index);
+                        }
                         lit_emitter_emitargedop(emitter, expr->line, ref ? OP_REFERENCE_UPVALUE : OP_GET_UPVALUE, (uint8_t)index);
                     }
                 }
@@ -919,6 +1022,7 @@ static bool lit_emitter_emitexpression(LitEmitter* emitter, LitAstExpression* ex
                 {
                     if(ref)
                     {
+                        emitter->compiler->locals.values[index].reassigned = true;
                         lit_emitter_emit1op(emitter, expr->line, OP_REFERENCE_LOCAL);
                         lit_emitter_emitshort(emitter, expr->line, index);
                     }
@@ -961,6 +1065,7 @@ static bool lit_emitter_emitexpression(LitEmitter* emitter, LitAstExpression* ex
                         }
                         else
                         {
+                            lit_emitter_markupvaluereassigned(emitter->compiler, index);
                             lit_emitter_emitargedop(emitter, expr->line, OP_SET_UPVALUE, (uint8_t)index);
                         }
                         break;
@@ -971,7 +1076,7 @@ static bool lit_emitter_emitexpression(LitEmitter* emitter, LitAstExpression* ex
                         {
                             lit_emitter_raiseerror(emitter, expr->line, LITERROR_CONSTANT_MODIFIED, e->length, e->name);
                         }
-
+                        emitter->compiler->locals.values[index].reassigned = true;
                         lit_emitter_emitbyteorshort(emitter, expr->line, OP_SET_LOCAL, OP_SET_LOCAL_LONG, index);
                     }
                 }
@@ -1043,7 +1148,8 @@ static bool lit_emitter_emitexpression(LitEmitter* emitter, LitAstExpression* ex
                     if(method)
                     {
                         LitAstGetExpr* e = (LitAstGetExpr*)callexpr->callee;
-
+                        emitter->last_call = expr;
+                        emitter->last_call_offset = emitter->chunk->count;
                         lit_emitter_emitvaryingop(emitter, expr->line,
                                         ((LitAstGetExpr*)callexpr->callee)->ignore_result ? OP_INVOKE_IGNORING : OP_INVOKE,
                                         (uint8_t)callexpr->args.count);
@@ -1064,6 +1170,8 @@ static bool lit_emitter_emitexpression(LitEmitter* emitter, LitAstExpression* ex
                 }
                 else
                 {
+                    emitter->last_call = expr;
+                    emitter->last_call_offset = emitter->chunk->count;
                     lit_emitter_emitvaryingop(emitter, expr->line, OP_CALL, (uint8_t)callexpr->args.count);
                 }
                 if(method)
@@ -1099,7 +1207,7 @@ static bool lit_emitter_emitexpression(LitEmitter* emitter, LitAstExpression* ex
                 {
                     LitAstExpression* e = init->values.values[i];
                     emitter->last_line = e->line;
-                    lit_emitter_emitconstant(emitter, emitter->last_line, lit_vallist_get(&init->keys, i));
+                    lit_emitter_emitconstant(emitter, emitter->last_line, ((LitAstLiteralExpr*)init->keys.values[i])->value);
                     lit_emitter_emitexpression(emitter, e);
                     lit_emitter_emit1op(emitter, emitter->last_line, OP_PUSH_OBJECT_FIELD);
                 }
@@ -1169,19 +1277,7 @@ static bool lit_emitter_emitexpression(LitEmitter* emitter, LitAstExpression* ex
                 function->arg_count = lambdaexpr->parameters.count;
                 function->max_slots += function->arg_count;
                 function->vararg = vararg;
-                if(function->upvalue_count > 0)
-                {
-                    lit_emitter_emit1op(emitter, emitter->last_line, OP_CLOSURE);
-                    lit_emitter_emitshort(emitter, emitter->last_line, lit_emitter_addconstant(emitter, emitter->last_line, lit_value_objectvalue(function)));
-                    for(size_t i = 0; i < function->upvalue_count; i++)
-                    {
-                        lit_emitter_emit2bytes(emitter, emitter->last_line, compiler.upvalues[i].isLocal ? 1 : 0, compiler.upvalues[i].index);
-                    }
-                }
-                else
-                {
-                    lit_emitter_emitconstant(emitter, emitter->last_line, lit_value_objectvalue(function));
-                }
+                lit_emitter_emitclosure(emitter, &compiler, function);
             }
             break;
         case LITEXPR_ARRAY:
@@ -1201,7 +1297,7 @@ static bool lit_emitter_emitexpression(LitEmitter* emitter, LitAstExpression* ex
                 lit_emitter_emit1op(emitter, expr->line, OP_OBJECT);
                 for(size_t i = 0; i < objexpr->values.count; i++)
                 {
-                    lit_emitter_emitconstant(emitter, emitter->last_line, lit_vallist_get(&objexpr->keys, i));
+                    lit_emitter_emitconstant(emitter, emitter->last_line, ((LitAstLiteralExpr*)objexpr->keys.values[i])->value);
                     lit_emitter_emitexpression(emitter, objexpr->values.values[i]);
                     lit_emitter_emit1op(emitter, emitter->last_line, OP_PUSH_OBJECT_FIELD);
                 }
@@ -1618,6 +1714,8 @@ static bool lit_emitter_emitexpression(LitEmitter* emitter, LitAstExpression* ex
                 if(islocal)
                 {
                     lit_emitter_marklocalinit(emitter, index);
+                    // the function can capture itself before it is stored in its slot
+                    emitter->compiler->locals.values[index].reassigned = true;
                 }
                 else if(isprivate)
                 {
@@ -1632,19 +1730,7 @@ static bool lit_emitter_emitexpression(LitEmitter* emitter, LitAstExpression* ex
                 function->arg_count = funcstmt->parameters.count;
                 function->max_slots += function->arg_count;
                 function->vararg = vararg;
-                if(function->upvalue_count > 0)
-                {
-                    lit_emitter_emit1op(emitter, emitter->last_line, OP_CLOSURE);
-                    lit_emitter_emitshort(emitter, emitter->last_line, lit_emitter_addconstant(emitter, emitter->last_line, lit_value_objectvalue(function)));
-                    for(i = 0; i < function->upvalue_count; i++)
-                    {
-                        lit_emitter_emit2bytes(emitter, emitter->last_line, compiler.upvalues[i].isLocal ? 1 : 0, compiler.upvalues[i].index);
-                    }
-                }
-                else
-                {
-                    lit_emitter_emitconstant(emitter, emitter->last_line, lit_value_objectvalue(function));
-                }
+                lit_emitter_emitclosure(emitter, &compiler, function);
                 if(isexport)
                 {
                     lit_emitter_emit1op(emitter, emitter->last_line, OP_SET_GLOBAL);
@@ -1674,7 +1760,20 @@ static bool lit_emitter_emitexpression(LitEmitter* emitter, LitAstExpression* ex
                 }
                 else
                 {
+                    emitter->last_call = NULL;
                     lit_emitter_emitexpression(emitter, expression);
+                    // return f(x): let the call reuse this frame. the OP_RETURN stays, for callees that aren't script functions
+                    if(expression == emitter->last_call && ((LitAstCallExpr*)expression)->init == NULL)
+                    {
+                        if(emitter->chunk->code[emitter->last_call_offset] == OP_CALL)
+                        {
+                            emitter->chunk->code[emitter->last_call_offset] = OP_TAIL_CALL;
+                        }
+                        else if(emitter->chunk->code[emitter->last_call_offset] == OP_INVOKE)
+                        {
+                            emitter->chunk->code[emitter->last_call_offset] = OP_TAIL_INVOKE;
+                        }
+                    }
                 }
                 lit_emitter_emit1op(emitter, emitter->last_line, OP_RETURN);
                 if(emitter->compiler->scope_depth == 0)
@@ -1702,19 +1801,7 @@ static bool lit_emitter_emitexpression(LitEmitter* emitter, LitAstExpression* ex
                 function->arg_count = mthstmt->parameters.count;
                 function->max_slots += function->arg_count;
                 function->vararg = vararg;
-                if(function->upvalue_count > 0)
-                {
-                    lit_emitter_emit1op(emitter, emitter->last_line, OP_CLOSURE);
-                    lit_emitter_emitshort(emitter, emitter->last_line, lit_emitter_addconstant(emitter, emitter->last_line, lit_value_objectvalue(function)));
-                    for(i = 0; i < function->upvalue_count; i++)
-                    {
-                        lit_emitter_emit2bytes(emitter, emitter->last_line, compiler.upvalues[i].isLocal ? 1 : 0, compiler.upvalues[i].index);
-                    }
-                }
-                else
-                {
-                    lit_emitter_emitconstant(emitter, emitter->last_line, lit_value_objectvalue(function));
-                }
+                lit_emitter_emitclosure(emitter, &compiler, function);
                 lit_emitter_emit1op(emitter, emitter->last_line, mthstmt->is_static ? OP_STATIC_FIELD : OP_METHOD);
                 lit_emitter_emitshort(emitter, emitter->last_line, lit_emitter_addconstant(emitter, expr->line, lit_value_objectvalue(mthstmt->name)));
 
@@ -1808,22 +1895,20 @@ static bool lit_emitter_emitexpression(LitEmitter* emitter, LitAstExpression* ex
     return false;
 }
 
-LitModule* lit_emitter_modemit(LitEmitter* emitter, LitAstExprList* statements, LitString* module_name)
+/*
+* a module is emitted in three steps, so it can also be fed one top-level statement
+* at a time: every private name is declared first, so functions can refer to the
+* ones declared after them.
+*/
+LitModule* lit_emitter_beginmodule(LitEmitter* emitter, LitCompiler* compiler, LitString* module_name)
 {
     size_t i;
-    size_t total;
-    size_t old_privates_count;
-    bool isnew;
-    LitState* state;        
     LitValue module_value;
     LitModule* module;
     LitPrivList* privates;
-    LitCompiler compiler;
-    LitAstExpression* exstmt;
     emitter->last_line = 1;
     emitter->emit_reference = 0;
-    state = emitter->state;
-    isnew = false;
+    emitter->module_isnew = false;
     if(lit_table_get(&emitter->state->vm->modules->values, module_name, &module_value))
     {
         module = lit_value_asmodule(module_value);
@@ -1831,34 +1916,52 @@ LitModule* lit_emitter_modemit(LitEmitter* emitter, LitAstExprList* statements,
     else
     {
         module = lit_create_module(emitter->state, module_name);
-        isnew = true;
+        emitter->module_isnew = true;
     }
     emitter->module = module;
-    old_privates_count = module->private_count;
-    if(old_privates_count > 0)
+    emitter->module_oldprivates = module->private_count;
+    if(emitter->module_oldprivates > 0)
     {
         privates = &emitter->privates;
-        privates->count = old_privates_count - 1;
-        lit_privlist_push(state, privates, (LitPrivate){ true, false });
-        for(i = 0; i < old_privates_count; i++)
+        privates->count = emitter->module_oldprivates - 1;
+        lit_privlist_push(emitter->state, privates, (LitPrivate){ true, false });
+        for(i = 0; i < emitter->module_oldprivates; i++)
         {
             privates->values[i].initialized = true;
         }
     }
-    lit_compiler_compiler(emitter, &compiler, LITFUNC_SCRIPT);
-    emitter->chunk = &compiler.function->chunk;
-    resolve_statements(emitter, statements);
-    for(i = 0; i < statements->count; i++)
-    {
-        exstmt = statements->values[i];
-        if(lit_emitter_emitexpression(emitter, exstmt))
-        {
-            break;
-        }
-    }
+    lit_compiler_compiler(emitter, compiler, LITFUNC_SCRIPT);
+    emitter->chunk = &compiler->function->chunk;
+    return module;
+}
+
+/* matches the LitDeclareFn signature, for lit_parser_prescan */
+void lit_emitter_declareprivate(void* data, const char* name, size_t length, size_t line, bool constant)
+{
+    LitEmitter* emitter;
+    emitter = (LitEmitter*)data;
+    lit_emitter_markprivateinit(emitter, lit_emitter_addprivate(emitter, name, length, line, constant));
+}
+
+/* returns true if nothing should be emitted after this statement */
+bool lit_emitter_emitstatement(LitEmitter* emitter, LitAstExpression* statement)
+{
+    return lit_emitter_emitexpression(emitter, statement);
+}
+
+LitModule* lit_emitter_endmodule(LitEmitter* emitter, LitString* module_name)
+{
+    size_t i;
+    size_t total;
+    size_t old_privates_count;
+    LitState* state;
+    LitModule* module;
+    state = emitter->state;
+    module = emitter->module;
+    old_privates_count = emitter->module_oldprivates;
     lit_emitter_endscope(emitter, emitter->last_line);
     module->main_function = lit_compiler_end(emitter, module_name);
-    if(isnew)
+    if(emitter->module_isnew)
     {
         total = emitter->privates.count;
         module->privates = LIT_ALLOCATE(emitter->state, sizeof(LitValue), total);
@@ -1876,14 +1979,30 @@ LitModule* lit_emitter_modemit(LitEmitter* emitter, LitAstExprList* statements,
         }
     }
     lit_privlist_destroy(emitter->state, &emitter->privates);
-    if(lit_astopt_isoptenabled(LITOPTSTATE_PRIVATE_NAMES))
+    if(lit_astopt_isoptenabled(emitter->state, LITOPTSTATE_PRIVATE_NAMES))
     {
         lit_table_destroy(emitter->state, &emitter->module->private_names->values);
     }
-    if(isnew && !state->had_error)
+    if(emitter->module_isnew && !state->had_error)
     {
         lit_table_set(state, &state->vm->modules->values, module_name, lit_value_objectvalue(module));
     }
     module->ran = true;
     return module;
 }
+
+LitModule* lit_emitter_modemit(LitEmitter* emitter, LitAstExprList* statements, LitString* module_name)
+{
+    size_t i;
+    LitCompiler compiler;
+    lit_emitter_beginmodule(emitter, &compiler, module_name);
+    resolve_statements(emitter, statements);
+    for(i = 0; i < statements->count; i++)
+    {
+        if(lit_emitter_emitstatement(emitter, statements->values[i]))
+        {
+            break;
+        }
+    }
+    return lit_emitter_endmodule(emitter, module_name);
+}
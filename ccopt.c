@@ -1,8 +1,6 @@
 
 #include "lit.h"
 
-#define LIT_DEBUG_OPTIMIZER
-
 #define optc_do_binary_op(op) \
     if(lit_value_isnumber(a) && lit_value_isnumber(b)) \
     { \
@@ -33,6 +31,7 @@ static void lit_astopt_optexpression(LitOptimizer* optimizer, LitAstExpression**
 static void lit_astopt_optexprlist(LitOptimizer* optimizer, LitAstExprList* expressions);
 static void lit_astopt_optstmtlist(LitOptimizer* optimizer, LitAstExprList* statements);
 static void lit_asdtopt_optstatement(LitOptimizer* optimizer, LitAstExpression** slot);
+static bool lit_astopt_ismoduleopt(LitOptimizer* optimizer, LitOptimization optimization);
 
 static const char* optimization_level_descriptions[LITOPTLEVEL_TOTAL]
 = { "No optimizations (same as -Ono-all)", "Super light optimizations, sepcific to interactive shell.",
@@ -41,7 +40,8 @@ static const char* optimization_level_descriptions[LITOPTLEVEL_TOTAL]
 
 static const char* optimization_names[LITOPTSTATE_TOTAL]
 = { "constant-folding", "literal-folding", "unused-var",    "unreachable-code",
-    "empty-body",       "line-info",       "private-names", "c-for" };
+    "empty-body",       "line-info",       "private-names", "c-for",
+    "inline",           "licm",            "cse" };
 
 static const char* optimization_descriptions[LITOPTSTATE_TOTAL]
 = { "Replaces constants in code with their values.",
@@ -51,14 +51,67 @@ static const char* optimization_descriptions[LITOPTSTATE_TOTAL]
     "Removes loops with empty bodies.",
     "Removes line information from chunks to save on space.",
     "Removes names of the private locals from modules (they are indexed by id at runtime).",
-    "Replaces for-in loops with c-style for loops where it can." };
+    "Replaces for-in loops with c-style for loops where it can.",
+    "Replaces calls to small, non-recursive functions with their bodies.",
+    "Moves values that don't change inside of a loop out of it.",
+    "Computes values that are repeated in a block only once." };
+
+/* the largest function body (in ast nodes) that calls get replaced with */
+#define LIT_OPT_INLINE_BUDGET 24
 
-static bool optimization_states[LITOPTSTATE_TOTAL];
+/* the most values a single loop or block is checked for */
+#define LIT_OPT_HOIST_MAX 32
 
-static bool optimization_states_setup = false;
-static bool any_optimization_enabled = false;
+typedef struct LitInlineScan LitInlineScan;
+typedef struct LitEscapeScan LitEscapeScan;
+typedef struct LitHoistCandidate LitHoistCandidate;
+typedef struct LitHoistScan LitHoistScan;
+typedef bool(*LitAstVisitFn)(LitAstExpression*, void*);
+
+struct LitInlineScan
+{
+    LitOptimizer* optimizer;
+    LitAstParamList* parameters;
+    /* the function itself, when checking a call site */
+    LitVariable* function;
+    size_t size;
+    size_t calls;
+    bool inlinable;
+};
+
+struct LitEscapeScan
+{
+    LitAstVarExpr* name;
+    size_t uses;
+    size_t safe;
+};
 
-static void lit_astopt_setupstates();
+struct LitHoistCandidate
+{
+    /* the first occurrence, which becomes the initializer of the temporary */
+    LitAstExpression* expression;
+    size_t count;
+    /* statements of the block the first and the last occurrence are in */
+    size_t first;
+    size_t last;
+    /* set once the candidate is picked */
+    LitString* name;
+};
+
+struct LitHoistScan
+{
+    LitOptimizer* optimizer;
+    /* the code the value has to stay the same across */
+    LitAstExpression** region;
+    size_t region_count;
+    /* for common subexpressions: the block, and the statement the temporary is declared before */
+    LitAstExprList* statements;
+    size_t before;
+    size_t statement;
+    LitHoistCandidate candidates[LIT_OPT_HOIST_MAX];
+    size_t count;
+    bool replace;
+};
 
 #if defined(LIT_DEBUG_OPTIMIZER)
 void lit_astopt_optdbg(const char* fmt, ...)
@@ -70,97 +123,1631 @@ void lit_astopt_optdbg(const char* fmt, ...)
     fprintf(stderr, "\n");
     va_end(va);
 }
-#else
-    #define lit_astopt_optdbg(msg, ...)
-#endif
+#else
+    #define lit_astopt_optdbg(msg, ...)
+#endif
+
+void lit_varlist_init(LitVarList* array)
+{
+    array->values = NULL;
+    array->capacity = 0;
+    array->count = 0;
+}
+
+void lit_varlist_destroy(LitState* state, LitVarList* array)
+{
+    LIT_FREE_ARRAY(state, sizeof(LitVariable), array->values, array->capacity);
+    lit_varlist_init(array);
+}
+
+void lit_varlist_push(LitState* state, LitVarList* array, LitVariable value)
+{
+    size_t old_capacity;
+    if(array->capacity < array->count + 1)
+    {
+        old_capacity = array->capacity;
+        array->capacity = LIT_GROW_CAPACITY(old_capacity);
+        array->values = LIT_GROW_ARRAY(state, array->values, sizeof(LitVariable), old_capacity, array->capacity);
+    }
+    array->values[array->count] = value;
+    array->count++;
+}
+
+void lit_astopt_init(LitState* state, LitOptimizer* optimizer)
+{
+    optimizer->state = state;
+    optimizer->depth = -1;
+    optimizer->mark_used = false;
+    optimizer->inlining = false;
+    optimizer->function = NULL;
+    optimizer->function_base = 0;
+    optimizer->module = NULL;
+    optimizer->temps = 0;
+    lit_varlist_init(&optimizer->variables);
+    lit_varlist_init(&optimizer->assigned);
+}
+
+static void lit_astopt_beginscope(LitOptimizer* optimizer)
+{
+    optimizer->depth++;
+}
+
+/*
+* a declaration can only be dropped when evaluating it has no side effects.
+*/
+static bool lit_astopt_isdroppable(LitAstExpression* declaration)
+{
+    LitAstExpression* init;
+    if(declaration->type == LITEXPR_FUNCTION)
+    {
+        return true;
+    }
+    if(declaration->type != LITEXPR_VARSTMT)
+    {
+        return false;
+    }
+    init = ((LitAstAssignVarExpr*)declaration)->init;
+    return init == NULL || init->type == LITEXPR_LITERAL || init->type == LITEXPR_LAMBDA;
+}
+
+static void lit_astopt_endscope(LitOptimizer* optimizer)
+{
+    bool remove_unused;
+    LitVariable* variable;
+    LitVarList* variables;
+    optimizer->depth--;
+    variables = &optimizer->variables;
+    remove_unused = lit_astopt_isoptenabled(optimizer->state, LITOPTSTATE_UNUSED_VAR);
+    while(variables->count > 0 && variables->values[variables->count - 1].depth > optimizer->depth)
+    {
+        variable = &variables->values[variables->count - 1];
+        // top-level names may be referenced before they are declared (or from other modules)
+        if(remove_unused && !variable->used && variable->depth > 0 && variable->declaration != NULL
+           && *variable->declaration != NULL && lit_astopt_isdroppable(*variable->declaration))
+        {
+            *variable->declaration = NULL;
+        }
+        variables->count--;
+    }
+}
+
+static LitVariable* lit_astopt_addvar(LitOptimizer* optimizer, const char* name, size_t length, bool constant, LitAstExpression** declaration)
+{
+    lit_varlist_push(optimizer->state, &optimizer->variables,
+                        (LitVariable){ name, length, optimizer->depth, constant, optimizer->mark_used, NULL_VALUE, declaration, false, LITOPTKIND_UNKNOWN });
+
+    return &optimizer->variables.values[optimizer->variables.count - 1];
+}
+
+static LitVariable* lit_astopt_resolvevar(LitOptimizer* optimizer, const char* name, size_t length)
+{
+    int i;
+    LitVarList* variables;
+    LitVariable* variable;
+    variables = &optimizer->variables;
+    for(i = variables->count - 1; i >= 0; i--)
+    {
+        variable = &variables->values[i];
+        if(length == variable->length && memcmp(variable->name, name, length) == 0)
+        {
+            return variable;
+        }
+    }
+    return NULL;
+}
+
+static bool lit_astopt_isemptyexpr(LitAstExpression* statement)
+{
+    return statement == NULL || (statement->type == LITEXPR_BLOCK && ((LitAstBlockExpr*)statement)->statements.count == 0);
+}
+
+/*
+* the function whose body is optimized next; returns the one to go back to afterwards.
+*/
+static LitAstExpression* lit_astopt_beginfunction(LitOptimizer* optimizer, LitAstExpression* body, size_t* base)
+{
+    LitAstExpression* function;
+    function = optimizer->function;
+    *base = optimizer->function_base;
+    optimizer->function = body;
+    optimizer->function_base = optimizer->variables.count;
+    return function;
+}
+
+static void lit_astopt_endfunction(LitOptimizer* optimizer, LitAstExpression* function, size_t base)
+{
+    optimizer->function = function;
+    optimizer->function_base = base;
+}
+
+/*
+* parameters shadow outer variables (and constants) of the same name inside the body.
+*/
+static void lit_astopt_addparams(LitOptimizer* optimizer, LitAstParamList* parameters)
+{
+    size_t i;
+    LitVariable* variable;
+    for(i = 0; i < parameters->count; i++)
+    {
+        variable = lit_astopt_addvar(optimizer, parameters->values[i].name, parameters->values[i].length, false, NULL);
+        variable->used = true;
+    }
+}
+
+static bool lit_astopt_walk(LitAstExpression* expression, LitAstVisitFn fn, void* data);
+
+static bool lit_astopt_walklist(LitAstExprList* expressions, LitAstVisitFn fn, void* data)
+{
+    size_t i;
+    if(expressions == NULL)
+    {
+        return true;
+    }
+    for(i = 0; i < expressions->count; i++)
+    {
+        if(!lit_astopt_walk(expressions->values[i], fn, data))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool lit_astopt_walkparams(LitAstParamList* parameters, LitAstVisitFn fn, void* data)
+{
+    size_t i;
+    for(i = 0; i < parameters->count; i++)
+    {
+        if(!lit_astopt_walk(parameters->values[i].default_value, fn, data))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+* calls fn on expression and everything below it, and stops as soon as fn returns false.
+* returns false if it was stopped.
+*/
+static bool lit_astopt_walk(LitAstExpression* expression, LitAstVisitFn fn, void* data)
+{
+    if(expression == NULL)
+    {
+        return true;
+    }
+    if(!fn(expression, data))
+    {
+        return false;
+    }
+    switch(expression->type)
+    {
+        case LITEXPR_BINARY:
+            {
+                LitAstBinaryExpr* expr = (LitAstBinaryExpr*)expression;
+                return (expr->ignore_left || lit_astopt_walk(expr->left, fn, data)) && lit_astopt_walk(expr->right, fn, data);
+            }
+            break;
+        case LITEXPR_UNARY:
+            {
+                return lit_astopt_walk(((LitAstUnaryExpr*)expression)->right, fn, data);
+            }
+            break;
+        case LITEXPR_ASSIGN:
+            {
+                LitAstAssignExpr* expr = (LitAstAssignExpr*)expression;
+                return lit_astopt_walk(expr->to, fn, data) && lit_astopt_walk(expr->value, fn, data);
+            }
+            break;
+        case LITEXPR_CALL:
+            {
+                LitAstCallExpr* expr = (LitAstCallExpr*)expression;
+                return lit_astopt_walk(expr->callee, fn, data) && lit_astopt_walklist(&expr->args, fn, data)
+                       && lit_astopt_walk(expr->init, fn, data);
+            }
+            break;
+        case LITEXPR_GET:
+            {
+                return lit_astopt_walk(((LitAstGetExpr*)expression)->where, fn, data);
+            }
+            break;
+        case LITEXPR_SET:
+            {
+                LitAstSetExpr* expr = (LitAstSetExpr*)expression;
+                return lit_astopt_walk(expr->where, fn, data) && lit_astopt_walk(expr->value, fn, data);
+            }
+            break;
+        case LITEXPR_LAMBDA:
+            {
+                LitAstLambdaExpr* expr = (LitAstLambdaExpr*)expression;
+                return lit_astopt_walkparams(&expr->parameters, fn, data) && lit_astopt_walk(expr->body, fn, data);
+            }
+            break;
+        case LITEXPR_ARRAY:
+            {
+                return lit_astopt_walklist(&((LitAstArrayExpr*)expression)->values, fn, data);
+            }
+            break;
+        case LITEXPR_OBJECT:
+            {
+                return lit_astopt_walklist(&((LitAstObjectExpr*)expression)->values, fn, data);
+            }
+            break;
+        case LITEXPR_SUBSCRIPT:
+            {
+                LitAstIndexExpr* expr = (LitAstIndexExpr*)expression;
+                return lit_astopt_walk(expr->array, fn, data) && lit_astopt_walk(expr->index, fn, data);
+            }
+            break;
+        case LITEXPR_RANGE:
+            {
+                LitAstRangeExpr* expr = (LitAstRangeExpr*)expression;
+                return lit_astopt_walk(expr->from, fn, data) && lit_astopt_walk(expr->to, fn, data);
+            }
+            break;
+        case LITEXPR_TERNARY:
+            {
+                LitAstTernaryExpr* expr = (LitAstTernaryExpr*)expression;
+                return lit_astopt_walk(expr->condition, fn, data) && lit_astopt_walk(expr->if_branch, fn, data)
+                       && lit_astopt_walk(expr->else_branch, fn, data);
+            }
+            break;
+        case LITEXPR_INTERPOLATION:
+            {
+                return lit_astopt_walklist(&((LitAstStrInterExpr*)expression)->expressions, fn, data);
+            }
+            break;
+        case LITEXPR_REFERENCE:
+            {
+                return lit_astopt_walk(((LitAstRefExpr*)expression)->to, fn, data);
+            }
+            break;
+        case LITEXPR_EXPRESSION:
+            {
+                return lit_astopt_walk(((LitAstExprExpr*)expression)->expression, fn, data);
+            }
+            break;
+        case LITEXPR_BLOCK:
+            {
+                return lit_astopt_walklist(&((LitAstBlockExpr*)expression)->statements, fn, data);
+            }
+            break;
+        case LITEXPR_VARSTMT:
+            {
+                return lit_astopt_walk(((LitAstAssignVarExpr*)expression)->init, fn, data);
+            }
+            break;
+        case LITEXPR_IFSTMT:
+            {
+                LitAstIfExpr* stmt = (LitAstIfExpr*)expression;
+                return lit_astopt_walk(stmt->condition, fn, data) && lit_astopt_walk(stmt->if_branch, fn, data)
+                       && lit_astopt_walklist(stmt->elseif_conditions, fn, data) && lit_astopt_walklist(stmt->elseif_branches, fn, data)
+                       && lit_astopt_walk(stmt->else_branch, fn, data);
+            }
+            break;
+        case LITEXPR_WHILE:
+            {
+                LitAstWhileExpr* stmt = (LitAstWhileExpr*)expression;
+                return lit_astopt_walk(stmt->condition, fn, data) && lit_astopt_walk(stmt->body, fn, data);
+            }
+            break;
+        case LITEXPR_FOR:
+            {
+                LitAstForExpr* stmt = (LitAstForExpr*)expression;
+                return lit_astopt_walk(stmt->init, fn, data) && lit_astopt_walk(stmt->var, fn, data)
+                       && lit_astopt_walk(stmt->condition, fn, data) && lit_astopt_walk(stmt->increment, fn, data)
+                       && lit_astopt_walk(stmt->body, fn, data);
+            }
+            break;
+        case LITEXPR_FUNCTION:
+            {
+                LitAstFunctionExpr* stmt = (LitAstFunctionExpr*)expression;
+                return lit_astopt_walkparams(&stmt->parameters, fn, data) && lit_astopt_walk(stmt->body, fn, data);
+            }
+            break;
+        case LITEXPR_RETURN:
+            {
+                return lit_astopt_walk(((LitAstReturnExpr*)expression)->expression, fn, data);
+            }
+            break;
+        case LITEXPR_METHOD:
+            {
+                LitAstMethodExpr* stmt = (LitAstMethodExpr*)expression;
+                return lit_astopt_walkparams(&stmt->parameters, fn, data) && lit_astopt_walk(stmt->body, fn, data);
+            }
+            break;
+        case LITEXPR_CLASS:
+            {
+                return lit_astopt_walklist(&((LitAstClassExpr*)expression)->fields, fn, data);
+            }
+            break;
+        case LITEXPR_FIELD:
+            {
+                LitAstFieldExpr* stmt = (LitAstFieldExpr*)expression;
+                return lit_astopt_walk(stmt->getter, fn, data) && lit_astopt_walk(stmt->setter, fn, data);
+            }
+            break;
+        default:
+            {
+            }
+            break;
+    }
+    return true;
+}
+
+static bool lit_astopt_visitnoclosure(LitAstExpression* expression, void* data)
+{
+    (void)data;
+    return expression->type != LITEXPR_LAMBDA && expression->type != LITEXPR_FUNCTION;
+}
+
+static bool lit_astopt_hasclosure(LitAstExpression* expression)
+{
+    return !lit_astopt_walk(expression, lit_astopt_visitnoclosure, NULL);
+}
+
+static bool lit_astopt_visitassign(LitAstExpression* expression, void* data)
+{
+    LitAstExpression* to;
+    LitOptimizer* optimizer;
+    optimizer = (LitOptimizer*)data;
+    to = NULL;
+    if(expression->type == LITEXPR_ASSIGN)
+    {
+        to = ((LitAstAssignExpr*)expression)->to;
+    }
+    else if(expression->type == LITEXPR_REFERENCE)
+    {
+        to = ((LitAstRefExpr*)expression)->to;
+    }
+    if(to != NULL && to->type == LITEXPR_VAREXPR)
+    {
+        lit_varlist_push(optimizer->state, &optimizer->assigned,
+                         (LitVariable){ ((LitAstVarExpr*)to)->name, ((LitAstVarExpr*)to)->length, 0, false, false, NULL_VALUE, NULL, false, LITOPTKIND_UNKNOWN });
+    }
+    return true;
+}
+
+static bool lit_astopt_isassigned(LitOptimizer* optimizer, const char* name, size_t length)
+{
+    size_t i;
+    LitVariable* variable;
+    for(i = 0; i < optimizer->assigned.count; i++)
+    {
+        variable = &optimizer->assigned.values[i];
+        if(variable->length == length && memcmp(variable->name, name, length) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int lit_astopt_findparam(LitAstParamList* parameters, const char* name, size_t length)
+{
+    size_t i;
+    for(i = 0; i < parameters->count; i++)
+    {
+        if(parameters->values[i].length == length && memcmp(parameters->values[i].name, name, length) == 0)
+        {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/*
+* only side-effect-light expressions over the parameters and module-level names can be inlined.
+* at a call site those names must still mean what they meant at the declaration: either nothing
+* declared them, or a module-level variable that was declared before the function.
+*/
+static bool lit_astopt_visitinline(LitAstExpression* expression, void* data)
+{
+    LitVariable* variable;
+    LitAstVarExpr* varexpr;
+    LitInlineScan* scan;
+    scan = (LitInlineScan*)data;
+    scan->size++;
+    scan->inlinable = false;
+    if(scan->size > LIT_OPT_INLINE_BUDGET)
+    {
+        return false;
+    }
+    switch(expression->type)
+    {
+        case LITEXPR_LITERAL:
+        case LITEXPR_UNARY:
+        case LITEXPR_TERNARY:
+        case LITEXPR_SUBSCRIPT:
+        case LITEXPR_RANGE:
+        case LITEXPR_ARRAY:
+        case LITEXPR_INTERPOLATION:
+        case LITEXPR_GET:
+            {
+            }
+            break;
+        case LITEXPR_BINARY:
+            {
+                if(((LitAstBinaryExpr*)expression)->ignore_left)
+                {
+                    return false;
+                }
+            }
+            break;
+        case LITEXPR_CALL:
+            {
+                if(((LitAstCallExpr*)expression)->init != NULL)
+                {
+                    return false;
+                }
+                scan->calls++;
+            }
+            break;
+        case LITEXPR_VAREXPR:
+            {
+                varexpr = (LitAstVarExpr*)expression;
+                if(lit_astopt_findparam(scan->parameters, varexpr->name, varexpr->length) != -1)
+                {
+                    break;
+                }
+                variable = lit_astopt_resolvevar(scan->optimizer, varexpr->name, varexpr->length);
+                if(variable != NULL && (variable->depth != 0 || (scan->function != NULL && variable >= scan->function)))
+                {
+                    return false;
+                }
+            }
+            break;
+        default:
+            {
+                return false;
+            }
+            break;
+    }
+    scan->inlinable = true;
+    return true;
+}
+
+/*
+* the returned expression of a function whose body is just 'return <expression>', or NULL.
+*/
+static LitAstExpression* lit_astopt_inlinebody(LitAstFunctionExpr* function)
+{
+    size_t i;
+    LitAstExpression* found;
+    LitAstExpression* statement;
+    LitAstBlockExpr* body;
+    if(function->body == NULL || function->body->type != LITEXPR_BLOCK)
+    {
+        return NULL;
+    }
+    body = (LitAstBlockExpr*)function->body;
+    found = NULL;
+    for(i = 0; i < body->statements.count; i++)
+    {
+        statement = body->statements.values[i];
+        if(statement == NULL)
+        {
+            continue;
+        }
+        if(found != NULL || statement->type != LITEXPR_RETURN)
+        {
+            return NULL;
+        }
+        found = ((LitAstReturnExpr*)statement)->expression;
+    }
+    return found;
+}
+
+static bool lit_astopt_caninline(LitOptimizer* optimizer, LitAstFunctionExpr* function)
+{
+    size_t i;
+    LitAstExpression* body;
+    LitAstParameter* parameter;
+    LitInlineScan scan;
+    if(function->exported || function->parameters.count > UINT8_MAX || lit_astopt_isassigned(optimizer, function->name, function->length))
+    {
+        return false;
+    }
+    for(i = 0; i < function->parameters.count; i++)
+    {
+        parameter = &function->parameters.values[i];
+        if(parameter->default_value != NULL || (parameter->length == 3 && memcmp(parameter->name, "...", 3) == 0))
+        {
+            return false;
+        }
+    }
+    body = lit_astopt_inlinebody(function);
+    if(body == NULL)
+    {
+        return false;
+    }
+    scan = (LitInlineScan){ optimizer, &function->parameters, NULL, 0, 0, true };
+    lit_astopt_walk(body, lit_astopt_visitinline, &scan);
+    return scan.inlinable;
+}
+
+static LitAstExpression* lit_astopt_cloneinline(LitOptimizer* optimizer, LitAstExpression* expression, LitAstParamList* parameters, LitAstExprList* args, size_t line);
+
+static void lit_astopt_cloneinlinelist(LitOptimizer* optimizer, LitAstExprList* to, LitAstExprList* from, LitAstParamList* parameters, LitAstExprList* args, size_t line)
+{
+    size_t i;
+    for(i = 0; i < from->count; i++)
+    {
+        lit_exprlist_push(optimizer->state, to, lit_astopt_cloneinline(optimizer, from->values[i], parameters, args, line));
+    }
+}
+
+/*
+* copies an inlinable function body, with its parameters replaced by the arguments of the call.
+*/
+static LitAstExpression* lit_astopt_cloneinline(LitOptimizer* optimizer, LitAstExpression* expression, LitAstParamList* parameters, LitAstExprList* args, size_t line)
+{
+    int param;
+    LitState* state;
+    state = optimizer->state;
+    if(expression == NULL)
+    {
+        return NULL;
+    }
+    switch(expression->type)
+    {
+        case LITEXPR_LITERAL:
+            {
+                return (LitAstExpression*)lit_ast_make_literalexpr(state, line, ((LitAstLiteralExpr*)expression)->value);
+            }
+            break;
+        case LITEXPR_BINARY:
+            {
+                LitAstBinaryExpr* expr = (LitAstBinaryExpr*)expression;
+                return (LitAstExpression*)lit_ast_make_binaryexpr(state, line, lit_astopt_cloneinline(optimizer, expr->left, parameters, args, line),
+                                                                  lit_astopt_cloneinline(optimizer, expr->right, parameters, args, line), expr->op);
+            }
+            break;
+        case LITEXPR_UNARY:
+            {
+                LitAstUnaryExpr* expr = (LitAstUnaryExpr*)expression;
+                return (LitAstExpression*)lit_ast_make_unaryexpr(state, line, lit_astopt_cloneinline(optimizer, expr->right, parameters, args, line), expr->op);
+            }
+            break;
+        case LITEXPR_VAREXPR:
+            {
+                LitAstVarExpr* expr = (LitAstVarExpr*)expression;
+                param = parameters == NULL ? -1 : lit_astopt_findparam(parameters, expr->name, expr->length);
+                if(param != -1)
+                {
+                    return lit_astopt_cloneinline(optimizer, args->values[param], NULL, NULL, line);
+                }
+                return (LitAstExpression*)lit_ast_make_varexpr(state, line, expr->name, expr->length);
+            }
+            break;
+        case LITEXPR_CALL:
+            {
+                LitAstCallExpr* expr = (LitAstCallExpr*)expression;
+                LitAstCallExpr* call = lit_ast_make_callexpr(state, line, lit_astopt_cloneinline(optimizer, expr->callee, parameters, args, line));
+                lit_astopt_cloneinlinelist(optimizer, &call->args, &expr->args, parameters, args, line);
+                return (LitAstExpression*)call;
+            }
+            break;
+        case LITEXPR_GET:
+            {
+                LitAstGetExpr* expr = (LitAstGetExpr*)expression;
+                LitAstGetExpr* get = lit_ast_make_getexpr(state, line, lit_astopt_cloneinline(optimizer, expr->where, parameters, args, line),
+                                                          expr->name, expr->length, expr->jump != -1, expr->ignore_result);
+                get->ignore_emit = expr->ignore_emit;
+                return (LitAstExpression*)get;
+            }
+            break;
+        case LITEXPR_ARRAY:
+            {
+                LitAstArrayExpr* array = lit_ast_make_arrayexpr(state, line);
+                lit_astopt_cloneinlinelist(optimizer, &array->values, &((LitAstArrayExpr*)expression)->values, parameters, args, line);
+                return (LitAstExpression*)array;
+            }
+            break;
+        case LITEXPR_SUBSCRIPT:
+            {
+                LitAstIndexExpr* expr = (LitAstIndexExpr*)expression;
+                return (LitAstExpression*)lit_ast_make_subscriptexpr(state, line, lit_astopt_cloneinline(optimizer, expr->array, parameters, args, line),
+                                                                     lit_astopt_cloneinline(optimizer, expr->index, parameters, args, line));
+            }
+            break;
+        case LITEXPR_RANGE:
+            {
+                LitAstRangeExpr* expr = (LitAstRangeExpr*)expression;
+                return (LitAstExpression*)lit_ast_make_rangeexpr(state, line, lit_astopt_cloneinline(optimizer, expr->from, parameters, args, line),
+                                                                 lit_astopt_cloneinline(optimizer, expr->to, parameters, args, line));
+            }
+            break;
+        case LITEXPR_TERNARY:
+            {
+                LitAstTernaryExpr* expr = (LitAstTernaryExpr*)expression;
+                return (LitAstExpression*)lit_ast_make_ternaryexpr(state, line, lit_astopt_cloneinline(optimizer, expr->condition, parameters, args, line),
+                                                                   lit_astopt_cloneinline(optimizer, expr->if_branch, parameters, args, line),
+                                                                   lit_astopt_cloneinline(optimizer, expr->else_branch, parameters, args, line));
+            }
+            break;
+        case LITEXPR_INTERPOLATION:
+            {
+                LitAstStrInterExpr* inter = lit_ast_make_strinterpolexpr(state, line);
+                lit_astopt_cloneinlinelist(optimizer, &inter->expressions, &((LitAstStrInterExpr*)expression)->expressions, parameters, args, line);
+                return (LitAstExpression*)inter;
+            }
+            break;
+        default:
+            {
+                UNREACHABLE
+            }
+            break;
+    }
+    return NULL;
+}
+
+/*
+* replaces a call to an inlinable function with a copy of its body.
+* arguments have to be literals, or plain variables when the body makes no calls
+* (a call could change the variable before the inlined body reads it).
+*/
+static bool lit_astopt_tryinline(LitOptimizer* optimizer, LitAstExpression** slot)
+{
+    size_t i;
+    LitAstExpression* arg;
+    LitAstExpression* body;
+    LitAstCallExpr* expr;
+    LitAstVarExpr* callee;
+    LitAstFunctionExpr* function;
+    LitVariable* variable;
+    LitInlineScan scan;
+    expr = (LitAstCallExpr*)*slot;
+    if(optimizer->inlining || !lit_astopt_ismoduleopt(optimizer, LITOPTSTATE_INLINE) || expr->init != NULL || expr->callee->type != LITEXPR_VAREXPR)
+    {
+        return false;
+    }
+    callee = (LitAstVarExpr*)expr->callee;
+    variable = lit_astopt_resolvevar(optimizer, callee->name, callee->length);
+    if(variable == NULL || !variable->inlinable || *variable->declaration == NULL)
+    {
+        return false;
+    }
+    function = (LitAstFunctionExpr*)*variable->declaration;
+    if(expr->args.count != function->parameters.count)
+    {
+        return false;
+    }
+    body = lit_astopt_inlinebody(function);
+    scan = (LitInlineScan){ optimizer, &function->parameters, variable, 0, 0, true };
+    lit_astopt_walk(body, lit_astopt_visitinline, &scan);
+    if(!scan.inlinable)
+    {
+        return false;
+    }
+    for(i = 0; i < expr->args.count; i++)
+    {
+        arg = expr->args.values[i];
+        if(arg->type == LITEXPR_LITERAL)
+        {
+            continue;
+        }
+        if(arg->type != LITEXPR_VAREXPR || scan.calls > 0
+           || (((LitAstVarExpr*)arg)->length == 3 && memcmp(((LitAstVarExpr*)arg)->name, "...", 3) == 0))
+        {
+            return false;
+        }
+    }
+    lit_astopt_optdbg("inlining call to '%.*s'", (int)callee->length, callee->name);
+    *slot = lit_astopt_cloneinline(optimizer, body, &function->parameters, &expr->args, expr->exobj.line);
+    optimizer->inlining = true;
+    lit_astopt_optexpression(optimizer, slot);
+    optimizer->inlining = false;
+    return true;
+}
+
+static bool lit_astopt_isname(const char* name, size_t length, const char* expect)
+{
+    return length == strlen(expect) && memcmp(name, expect, length) == 0;
+}
+
+static bool lit_astopt_isvarnamed(LitAstExpression* expression, const char* name, size_t length)
+{
+    return expression != NULL && expression->type == LITEXPR_VAREXPR && ((LitAstVarExpr*)expression)->length == length
+           && memcmp(((LitAstVarExpr*)expression)->name, name, length) == 0;
+}
+
+/*
+* Math.Pi and Math.Tau, as long as Math is the global class.
+*/
+static bool lit_astopt_ismathconst(LitOptimizer* optimizer, LitAstGetExpr* expr)
+{
+    if(!lit_astopt_isvarnamed(expr->where, "Math", 4)
+       || !(lit_astopt_isname(expr->name, expr->length, "Pi") || lit_astopt_isname(expr->name, expr->length, "Tau")))
+    {
+        return false;
+    }
+    return lit_astopt_resolvevar(optimizer, "Math", 4) == NULL && !lit_astopt_isassigned(optimizer, "Math", 4);
+}
+
+static bool lit_astopt_isarithmetic(LitTokType op)
+{
+    switch(op)
+    {
+        case LITTOK_PLUS:
+        case LITTOK_MINUS:
+        case LITTOK_STAR:
+        case LITTOK_SLASH:
+        case LITTOK_STAR_STAR:
+        case LITTOK_PERCENT:
+        case LITTOK_SHARP:
+        case LITTOK_LESS_LESS:
+        case LITTOK_GREATER_GREATER:
+        case LITTOK_BAR:
+        case LITTOK_AMPERSAND:
+        case LITTOK_CARET:
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
+/*
+* the type an expression is known to produce. operators are only known when both operands are,
+* since on anything else they could end up calling an overload.
+*/
+static LitOptKind lit_astopt_kindof(LitOptimizer* optimizer, LitAstExpression* expression)
+{
+    LitOptKind kind;
+    LitOptKind left;
+    LitOptKind right;
+    LitValue value;
+    LitVariable* variable;
+    if(expression == NULL)
+    {
+        return LITOPTKIND_UNKNOWN;
+    }
+    switch(expression->type)
+    {
+        case LITEXPR_LITERAL:
+            {
+                value = ((LitAstLiteralExpr*)expression)->value;
+                if(lit_value_isnumber(value))
+                {
+                    return LITOPTKIND_NUMBER;
+                }
+                if(lit_value_isstring(value))
+                {
+                    return LITOPTKIND_STRING;
+                }
+            }
+            break;
+        case LITEXPR_ARRAY:
+            {
+                return LITOPTKIND_ARRAY;
+            }
+            break;
+        case LITEXPR_OBJECT:
+            {
+                return LITOPTKIND_MAP;
+            }
+            break;
+        case LITEXPR_VAREXPR:
+            {
+                LitAstVarExpr* expr = (LitAstVarExpr*)expression;
+                variable = lit_astopt_resolvevar(optimizer, expr->name, expr->length);
+                if(variable != NULL && !lit_astopt_isassigned(optimizer, expr->name, expr->length))
+                {
+                    return variable->kind;
+                }
+            }
+            break;
+        case LITEXPR_GET:
+            {
+                LitAstGetExpr* expr = (LitAstGetExpr*)expression;
+                if(expr->jump != -1 || expr->ignore_emit)
+                {
+                    break;
+                }
+                if(lit_astopt_isname(expr->name, expr->length, "length"))
+                {
+                    kind = lit_astopt_kindof(optimizer, expr->where);
+                    if(kind == LITOPTKIND_STRING || kind == LITOPTKIND_ARRAY || kind == LITOPTKIND_MAP)
+                    {
+                        return LITOPTKIND_NUMBER;
+                    }
+                }
+                else if(lit_astopt_ismathconst(optimizer, expr))
+                {
+                    return LITOPTKIND_NUMBER;
+                }
+            }
+            break;
+        case LITEXPR_UNARY:
+            {
+                LitAstUnaryExpr* expr = (LitAstUnaryExpr*)expression;
+                if((expr->op == LITTOK_MINUS || expr->op == LITTOK_TILDE) && lit_astopt_kindof(optimizer, expr->right) == LITOPTKIND_NUMBER)
+                {
+                    return LITOPTKIND_NUMBER;
+                }
+            }
+            break;
+        case LITEXPR_BINARY:
+            {
+                LitAstBinaryExpr* expr = (LitAstBinaryExpr*)expression;
+                if(expr->ignore_left)
+                {
+                    break;
+                }
+                left = lit_astopt_kindof(optimizer, expr->left);
+                right = lit_astopt_kindof(optimizer, expr->right);
+                if(left == LITOPTKIND_NUMBER && right == LITOPTKIND_NUMBER && lit_astopt_isarithmetic(expr->op))
+                {
+                    return LITOPTKIND_NUMBER;
+                }
+                if(left == LITOPTKIND_STRING && right == LITOPTKIND_STRING && expr->op == LITTOK_PLUS)
+                {
+                    return LITOPTKIND_STRING;
+                }
+            }
+            break;
+        default:
+            break;
+    }
+    return LITOPTKIND_UNKNOWN;
+}
+
+static bool lit_astopt_sameexpr(LitAstExpression* a, LitAstExpression* b)
+{
+    if(a == NULL || b == NULL || a->type != b->type)
+    {
+        return a == b;
+    }
+    switch(a->type)
+    {
+        case LITEXPR_LITERAL:
+            {
+                return ((LitAstLiteralExpr*)a)->value == ((LitAstLiteralExpr*)b)->value;
+            }
+            break;
+        case LITEXPR_VAREXPR:
+            {
+                return lit_astopt_isvarnamed(b, ((LitAstVarExpr*)a)->name, ((LitAstVarExpr*)a)->length);
+            }
+            break;
+        case LITEXPR_GET:
+            {
+                LitAstGetExpr* ga = (LitAstGetExpr*)a;
+                LitAstGetExpr* gb = (LitAstGetExpr*)b;
+                return ga->length == gb->length && memcmp(ga->name, gb->name, ga->length) == 0 && lit_astopt_sameexpr(ga->where, gb->where);
+            }
+            break;
+        case LITEXPR_UNARY:
+            {
+                LitAstUnaryExpr* ua = (LitAstUnaryExpr*)a;
+                LitAstUnaryExpr* ub = (LitAstUnaryExpr*)b;
+                return ua->op == ub->op && lit_astopt_sameexpr(ua->right, ub->right);
+            }
+            break;
+        case LITEXPR_BINARY:
+            {
+                LitAstBinaryExpr* ba = (LitAstBinaryExpr*)a;
+                LitAstBinaryExpr* bb = (LitAstBinaryExpr*)b;
+                return ba->op == bb->op && !ba->ignore_left && !bb->ignore_left && lit_astopt_sameexpr(ba->left, bb->left)
+                       && lit_astopt_sameexpr(ba->right, bb->right);
+            }
+            break;
+        default:
+            break;
+    }
+    return false;
+}
+
+static bool lit_astopt_visitmention(LitAstExpression* expression, void* data)
+{
+    LitAstVarExpr* name;
+    name = (LitAstVarExpr*)data;
+    return !lit_astopt_isvarnamed(expression, name->name, name->length);
+}
+
+static bool lit_astopt_mentions(LitAstExpression* expression, LitAstVarExpr* name)
+{
+    return !lit_astopt_walk(expression, lit_astopt_visitmention, name);
+}
+
+/*
+* array and map methods that never hand the receiver to script code.
+*/
+static bool lit_astopt_isplainmethod(const char* name, size_t length)
+{
+    static const char* methods[] = { "add",     "push",        "insert",   "slice",         "addAll", "remove",
+                                     "removeAt", "indexOf",    "contains", "clear",         "reserve", "shrinkToFit",
+                                     "join",    "sort",        "clone",    "toString",      "pop",    "iterator",
+                                     "iteratorValue", NULL };
+    size_t i;
+    for(i = 0; methods[i] != NULL; i++)
+    {
+        if(lit_astopt_isname(name, length, methods[i]))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+* counts the uses of a name, and the ones that can't leak the value it holds.
+* a closure or a reference that mentions the name at all stops the walk.
+*/
+static bool lit_astopt_visitescape(LitAstExpression* expression, void* data)
+{
+    LitEscapeScan* scan;
+    scan = (LitEscapeScan*)data;
+    switch(expression->type)
+    {
+        case LITEXPR_VAREXPR:
+            {
+                if(lit_astopt_isvarnamed(expression, scan->name->name, scan->name->length))
+                {
+                    scan->uses++;
+                }
+            }
+            break;
+        case LITEXPR_GET:
+            {
+                LitAstGetExpr* expr = (LitAstGetExpr*)expression;
+                if(lit_astopt_isvarnamed(expr->where, scan->name->name, scan->name->length) && lit_astopt_isname(expr->name, expr->length, "length"))
+                {
+                    scan->safe++;
+                }
+            }
+            break;
+        case LITEXPR_CALL:
+            {
+                LitAstGetExpr* callee = (LitAstGetExpr*)((LitAstCallExpr*)expression)->callee;
+                if(callee->exobj.type == LITEXPR_GET && lit_astopt_isvarnamed(callee->where, scan->name->name, scan->name->length)
+                   && !lit_astopt_isname(callee->name, callee->length, "length") && lit_astopt_isplainmethod(callee->name, callee->length))
+                {
+                    scan->safe++;
+                }
+            }
+            break;
+        case LITEXPR_SUBSCRIPT:
+            {
+                if(lit_astopt_isvarnamed(((LitAstIndexExpr*)expression)->array, scan->name->name, scan->name->length))
+                {
+                    scan->safe++;
+                }
+            }
+            break;
+        case LITEXPR_FOR:
+            {
+                LitAstForExpr* stmt = (LitAstForExpr*)expression;
+                if(!stmt->c_style && lit_astopt_isvarnamed(stmt->condition, scan->name->name, scan->name->length))
+                {
+                    scan->safe++;
+                }
+            }
+            break;
+        case LITEXPR_LAMBDA:
+        case LITEXPR_FUNCTION:
+        case LITEXPR_METHOD:
+        case LITEXPR_FIELD:
+        case LITEXPR_REFERENCE:
+            {
+                if(lit_astopt_mentions(expression, scan->name))
+                {
+                    scan->uses++;
+                    return false;
+                }
+            }
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+/*
+* an array or map that no other code can get hold of: a local of the function being optimized,
+* that never leaves it.
+*/
+static bool lit_astopt_isowned(LitOptimizer* optimizer, LitAstVarExpr* name)
+{
+    LitVariable* variable;
+    LitEscapeScan scan;
+    variable = lit_astopt_resolvevar(optimizer, name->name, name->length);
+    if(variable == NULL || variable->depth == 0 || (size_t)(variable - optimizer->variables.values) < optimizer->function_base)
+    {
+        return false;
+    }
+    scan = (LitEscapeScan){ name, 0, 0 };
+    if(optimizer->function != NULL)
+    {
+        if(!lit_astopt_walk(optimizer->function, lit_astopt_visitescape, &scan))
+        {
+            return false;
+        }
+    }
+    else if(!lit_astopt_walklist(optimizer->module, lit_astopt_visitescape, &scan))
+    {
+        return false;
+    }
+    return scan.uses <= scan.safe;
+}
+
+static bool lit_astopt_visitmutation(LitAstExpression* expression, void* data)
+{
+    LitAstVarExpr* name;
+    name = (LitAstVarExpr*)data;
+    if(expression->type == LITEXPR_CALL)
+    {
+        LitAstGetExpr* callee = (LitAstGetExpr*)((LitAstCallExpr*)expression)->callee;
+        return !(callee->exobj.type == LITEXPR_GET && lit_astopt_isvarnamed(callee->where, name->name, name->length));
+    }
+    if(expression->type == LITEXPR_ASSIGN)
+    {
+        LitAstIndexExpr* to = (LitAstIndexExpr*)((LitAstAssignExpr*)expression)->to;
+        return !(to->exobj.type == LITEXPR_SUBSCRIPT && lit_astopt_isvarnamed(to->array, name->name, name->length));
+    }
+    return true;
+}
+
+static bool lit_astopt_visitnocall(LitAstExpression* expression, void* data)
+{
+    (void)data;
+    return expression->type != LITEXPR_CALL && expression->type != LITEXPR_SET;
+}
+
+static bool lit_astopt_visitdeclaration(LitAstExpression* expression, void* data)
+{
+    LitAstVarExpr* name;
+    LitAstParamList* parameters;
+    name = (LitAstVarExpr*)data;
+    parameters = NULL;
+    switch(expression->type)
+    {
+        case LITEXPR_VARSTMT:
+            {
+                LitAstAssignVarExpr* stmt = (LitAstAssignVarExpr*)expression;
+                return !(stmt->length == name->length && memcmp(stmt->name, name->name, name->length) == 0);
+            }
+            break;
+        case LITEXPR_FUNCTION:
+            {
+                LitAstFunctionExpr* stmt = (LitAstFunctionExpr*)expression;
+                if(stmt->length == name->length && memcmp(stmt->name, name->name, name->length) == 0)
+                {
+                    return false;
+                }
+                parameters = &stmt->parameters;
+            }
+            break;
+        case LITEXPR_LAMBDA:
+            {
+                parameters = &((LitAstLambdaExpr*)expression)->parameters;
+            }
+            break;
+        case LITEXPR_METHOD:
+            {
+                parameters = &((LitAstMethodExpr*)expression)->parameters;
+            }
+            break;
+        default:
+            break;
+    }
+    if(parameters != NULL && lit_astopt_findparam(parameters, name->name, name->length) >= 0)
+    {
+        return false;
+    }
+    return true;
+}
+
+static bool lit_astopt_walkregion(LitHoistScan* scan, LitAstVisitFn fn, void* data)
+{
+    size_t i;
+    for(i = 0; i < scan->region_count; i++)
+    {
+        if(!lit_astopt_walk(scan->region[i], fn, data))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+* a variable the hoisted value reads has to be the same one where the temporary is declared.
+*/
+static bool lit_astopt_isvisible(LitHoistScan* scan, LitAstVarExpr* name)
+{
+    uintptr_t at;
+    uintptr_t from;
+    LitVariable* variable;
+    variable = lit_astopt_resolvevar(scan->optimizer, name->name, name->length);
+    if(variable == NULL)
+    {
+        return false;
+    }
+    if(scan->statements == NULL)
+    {
+        return lit_astopt_walkregion(scan, lit_astopt_visitdeclaration, name);
+    }
+    if(variable->depth < scan->optimizer->depth)
+    {
+        return true;
+    }
+    at = (uintptr_t)variable->declaration;
+    from = (uintptr_t)scan->statements->values;
+    return at >= from && at < from + scan->before * sizeof(LitAstExpression*);
+}
+
+/*
+* whether an expression of known type evaluates to the same value anywhere in the region,
+* and can be evaluated early without side effects.
+*/
+static bool lit_astopt_isstable(LitHoistScan* scan, LitAstExpression* expression)
+{
+    switch(expression->type)
+    {
+        case LITEXPR_LITERAL:
+            {
+                return true;
+            }
+            break;
+        case LITEXPR_VAREXPR:
+            {
+                return lit_astopt_isvisible(scan, (LitAstVarExpr*)expression);
+            }
+            break;
+        case LITEXPR_UNARY:
+            {
+                return lit_astopt_isstable(scan, ((LitAstUnaryExpr*)expression)->right);
+            }
+            break;
+        case LITEXPR_BINARY:
+            {
+                LitAstBinaryExpr* expr = (LitAstBinaryExpr*)expression;
+                return lit_astopt_isstable(scan, expr->left) && lit_astopt_isstable(scan, expr->right);
+            }
+            break;
+        case LITEXPR_GET:
+            {
+                LitAstGetExpr* expr = (LitAstGetExpr*)expression;
+                if(lit_astopt_ismathconst(scan->optimizer, expr))
+                {
+                    return lit_astopt_walkregion(scan, lit_astopt_visitnocall, NULL);
+                }
+                if(expr->where->type != LITEXPR_VAREXPR || !lit_astopt_isvisible(scan, (LitAstVarExpr*)expr->where))
+                {
+                    return false;
+                }
+                if(lit_astopt_kindof(scan->optimizer, expr->where) == LITOPTKIND_STRING)
+                {
+                    return true;
+                }
+                return lit_astopt_isowned(scan->optimizer, (LitAstVarExpr*)expr->where)
+                       && lit_astopt_walkregion(scan, lit_astopt_visitmutation, expr->where);
+            }
+            break;
+        default:
+            break;
+    }
+    return false;
+}
+
+/*
+* while collecting, counts an occurrence of a candidate; while replacing, swaps it for its temporary.
+* returns false if the expression isn't a candidate, and its operands should be looked at instead.
+*/
+static bool lit_astopt_hoistcandidate(LitHoistScan* scan, LitAstExpression** slot)
+{
+    size_t i;
+    LitOptKind kind;
+    LitAstExpression* expression;
+    LitHoistCandidate* candidate;
+    expression = *slot;
+    kind = lit_astopt_kindof(scan->optimizer, expression);
+    if(kind != LITOPTKIND_NUMBER && kind != LITOPTKIND_STRING)
+    {
+        return false;
+    }
+    if(scan->replace)
+    {
+        for(i = 0; i < scan->count; i++)
+        {
+            candidate = &scan->candidates[i];
+            if(candidate->name == NULL || !lit_astopt_sameexpr(candidate->expression, expression))
+            {
+                continue;
+            }
+            *slot = (LitAstExpression*)lit_ast_make_varexpr(scan->optimizer->state, expression->line, candidate->name->chars,
+                                                            lit_string_getlength(candidate->name));
+            return true;
+        }
+        return false;
+    }
+    if(scan->statements == NULL && !lit_astopt_isstable(scan, expression))
+    {
+        return false;
+    }
+    for(i = 0; i < scan->count; i++)
+    {
+        candidate = &scan->candidates[i];
+        if(lit_astopt_sameexpr(candidate->expression, expression))
+        {
+            candidate->count++;
+            candidate->last = scan->statement;
+            break;
+        }
+    }
+    if(i == scan->count && scan->count < LIT_OPT_HOIST_MAX)
+    {
+        scan->candidates[scan->count++] = (LitHoistCandidate){ expression, 1, scan->statement, scan->statement, NULL };
+    }
+    // a loop hoists the whole value, a block may find its operands repeated on their own
+    return scan->statements == NULL;
+}
 
-void lit_varlist_init(LitVarList* array)
+static void lit_astopt_hoistslot(LitHoistScan* scan, LitAstExpression** slot);
+
+static bool lit_astopt_visitother(LitAstExpression* expression, void* data)
 {
-    array->values = NULL;
-    array->capacity = 0;
-    array->count = 0;
+    return expression != (LitAstExpression*)data;
 }
 
-void lit_varlist_destroy(LitState* state, LitVarList* array)
+static void lit_astopt_hoistlist(LitHoistScan* scan, LitAstExprList* expressions)
 {
-    LIT_FREE_ARRAY(state, sizeof(LitVariable), array->values, array->capacity);
-    lit_varlist_init(array);
+    size_t i;
+    if(expressions == NULL)
+    {
+        return;
+    }
+    for(i = 0; i < expressions->count; i++)
+    {
+        lit_astopt_hoistslot(scan, &expressions->values[i]);
+    }
 }
 
-void lit_varlist_push(LitState* state, LitVarList* array, LitVariable value)
+/*
+* goes over everything that runs as part of the code in slot, but not into functions declared there.
+*/
+static void lit_astopt_hoistslot(LitHoistScan* scan, LitAstExpression** slot)
 {
-    size_t old_capacity;
-    if(array->capacity < array->count + 1)
+    LitAstExpression* expression;
+    expression = *slot;
+    if(expression == NULL)
     {
-        old_capacity = array->capacity;
-        array->capacity = LIT_GROW_CAPACITY(old_capacity);
-        array->values = LIT_GROW_ARRAY(state, array->values, sizeof(LitVariable), old_capacity, array->capacity);
+        return;
+    }
+    if((expression->type == LITEXPR_BINARY || expression->type == LITEXPR_UNARY || expression->type == LITEXPR_GET)
+       && lit_astopt_hoistcandidate(scan, slot))
+    {
+        return;
+    }
+    switch(expression->type)
+    {
+        case LITEXPR_BINARY:
+            {
+                LitAstBinaryExpr* expr = (LitAstBinaryExpr*)expression;
+                if(!expr->ignore_left)
+                {
+                    lit_astopt_hoistslot(scan, &expr->left);
+                }
+                lit_astopt_hoistslot(scan, &expr->right);
+            }
+            break;
+        case LITEXPR_UNARY:
+            {
+                lit_astopt_hoistslot(scan, &((LitAstUnaryExpr*)expression)->right);
+            }
+            break;
+        case LITEXPR_ASSIGN:
+            {
+                LitAstAssignExpr* expr = (LitAstAssignExpr*)expression;
+                if(expr->to->type == LITEXPR_SUBSCRIPT)
+                {
+                    lit_astopt_hoistslot(scan, &((LitAstIndexExpr*)expr->to)->array);
+                    lit_astopt_hoistslot(scan, &((LitAstIndexExpr*)expr->to)->index);
+                }
+                lit_astopt_hoistslot(scan, &expr->value);
+            }
+            break;
+        case LITEXPR_CALL:
+            {
+                LitAstCallExpr* expr = (LitAstCallExpr*)expression;
+                if(expr->callee->type == LITEXPR_GET)
+                {
+                    lit_astopt_hoistslot(scan, &((LitAstGetExpr*)expr->callee)->where);
+                }
+                else
+                {
+                    lit_astopt_hoistslot(scan, &expr->callee);
+                }
+                lit_astopt_hoistlist(scan, &expr->args);
+            }
+            break;
+        case LITEXPR_GET:
+            {
+                lit_astopt_hoistslot(scan, &((LitAstGetExpr*)expression)->where);
+            }
+            break;
+        case LITEXPR_SET:
+            {
+                LitAstSetExpr* expr = (LitAstSetExpr*)expression;
+                lit_astopt_hoistslot(scan, &expr->where);
+                lit_astopt_hoistslot(scan, &expr->value);
+            }
+            break;
+        case LITEXPR_ARRAY:
+            {
+                lit_astopt_hoistlist(scan, &((LitAstArrayExpr*)expression)->values);
+            }
+            break;
+        case LITEXPR_OBJECT:
+            {
+                lit_astopt_hoistlist(scan, &((LitAstObjectExpr*)expression)->values);
+            }
+            break;
+        case LITEXPR_SUBSCRIPT:
+            {
+                LitAstIndexExpr* expr = (LitAstIndexExpr*)expression;
+                lit_astopt_hoistslot(scan, &expr->array);
+                lit_astopt_hoistslot(scan, &expr->index);
+            }
+            break;
+        case LITEXPR_RANGE:
+            {
+                LitAstRangeExpr* expr = (LitAstRangeExpr*)expression;
+                lit_astopt_hoistslot(scan, &expr->from);
+                lit_astopt_hoistslot(scan, &expr->to);
+            }
+            break;
+        case LITEXPR_TERNARY:
+            {
+                LitAstTernaryExpr* expr = (LitAstTernaryExpr*)expression;
+                lit_astopt_hoistslot(scan, &expr->condition);
+                lit_astopt_hoistslot(scan, &expr->if_branch);
+                lit_astopt_hoistslot(scan, &expr->else_branch);
+            }
+            break;
+        case LITEXPR_INTERPOLATION:
+            {
+                lit_astopt_hoistlist(scan, &((LitAstStrInterExpr*)expression)->expressions);
+            }
+            break;
+        case LITEXPR_EXPRESSION:
+            {
+                lit_astopt_hoistslot(scan, &((LitAstExprExpr*)expression)->expression);
+            }
+            break;
+        case LITEXPR_BLOCK:
+            {
+                lit_astopt_hoistlist(scan, &((LitAstBlockExpr*)expression)->statements);
+            }
+            break;
+        case LITEXPR_VARSTMT:
+            {
+                lit_astopt_hoistslot(scan, &((LitAstAssignVarExpr*)expression)->init);
+            }
+            break;
+        case LITEXPR_IFSTMT:
+            {
+                LitAstIfExpr* stmt = (LitAstIfExpr*)expression;
+                lit_astopt_hoistslot(scan, &stmt->condition);
+                lit_astopt_hoistslot(scan, &stmt->if_branch);
+                lit_astopt_hoistlist(scan, stmt->elseif_conditions);
+                lit_astopt_hoistlist(scan, stmt->elseif_branches);
+                lit_astopt_hoistslot(scan, &stmt->else_branch);
+            }
+            break;
+        case LITEXPR_WHILE:
+            {
+                LitAstWhileExpr* stmt = (LitAstWhileExpr*)expression;
+                lit_astopt_hoistslot(scan, &stmt->condition);
+                lit_astopt_hoistslot(scan, &stmt->body);
+            }
+            break;
+        case LITEXPR_FOR:
+            {
+                LitAstForExpr* stmt = (LitAstForExpr*)expression;
+                lit_astopt_hoistslot(scan, &stmt->init);
+                lit_astopt_hoistslot(scan, &stmt->condition);
+                lit_astopt_hoistslot(scan, &stmt->increment);
+                lit_astopt_hoistslot(scan, &stmt->body);
+            }
+            break;
+        case LITEXPR_RETURN:
+            {
+                lit_astopt_hoistslot(scan, &((LitAstReturnExpr*)expression)->expression);
+            }
+            break;
+        default:
+            break;
     }
-    array->values[array->count] = value;
-    array->count++;
 }
 
-void lit_astopt_init(LitState* state, LitOptimizer* optimizer)
+static LitString* lit_astopt_maketemp(LitOptimizer* optimizer, const char* prefix)
 {
-    optimizer->state = state;
-    optimizer->depth = -1;
-    optimizer->mark_used = false;
-    lit_varlist_init(&optimizer->variables);
+    char name[32];
+    int length;
+    // '$' can't start an identifier, so these never clash with user names
+    length = snprintf(name, sizeof(name), "$%s%d", prefix, (int)optimizer->temps++);
+    return lit_string_copy(optimizer->state, name, length);
 }
 
-static void lit_astopt_beginscope(LitOptimizer* optimizer)
+static LitAstExpression* lit_astopt_maketempdecl(LitOptimizer* optimizer, LitHoistCandidate* candidate, size_t line)
 {
-    optimizer->depth++;
+    return (LitAstExpression*)lit_ast_make_assignvarexpr(optimizer->state, line, candidate->name->chars,
+                                                         lit_string_getlength(candidate->name), candidate->expression, false);
 }
 
-static void lit_astopt_endscope(LitOptimizer* optimizer)
+/*
+* moves loop-invariant values out of the loop in slot, which then becomes
+* { var $licm0 = value; ...; loop }
+*/
+static void lit_astopt_hoistloop(LitOptimizer* optimizer, LitAstExpression** slot)
 {
-    bool remove_unused;
-    LitVariable* variable;
-    LitVarList* variables;
-    optimizer->depth--;
-    variables = &optimizer->variables;
-    remove_unused = lit_astopt_isoptenabled(LITOPTSTATE_UNUSED_VAR);
-    while(variables->count > 0 && variables->values[variables->count - 1].depth > optimizer->depth)
+    size_t i;
+    LitAstExpression* loop;
+    LitAstBlockExpr* block;
+    LitHoistScan scan;
+    loop = *slot;
+    memset(&scan, 0, sizeof(scan));
+    scan.optimizer = optimizer;
+    scan.region = slot;
+    scan.region_count = 1;
+    for(scan.replace = false;; scan.replace = true)
     {
-        if(remove_unused && !variables->values[variables->count - 1].used)
+        if(loop->type == LITEXPR_WHILE)
         {
-            variable = &variables->values[variables->count - 1];
-            lit_ast_destroyexpression(optimizer->state, *variable->declaration);
-            *variable->declaration = NULL;
+            lit_astopt_hoistslot(&scan, &((LitAstWhileExpr*)loop)->condition);
+            lit_astopt_hoistslot(&scan, &((LitAstWhileExpr*)loop)->body);
+        }
+        else
+        {
+            lit_astopt_hoistslot(&scan, &((LitAstForExpr*)loop)->condition);
+            lit_astopt_hoistslot(&scan, &((LitAstForExpr*)loop)->increment);
+            lit_astopt_hoistslot(&scan, &((LitAstForExpr*)loop)->body);
+        }
+        if(scan.replace || scan.count == 0)
+        {
+            break;
+        }
+        for(i = 0; i < scan.count; i++)
+        {
+            scan.candidates[i].name = lit_astopt_maketemp(optimizer, "licm");
         }
-        variables->count--;
     }
+    if(scan.count == 0)
+    {
+        return;
+    }
+    lit_astopt_optdbg("hoisting %i loop-invariant expression(s) out of the loop", (int)scan.count);
+    block = lit_ast_make_blockexpr(optimizer->state, loop->line);
+    for(i = 0; i < scan.count; i++)
+    {
+        lit_exprlist_push(optimizer->state, &block->statements, lit_astopt_maketempdecl(optimizer, &scan.candidates[i], loop->line));
+    }
+    lit_exprlist_push(optimizer->state, &block->statements, loop);
+    *slot = (LitAstExpression*)block;
 }
 
-static LitVariable* lit_astopt_addvar(LitOptimizer* optimizer, const char* name, size_t length, bool constant, LitAstExpression** declaration)
-{
-    lit_varlist_push(optimizer->state, &optimizer->variables,
-                        (LitVariable){ name, length, optimizer->depth, constant, optimizer->mark_used, NULL_VALUE, declaration });
-
-    return &optimizer->variables.values[optimizer->variables.count - 1];
-}
-
-static LitVariable* lit_astopt_resolvevar(LitOptimizer* optimizer, const char* name, size_t length)
+/*
+* the optimizer keeps pointers to the statements that declared the variables in a block,
+* so they have to be moved along when a statement is put in front of them.
+*/
+static void lit_astopt_insertstmt(LitOptimizer* optimizer, LitAstExprList* statements, size_t index, LitAstExpression* statement)
 {
-    int i;
-    LitVarList* variables;
+    size_t i;
+    size_t at;
+    size_t count;
+    uintptr_t from;
     LitVariable* variable;
-    variables = &optimizer->variables;
-    for(i = variables->count - 1; i >= 0; i--)
+    from = (uintptr_t)statements->values;
+    count = statements->count;
+    lit_exprlist_push(optimizer->state, statements, NULL);
+    memmove(&statements->values[index + 1], &statements->values[index], (count - index) * sizeof(LitAstExpression*));
+    statements->values[index] = statement;
+    for(i = 0; i < optimizer->variables.count; i++)
     {
-        variable = &variables->values[i];
-        if(length == variable->length && memcmp(variable->name, name, length) == 0)
+        variable = &optimizer->variables.values[i];
+        if((uintptr_t)variable->declaration < from || (uintptr_t)variable->declaration >= from + count * sizeof(LitAstExpression*))
         {
-            return variable;
+            continue;
         }
+        at = ((uintptr_t)variable->declaration - from) / sizeof(LitAstExpression*);
+        variable->declaration = &statements->values[at >= index ? at + 1 : at];
+    }
+}
+
+static LitAstExpression** lit_astopt_straightline(LitAstExpression* statement)
+{
+    if(statement == NULL)
+    {
+        return NULL;
+    }
+    switch(statement->type)
+    {
+        case LITEXPR_EXPRESSION:
+            return &((LitAstExprExpr*)statement)->expression;
+        case LITEXPR_VARSTMT:
+            return &((LitAstAssignVarExpr*)statement)->init;
+        case LITEXPR_RETURN:
+            return &((LitAstReturnExpr*)statement)->expression;
+        default:
+            break;
     }
     return NULL;
 }
 
-static bool lit_astopt_isemptyexpr(LitAstExpression* statement)
+/*
+* computes values that the statements of a block repeat only once, into temporaries
+* declared right before the first statement that needs them.
+*/
+static void lit_astopt_cseblock(LitOptimizer* optimizer, LitAstExprList* statements)
 {
-    return statement == NULL || (statement->type == LITEXPR_BLOCK && ((LitAstBlockExpr*)statement)->statements.count == 0);
+    size_t i;
+    size_t j;
+    size_t chosen;
+    LitAstExpression** slot;
+    LitHoistScan scan;
+    LitHoistCandidate* candidate;
+    memset(&scan, 0, sizeof(scan));
+    scan.optimizer = optimizer;
+    scan.statements = statements;
+    for(scan.replace = false;; scan.replace = true)
+    {
+        for(i = 0; i < statements->count; i++)
+        {
+            scan.statement = i;
+            slot = lit_astopt_straightline(statements->values[i]);
+            if(slot != NULL)
+            {
+                lit_astopt_hoistslot(&scan, slot);
+            }
+        }
+        if(scan.replace)
+        {
+            break;
+        }
+        chosen = 0;
+        for(i = 0; i < scan.count; i++)
+        {
+            candidate = &scan.candidates[i];
+            scan.region = &statements->values[candidate->first];
+            scan.region_count = candidate->last - candidate->first + 1;
+            scan.before = candidate->first;
+            if(candidate->count < 2 || !lit_astopt_isstable(&scan, candidate->expression))
+            {
+                continue;
+            }
+            // the first occurrence can only belong to one temporary
+            for(j = 0; j < i; j++)
+            {
+                if(scan.candidates[j].name != NULL && !lit_astopt_walk(scan.candidates[j].expression, lit_astopt_visitother, candidate->expression))
+                {
+                    break;
+                }
+            }
+            if(j == i)
+            {
+                candidate->name = lit_astopt_maketemp(optimizer, "cse");
+                chosen++;
+            }
+        }
+        if(chosen == 0)
+        {
+            return;
+        }
+    }
+    // last one first, so the indices of the others stay valid
+    for(i = scan.count; i > 0; i--)
+    {
+        candidate = &scan.candidates[i - 1];
+        if(candidate->name != NULL)
+        {
+            lit_astopt_optdbg("reusing the value of a common subexpression");
+            lit_astopt_insertstmt(optimizer, statements, candidate->first,
+                                  lit_astopt_maketempdecl(optimizer, candidate, candidate->expression->line));
+        }
+    }
 }
 
 static LitValue lit_astopt_evalunaryop(LitOptimizer* optimizer, LitValue value, LitTokType op)
@@ -326,7 +1913,6 @@ static LitValue lit_astopt_attemptoptbinary(LitOptimizer* optimizer, LitAstBinar
             else if(number == 1)
             {
                 lit_astopt_optdbg("reducing expression to literal '1'");
-                lit_ast_destroyexpression(optimizer->state, left ? expression->right : expression->left);
                 expression->left = branch;
                 expression->right = NULL;
             }
@@ -334,14 +1920,12 @@ static LitValue lit_astopt_attemptoptbinary(LitOptimizer* optimizer, LitAstBinar
         else if((op == LITTOK_PLUS || op == LITTOK_MINUS) && number == 0)
         {
             lit_astopt_optdbg("reducing expression that would result in '0' to literal '0'");
-            lit_ast_destroyexpression(optimizer->state, left ? expression->right : expression->left);
             expression->left = branch;
             expression->right = NULL;
         }
         else if(((left && op == LITTOK_SLASH) || op == LITTOK_STAR_STAR) && number == 1)
         {
             lit_astopt_optdbg("reducing expression that would result in '1' to literal '1'");
-            lit_ast_destroyexpression(optimizer->state, left ? expression->right : expression->left);
             expression->left = branch;
             expression->right = NULL;
         }
@@ -422,13 +2006,12 @@ static void lit_astopt_optexpression(LitOptimizer* optimizer, LitAstExpression**
         case LITEXPR_UNARY:
         case LITEXPR_BINARY:
             {
-                if(lit_astopt_isoptenabled(LITOPTSTATE_LITERAL_FOLDING))
+                if(lit_astopt_isoptenabled(optimizer->state, LITOPTSTATE_LITERAL_FOLDING))
                 {
                     LitValue optimized = lit_astopt_evalexpr(optimizer, expression);
                     if(optimized != NULL_VALUE)
                     {
                         *slot = (LitAstExpression*)lit_ast_make_literalexpr(state, expression->line, optimized);
-                        lit_ast_destroyexpression(state, expression);
                         break;
                     }
                 }
@@ -464,8 +2047,12 @@ static void lit_astopt_optexpression(LitOptimizer* optimizer, LitAstExpression**
         case LITEXPR_CALL:
             {
                 LitAstCallExpr* expr = (LitAstCallExpr*)expression;
-                lit_astopt_optexpression(optimizer, &expr->callee);
                 lit_astopt_optexprlist(optimizer, &expr->args);
+                if(lit_astopt_tryinline(optimizer, slot))
+                {
+                    break;
+                }
+                lit_astopt_optexpression(optimizer, &expr->callee);
             }
             break;
         case LITEXPR_SET:
@@ -482,9 +2069,13 @@ static void lit_astopt_optexpression(LitOptimizer* optimizer, LitAstExpression**
             break;
         case LITEXPR_LAMBDA:
             {
+                size_t base;
+                LitAstExpression* function = lit_astopt_beginfunction(optimizer, ((LitAstLambdaExpr*)expression)->body, &base);
                 lit_astopt_beginscope(optimizer);
+                lit_astopt_addparams(optimizer, &((LitAstLambdaExpr*)expression)->parameters);
                 lit_asdtopt_optstatement(optimizer, &((LitAstLambdaExpr*)expression)->body);
                 lit_astopt_endscope(optimizer);
+                lit_astopt_endfunction(optimizer, function, base);
             }
             break;
 
@@ -530,16 +2121,13 @@ static void lit_astopt_optexpression(LitOptimizer* optimizer, LitAstExpression**
                 if(lit_value_isfalsey(optimized))
                 {
                     *slot = expr->else_branch;
-                    expr->else_branch = NULL;// So that it doesn't get freed
                 }
                 else
                 {
                     *slot = expr->if_branch;
-                    expr->if_branch = NULL;// So that it doesn't get freed
                 }
 
                 lit_astopt_optexpression(optimizer, slot);
-                lit_ast_destroyexpression(state, expression);
             }
             else
             {
@@ -570,7 +2158,6 @@ static void lit_astopt_optexpression(LitOptimizer* optimizer, LitAstExpression**
                 if(variable->constant && variable->constant_value != NULL_VALUE)
                 {
                     *slot = (LitAstExpression*)lit_ast_make_literalexpr(state, expression->line, variable->constant_value);
-                    lit_ast_destroyexpression(state, expression);
                 }
             }
 
@@ -624,12 +2211,15 @@ static void lit_asdtopt_optstatement(LitOptimizer* optimizer, LitAstExpression**
                 stmt = (LitAstBlockExpr*)statement;
                 if(stmt->statements.count == 0)
                 {
-                    lit_ast_destroyexpression(state, statement);
                     *slot = NULL;
                     break;
                 }
                 lit_astopt_beginscope(optimizer);
                 lit_astopt_optstmtlist(optimizer, &stmt->statements);
+                if(lit_astopt_ismoduleopt(optimizer, LITOPTSTATE_CSE))
+                {
+                    lit_astopt_cseblock(optimizer, &stmt->statements);
+                }
                 lit_astopt_endscope(optimizer);
                 bool found = false;
                 for(size_t i = 0; i < stmt->statements.count; i++)
@@ -646,7 +2236,6 @@ static void lit_asdtopt_optstatement(LitOptimizer* optimizer, LitAstExpression**
                                 step = stmt->statements.values[j];
                                 if(step != NULL)
                                 {
-                                    lit_ast_destroyexpression(state, step);
                                     stmt->statements.values[j] = NULL;
                                 }
                             }
@@ -655,9 +2244,8 @@ static void lit_asdtopt_optstatement(LitOptimizer* optimizer, LitAstExpression**
                         }
                     }
                 }
-                if(!found && lit_astopt_isoptenabled(LITOPTSTATE_EMPTY_BODY))
+                if(!found && lit_astopt_isoptenabled(optimizer->state, LITOPTSTATE_EMPTY_BODY))
                 {
-                    lit_ast_destroyexpression(optimizer->state, statement);
                     *slot = NULL;
                 }
             }
@@ -670,17 +2258,15 @@ static void lit_asdtopt_optstatement(LitOptimizer* optimizer, LitAstExpression**
             lit_astopt_optexpression(optimizer, &stmt->condition);
             lit_asdtopt_optstatement(optimizer, &stmt->if_branch);
 
-            bool empty = lit_astopt_isoptenabled(LITOPTSTATE_EMPTY_BODY);
-            bool dead = lit_astopt_isoptenabled(LITOPTSTATE_UNREACHABLE_CODE);
+            bool empty = lit_astopt_isoptenabled(optimizer->state, LITOPTSTATE_EMPTY_BODY);
+            bool dead = lit_astopt_isoptenabled(optimizer->state, LITOPTSTATE_UNREACHABLE_CODE);
 
             LitValue optimized = empty ? lit_astopt_evalexpr(optimizer, stmt->condition) : NULL_VALUE;
 
             if((optimized != NULL_VALUE && lit_value_isfalsey(optimized)) || (dead && lit_astopt_isemptyexpr(stmt->if_branch)))
             {
-                lit_ast_destroyexpression(state, stmt->condition);
                 stmt->condition = NULL;
 
-                lit_ast_destroyexpression(state, stmt->if_branch);
                 stmt->if_branch = NULL;
             }
 
@@ -695,10 +2281,8 @@ static void lit_asdtopt_optstatement(LitOptimizer* optimizer, LitAstExpression**
                     {
                         if(empty && lit_astopt_isemptyexpr(stmt->elseif_branches->values[i]))
                         {
-                            lit_ast_destroyexpression(state, stmt->elseif_conditions->values[i]);
                             stmt->elseif_conditions->values[i] = NULL;
 
-                            lit_ast_destroyexpression(state, stmt->elseif_branches->values[i]);
                             stmt->elseif_branches->values[i] = NULL;
 
                             continue;
@@ -710,10 +2294,8 @@ static void lit_asdtopt_optstatement(LitOptimizer* optimizer, LitAstExpression**
 
                             if(value != NULL_VALUE && lit_value_isfalsey(value))
                             {
-                                lit_ast_destroyexpression(state, stmt->elseif_conditions->values[i]);
                                 stmt->elseif_conditions->values[i] = NULL;
 
-                                lit_ast_destroyexpression(state, stmt->elseif_branches->values[i]);
                                 stmt->elseif_branches->values[i] = NULL;
                             }
                         }
@@ -730,13 +2312,12 @@ static void lit_asdtopt_optstatement(LitOptimizer* optimizer, LitAstExpression**
             LitAstWhileExpr* stmt = (LitAstWhileExpr*)statement;
             lit_astopt_optexpression(optimizer, &stmt->condition);
 
-            if(lit_astopt_isoptenabled(LITOPTSTATE_UNREACHABLE_CODE))
+            if(lit_astopt_isoptenabled(optimizer->state, LITOPTSTATE_UNREACHABLE_CODE))
             {
                 LitValue optimized = lit_astopt_evalexpr(optimizer, stmt->condition);
 
                 if(optimized != NULL_VALUE && lit_value_isfalsey(optimized))
                 {
-                    lit_ast_destroyexpression(optimizer->state, statement);
                     *slot = NULL;
                     break;
                 }
@@ -744,9 +2325,8 @@ static void lit_asdtopt_optstatement(LitOptimizer* optimizer, LitAstExpression**
 
             lit_asdtopt_optstatement(optimizer, &stmt->body);
 
-            if(lit_astopt_isoptenabled(LITOPTSTATE_EMPTY_BODY) && lit_astopt_isemptyexpr(stmt->body))
+            if(lit_astopt_isoptenabled(optimizer->state, LITOPTSTATE_EMPTY_BODY) && lit_astopt_isemptyexpr(stmt->body))
             {
-                lit_ast_destroyexpression(optimizer->state, statement);
                 *slot = NULL;
             }
 
@@ -766,13 +2346,14 @@ static void lit_asdtopt_optstatement(LitOptimizer* optimizer, LitAstExpression**
                 optimizer->mark_used = false;
                 lit_asdtopt_optstatement(optimizer, &stmt->body);
                 lit_astopt_endscope(optimizer);
-                if(lit_astopt_isoptenabled(LITOPTSTATE_EMPTY_BODY) && lit_astopt_isemptyexpr(stmt->body))
+                if(lit_astopt_isoptenabled(optimizer->state, LITOPTSTATE_EMPTY_BODY) && lit_astopt_isemptyexpr(stmt->body))
                 {
-                    lit_ast_destroyexpression(optimizer->state, statement);
                     *slot = NULL;
                     break;
                 }
-                if(stmt->c_style || !lit_astopt_isoptenabled(LITOPTSTATE_C_FOR) || stmt->condition->type != LITEXPR_RANGE)
+                // a closure in the body could capture the loop variable, which is fresh on every iteration
+                if(stmt->c_style || !lit_astopt_isoptenabled(optimizer->state, LITOPTSTATE_C_FOR) || stmt->condition->type != LITEXPR_RANGE
+                   || lit_astopt_hasclosure(stmt->body))
                 {
                     break;
                 }
@@ -803,16 +2384,19 @@ static void lit_asdtopt_optstatement(LitOptimizer* optimizer, LitAstExpression**
                 range->from = NULL;
                 range->to = NULL;
                 stmt->c_style = true;
-                lit_ast_destroyexpression(state, (LitAstExpression*)range);
             }
             break;
 
         case LITEXPR_VARSTMT:
             {
                 LitAstAssignVarExpr* stmt = (LitAstAssignVarExpr*)statement;
-                LitVariable* variable = lit_astopt_addvar(optimizer, stmt->name, stmt->length, stmt->constant, slot);
+                lit_astopt_addvar(optimizer, stmt->name, stmt->length, stmt->constant, slot);
+                size_t index = optimizer->variables.count - 1;
                 lit_astopt_optexpression(optimizer, &stmt->init);
-                if(stmt->constant && lit_astopt_isoptenabled(LITOPTSTATE_CONSTANT_FOLDING))
+                // the initializer may have declared variables of its own (in a lambda), moving the list
+                LitVariable* variable = &optimizer->variables.values[index];
+                variable->kind = lit_astopt_kindof(optimizer, stmt->init);
+                if(stmt->constant && lit_astopt_isoptenabled(optimizer->state, LITOPTSTATE_CONSTANT_FOLDING))
                 {
                     LitValue value = lit_astopt_evalexpr(optimizer, stmt->init);
 
@@ -827,14 +2411,23 @@ static void lit_asdtopt_optstatement(LitOptimizer* optimizer, LitAstExpression**
             {
                 LitAstFunctionExpr* stmt = (LitAstFunctionExpr*)statement;
                 LitVariable* variable = lit_astopt_addvar(optimizer, stmt->name, stmt->length, false, slot);
+                size_t index = optimizer->variables.count - 1;
                 if(stmt->exported)
                 {
                     // Otherwise it will get optimized-out with a big chance
                     variable->used = true;
                 }
+                size_t base;
+                LitAstExpression* function = lit_astopt_beginfunction(optimizer, stmt->body, &base);
                 lit_astopt_beginscope(optimizer);
+                lit_astopt_addparams(optimizer, &stmt->parameters);
                 lit_asdtopt_optstatement(optimizer, &stmt->body);
                 lit_astopt_endscope(optimizer);
+                lit_astopt_endfunction(optimizer, function, base);
+                if(lit_astopt_ismoduleopt(optimizer, LITOPTSTATE_INLINE))
+                {
+                    optimizer->variables.values[index].inlinable = lit_astopt_caninline(optimizer, stmt);
+                }
             }
             break;
         case LITEXPR_RETURN:
@@ -844,9 +2437,13 @@ static void lit_asdtopt_optstatement(LitOptimizer* optimizer, LitAstExpression**
             break;
         case LITEXPR_METHOD:
             {
+                size_t base;
+                LitAstExpression* function = lit_astopt_beginfunction(optimizer, ((LitAstMethodExpr*)statement)->body, &base);
                 lit_astopt_beginscope(optimizer);
+                lit_astopt_addparams(optimizer, &((LitAstMethodExpr*)statement)->parameters);
                 lit_asdtopt_optstatement(optimizer, &((LitAstMethodExpr*)statement)->body);
                 lit_astopt_endscope(optimizer);
+                lit_astopt_endfunction(optimizer, function, base);
             }
             break;
         case LITEXPR_CLASS:
@@ -856,18 +2453,24 @@ static void lit_asdtopt_optstatement(LitOptimizer* optimizer, LitAstExpression**
             break;
         case LITEXPR_FIELD:
             {
+                size_t base;
+                LitAstExpression* function;
                 LitAstFieldExpr* stmt = (LitAstFieldExpr*)statement;
                 if(stmt->getter != NULL)
                 {
+                    function = lit_astopt_beginfunction(optimizer, stmt->getter, &base);
                     lit_astopt_beginscope(optimizer);
                     lit_asdtopt_optstatement(optimizer, &stmt->getter);
                     lit_astopt_endscope(optimizer);
+                    lit_astopt_endfunction(optimizer, function, base);
                 }
                 if(stmt->setter != NULL)
                 {
+                    function = lit_astopt_beginfunction(optimizer, stmt->setter, &base);
                     lit_astopt_beginscope(optimizer);
                     lit_asdtopt_optstatement(optimizer, &stmt->setter);
                     lit_astopt_endscope(optimizer);
+                    lit_astopt_endfunction(optimizer, function, base);
                 }
             }
             break;
@@ -879,6 +2482,12 @@ static void lit_asdtopt_optstatement(LitOptimizer* optimizer, LitAstExpression**
             break;
 
     }
+    statement = *slot;
+    if(statement != NULL && lit_astopt_ismoduleopt(optimizer, LITOPTSTATE_LICM)
+       && (statement->type == LITEXPR_WHILE || (statement->type == LITEXPR_FOR && ((LitAstForExpr*)statement)->c_style)))
+    {
+        lit_astopt_hoistloop(optimizer, slot);
+    }
 }
 
 static void lit_astopt_optstmtlist(LitOptimizer* optimizer, LitAstExprList* statements)
@@ -890,109 +2499,141 @@ static void lit_astopt_optstmtlist(LitOptimizer* optimizer, LitAstExprList* stat
     }
 }
 
-void lit_astopt_optast(LitOptimizer* optimizer, LitAstExprList* statements)
+/*
+* statements is the whole module, or NULL when it is compiled one statement at a time:
+* LITOPTSTATE_INLINE, LITOPTSTATE_LICM and LITOPTSTATE_CSE are skipped then,
+* since they rely on knowing every assignment in the module.
+*/
+void lit_astopt_beginmodule(LitOptimizer* optimizer, LitAstExprList* statements)
 {
-    return;
-    if(!optimization_states_setup)
+    optimizer->module = statements;
+    optimizer->temps = 0;
+    if(!optimizer->state->config.anyoptimization)
     {
-        lit_astopt_setupstates();
+        return;
     }
-    if(!any_optimization_enabled)
+    if(lit_astopt_ismoduleopt(optimizer, LITOPTSTATE_INLINE) || lit_astopt_ismoduleopt(optimizer, LITOPTSTATE_LICM)
+       || lit_astopt_ismoduleopt(optimizer, LITOPTSTATE_CSE))
     {
-        return;
+        lit_astopt_walklist(statements, lit_astopt_visitassign, optimizer);
     }
     lit_astopt_beginscope(optimizer);
-    lit_astopt_optstmtlist(optimizer, statements);
-    lit_astopt_endscope(optimizer);
-    lit_varlist_destroy(optimizer->state, &optimizer->variables);
 }
 
-static void lit_astopt_setupstates()
+void lit_astopt_optmodstatement(LitOptimizer* optimizer, LitAstExpression** slot)
 {
-    lit_astopt_setoptlevel(LITOPTLEVEL_DEBUG);
+    if(optimizer->state->config.anyoptimization)
+    {
+        lit_asdtopt_optstatement(optimizer, slot);
+    }
 }
 
-bool lit_astopt_isoptenabled(LitOptimization optimization)
+void lit_astopt_endmodule(LitOptimizer* optimizer)
 {
-    if(!optimization_states_setup)
+    if(optimizer->state->config.anyoptimization)
     {
-        lit_astopt_setupstates();
+        lit_astopt_endscope(optimizer);
     }
-    return optimization_states[(int)optimization];
+    lit_varlist_destroy(optimizer->state, &optimizer->variables);
+    lit_varlist_destroy(optimizer->state, &optimizer->assigned);
+    optimizer->module = NULL;
 }
 
-void lit_astopt_setoptenabled(LitOptimization optimization, bool enabled)
+void lit_astopt_optast(LitOptimizer* optimizer, LitAstExprList* statements)
 {
     size_t i;
-    if(!optimization_states_setup)
+    lit_astopt_beginmodule(optimizer, statements);
+    for(i = 0; i < statements->count; i++)
     {
-        lit_astopt_setupstates();
+        lit_astopt_optmodstatement(optimizer, &statements->values[i]);
     }
-    optimization_states[(int)optimization] = enabled;
+    lit_astopt_endmodule(optimizer);
+}
+
+static bool lit_astopt_ismoduleopt(LitOptimizer* optimizer, LitOptimization optimization)
+{
+    return optimizer->module != NULL && lit_astopt_isoptenabled(optimizer->state, optimization);
+}
+
+bool lit_astopt_isoptenabled(LitState* state, LitOptimization optimization)
+{
+    return state->config.optimizations[(int)optimization];
+}
+
+void lit_astopt_setoptenabled(LitState* state, LitOptimization optimization, bool enabled)
+{
+    size_t i;
+    state->config.optimizations[(int)optimization] = enabled;
     if(enabled)
     {
-        any_optimization_enabled = true;
+        state->config.anyoptimization = true;
     }
     else
     {
         for(i = 0; i < LITOPTSTATE_TOTAL; i++)
         {
-            if(optimization_states[i])
+            if(state->config.optimizations[i])
             {
                 return;
             }
         }
-        any_optimization_enabled = false;
+        state->config.anyoptimization = false;
     }
 }
 
-void lit_astopt_setalloptenabled(bool enabled)
+void lit_astopt_setalloptenabled(LitState* state, bool enabled)
 {
     size_t i;
-    optimization_states_setup = true;
-    any_optimization_enabled = enabled;
+    state->config.anyoptimization = enabled;
     for(i = 0; i < LITOPTSTATE_TOTAL; i++)
     {
-        optimization_states[i] = enabled;
+        state->config.optimizations[i] = enabled;
     }
 }
 
-void lit_astopt_setoptlevel(LitOptLevel level)
+void lit_astopt_setoptlevel(LitState* state, LitOptLevel level)
 {
     switch(level)
     {
         case LITOPTLEVEL_NONE:
             {
-                lit_astopt_setalloptenabled(false);
+                lit_astopt_setalloptenabled(state, false);
             }
             break;
         case LITOPTLEVEL_REPL:
             {
-                lit_astopt_setalloptenabled(true);
-                lit_astopt_setoptenabled(LITOPTSTATE_UNUSED_VAR, false);
-                lit_astopt_setoptenabled(LITOPTSTATE_UNREACHABLE_CODE, false);
-                lit_astopt_setoptenabled(LITOPTSTATE_EMPTY_BODY, false);
-                lit_astopt_setoptenabled(LITOPTSTATE_LINE_INFO, false);
-                lit_astopt_setoptenabled(LITOPTSTATE_PRIVATE_NAMES, false);
+                lit_astopt_setalloptenabled(state, true);
+                lit_astopt_setoptenabled(state, LITOPTSTATE_UNUSED_VAR, false);
+                lit_astopt_setoptenabled(state, LITOPTSTATE_UNREACHABLE_CODE, false);
+                lit_astopt_setoptenabled(state, LITOPTSTATE_EMPTY_BODY, false);
+                lit_astopt_setoptenabled(state, LITOPTSTATE_LINE_INFO, false);
+                lit_astopt_setoptenabled(state, LITOPTSTATE_PRIVATE_NAMES, false);
+                lit_astopt_setoptenabled(state, LITOPTSTATE_INLINE, false);
+                lit_astopt_setoptenabled(state, LITOPTSTATE_LICM, false);
+                lit_astopt_setoptenabled(state, LITOPTSTATE_CSE, false);
             }
             break;
         case LITOPTLEVEL_DEBUG:
             {
-                lit_astopt_setalloptenabled(true);
-                lit_astopt_setoptenabled(LITOPTSTATE_UNUSED_VAR, false);
-                lit_astopt_setoptenabled(LITOPTSTATE_LINE_INFO, false);
-                lit_astopt_setoptenabled(LITOPTSTATE_PRIVATE_NAMES, false);
+                lit_astopt_setalloptenabled(state, true);
+                lit_astopt_setoptenabled(state, LITOPTSTATE_UNUSED_VAR, false);
+                lit_astopt_setoptenabled(state, LITOPTSTATE_LINE_INFO, false);
+                lit_astopt_setoptenabled(state, LITOPTSTATE_PRIVATE_NAMES, false);
+                lit_astopt_setoptenabled(state, LITOPTSTATE_LICM, false);
+                lit_astopt_setoptenabled(state, LITOPTSTATE_CSE, false);
             }
             break;
         case LITOPTLEVEL_RELEASE:
             {
-                lit_astopt_setalloptenabled(true);
-                lit_astopt_setoptenabled(LITOPTSTATE_LINE_INFO, false);
+                lit_astopt_setalloptenabled(state, true);
+                lit_astopt_setoptenabled(state, LITOPTSTATE_LINE_INFO, false);
+                lit_astopt_setoptenabled(state, LITOPTSTATE_LICM, false);
+                lit_astopt_setoptenabled(state, LITOPTSTATE_CSE, false);
             }
             break;
         case LITOPTLEVEL_EXTREME:
             {
-                lit_astopt_setalloptenabled(true);
+                lit_astopt_setalloptenabled(state, true);
             }
             break;
         case LITOPTLEVEL_TOTAL:
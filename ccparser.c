@@ -3,7 +3,6 @@
 #include <setjmp.h>
 #include "lit.h"
 
-static jmp_buf prs_jmpbuffer;
 static LitParseRule rules[LITTOK_EOF + 1];
 
 
@@ -15,8 +14,9 @@ static LitTokType operators[]=
 };
 
 
-static bool did_setup_rules;
-static void lit_parser_setuprules();
+/* the rules are the same for every parser, and filled in once */
+static LitOnce did_setup_rules = LIT_ONCE_INIT;
+static void lit_parser_setuprules(void);
 static void lit_parser_sync(LitParser* parser);
 
 static LitAstExpression *lit_parser_parseblock(LitParser *parser);
@@ -33,6 +33,8 @@ static LitAstExpression *lit_parser_parsefield(LitParser *parser, LitString *nam
 static LitAstExpression *lit_parser_parsemethod(LitParser *parser, bool is_static);
 static LitAstExpression *lit_parser_parseclass(LitParser *parser);
 static LitAstExpression *lit_parser_parsestatement(LitParser *parser);
+static LitAstExpression *lit_parser_parseclassrule(LitParser *parser);
+static LitAstExpression *lit_parser_parsestatementrule(LitParser *parser);
 static LitAstExpression *lit_parser_parsedeclaration(LitParser *parser);
 
 static LitAstExpression *lit_parser_rulenumber(LitParser *parser, bool can_assign);
@@ -63,7 +65,7 @@ static LitAstExpression *lit_parser_rulenothing(LitParser *parser, bool canassig
 static LitAstExpression *lit_parser_rulefunction(LitParser *parser, bool canassign);
 
 
-static void lit_parser_setuprules()
+static void lit_parser_setuprules(void)
 {
     rules[LITTOK_LEFT_PAREN] = (LitParseRule){ lit_parser_rulegroupingorlambda, lit_parser_rulecall, LITPREC_CALL };
     rules[LITTOK_PLUS] = (LitParseRule){ NULL, lit_parser_rulebinary, LITPREC_TERM };
@@ -255,11 +257,7 @@ static inline bool prs_is_at_end(LitParser* parser)
 
 void lit_parser_init(LitState* state, LitParser* parser)
 {
-    if(!did_setup_rules)
-    {
-        did_setup_rules = true;
-        lit_parser_setuprules();
-    }
+    lit_once(&did_setup_rules, lit_parser_setuprules);
     parser->state = state;
     parser->had_error = false;
     parser->panic_mode = false;
@@ -941,7 +939,8 @@ static LitAstExpression* lit_parser_ruleobject(LitParser* parser, bool can_assig
     {
         lit_parser_ignorenewlines(parser, true);
         lit_parser_consume(parser, LITTOK_IDENTIFIER, "key string after '{'");
-        lit_vallist_push(parser->state, &object->keys, lit_value_objectvalue(lit_string_copy(parser->state, parser->previous.start, parser->previous.length)));
+        lit_exprlist_push(parser->state, &object->keys, (LitAstExpression*)lit_ast_make_literalexpr(parser->state, parser->previous.line,
+                          lit_value_objectvalue(lit_string_copy(parser->state, parser->previous.start, parser->previous.length))));
         lit_parser_ignorenewlines(parser, true);
         lit_parser_consume(parser, LITTOK_EQUAL, "'=' after key string");
         lit_parser_ignorenewlines(parser, true);
@@ -1191,14 +1190,30 @@ static LitAstExpression* lit_parser_rulereference(LitParser* parser, bool can_as
 
 
 
-static LitAstExpression* lit_parser_parsestatement(LitParser* parser)
+/*
+* runs fn, resuming here with NULL when it hits an error. the caller's recovery point
+* is put back afterwards: statements nest, and jumping to the one of a nested statement
+* that already returned would land in a dead stack frame.
+*/
+static LitAstExpression* lit_parser_parserecoverable(LitParser* parser, LitAstExpression* (*fn)(LitParser*))
 {
+    jmp_buf outer;
     LitAstExpression* expression;
-    lit_parser_ignorenewlines(parser, true);
-    if(setjmp(prs_jmpbuffer))
+    memcpy(outer, parser->jmpbuffer, sizeof(jmp_buf));
+    if(setjmp(parser->jmpbuffer))
     {
+        memcpy(parser->jmpbuffer, outer, sizeof(jmp_buf));
         return NULL;
     }
+    expression = fn(parser);
+    memcpy(parser->jmpbuffer, outer, sizeof(jmp_buf));
+    return expression;
+}
+
+static LitAstExpression* lit_parser_parsestatementrule(LitParser* parser)
+{
+    LitAstExpression* expression;
+    lit_parser_ignorenewlines(parser, true);
     if(lit_parser_match(parser, LITTOK_VAR) || lit_parser_match(parser, LITTOK_CONST))
     {
         return lit_parser_parsevar_declaration(parser, true);
@@ -1595,7 +1610,7 @@ static LitAstExpression* lit_parser_parsemethod(LitParser* parser, bool is_stati
     return (LitAstExpression*)method;
 }
 
-static LitAstExpression* lit_parser_parseclass(LitParser* parser)
+static LitAstExpression* lit_parser_parseclassrule(LitParser* parser)
 {
     bool finished_parsing_fields;
     bool field_is_static;
@@ -1606,10 +1621,6 @@ static LitAstExpression* lit_parser_parseclass(LitParser* parser)
     LitAstClassExpr* klass;
     LitAstExpression* var;
     LitAstExpression* method;
-    if(setjmp(prs_jmpbuffer))
-    {
-        return NULL;
-    }
     line = parser->previous.line;
     is_static = parser->previous.type == LITTOK_STATIC;
     if(is_static)
@@ -1669,6 +1680,16 @@ static LitAstExpression* lit_parser_parseclass(LitParser* parser)
     return (LitAstExpression*)klass;
 }
 
+static LitAstExpression* lit_parser_parsestatement(LitParser* parser)
+{
+    return lit_parser_parserecoverable(parser, lit_parser_parsestatementrule);
+}
+
+static LitAstExpression* lit_parser_parseclass(LitParser* parser)
+{
+    return lit_parser_parserecoverable(parser, lit_parser_parseclassrule);
+}
+
 static void lit_parser_sync(LitParser* parser)
 {
     parser->panic_mode = false;
@@ -1676,7 +1697,7 @@ static void lit_parser_sync(LitParser* parser)
     {
         if(parser->previous.type == LITTOK_NEW_LINE)
         {
-            longjmp(prs_jmpbuffer, 1);
+            longjmp(parser->jmpbuffer, 1);
             return;
         }
         switch(parser->current.type)
@@ -1692,7 +1713,7 @@ static void lit_parser_sync(LitParser* parser)
             case LITTOK_WHILE:
             case LITTOK_RETURN:
             {
-                longjmp(prs_jmpbuffer, 1);
+                longjmp(parser->jmpbuffer, 1);
                 return;
             }
             default:
@@ -1718,33 +1739,156 @@ static LitAstExpression* lit_parser_parsedeclaration(LitParser* parser)
     return statement;
 }
 
-bool lit_parser_parsesource(LitParser* parser, const char* file_name, const char* source, LitAstExprList* statements)
+void lit_parser_begin(LitParser* parser, LitCompiler* compiler, const char* file_name, const char* source)
 {
-    LitCompiler compiler;
-    LitAstExpression* statement;
     parser->had_error = false;
     parser->panic_mode = false;
     lit_lex_init(parser->state, parser->state->scanner, file_name, source);
-    lit_parser_initcompiler(parser, &compiler);
+    lit_parser_initcompiler(parser, compiler);
+    // an error in the very first tokens resumes here, there is no statement to give up on yet
+    if(setjmp(parser->jmpbuffer))
+    {
+        return;
+    }
     lit_parser_advance(parser);
     lit_parser_ignorenewlines(parser, true);
-    if(!prs_is_at_end(parser))
+}
+
+/*
+* parses the next top-level statement, and sets done once the source is used up.
+* the statement is NULL if nothing could be parsed.
+*/
+LitAstExpression* lit_parser_parsenext(LitParser* parser, bool* done)
+{
+    LitAstExpression* statement;
+    if(prs_is_at_end(parser))
+    {
+        *done = true;
+        return NULL;
+    }
+    statement = lit_parser_parsedeclaration(parser);
+    // the recovery point set while parsing the statement is gone now that it returned
+    if(setjmp(parser->jmpbuffer))
+    {
+        *done = prs_is_at_end(parser);
+        return statement;
+    }
+    if(!lit_parser_matchnewline(parser))
     {
-        do
+        if(lit_parser_match(parser, LITTOK_EOF))
         {
-            statement = lit_parser_parsedeclaration(parser);
-            if(statement != NULL)
-            {
-                lit_exprlist_push(parser->state, statements, statement);
-            }
-            if(!lit_parser_matchnewline(parser))
-            {
-                if(lit_parser_match(parser, LITTOK_EOF))
+            *done = true;
+            return statement;
+        }
+    }
+    *done = prs_is_at_end(parser);
+    return statement;
+}
+
+bool lit_parser_haderror(LitParser* parser)
+{
+    return parser->had_error || parser->state->scanner->had_error;
+}
+
+bool lit_parser_parsesource(LitParser* parser, const char* file_name, const char* source, LitAstExprList* statements)
+{
+    bool done;
+    LitCompiler compiler;
+    LitAstExpression* statement;
+    lit_parser_begin(parser, &compiler, file_name, source);
+    do
+    {
+        statement = lit_parser_parsenext(parser, &done);
+        if(statement != NULL)
+        {
+            lit_exprlist_push(parser->state, statements, statement);
+        }
+    } while(!done);
+    return lit_parser_haderror(parser);
+}
+
+/*
+* a token-only pass that reports the private names the top-level statements
+* will declare (what the emitter resolves up front for a whole module), so a
+* module compiled one statement at a time can still refer to names declared
+* further down. runs on a copy of the definitions, since #define and #undef
+* are applied again by the real pass.
+*/
+void lit_parser_prescan(LitParser* parser, const char* file_name, const char* source, LitDeclareFn declare, void* data)
+{
+    int depth;
+    bool start;
+    bool constant;
+    LitToken token;
+    LitToken name;
+    LitScanner scanner;
+    LitPreprocessor preprocessor;
+    lit_preproc_init(parser->state, &preprocessor);
+    lit_table_add_all(parser->state, &parser->state->preprocessor->defined, &preprocessor.defined);
+    lit_lex_init(parser->state, &scanner, file_name, source);
+    scanner.preprocessor = &preprocessor;
+    depth = 0;
+    start = true;
+    token = lit_lex_scantoken(&scanner);
+    while(token.type != LITTOK_EOF)
+    {
+        switch(token.type)
+        {
+            case LITTOK_NEW_LINE:
+            case LITTOK_SEMICOLON:
                 {
-                    break;
+                    start = depth == 0;
                 }
-            }
-        } while(!prs_is_at_end(parser));
+                break;
+            case LITTOK_LEFT_PAREN:
+            case LITTOK_LEFT_BRACE:
+            case LITTOK_LEFT_BRACKET:
+                {
+                    depth++;
+                    start = false;
+                }
+                break;
+            case LITTOK_RIGHT_PAREN:
+            case LITTOK_RIGHT_BRACE:
+            case LITTOK_RIGHT_BRACKET:
+                {
+                    depth--;
+                    start = depth == 0 && token.type == LITTOK_RIGHT_BRACE;
+                }
+                break;
+            case LITTOK_VAR:
+            case LITTOK_CONST:
+            case LITTOK_FUNCTION:
+                {
+                    if(!start || depth != 0)
+                    {
+                        start = false;
+                        break;
+                    }
+                    start = false;
+                    constant = token.type == LITTOK_CONST;
+                    name = lit_lex_scantoken(&scanner);
+                    if(name.type != LITTOK_IDENTIFIER)
+                    {
+                        token = name;
+                        continue;
+                    }
+                    token = lit_lex_scantoken(&scanner);
+                    // function a.b() assigns to a field instead
+                    if(token.type != LITTOK_DOT)
+                    {
+                        declare(data, name.start, name.length, name.line, constant);
+                    }
+                    continue;
+                }
+                break;
+            default:
+                {
+                    start = false;
+                }
+                break;
+        }
+        token = lit_lex_scantoken(&scanner);
     }
-    return parser->had_error || parser->state->scanner->had_error;
+    lit_preproc_destroy(&preprocessor);
 }
@@ -2,18 +2,23 @@
 #include <stdio.h>
 #include "lit.h"
 
+/*
+* the preprocessor no longer rewrites the source: the scanner hands it every
+* directive line ('#' at the start of a line) and skips the lines it turns off,
+* so the source can stay read-only (and mmap'ed).
+*/
+
 void lit_preproc_init(LitState* state, LitPreprocessor* preprocessor)
 {
     preprocessor->state = state;
-
     lit_table_init(state, &preprocessor->defined);
-    lit_vallist_init(&preprocessor->open_ifs);
+    preprocessor->depth = 0;
+    preprocessor->skip_depth = 0;
 }
 
 void lit_preproc_destroy(LitPreprocessor* preprocessor)
 {
     lit_table_destroy(preprocessor->state, &preprocessor->defined);
-    lit_vallist_destroy(preprocessor->state, &preprocessor->open_ifs);
 }
 
 void lit_preproc_setdef(LitState* state, const char* name)
@@ -21,197 +26,95 @@ void lit_preproc_setdef(LitState* state, const char* name)
     lit_table_set(state, &state->preprocessor->defined, CONST_STRING(state, name), TRUE_VALUE);
 }
 
-void lit_preproc_override(char* source, int length)
+/* called for every new source; definitions are kept, open blocks are not */
+void lit_preproc_begin(LitPreprocessor* preprocessor)
 {
-    while(length-- > 0)
-    {
-        if(*source != '\n')
-        {
-            *source = ' ';
-        }
-        source++;
-    }
+    preprocessor->depth = 0;
+    preprocessor->skip_depth = 0;
 }
 
-bool lit_preproc_run(LitPreprocessor* preprocessor, char* source)
+bool lit_preproc_isactive(LitPreprocessor* preprocessor)
 {
-    bool close;
-    bool in_macro;
-    bool in_arg;
-    bool on_new_line;
-    int ignore_depth;
-    int depth;
-    char c;
-    char* branch_start;
-    char* macro_start;
-    char* arg_start;
-    char* current;
-    LitState* state;
-    LitValue tmp;
-    LitString* arg;
+    return preprocessor->skip_depth == 0;
+}
+
+bool lit_preproc_isclosed(LitPreprocessor* preprocessor)
+{
+    return preprocessor->depth == 0;
+}
+
+static bool lit_preproc_isnamed(const char* name, size_t length, const char* directive)
+{
+    return strlen(directive) == length && memcmp(name, directive, length) == 0;
+}
 
+/*
+* applies one directive. returns false and sets error if it is unknown, or
+* closes a block that was never opened.
+*/
+bool lit_preproc_directive(LitPreprocessor* preprocessor, const char* name, size_t length, const char* arg, size_t arglength, LitError* error)
+{
+    bool negate;
+    bool defined;
+    LitValue tmp;
+    LitString* argstr;
+    LitState* state;
     state = preprocessor->state;
-    macro_start = source;
-    arg_start = source;
-    current = source;
-    in_macro = false;
-    in_arg = false;
-    on_new_line = true;
-    ignore_depth = -1;
-    depth = 0;
-    do
+    if(lit_preproc_isnamed(name, length, "define") || lit_preproc_isnamed(name, length, "undef"))
     {
-        c = current[0];
-        current++;
-        // Single line comment
-        if(c == '/' && current[0] == '/')
+        if(lit_preproc_isactive(preprocessor))
         {
-            current++;
-            do
+            argstr = lit_string_copy(state, arg, arglength);
+            if(name[0] == 'u')
             {
-                c = current[0];
-                current++;
-            } while(c != '\n' && c != '\0');
-            in_macro = false;
-            on_new_line = true;
-            continue;
-        }
-        else if(c == '/' && current[0] == '*')
-        {
-            // Multiline comment
-            current++;
-            do
+                lit_table_delete(&preprocessor->defined, argstr);
+            }
+            else
             {
-                c = current[0];
-                current++;
-            } while(c != '*' && c != '\0' && current[0] != '/');
-            in_macro = false;
-            on_new_line = true;
-            continue;
+                lit_table_set(state, &preprocessor->defined, argstr, TRUE_VALUE);
+            }
         }
-        if(in_macro)
+        return true;
+    }
+    if(lit_preproc_isnamed(name, length, "ifdef") || lit_preproc_isnamed(name, length, "ifndef"))
+    {
+        preprocessor->depth++;
+        if(lit_preproc_isactive(preprocessor))
         {
-            if(!lit_is_alpha(c) && !(((current - macro_start) > 1) && lit_is_digit(c)))
+            negate = name[2] == 'n';
+            defined = lit_table_get(&preprocessor->defined, lit_string_copy(state, arg, arglength), &tmp);
+            if(defined == negate)
             {
-                if(in_arg)
-                {
-                    arg = lit_string_copy(state, arg_start, (int)(current - arg_start) - 1);
-                    if(memcmp(macro_start, "define", 6) == 0 || memcmp(macro_start, "undef", 5) == 0)
-                    {
-                        if(ignore_depth < 0)
-                        {
-                            close = macro_start[0] == 'u';
-                            if(close)
-                            {
-                                lit_table_delete(&preprocessor->defined, arg);
-                            }
-                            else
-                            {
-                                lit_table_set(state, &preprocessor->defined, arg, TRUE_VALUE);
-                            }
-                        }
-                    }
-                    else
-                    {// ifdef || ifndef
-                        depth++;
-                        if(ignore_depth < 0)
-                        {
-                            close = macro_start[2] == 'n';
-                            if((lit_table_get(&preprocessor->defined, arg, &tmp) ^ close) == false)
-                            {
-                                ignore_depth = depth;
-                            }
-
-                            lit_vallist_push(preprocessor->state, &preprocessor->open_ifs, (LitValue)macro_start);
-                        }
-                    }
-                    // Remove the macro from code
-                    lit_preproc_override(macro_start - 1, (int)(current - macro_start));
-                    in_macro = false;
-                    in_arg = false;
-                }
-                else
-                {
-                    if(memcmp(macro_start, "define", 6) == 0 || memcmp(macro_start, "undef", 5) == 0
-                       || memcmp(macro_start, "ifdef", 5) == 0 || memcmp(macro_start, "ifndef", 6) == 0)
-                    {
-                        arg_start = current;
-                        in_arg = true;
-                    }
-                    else if(memcmp(macro_start, "else", 4) == 0 || memcmp(macro_start, "endif", 5) == 0)
-                    {
-                        in_macro = false;
-                        // If this is endif
-                        if(macro_start[1] == 'n')
-                        {
-                            depth--;
-                            if(ignore_depth > -1)
-                            {
-                                // Remove the whole if branch from code
-                                branch_start = (char*)lit_vallist_get(&preprocessor->open_ifs, lit_vallist_count(&preprocessor->open_ifs) - 1);
-                                lit_preproc_override(branch_start - 1, (int)(current - branch_start));
-                                if(ignore_depth == depth + 1)
-                                {
-                                    ignore_depth = -1;
-                                    lit_vallist_deccount(&preprocessor->open_ifs);
-                                }
-                            }
-                            else
-                            {
-                                lit_vallist_deccount(&preprocessor->open_ifs);
-                                // Remove #endif
-                                lit_preproc_override(macro_start - 1, (int)(current - macro_start));
-                            }
-                        }
-                        else if(ignore_depth < 0 || depth <= ignore_depth)
-                        {
-                            // #else
-                            if(ignore_depth == depth)
-                            {
-                                // Remove the macro from code
-                                branch_start = (char*)lit_vallist_get(&preprocessor->open_ifs, lit_vallist_count(&preprocessor->open_ifs) - 1);
-                                lit_preproc_override(branch_start - 1, (int)(current - branch_start));
-                                ignore_depth = -1;
-                            }
-                            else
-                            {
-                                lit_vallist_set(&preprocessor->open_ifs, lit_vallist_count(&preprocessor->open_ifs) - 1, (LitValue)macro_start);
-                                ignore_depth = depth;
-                            }
-                        }
-                    }
-                    else
-                    {
-                        lit_state_raiseerror(preprocessor->state, (LitErrType)0,
-                                  lit_format_error(preprocessor->state, 0, LITERROR_UNKNOWN_MACRO, (int)(current - macro_start) - 1, macro_start)
-                                  ->chars);
-                        return false;
-                    }
-                }
+                preprocessor->skip_depth = preprocessor->depth;
             }
         }
-        else
+        return true;
+    }
+    if(lit_preproc_isnamed(name, length, "else") || lit_preproc_isnamed(name, length, "endif"))
+    {
+        if(preprocessor->depth == 0)
         {
-            macro_start = current;
-            if(c == '\n')
-            {
-                on_new_line = true;
-            }
-            else if(!(c == '\t' || c == ' ' || c == '#'))
-            {
-                on_new_line = false;
-            }
-            else
+            *error = LITERROR_UNCLOSED_MACRO;
+            return false;
+        }
+        if(name[1] == 'n')
+        {
+            if(preprocessor->skip_depth == preprocessor->depth)
             {
-                in_macro = on_new_line && c == '#';
+                preprocessor->skip_depth = 0;
             }
+            preprocessor->depth--;
         }
-    } while(c != '\0');
-    if(in_macro || lit_vallist_count(&preprocessor->open_ifs) > 0 || depth > 0)
-    {
-        lit_state_raiseerror(preprocessor->state, (LitErrType)0, lit_format_error(preprocessor->state, 0, LITERROR_UNCLOSED_MACRO)->chars);
-        return false;
+        else if(preprocessor->skip_depth == preprocessor->depth)
+        {
+            preprocessor->skip_depth = 0;
+        }
+        else if(lit_preproc_isactive(preprocessor))
+        {
+            preprocessor->skip_depth = preprocessor->depth;
+        }
+        return true;
     }
-    lit_vallist_destroy(preprocessor->state, &preprocessor->open_ifs);
-    return true;
+    *error = LITERROR_UNKNOWN_MACRO;
+    return false;
 }
@@ -40,6 +40,9 @@ void lit_lex_init(LitState* state, LitScanner* scanner, const char* file_name, c
     scanner->state = state;
     scanner->num_braces = 0;
     scanner->had_error = false;
+    scanner->at_line_start = true;
+    scanner->preprocessor = state->preprocessor;
+    lit_preproc_begin(scanner->preprocessor);
 }
 
 static LitToken lit_lex_maketoken(LitScanner* scanner, LitTokType type)
@@ -575,6 +578,73 @@ static LitToken lit_lex_scanidentifier(LitScanner* scanner)
     return lit_lex_maketoken(scanner, lit_lex_scanidenttype(scanner));
 }
 
+static void lit_lex_skipblanks(LitScanner* scanner)
+{
+    while(lit_lex_peekcurrent(scanner) == ' ' || lit_lex_peekcurrent(scanner) == '\t')
+    {
+        lit_lex_advance(scanner);
+    }
+}
+
+/*
+* handles the directive at the current '#', then every directive met while
+* the lines that follow are switched off. stops at the end of the last
+* directive line, or at the end of the source.
+*/
+static bool lit_lex_scandirective(LitScanner* scanner, LitToken* error)
+{
+    size_t length;
+    size_t arglength;
+    const char* name;
+    const char* arg;
+    LitError code;
+    while(true)
+    {
+        lit_lex_advance(scanner);
+        name = scanner->current;
+        while(lit_is_alpha(lit_lex_peekcurrent(scanner)) || lit_is_digit(lit_lex_peekcurrent(scanner)))
+        {
+            lit_lex_advance(scanner);
+        }
+        length = (size_t)(scanner->current - name);
+        lit_lex_skipblanks(scanner);
+        arg = scanner->current;
+        while(lit_is_alpha(lit_lex_peekcurrent(scanner)) || lit_is_digit(lit_lex_peekcurrent(scanner)))
+        {
+            lit_lex_advance(scanner);
+        }
+        arglength = (size_t)(scanner->current - arg);
+        if(!lit_preproc_directive(scanner->preprocessor, name, length, arg, arglength, &code))
+        {
+            *error = lit_lex_makeerrortoken(scanner, code, (int)length, name);
+            return false;
+        }
+        if(lit_preproc_isactive(scanner->preprocessor))
+        {
+            return true;
+        }
+        // skip whole lines until the next directive
+        while(true)
+        {
+            while(lit_lex_peekcurrent(scanner) != '\n' && !lit_lex_isatend(scanner))
+            {
+                lit_lex_advance(scanner);
+            }
+            if(lit_lex_isatend(scanner))
+            {
+                return true;
+            }
+            lit_lex_advance(scanner);
+            scanner->line++;
+            lit_lex_skipblanks(scanner);
+            if(lit_lex_peekcurrent(scanner) == '#' && lit_is_alpha(lit_lex_peeknext(scanner)))
+            {
+                break;
+            }
+        }
+    }
+}
+
 LitToken lit_lex_rollback(LitScanner* scanner)
 {
     //scanner->current--;
@@ -586,14 +656,31 @@ LitToken lit_lex_scantoken(LitScanner* scanner)
     {
         LitToken token = lit_lex_maketoken(scanner, LITTOK_NEW_LINE);
         scanner->line++;
+        scanner->at_line_start = true;
 
         return token;
     }
 
     scanner->start = scanner->current;
 
+    if(scanner->at_line_start && lit_lex_peekcurrent(scanner) == '#' && lit_is_alpha(lit_lex_peeknext(scanner)))
+    {
+        LitToken error;
+        if(!lit_lex_scandirective(scanner, &error))
+        {
+            return error;
+        }
+        return lit_lex_scantoken(scanner);
+    }
+    scanner->at_line_start = false;
+
     if(lit_lex_isatend(scanner))
     {
+        if(!lit_preproc_isclosed(scanner->preprocessor))
+        {
+            lit_preproc_begin(scanner->preprocessor);
+            return lit_lex_makeerrortoken(scanner, LITERROR_UNCLOSED_MACRO);
+        }
         return lit_lex_maketoken(scanner, LITTOK_EOF);
     }
 
@@ -13,14 +13,21 @@ void lit_chunk_init(LitChunk* chunk)
     chunk->lines = NULL;
 
     lit_vallist_init(&chunk->constants);
+    chunk->mapped = false;
+    chunk->constindex = NULL;
+    chunk->constindex_capacity = 0;
 }
 
 void lit_chunk_destroy(LitState* state, LitChunk* chunk)
 {
-    LIT_FREE_ARRAY(state, sizeof(uint8_t), chunk->code, chunk->capacity);
-    LIT_FREE_ARRAY(state, sizeof(uint16_t), chunk->lines, chunk->line_capacity);
+    if(!chunk->mapped)
+    {
+        LIT_FREE_ARRAY(state, sizeof(uint8_t), chunk->code, chunk->capacity);
+        LIT_FREE_ARRAY(state, sizeof(uint16_t), chunk->lines, chunk->line_capacity);
+    }
 
     lit_vallist_destroy(state, &chunk->constants);
+    lit_chunk_dropconstindex(state, chunk);
     lit_chunk_init(chunk);
 }
 
@@ -71,16 +78,80 @@ void lit_chunk_push(LitState* state, LitChunk* chunk, uint8_t byte, uint16_t lin
     chunk->lines[line_index + 1]++;
 }
 
+/* below this many constants a linear scan is cheaper than keeping an index */
+#define LIT_CHUNK_CONSTINDEX_MIN 32
+
+static size_t lit_chunk_constslot(LitChunk* chunk, LitValue constant)
+{
+    size_t mask;
+    size_t slot;
+    uint32_t entry;
+    mask = chunk->constindex_capacity - 1;
+    slot = (size_t)((constant * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+    while(true)
+    {
+        entry = chunk->constindex[slot];
+        if(entry == 0 || lit_vallist_get(&chunk->constants, entry - 1) == constant)
+        {
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+static void lit_chunk_growconstindex(LitState* state, LitChunk* chunk)
+{
+    size_t i;
+    size_t capacity;
+    capacity = chunk->constindex_capacity == 0 ? LIT_CHUNK_CONSTINDEX_MIN * 4 : chunk->constindex_capacity * 2;
+    LIT_FREE_ARRAY(state, sizeof(uint32_t), chunk->constindex, chunk->constindex_capacity);
+    chunk->constindex = LIT_ALLOCATE(state, sizeof(uint32_t), capacity);
+    chunk->constindex_capacity = capacity;
+    memset(chunk->constindex, 0, capacity * sizeof(uint32_t));
+    for(i = 0; i < lit_vallist_count(&chunk->constants); i++)
+    {
+        chunk->constindex[lit_chunk_constslot(chunk, lit_vallist_get(&chunk->constants, i))] = i + 1;
+    }
+}
+
+/* the index is only needed while the chunk is compiled */
+void lit_chunk_dropconstindex(LitState* state, LitChunk* chunk)
+{
+    LIT_FREE_ARRAY(state, sizeof(uint32_t), chunk->constindex, chunk->constindex_capacity);
+    chunk->constindex = NULL;
+    chunk->constindex_capacity = 0;
+}
+
 size_t lit_chunk_addconst(LitState* state, LitChunk* chunk, LitValue constant)
 {
+    size_t i;
+    size_t slot;
+    size_t count;
     LitState** cst;
     cst = &state;
-    for(size_t i = 0; i < lit_vallist_count(&chunk->constants); i++)
+    count = lit_vallist_count(&chunk->constants);
+    if(chunk->constindex == NULL && count < LIT_CHUNK_CONSTINDEX_MIN)
     {
-        if(lit_vallist_get(&chunk->constants, i) == constant)
+        for(i = 0; i < count; i++)
+        {
+            if(lit_vallist_get(&chunk->constants, i) == constant)
+            {
+                return i;
+            }
+        }
+    }
+    else
+    {
+        if((count + 1) * 2 > chunk->constindex_capacity)
+        {
+            lit_chunk_growconstindex(state, chunk);
+        }
+        slot = lit_chunk_constslot(chunk, constant);
+        if(chunk->constindex[slot] != 0)
         {
-            return i;
+            return chunk->constindex[slot] - 1;
         }
+        chunk->constindex[slot] = count + 1;
     }
 
     lit_state_pushvalueroot(state, constant);
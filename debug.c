@@ -4,6 +4,10 @@
 
 void lit_disassemble_module(LitState* state, LitModule* module, const char* source)
 {
+    if(module->main_function->image != NULL)
+    {
+        lit_ioutil_loadconstants(state, module->main_function);
+    }
     lit_disassemble_chunk(state, &module->main_function->chunk, module->main_function->name->chars, source);
 }
 
@@ -22,6 +26,10 @@ void lit_disassemble_chunk(LitState* state, LitChunk* chunk, const char* name, c
         if(lit_value_isfunction(value))
         {
             function = lit_value_asfunction(value);
+            if(function->image != NULL)
+            {
+                lit_ioutil_loadconstants(state, function);
+            }
             lit_disassemble_chunk(state, &function->chunk, function->name->chars, source);
         }
     }
@@ -32,6 +40,21 @@ void lit_disassemble_chunk(LitState* state, LitChunk* chunk, const char* name, c
     }
 }
 
+const char* lit_debug_opcodename(int op)
+{
+    static const char* names[] =
+    {
+        #define OPCODE(name, effect) "OP_" #name,
+        #include "opcodes.inc"
+        #undef OPCODE
+    };
+    if(op < 0 || op >= OP_TOTAL)
+    {
+        return "OP_UNKNOWN";
+    }
+    return names[op];
+}
+
 static size_t print_simple_op(LitState* state, LitWriter* wr, const char* name, size_t offset)
 {
     (void)state;
@@ -265,7 +288,7 @@ size_t lit_disassemble_instruction(LitState* state, LitChunk* chunk, size_t offs
                 {
                     is_local = chunk->code[offset++];
                     index = chunk->code[offset++];
-                    lit_writer_writeformat(wr, "%04d      |                     %s %d\n", (int)(offset - 2), is_local ? "local" : "upvalue", (int)index);
+                    lit_writer_writeformat(wr, "%04d      |                     %s %d\n", (int)(offset - 2), (is_local & LIT_CAPTURE_BYVALUE) ? "value" : (is_local ? "local" : "upvalue"), (int)index);
                 }
                 return offset;
             }
@@ -328,6 +351,10 @@ size_t lit_disassemble_instruction(LitState* state, LitChunk* chunk, size_t offs
             return print_constant_op(state, wr, "OP_REFERENCE_GLOBAL", chunk, offset, true);
         case OP_SET_REFERENCE:
             return print_simple_op(state, wr, "OP_SET_REFERENCE", offset);
+        case OP_TAIL_CALL:
+            return print_byte_op(state, wr, "OP_TAIL_CALL", chunk, offset);
+        case OP_TAIL_INVOKE:
+            return print_invoke_op(state, wr, "OP_TAIL_INVOKE", chunk, offset);
         default:
             {
                 lit_writer_writeformat(wr, "Unknown opcode %d\n", instruction);
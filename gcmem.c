@@ -4,35 +4,28 @@
 #include <time.h>
 #include "lit.h"
 
-#if 1
-    LitObject g_stackmem[1024 * (1024 * 4)];
-    size_t g_objcount = 0;
-#endif
-
 LitObject* lit_gcmem_allocobject(LitState* state, size_t size, LitObjType type, bool islight)
 {
     LitObject* obj;
-    //islight = false;
-    if(islight)
-    {
-        #if 0
-            LitObject stkobj; 
-            lit_vallist_push(state, &state->lightobjects, (obj = &stkobj));
-        #else
-            obj = &g_stackmem[g_objcount];
-            g_objcount++;
-        #endif
-        obj->mustfree = false;
-    }
-    else
-    {
-        obj = (LitObject*)lit_gcmem_memrealloc(state, NULL, 0, size);
-        obj->mustfree = true;
-    }
+    /*
+    * light objects (only made by the USE_NUMBEROBJECT experiment) are allocated and
+    * collected like any other: a process-wide arena for them would tie states together.
+    */
+    (void)islight;
+    obj = (LitObject*)lit_gcmem_memrealloc(state, NULL, 0, size);
+    obj->mustfree = true;
     obj->type = type;
     obj->marked = false;
     obj->next = state->vm->objects;
     state->vm->objects = obj;
+    if(state->allocprofiler != NULL && state->allocprofiler->running)
+    {
+        state->allocprofiler->countdown -= (int64_t)size;
+        if(state->allocprofiler->countdown <= 0)
+        {
+            lit_allocprof_sample(state, obj, size, type);
+        }
+    }
     #ifdef LIT_LOG_ALLOCATION
         printf("%p allocate %ld for %s\n", (void*)obj, size, lit_tostring_typename(type));
     #endif
@@ -82,7 +75,16 @@ void lit_gcmem_marktable(LitVM* vm, LitTable* table)
 
 void lit_gcmem_markobject(LitVM* vm, LitObject* object)
 {
-    if(object == NULL || object->marked)
+    if(object == NULL)
+    {
+        return;
+    }
+    if(vm->heapedges != NULL)
+    {
+        lit_heapsnap_addedge(vm->heapedges, object);
+        return;
+    }
+    if(object->marked)
     {
         return;
     }
@@ -133,6 +135,10 @@ void lit_gcmem_vmmarkroots(LitVM* vm)
     lit_gcmem_markobject(vm, (LitObject*)state->arrayvalue_class);
     lit_gcmem_markobject(vm, (LitObject*)state->mapvalue_class);
     lit_gcmem_markobject(vm, (LitObject*)state->rangevalue_class);
+    lit_gcmem_markobject(vm, (LitObject*)state->float64arrayvalue_class);
+    lit_gcmem_markobject(vm, (LitObject*)state->int32arrayvalue_class);
+    lit_gcmem_markobject(vm, (LitObject*)state->uint8arrayvalue_class);
+    lit_gcmem_markobject(vm, (LitObject*)state->buffervalue_class);
     lit_gcmem_markobject(vm, (LitObject*)state->api_name);
     lit_gcmem_markobject(vm, (LitObject*)state->api_function);
     lit_gcmem_markobject(vm, (LitObject*)state->api_fiber);
@@ -156,7 +162,6 @@ void lit_gcmem_vmblackobject(LitVM* vm, LitObject* object)
     LitUserdata* data;
     LitFunction* function;
     LitFiber* fiber;
-    LitUpvalue* upvalue;
     LitCallFrame* frame;
     LitModule* module;
     LitClosure* closure;
@@ -176,6 +181,8 @@ void lit_gcmem_vmblackobject(LitVM* vm, LitObject* object)
         case LITTYPE_NATIVE_METHOD:
         case LITTYPE_PRIMITIVE_METHOD:
         case LITTYPE_RANGE:
+        case LITTYPE_TYPEDARRAY:
+        case LITTYPE_BUFFER:
         case LITTYPE_STRING:
         case LITTYPE_NUMBER:
             {
@@ -216,11 +223,12 @@ void lit_gcmem_vmblackobject(LitVM* vm, LitObject* object)
                         lit_gcmem_markobject(vm, (LitObject*)frame->function);
                     }
                 }
-                for(upvalue = fiber->open_upvalues; upvalue != NULL; upvalue = upvalue->next)
+                for(i = 0; i < fiber->open_upvalue_top; i++)
                 {
-                    lit_gcmem_markobject(vm, (LitObject*)upvalue);
+                    lit_gcmem_markobject(vm, (LitObject*)fiber->open_upvalues[i]);
                 }
                 lit_gcmem_markvalue(vm, fiber->lit_emitter_raiseerror);
+                lit_gcmem_markvalue(vm, fiber->waiting);
                 lit_gcmem_markobject(vm, (LitObject*)fiber->module);
                 lit_gcmem_markobject(vm, (LitObject*)fiber->parent);
             }
@@ -243,13 +251,9 @@ void lit_gcmem_vmblackobject(LitVM* vm, LitObject* object)
             {
                 closure = (LitClosure*)object;
                 lit_gcmem_markobject(vm, (LitObject*)closure->function);
-                // Check for NULL is needed for a really specific gc-case
-                if(closure->upvalues != NULL)
+                for(i = 0; i < closure->upvalue_count; i++)
                 {
-                    for(i = 0; i < closure->upvalue_count; i++)
-                    {
-                        lit_gcmem_markobject(vm, (LitObject*)closure->upvalues[i]);
-                    }
+                    lit_gcmem_markvalue(vm, closure->upvalues[i]);
                 }
             }
             break;
@@ -349,45 +353,250 @@ void lit_gcmem_vmsweep(LitVM* vm)
             {
                 vm->objects = object;
             }
+            if(vm->state->allocprofiler != NULL)
+            {
+                lit_allocprof_onfree(vm->state, unreached);
+            }
+            if(vm->state->gcstats.current != NULL)
+            {
+                vm->state->gcstats.current->freed[unreached->type]++;
+                vm->state->gcstats.objects_freed++;
+            }
             lit_object_destroy(vm->state, unreached);
         }
     }
 }
 
+void lit_gcmem_initstats(LitState* state)
+{
+    memset(&state->gcstats, 0, sizeof(LitGCStats));
+    state->gcstats.grow_factor = LIT_GC_HEAP_GROW_FACTOR;
+    state->gcstats.started = lit_util_nanotime();
+    state->gcstats.last_end = state->gcstats.started;
+}
+
+/*
+* fraction is the share of run time the collector should take, between 0 and 1
+* (exclusive); 0 goes back to growing the heap by LIT_GC_HEAP_GROW_FACTOR.
+*/
+void lit_gcmem_settarget(LitState* state, double fraction)
+{
+    if(fraction <= 0 || fraction >= 1)
+    {
+        state->gcstats.target_fraction = 0;
+        state->gcstats.grow_factor = LIT_GC_HEAP_GROW_FACTOR;
+        return;
+    }
+    state->gcstats.target_fraction = fraction;
+}
+
+/*
+* a collection costs about as much as what survives it, and the time until the next
+* one is however long the program takes to allocate the headroom. so, given how fast
+* it allocated since the last one, pick the headroom that makes
+* gc time / (gc time + mutator time) come out at the target.
+*/
+static void lit_gcmem_pace(LitState* state, LitGCEvent* event, int64_t allocated)
+{
+    double rate;
+    double factor;
+    double headroom;
+    LitGCStats* stats;
+    stats = &state->gcstats;
+    if(stats->target_fraction > 0 && event->mutator_time > 0 && event->total_time > 0 && allocated > 0)
+    {
+        rate = (double)allocated / (double)event->mutator_time;
+        headroom = rate * (double)event->total_time * (1 - stats->target_fraction) / stats->target_fraction;
+        factor = 1 + headroom / (double)(event->bytes_after > 0 ? event->bytes_after : 1);
+        if(factor < LIT_GC_PACER_MINGROW)
+        {
+            factor = LIT_GC_PACER_MINGROW;
+        }
+        else if(factor > LIT_GC_PACER_MAXGROW)
+        {
+            factor = LIT_GC_PACER_MAXGROW;
+        }
+        /* single collections are noisy, so only move halfway */
+        stats->grow_factor = (stats->grow_factor + factor) / 2;
+    }
+    state->next_gc = (int64_t)((double)state->bytes_allocated * stats->grow_factor);
+}
+
+static void lit_gcmem_record(LitState* state, LitGCEvent* event, uint64_t end)
+{
+    int bucket;
+    uint64_t micros;
+    LitGCStats* stats;
+    stats = &state->gcstats;
+    stats->total_time += event->total_time;
+    stats->bytes_freed += event->bytes_before - event->bytes_after;
+    if(event->total_time > stats->max_pause)
+    {
+        stats->max_pause = event->total_time;
+    }
+    micros = event->total_time / 1000;
+    bucket = lit_util_bitlength(micros);
+    if(bucket >= LIT_GC_PAUSEBUCKETS)
+    {
+        bucket = LIT_GC_PAUSEBUCKETS - 1;
+    }
+    stats->pauses[bucket]++;
+    if(event->total_time + event->mutator_time > 0)
+    {
+        stats->fraction = stats->fraction * 0.75 + 0.25 * ((double)event->total_time / (double)(event->total_time + event->mutator_time));
+    }
+    stats->last_end = end;
+}
+
 uint64_t lit_gcmem_collectgarbage(LitVM* vm)
 {
-    clock_t t;
-    uint64_t before;
+    uint64_t start;
+    uint64_t marked;
+    uint64_t swept;
+    uint64_t end;
+    int64_t before;
+    int64_t allocated;
     uint64_t collected;
-    (void)t;
-    if(!vm->state->allow_gc)
+    LitState* state;
+    LitGCEvent* event;
+    state = vm->state;
+    if(!state->allow_gc)
     {
         return 0;
     }
 
-    vm->state->allow_gc = false;
-    before = vm->state->bytes_allocated;
+    state->allow_gc = false;
+    before = state->bytes_allocated;
+    start = lit_util_nanotime();
+    /* what was allocated since the previous collection left off */
+    allocated = before - (state->gcstats.cycles > 0 ? state->gcstats.events[(state->gcstats.cycles - 1) % LIT_GC_EVENTLOG].bytes_after : 0);
+    event = &state->gcstats.events[state->gcstats.cycles % LIT_GC_EVENTLOG];
+    memset(event, 0, sizeof(LitGCEvent));
+    event->cycle = ++state->gcstats.cycles;
+    event->bytes_before = before;
+    event->mutator_time = start > state->gcstats.last_end ? start - state->gcstats.last_end : 0;
+    state->gcstats.current = event;
 
 #ifdef LIT_LOG_GC
     printf("-- gc begin\n");
-    t = clock();
 #endif
 
     lit_gcmem_vmmarkroots(vm);
     lit_gcmem_vmtracerefs(vm);
+    marked = lit_util_nanotime();
     lit_table_removewhite(&vm->strings);
+    swept = lit_util_nanotime();
     lit_gcmem_vmsweep(vm);
-    vm->state->next_gc = vm->state->bytes_allocated * LIT_GC_HEAP_GROW_FACTOR;
-    vm->state->allow_gc = true;
-    collected = before - vm->state->bytes_allocated;
+    if(state->allocprofiler != NULL)
+    {
+        lit_allocprof_aftergc(state);
+    }
+    end = lit_util_nanotime();
+    state->gcstats.current = NULL;
+    event->mark_time = marked - start;
+    event->strings_time = swept - marked;
+    event->sweep_time = end - swept;
+    event->total_time = end - start;
+    event->bytes_after = state->bytes_allocated;
+    lit_gcmem_pace(state, event, allocated);
+    event->next_gc = state->next_gc;
+    lit_gcmem_record(state, event, end);
+    state->allow_gc = true;
+    collected = before - state->bytes_allocated;
 
 #ifdef LIT_LOG_GC
-    printf("-- gc end. Collected %imb in %gms\n", ((int)((collected / 1024.0 + 0.5) / 10)) * 10,
-           (double)(clock() - t) / CLOCKS_PER_SEC * 1000);
+    printf("-- gc end. Collected %imb in %gms\n", ((int)((collected / 1024.0 + 0.5) / 10)) * 10, (double)event->total_time / 1e6);
 #endif
     return collected;
 }
 
+/* copies up to max of the remembered collections into dest, oldest first, and returns how many */
+size_t lit_gcmem_getevents(LitState* state, LitGCEvent* dest, size_t max)
+{
+    size_t i;
+    size_t count;
+    uint64_t first;
+    count = state->gcstats.cycles < LIT_GC_EVENTLOG ? (size_t)state->gcstats.cycles : LIT_GC_EVENTLOG;
+    if(count > max)
+    {
+        count = max;
+    }
+    first = state->gcstats.cycles - count;
+    for(i = 0; i < count; i++)
+    {
+        dest[i] = state->gcstats.events[(first + i) % LIT_GC_EVENTLOG];
+    }
+    return count;
+}
+
+static void lit_gcmem_setnumber(LitState* state, LitMap* map, const char* name, double value)
+{
+    lit_map_set(state, map, CONST_STRING(state, name), lit_value_numbertovalue(state, value));
+}
+
+/* times are in milliseconds */
+LitValue lit_gcmem_statstovalue(LitState* state)
+{
+    size_t i;
+    size_t j;
+    size_t count;
+    uint64_t now;
+    LitMap* map;
+    LitMap* entry;
+    LitMap* freed;
+    LitArray* events;
+    LitArray* pauses;
+    LitGCStats* stats;
+    LitGCEvent log[LIT_GC_EVENTLOG];
+    stats = &state->gcstats;
+    now = lit_util_nanotime();
+    count = lit_gcmem_getevents(state, log, LIT_GC_EVENTLOG);
+    map = lit_create_map(state);
+    lit_state_pushroot(state, (LitObject*)map);
+    lit_gcmem_setnumber(state, map, "cycles", (double)stats->cycles);
+    lit_gcmem_setnumber(state, map, "totalTime", (double)stats->total_time / 1e6);
+    lit_gcmem_setnumber(state, map, "maxPause", (double)stats->max_pause / 1e6);
+    lit_gcmem_setnumber(state, map, "bytesFreed", (double)stats->bytes_freed);
+    lit_gcmem_setnumber(state, map, "objectsFreed", (double)stats->objects_freed);
+    lit_gcmem_setnumber(state, map, "fraction", now > stats->started ? (double)stats->total_time / (double)(now - stats->started) : 0);
+    lit_gcmem_setnumber(state, map, "recentFraction", stats->fraction);
+    lit_gcmem_setnumber(state, map, "targetFraction", stats->target_fraction);
+    lit_gcmem_setnumber(state, map, "growFactor", stats->grow_factor);
+    pauses = lit_create_array(state);
+    lit_map_set(state, map, CONST_STRING(state, "pauses"), lit_value_objectvalue(pauses));
+    for(i = 0; i < LIT_GC_PAUSEBUCKETS; i++)
+    {
+        lit_vallist_push(state, &pauses->list, lit_value_numbertovalue(state, (double)stats->pauses[i]));
+    }
+    events = lit_create_array(state);
+    lit_map_set(state, map, CONST_STRING(state, "events"), lit_value_objectvalue(events));
+    for(i = 0; i < count; i++)
+    {
+        entry = lit_create_map(state);
+        lit_vallist_push(state, &events->list, lit_value_objectvalue(entry));
+        lit_gcmem_setnumber(state, entry, "cycle", (double)log[i].cycle);
+        lit_gcmem_setnumber(state, entry, "mark", (double)log[i].mark_time / 1e6);
+        lit_gcmem_setnumber(state, entry, "strings", (double)log[i].strings_time / 1e6);
+        lit_gcmem_setnumber(state, entry, "sweep", (double)log[i].sweep_time / 1e6);
+        lit_gcmem_setnumber(state, entry, "total", (double)log[i].total_time / 1e6);
+        lit_gcmem_setnumber(state, entry, "mutator", (double)log[i].mutator_time / 1e6);
+        lit_gcmem_setnumber(state, entry, "before", (double)log[i].bytes_before);
+        lit_gcmem_setnumber(state, entry, "after", (double)log[i].bytes_after);
+        lit_gcmem_setnumber(state, entry, "nextRound", (double)log[i].next_gc);
+        freed = lit_create_map(state);
+        lit_map_set(state, entry, CONST_STRING(state, "freed"), lit_value_objectvalue(freed));
+        for(j = 0; j < LITTYPE_TOTAL; j++)
+        {
+            if(log[i].freed[j] > 0)
+            {
+                lit_gcmem_setnumber(state, freed, lit_tostring_objtype((LitObjType)j), (double)log[i].freed[j]);
+            }
+        }
+    }
+    lit_state_poproot(state);
+    return lit_value_objectvalue(map);
+}
+
 static LitValue objfn_gc_memory_used(LitVM* vm, LitValue instance, size_t arg_count, LitValue* args)
 {
     (void)instance;
@@ -404,6 +613,75 @@ static LitValue objfn_gc_next_round(LitVM* vm, LitValue instance, size_t arg_cou
     return lit_value_numbertovalue(vm->state, vm->state->next_gc);
 }
 
+/* GC.startAllocationProfile([interval]): samples an allocation every 'interval' bytes on average (default 1) */
+static LitValue objfn_gc_startallocationprofile(LitVM* vm, LitValue instance, size_t arg_count, LitValue* args)
+{
+    double interval;
+    (void)instance;
+    interval = lit_value_getnumber(vm, args, arg_count, 0, 1);
+    if(interval < 1)
+    {
+        interval = 1;
+    }
+    return lit_bool_to_value(vm->state, lit_allocprof_start(vm->state, (size_t)interval));
+}
+
+static LitValue objfn_gc_stopallocationprofile(LitVM* vm, LitValue instance, size_t arg_count, LitValue* args)
+{
+    (void)instance;
+    (void)arg_count;
+    (void)args;
+    lit_allocprof_stop(vm->state);
+    return NULL_VALUE;
+}
+
+/* the sites sampled so far, or null if allocations were never profiled */
+static LitValue objfn_gc_allocationprofile(LitVM* vm, LitValue instance, size_t arg_count, LitValue* args)
+{
+    (void)instance;
+    (void)arg_count;
+    (void)args;
+    return lit_allocprof_tovalue(vm->state);
+}
+
+/* GC.stats(): totals, the pause histogram, and the last few collections (see lit_gcmem_statstovalue) */
+static LitValue objfn_gc_stats(LitVM* vm, LitValue instance, size_t arg_count, LitValue* args)
+{
+    (void)instance;
+    (void)arg_count;
+    (void)args;
+    return lit_gcmem_statstovalue(vm->state);
+}
+
+static LitValue objfn_gc_targetfraction(LitVM* vm, LitValue instance, size_t arg_count, LitValue* args)
+{
+    (void)instance;
+    (void)arg_count;
+    (void)args;
+    return lit_value_numbertovalue(vm->state, vm->state->gcstats.target_fraction);
+}
+
+/* GC.targetFraction = 0.05 paces collections to take about 5% of the time; 0 turns pacing off */
+static LitValue objfn_gc_set_targetfraction(LitVM* vm, LitValue instance, size_t arg_count, LitValue* args)
+{
+    (void)instance;
+    lit_gcmem_settarget(vm->state, lit_value_getnumber(vm, args, arg_count, 0, 0));
+    return lit_value_numbertovalue(vm->state, vm->state->gcstats.target_fraction);
+}
+
+/* GC.snapshot(path): collects garbage, then writes every live object and its references to path */
+static LitValue objfn_gc_snapshot(LitVM* vm, LitValue instance, size_t arg_count, LitValue* args)
+{
+    bool ok;
+    const char* path;
+    (void)instance;
+    path = lit_value_checkstring(vm, args, arg_count, 0);
+    vm->state->allow_gc = true;
+    ok = lit_heapsnap_write(vm->state, path);
+    vm->state->allow_gc = false;
+    return lit_bool_to_value(vm->state, ok);
+}
+
 static LitValue objfn_gc_trigger(LitVM* vm, LitValue instance, size_t arg_count, LitValue* args)
 {
     (void)instance;
@@ -424,7 +702,13 @@ void lit_open_gc_library(LitState* state)
     {
         lit_class_bindgetset(state, klass, "memoryUsed", objfn_gc_memory_used, NULL, true);
         lit_class_bindgetset(state, klass, "nextRound", objfn_gc_next_round, NULL, true);
+        lit_class_bindgetset(state, klass, "targetFraction", objfn_gc_targetfraction, objfn_gc_set_targetfraction, true);
         lit_class_bindstaticmethod(state, klass, "trigger", objfn_gc_trigger);
+        lit_class_bindstaticmethod(state, klass, "stats", objfn_gc_stats);
+        lit_class_bindstaticmethod(state, klass, "startAllocationProfile", objfn_gc_startallocationprofile);
+        lit_class_bindstaticmethod(state, klass, "stopAllocationProfile", objfn_gc_stopallocationprofile);
+        lit_class_bindstaticmethod(state, klass, "allocationProfile", objfn_gc_allocationprofile);
+        lit_class_bindstaticmethod(state, klass, "snapshot", objfn_gc_snapshot);
     }
     lit_state_setglobal(state, klass->name, lit_value_objectvalue(klass));
     if(klass->super == NULL)
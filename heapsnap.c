@@ -0,0 +1,1013 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "lit.h"
+
+/*
+* heap snapshots. edges are not found by a second copy of the tracing code: while
+* vm->heapedges is set, lit_gcmem_markobject appends to it instead of marking, so
+* lit_gcmem_vmblackobject and lit_gcmem_vmmarkroots report exactly what the gc
+* would follow.
+*
+* the file (native byte order) is:
+*   "LITHEAP1", u32 object count, u32 root count,
+*   per object: u8 type, u64 shallow size, u32 name length, name, u32 edge count, u32 ids...
+*   u32 root ids...
+* an object's id is its position in vm->objects.
+*/
+
+#define LIT_HEAPSNAP_MAGIC "LITHEAP1"
+
+enum
+{
+    /* strings keep this much of their contents as the name */
+    LIT_HEAPSNAP_STRINGPREFIX = 40,
+};
+
+typedef struct LitHeapIds LitHeapIds;
+struct LitHeapIds
+{
+    LitObject** objects;
+    uint32_t* ids;
+    size_t capacity;
+};
+
+void lit_heapsnap_addedge(LitHeapEdges* edges, LitObject* object)
+{
+    size_t capacity;
+    LitObject** objects;
+    if(edges->count == edges->capacity)
+    {
+        capacity = edges->capacity == 0 ? 64 : edges->capacity * 2;
+        objects = (LitObject**)realloc(edges->objects, capacity * sizeof(LitObject*));
+        if(objects == NULL)
+        {
+            edges->failed = true;
+            return;
+        }
+        edges->objects = objects;
+        edges->capacity = capacity;
+    }
+    edges->objects[edges->count++] = object;
+}
+
+static size_t lit_heapsnap_slot(LitHeapIds* ids, LitObject* object)
+{
+    size_t slot;
+    slot = (size_t)(((uintptr_t)object >> 4) * 11400714819323198485ULL) & (ids->capacity - 1);
+    while(ids->objects[slot] != NULL && ids->objects[slot] != object)
+    {
+        slot = (slot + 1) & (ids->capacity - 1);
+    }
+    return slot;
+}
+
+static int64_t lit_heapsnap_idof(LitHeapIds* ids, LitObject* object)
+{
+    size_t slot;
+    slot = lit_heapsnap_slot(ids, object);
+    if(ids->objects[slot] == NULL)
+    {
+        return -1;
+    }
+    return ids->ids[slot];
+}
+
+static size_t lit_heapsnap_tablesize(LitTable* table)
+{
+    if(table->entries == NULL)
+    {
+        return 0;
+    }
+    return (size_t)(table->capacity + 1) * sizeof(LitTableEntry);
+}
+
+/* the object itself, plus the buffers only it points to */
+static size_t lit_heapsnap_shallowsize(LitObject* object)
+{
+    LitFunction* function;
+    LitFiber* fiber;
+    switch(object->type)
+    {
+        case LITTYPE_STRING:
+            return sizeof(LitString) + lit_string_getlength((LitString*)object) + 1;
+        case LITTYPE_FUNCTION:
+            {
+                function = (LitFunction*)object;
+                if(function->chunk.mapped)
+                {
+                    return sizeof(LitFunction) + function->chunk.constants.capacity * sizeof(LitValue);
+                }
+                return sizeof(LitFunction) + function->chunk.capacity + function->chunk.line_capacity * sizeof(uint16_t)
+                       + function->chunk.constants.capacity * sizeof(LitValue);
+            }
+        case LITTYPE_NATIVE_FUNCTION:
+            return sizeof(LitNativeFunction);
+        case LITTYPE_NATIVE_PRIMITIVE:
+            return sizeof(LitNativePrimFunction);
+        case LITTYPE_NATIVE_METHOD:
+            return sizeof(LitNativeMethod);
+        case LITTYPE_PRIMITIVE_METHOD:
+            return sizeof(LitPrimitiveMethod);
+        case LITTYPE_FIBER:
+            {
+                fiber = (LitFiber*)object;
+                return sizeof(LitFiber) + fiber->frame_capacity * sizeof(LitCallFrame) + fiber->stack_capacity * sizeof(LitValue)
+                       + (fiber->open_upvalues != NULL ? fiber->stack_capacity * sizeof(LitUpvalue*) : 0);
+            }
+        case LITTYPE_MODULE:
+            return sizeof(LitModule) + ((LitModule*)object)->private_count * sizeof(LitValue);
+        case LITTYPE_CLOSURE:
+            return sizeof(LitClosure) + ((LitClosure*)object)->upvalue_count * sizeof(LitValue);
+        case LITTYPE_UPVALUE:
+            return sizeof(LitUpvalue);
+        case LITTYPE_CLASS:
+            return sizeof(LitClass) + lit_heapsnap_tablesize(&((LitClass*)object)->methods) + lit_heapsnap_tablesize(&((LitClass*)object)->static_fields);
+        case LITTYPE_INSTANCE:
+            return sizeof(LitInstance) + lit_heapsnap_tablesize(&((LitInstance*)object)->fields);
+        case LITTYPE_BOUND_METHOD:
+            return sizeof(LitBoundMethod);
+        case LITTYPE_ARRAY:
+            return sizeof(LitArray) + ((LitArray*)object)->list.capacity * sizeof(LitValue);
+        case LITTYPE_MAP:
+            return sizeof(LitMap) + lit_heapsnap_tablesize(&((LitMap*)object)->values);
+        case LITTYPE_USERDATA:
+            return sizeof(LitUserdata) + ((LitUserdata*)object)->size;
+        case LITTYPE_RANGE:
+            return sizeof(LitRange);
+        case LITTYPE_FIELD:
+            return sizeof(LitField);
+        case LITTYPE_REFERENCE:
+            return sizeof(LitReference);
+        case LITTYPE_TYPEDARRAY:
+            return sizeof(LitTypedArray) + ((LitTypedArray*)object)->length * lit_typedarray_elemsize(((LitTypedArray*)object)->kind);
+        case LITTYPE_BUFFER:
+            return sizeof(LitBuffer) + ((LitBuffer*)object)->capacity;
+        default:
+            break;
+    }
+    return sizeof(LitObject);
+}
+
+/* what the analyzer shows next to the type: the class of an instance, the name of anything named */
+static LitString* lit_heapsnap_nameof(LitObject* object)
+{
+    switch(object->type)
+    {
+        case LITTYPE_STRING:
+            return (LitString*)object;
+        case LITTYPE_FUNCTION:
+            return ((LitFunction*)object)->name;
+        case LITTYPE_CLOSURE:
+            return ((LitClosure*)object)->function->name;
+        case LITTYPE_NATIVE_FUNCTION:
+            return ((LitNativeFunction*)object)->name;
+        case LITTYPE_NATIVE_PRIMITIVE:
+            return ((LitNativePrimFunction*)object)->name;
+        case LITTYPE_NATIVE_METHOD:
+            return ((LitNativeMethod*)object)->name;
+        case LITTYPE_PRIMITIVE_METHOD:
+            return ((LitPrimitiveMethod*)object)->name;
+        case LITTYPE_MODULE:
+            return ((LitModule*)object)->name;
+        case LITTYPE_CLASS:
+            return ((LitClass*)object)->name;
+        case LITTYPE_INSTANCE:
+            return ((LitInstance*)object)->klass->name;
+        default:
+            break;
+    }
+    return NULL;
+}
+
+/* drops anything outside of vm->objects (which shouldn't happen), so every edge has an id */
+static void lit_heapsnap_filteredges(LitHeapIds* ids, LitHeapEdges* edges)
+{
+    size_t i;
+    size_t count;
+    count = 0;
+    for(i = 0; i < edges->count; i++)
+    {
+        if(lit_heapsnap_idof(ids, edges->objects[i]) >= 0)
+        {
+            edges->objects[count++] = edges->objects[i];
+        }
+    }
+    edges->count = count;
+}
+
+static void lit_heapsnap_writeedges(FILE* file, LitHeapIds* ids, LitHeapEdges* edges, bool counted)
+{
+    size_t i;
+    lit_heapsnap_filteredges(ids, edges);
+    if(counted)
+    {
+        lit_ioutil_writeuint32(file, (uint32_t)edges->count);
+    }
+    for(i = 0; i < edges->count; i++)
+    {
+        lit_ioutil_writeuint32(file, (uint32_t)lit_heapsnap_idof(ids, edges->objects[i]));
+    }
+}
+
+/*
+* collects garbage (when allowed), and writes every object that is left with its
+* outgoing references, and the roots, to path.
+*/
+bool lit_heapsnap_write(LitState* state, const char* path)
+{
+    bool ok;
+    bool was_allowed;
+    size_t slot;
+    size_t length;
+    uint32_t count;
+    uint64_t size;
+    FILE* file;
+    LitVM* vm;
+    LitObject* object;
+    LitString* name;
+    LitHeapIds ids;
+    LitHeapEdges edges;
+    LitHeapEdges roots;
+    vm = state->vm;
+    lit_gcmem_collectgarbage(vm);
+    file = fopen(path, "wb");
+    if(file == NULL)
+    {
+        return false;
+    }
+    count = 0;
+    for(object = vm->objects; object != NULL; object = object->next)
+    {
+        count++;
+    }
+    ids.capacity = 64;
+    while(ids.capacity < (size_t)count * 2)
+    {
+        ids.capacity *= 2;
+    }
+    ids.objects = (LitObject**)calloc(ids.capacity, sizeof(LitObject*));
+    ids.ids = (uint32_t*)malloc(ids.capacity * sizeof(uint32_t));
+    memset(&edges, 0, sizeof(edges));
+    memset(&roots, 0, sizeof(roots));
+    ok = ids.objects != NULL && ids.ids != NULL;
+    was_allowed = state->allow_gc;
+    state->allow_gc = false;
+    if(ok)
+    {
+        count = 0;
+        for(object = vm->objects; object != NULL; object = object->next)
+        {
+            slot = lit_heapsnap_slot(&ids, object);
+            ids.objects[slot] = object;
+            ids.ids[slot] = count++;
+        }
+        vm->heapedges = &roots;
+        lit_gcmem_vmmarkroots(vm);
+        vm->heapedges = NULL;
+        lit_heapsnap_filteredges(&ids, &roots);
+        fwrite(LIT_HEAPSNAP_MAGIC, 1, 8, file);
+        lit_ioutil_writeuint32(file, count);
+        lit_ioutil_writeuint32(file, (uint32_t)roots.count);
+        for(object = vm->objects; object != NULL && ok; object = object->next)
+        {
+            size = lit_heapsnap_shallowsize(object);
+            lit_ioutil_writeuint8(file, (uint8_t)object->type);
+            fwrite(&size, sizeof(uint64_t), 1, file);
+            name = lit_heapsnap_nameof(object);
+            length = name == NULL ? 0 : lit_string_getlength(name);
+            if(object->type == LITTYPE_STRING && length > LIT_HEAPSNAP_STRINGPREFIX)
+            {
+                length = LIT_HEAPSNAP_STRINGPREFIX;
+            }
+            lit_ioutil_writeuint32(file, (uint32_t)length);
+            if(length > 0)
+            {
+                fwrite(lit_string_getdata(name), 1, length, file);
+            }
+            edges.count = 0;
+            vm->heapedges = &edges;
+            lit_gcmem_vmblackobject(vm, object);
+            vm->heapedges = NULL;
+            ok = !edges.failed;
+            lit_heapsnap_writeedges(file, &ids, &edges, true);
+        }
+        lit_heapsnap_writeedges(file, &ids, &roots, false);
+        ok = ok && !roots.failed;
+    }
+    state->allow_gc = was_allowed;
+    free(ids.objects);
+    free(ids.ids);
+    free(edges.objects);
+    free(roots.objects);
+    if(ferror(file))
+    {
+        ok = false;
+    }
+    if(fclose(file) != 0)
+    {
+        ok = false;
+    }
+    return ok;
+}
+
+/*
+* the offline analyzer. retained sizes come from the dominator tree of the graph,
+* rooted at a virtual node that points at every root; dominators are found with
+* the iterative algorithm of Cooper, Harvey and Kennedy.
+*/
+
+typedef struct LitHeapGraph LitHeapGraph;
+struct LitHeapGraph
+{
+    /* node_count objects, plus the virtual root at index node_count */
+    size_t node_count;
+    uint8_t* types;
+    uint64_t* sizes;
+    const char** names;
+    uint32_t* name_lengths;
+    /* edges of node i are targets[starts[i]..starts[i + 1]) */
+    size_t* starts;
+    uint32_t* targets;
+    /* the group an object is reported under: its class for instances, its type otherwise */
+    uint32_t* labels;
+    char** label_names;
+    size_t label_count;
+};
+
+typedef struct LitHeapReader LitHeapReader;
+struct LitHeapReader
+{
+    const char* data;
+    size_t length;
+    size_t position;
+    bool failed;
+};
+
+static const void* lit_heapsnap_take(LitHeapReader* reader, size_t length)
+{
+    const void* at;
+    if(reader->failed || length > reader->length - reader->position)
+    {
+        reader->failed = true;
+        return NULL;
+    }
+    at = reader->data + reader->position;
+    reader->position += length;
+    return at;
+}
+
+static uint32_t lit_heapsnap_readuint32(LitHeapReader* reader)
+{
+    uint32_t value;
+    const void* at;
+    at = lit_heapsnap_take(reader, sizeof(uint32_t));
+    if(at == NULL)
+    {
+        return 0;
+    }
+    memcpy(&value, at, sizeof(uint32_t));
+    return value;
+}
+
+static uint32_t lit_heapsnap_label(LitHeapGraph* graph, const char* name, size_t length)
+{
+    size_t i;
+    char** names;
+    for(i = 0; i < graph->label_count; i++)
+    {
+        if(strlen(graph->label_names[i]) == length && memcmp(graph->label_names[i], name, length) == 0)
+        {
+            return (uint32_t)i;
+        }
+    }
+    names = (char**)realloc(graph->label_names, (graph->label_count + 1) * sizeof(char*));
+    if(names == NULL)
+    {
+        return 0;
+    }
+    graph->label_names = names;
+    names[graph->label_count] = (char*)malloc(length + 1);
+    if(names[graph->label_count] == NULL)
+    {
+        return 0;
+    }
+    memcpy(names[graph->label_count], name, length);
+    names[graph->label_count][length] = '\0';
+    return (uint32_t)graph->label_count++;
+}
+
+static void lit_heapsnap_freegraph(LitHeapGraph* graph)
+{
+    size_t i;
+    for(i = 0; i < graph->label_count; i++)
+    {
+        free(graph->label_names[i]);
+    }
+    free(graph->label_names);
+    free(graph->types);
+    free(graph->sizes);
+    free(graph->names);
+    free(graph->name_lengths);
+    free(graph->starts);
+    free(graph->targets);
+    free(graph->labels);
+}
+
+static bool lit_heapsnap_readgraph(LitHeapGraph* graph, const char* data, size_t length)
+{
+    size_t i;
+    size_t j;
+    size_t edge_count;
+    size_t edge_capacity;
+    uint32_t count;
+    uint32_t root_count;
+    uint32_t* targets;
+    const uint8_t* type;
+    const char* name;
+    LitHeapReader reader;
+    memset(graph, 0, sizeof(LitHeapGraph));
+    reader.data = data;
+    reader.length = length;
+    reader.position = 0;
+    reader.failed = false;
+    name = (const char*)lit_heapsnap_take(&reader, 8);
+    if(name == NULL || memcmp(name, LIT_HEAPSNAP_MAGIC, 8) != 0)
+    {
+        return false;
+    }
+    count = lit_heapsnap_readuint32(&reader);
+    root_count = lit_heapsnap_readuint32(&reader);
+    /* every object takes at least 17 bytes, which bounds a corrupt count */
+    if(reader.failed || (size_t)count > length / 17)
+    {
+        return false;
+    }
+    graph->node_count = count;
+    graph->types = (uint8_t*)calloc(count + 1, sizeof(uint8_t));
+    graph->sizes = (uint64_t*)calloc(count + 1, sizeof(uint64_t));
+    graph->names = (const char**)calloc(count + 1, sizeof(const char*));
+    graph->name_lengths = (uint32_t*)calloc(count + 1, sizeof(uint32_t));
+    graph->starts = (size_t*)calloc(count + 2, sizeof(size_t));
+    graph->labels = (uint32_t*)calloc(count + 1, sizeof(uint32_t));
+    edge_capacity = (size_t)count * 2 + root_count + 16;
+    graph->targets = (uint32_t*)malloc(edge_capacity * sizeof(uint32_t));
+    if(graph->types == NULL || graph->sizes == NULL || graph->names == NULL || graph->name_lengths == NULL
+       || graph->starts == NULL || graph->labels == NULL || graph->targets == NULL)
+    {
+        return false;
+    }
+    edge_count = 0;
+    for(i = 0; i < count && !reader.failed; i++)
+    {
+        type = (const uint8_t*)lit_heapsnap_take(&reader, 1);
+        name = (const char*)lit_heapsnap_take(&reader, sizeof(uint64_t));
+        if(type == NULL || name == NULL)
+        {
+            return false;
+        }
+        graph->types[i] = *type;
+        memcpy(&graph->sizes[i], name, sizeof(uint64_t));
+        graph->name_lengths[i] = lit_heapsnap_readuint32(&reader);
+        graph->names[i] = (const char*)lit_heapsnap_take(&reader, graph->name_lengths[i]);
+        if(*type == LITTYPE_INSTANCE && graph->name_lengths[i] > 0)
+        {
+            graph->labels[i] = lit_heapsnap_label(graph, graph->names[i], graph->name_lengths[i]);
+        }
+        else
+        {
+            name = lit_tostring_objtype((LitObjType)*type);
+            graph->labels[i] = lit_heapsnap_label(graph, name, strlen(name));
+        }
+        graph->starts[i] = edge_count;
+        length = lit_heapsnap_readuint32(&reader);
+        if(reader.failed || length > (reader.length - reader.position) / sizeof(uint32_t))
+        {
+            return false;
+        }
+        if(edge_count + length > edge_capacity)
+        {
+            while(edge_count + length > edge_capacity)
+            {
+                edge_capacity *= 2;
+            }
+            targets = (uint32_t*)realloc(graph->targets, edge_capacity * sizeof(uint32_t));
+            if(targets == NULL)
+            {
+                return false;
+            }
+            graph->targets = targets;
+        }
+        for(j = 0; j < length; j++)
+        {
+            graph->targets[edge_count] = lit_heapsnap_readuint32(&reader);
+            if(graph->targets[edge_count] >= count)
+            {
+                return false;
+            }
+            edge_count++;
+        }
+    }
+    /* the virtual root */
+    graph->starts[count] = edge_count;
+    graph->labels[count] = lit_heapsnap_label(graph, "<roots>", 7);
+    if(edge_count + root_count > edge_capacity)
+    {
+        targets = (uint32_t*)realloc(graph->targets, (edge_count + root_count) * sizeof(uint32_t));
+        if(targets == NULL)
+        {
+            return false;
+        }
+        graph->targets = targets;
+    }
+    for(j = 0; j < root_count; j++)
+    {
+        graph->targets[edge_count] = lit_heapsnap_readuint32(&reader);
+        if(graph->targets[edge_count] >= count)
+        {
+            return false;
+        }
+        edge_count++;
+    }
+    graph->starts[count + 1] = edge_count;
+    return !reader.failed;
+}
+
+/*
+* numbers the nodes reachable from the virtual root in dfs postorder.
+* returns how many there are; order[k] is the node with postorder number k.
+*/
+static size_t lit_heapsnap_postorder(LitHeapGraph* graph, uint32_t* order, uint32_t* number)
+{
+    size_t top;
+    size_t count;
+    size_t total;
+    uint32_t node;
+    uint32_t target;
+    uint32_t* stack;
+    size_t* next;
+    total = graph->node_count + 1;
+    stack = (uint32_t*)malloc(total * sizeof(uint32_t));
+    next = (size_t*)malloc(total * sizeof(size_t));
+    if(stack == NULL || next == NULL)
+    {
+        free(stack);
+        free(next);
+        return 0;
+    }
+    for(node = 0; node < total; node++)
+    {
+        number[node] = UINT32_MAX;
+        next[node] = graph->starts[node];
+    }
+    count = 0;
+    top = 0;
+    stack[top++] = (uint32_t)graph->node_count;
+    /* UINT32_MAX - 1 marks a node that is on the stack, but not numbered yet */
+    number[graph->node_count] = UINT32_MAX - 1;
+    while(top > 0)
+    {
+        node = stack[top - 1];
+        if(next[node] < graph->starts[node + 1])
+        {
+            target = graph->targets[next[node]++];
+            if(number[target] == UINT32_MAX)
+            {
+                number[target] = UINT32_MAX - 1;
+                stack[top++] = target;
+            }
+            continue;
+        }
+        top--;
+        number[node] = (uint32_t)count;
+        order[count++] = node;
+    }
+    free(stack);
+    free(next);
+    return count;
+}
+
+static uint32_t lit_heapsnap_intersect(const uint32_t* idom, const uint32_t* number, uint32_t a, uint32_t b)
+{
+    while(a != b)
+    {
+        while(number[a] < number[b])
+        {
+            a = idom[a];
+        }
+        while(number[b] < number[a])
+        {
+            b = idom[b];
+        }
+    }
+    return a;
+}
+
+/* fills idom for every reachable node; the virtual root dominates itself */
+static bool lit_heapsnap_dominators(LitHeapGraph* graph, const uint32_t* order, const uint32_t* number, size_t reachable, uint32_t* idom)
+{
+    bool changed;
+    size_t i;
+    size_t k;
+    size_t e;
+    size_t total;
+    uint32_t node;
+    uint32_t pred;
+    uint32_t target;
+    uint32_t newidom;
+    size_t* pstarts;
+    uint32_t* preds;
+    total = graph->node_count + 1;
+    /* predecessors, among reachable nodes only */
+    pstarts = (size_t*)calloc(total + 1, sizeof(size_t));
+    preds = (uint32_t*)malloc((graph->starts[total] + 1) * sizeof(uint32_t));
+    if(pstarts == NULL || preds == NULL)
+    {
+        free(pstarts);
+        free(preds);
+        return false;
+    }
+    for(node = 0; node < total; node++)
+    {
+        if(number[node] == UINT32_MAX)
+        {
+            continue;
+        }
+        for(e = graph->starts[node]; e < graph->starts[node + 1]; e++)
+        {
+            pstarts[graph->targets[e] + 1]++;
+        }
+    }
+    for(i = 0; i < total; i++)
+    {
+        pstarts[i + 1] += pstarts[i];
+    }
+    for(node = 0; node < total; node++)
+    {
+        if(number[node] == UINT32_MAX)
+        {
+            continue;
+        }
+        for(e = graph->starts[node]; e < graph->starts[node + 1]; e++)
+        {
+            target = graph->targets[e];
+            preds[pstarts[target]++] = node;
+        }
+    }
+    /* pstarts[i] now points at the end of i's predecessors; shift it back */
+    for(i = total; i > 0; i--)
+    {
+        pstarts[i] = pstarts[i - 1];
+    }
+    pstarts[0] = 0;
+    for(node = 0; node < total; node++)
+    {
+        idom[node] = UINT32_MAX;
+    }
+    idom[graph->node_count] = (uint32_t)graph->node_count;
+    changed = true;
+    while(changed)
+    {
+        changed = false;
+        /* reverse postorder, skipping the root (which is numbered last) */
+        for(k = reachable - 1; k-- > 0;)
+        {
+            node = order[k];
+            newidom = UINT32_MAX;
+            for(e = pstarts[node]; e < pstarts[node + 1]; e++)
+            {
+                pred = preds[e];
+                if(idom[pred] == UINT32_MAX)
+                {
+                    continue;
+                }
+                newidom = newidom == UINT32_MAX ? pred : lit_heapsnap_intersect(idom, number, pred, newidom);
+            }
+            if(newidom != UINT32_MAX && idom[node] != newidom)
+            {
+                idom[node] = newidom;
+                changed = true;
+            }
+        }
+    }
+    free(pstarts);
+    free(preds);
+    return true;
+}
+
+typedef struct LitHeapPair LitHeapPair;
+struct LitHeapPair
+{
+    uint64_t key;
+    uint64_t bytes;
+};
+
+/* adds bytes to (label, retainer), in an open addressed table of capacity entries */
+static void lit_heapsnap_addpair(LitHeapPair* pairs, size_t capacity, uint32_t label, uint32_t retainer, uint64_t bytes)
+{
+    size_t slot;
+    uint64_t key;
+    key = ((uint64_t)label << 32) | retainer;
+    slot = (size_t)((key + 1) * 11400714819323198485ULL) & (capacity - 1);
+    while(pairs[slot].key != UINT64_MAX && pairs[slot].key != key)
+    {
+        slot = (slot + 1) & (capacity - 1);
+    }
+    pairs[slot].key = key;
+    pairs[slot].bytes += bytes;
+}
+
+static LIT_THREADLOCAL const uint64_t* heapsnap_sorting;
+
+static int lit_heapsnap_compare(const void* a, const void* b)
+{
+    uint64_t va;
+    uint64_t vb;
+    va = heapsnap_sorting[*(const uint32_t*)a];
+    vb = heapsnap_sorting[*(const uint32_t*)b];
+    if(va != vb)
+    {
+        return va < vb ? 1 : -1;
+    }
+    return *(const uint32_t*)a < *(const uint32_t*)b ? -1 : 1;
+}
+
+static void lit_heapsnap_sortby(uint32_t* items, size_t count, const uint64_t* values)
+{
+    heapsnap_sorting = values;
+    qsort(items, count, sizeof(uint32_t), lit_heapsnap_compare);
+}
+
+static void lit_heapsnap_printname(FILE* out, LitHeapGraph* graph, uint32_t node)
+{
+    uint32_t i;
+    fprintf(out, "%s", lit_tostring_objtype((LitObjType)graph->types[node]));
+    if(graph->name_lengths[node] == 0)
+    {
+        return;
+    }
+    fprintf(out, " ");
+    for(i = 0; i < graph->name_lengths[node]; i++)
+    {
+        fputc(isprint((unsigned char)graph->names[node][i]) ? graph->names[node][i] : '?', out);
+    }
+}
+
+static void lit_heapsnap_report(FILE* out, LitHeapGraph* graph, const uint32_t* order, size_t reachable, const uint32_t* idom, size_t top)
+{
+    size_t i;
+    size_t k;
+    size_t e;
+    size_t shown;
+    size_t total;
+    size_t capacity;
+    uint32_t node;
+    uint32_t label;
+    uint64_t allbytes;
+    uint64_t reachbytes;
+    uint64_t* retained;
+    uint64_t* labelcount;
+    uint64_t* labelshallow;
+    uint64_t* labelretained;
+    uint64_t* retainerbytes;
+    uint32_t* items;
+    uint32_t* retainers;
+    uint32_t* active;
+    size_t* children;
+    uint32_t* childlist;
+    uint32_t* stack;
+    size_t* cursor;
+    LitHeapPair* pairs;
+    total = graph->node_count + 1;
+    retained = (uint64_t*)calloc(total, sizeof(uint64_t));
+    items = (uint32_t*)malloc(total * sizeof(uint32_t));
+    labelcount = (uint64_t*)calloc(graph->label_count, sizeof(uint64_t));
+    labelshallow = (uint64_t*)calloc(graph->label_count, sizeof(uint64_t));
+    labelretained = (uint64_t*)calloc(graph->label_count, sizeof(uint64_t));
+    active = (uint32_t*)calloc(graph->label_count, sizeof(uint32_t));
+    children = (size_t*)calloc(total + 1, sizeof(size_t));
+    childlist = (uint32_t*)malloc(total * sizeof(uint32_t));
+    stack = (uint32_t*)malloc(total * sizeof(uint32_t));
+    cursor = (size_t*)malloc(total * sizeof(size_t));
+    capacity = 64;
+    while(capacity < reachable * 2)
+    {
+        capacity *= 2;
+    }
+    pairs = (LitHeapPair*)malloc(capacity * sizeof(LitHeapPair));
+    if(retained == NULL || items == NULL || labelcount == NULL || labelshallow == NULL || labelretained == NULL || active == NULL
+       || children == NULL || childlist == NULL || stack == NULL || cursor == NULL || pairs == NULL)
+    {
+        fprintf(out, "out of memory\n");
+        goto cleanup;
+    }
+    memset(pairs, 0xff, capacity * sizeof(LitHeapPair));
+    for(i = 0; i < capacity; i++)
+    {
+        pairs[i].bytes = 0;
+    }
+    allbytes = 0;
+    reachbytes = 0;
+    for(node = 0; node < graph->node_count; node++)
+    {
+        allbytes += graph->sizes[node];
+    }
+    /* a dominator is always numbered after the nodes it dominates */
+    for(k = 0; k < reachable; k++)
+    {
+        node = order[k];
+        retained[node] += graph->sizes[node];
+        if(node != graph->node_count)
+        {
+            reachbytes += graph->sizes[node];
+            retained[idom[node]] += retained[node];
+        }
+    }
+    fprintf(out, "%zu objects, %llu bytes; %zu reachable (%llu bytes), %zu unreachable\n", graph->node_count, (unsigned long long)allbytes,
+            reachable - 1, (unsigned long long)reachbytes, graph->node_count - (reachable - 1));
+
+    /* the dominator tree, to count each class's retained size once where its objects nest */
+    for(k = 0; k < reachable; k++)
+    {
+        node = order[k];
+        if(node != graph->node_count)
+        {
+            children[idom[node] + 1]++;
+        }
+    }
+    for(i = 0; i < total; i++)
+    {
+        children[i + 1] += children[i];
+    }
+    for(i = 0; i < total; i++)
+    {
+        cursor[i] = children[i];
+    }
+    for(k = 0; k < reachable; k++)
+    {
+        node = order[k];
+        if(node != graph->node_count)
+        {
+            childlist[cursor[idom[node]]++] = node;
+        }
+    }
+    for(i = 0; i < total; i++)
+    {
+        cursor[i] = children[i];
+    }
+    shown = 0;
+    stack[shown++] = (uint32_t)graph->node_count;
+    active[graph->labels[graph->node_count]]++;
+    while(shown > 0)
+    {
+        node = stack[shown - 1];
+        if(cursor[node] < children[node + 1])
+        {
+            node = childlist[cursor[node]++];
+            label = graph->labels[node];
+            labelcount[label]++;
+            labelshallow[label] += graph->sizes[node];
+            if(active[label] == 0)
+            {
+                labelretained[label] += retained[node];
+                lit_heapsnap_addpair(pairs, capacity, label, graph->labels[idom[node]], retained[node]);
+            }
+            active[label]++;
+            stack[shown++] = node;
+            continue;
+        }
+        active[graph->labels[node]]--;
+        shown--;
+    }
+
+    fprintf(out, "\nlargest objects by retained size:\n");
+    fprintf(out, "%14s %12s  %s\n", "retained", "shallow", "object");
+    k = 0;
+    for(i = 0; i < reachable; i++)
+    {
+        if(order[i] != graph->node_count)
+        {
+            items[k++] = order[i];
+        }
+    }
+    lit_heapsnap_sortby(items, k, retained);
+    for(i = 0; i < k && i < top; i++)
+    {
+        fprintf(out, "%14llu %12llu  #%u ", (unsigned long long)retained[items[i]], (unsigned long long)graph->sizes[items[i]], items[i]);
+        lit_heapsnap_printname(out, graph, items[i]);
+        fprintf(out, "\n");
+    }
+
+    fprintf(out, "\nby class (retained counts nested objects of the same class once):\n");
+    fprintf(out, "%10s %14s %14s  %-24s %s\n", "count", "shallow", "retained", "class", "retained by");
+    for(i = 0; i < graph->label_count; i++)
+    {
+        items[i] = (uint32_t)i;
+    }
+    lit_heapsnap_sortby(items, graph->label_count, labelretained);
+    retainers = (uint32_t*)malloc(graph->label_count * sizeof(uint32_t));
+    retainerbytes = (uint64_t*)calloc(graph->label_count, sizeof(uint64_t));
+    for(i = 0; i < graph->label_count && i < top && retainers != NULL && retainerbytes != NULL; i++)
+    {
+        label = items[i];
+        if(labelcount[label] == 0)
+        {
+            continue;
+        }
+        fprintf(out, "%10llu %14llu %14llu  %-24s", (unsigned long long)labelcount[label], (unsigned long long)labelshallow[label],
+                (unsigned long long)labelretained[label], graph->label_names[label]);
+        for(e = 0; e < graph->label_count; e++)
+        {
+            retainers[e] = (uint32_t)e;
+            retainerbytes[e] = 0;
+        }
+        for(e = 0; e < capacity; e++)
+        {
+            if(pairs[e].key != UINT64_MAX && (uint32_t)(pairs[e].key >> 32) == label)
+            {
+                retainerbytes[(uint32_t)pairs[e].key] = pairs[e].bytes;
+            }
+        }
+        lit_heapsnap_sortby(retainers, graph->label_count, retainerbytes);
+        for(e = 0; e < 3 && retainerbytes[retainers[e]] > 0; e++)
+        {
+            fprintf(out, "%s %s (%llu)", e == 0 ? "" : ",", graph->label_names[retainers[e]], (unsigned long long)retainerbytes[retainers[e]]);
+        }
+        fprintf(out, "\n");
+    }
+    free(retainers);
+    free(retainerbytes);
+cleanup:
+    free(retained);
+    free(items);
+    free(labelcount);
+    free(labelshallow);
+    free(labelretained);
+    free(active);
+    free(children);
+    free(childlist);
+    free(stack);
+    free(cursor);
+    free(pairs);
+}
+
+/* reads a snapshot written by lit_heapsnap_write, and reports on it */
+bool lit_heapsnap_analyze(const char* path, FILE* out, size_t top)
+{
+    bool ok;
+    long length;
+    size_t reachable;
+    char* data;
+    FILE* file;
+    uint32_t* order;
+    uint32_t* number;
+    uint32_t* idom;
+    LitHeapGraph graph;
+    file = fopen(path, "rb");
+    if(file == NULL)
+    {
+        fprintf(stderr, "cannot open '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    data = length > 0 ? (char*)malloc((size_t)length) : NULL;
+    if(data == NULL || fread(data, 1, (size_t)length, file) != (size_t)length)
+    {
+        fprintf(stderr, "cannot read '%s'\n", path);
+        fclose(file);
+        free(data);
+        return false;
+    }
+    fclose(file);
+    ok = lit_heapsnap_readgraph(&graph, data, (size_t)length);
+    if(!ok)
+    {
+        fprintf(stderr, "'%s' is not a valid heap snapshot\n", path);
+    }
+    else
+    {
+        order = (uint32_t*)malloc((graph.node_count + 1) * sizeof(uint32_t));
+        number = (uint32_t*)malloc((graph.node_count + 1) * sizeof(uint32_t));
+        idom = (uint32_t*)malloc((graph.node_count + 1) * sizeof(uint32_t));
+        ok = order != NULL && number != NULL && idom != NULL;
+        if(ok)
+        {
+            reachable = lit_heapsnap_postorder(&graph, order, number);
+            ok = reachable > 0 && lit_heapsnap_dominators(&graph, order, number, reachable, idom);
+            if(ok)
+            {
+                lit_heapsnap_report(out, &graph, order, reachable, idom, top);
+            }
+        }
+        free(order);
+        free(number);
+        free(idom);
+    }
+    lit_heapsnap_freegraph(&graph);
+    free(data);
+    return ok;
+}
@@ -8,7 +8,8 @@ void lit_datalist_init(LitDataList* dl, size_t typsz)
     dl->capacity = 0;
     dl->count = 0;
     dl->rawelemsz = typsz;
-    dl->elemsz = dl->rawelemsz + sizeof(intptr_t);
+    /* every slot is an intptr_t, no matter how small the element type is */
+    dl->elemsz = sizeof(intptr_t);
 }
 
 void lit_datalist_destroy(LitState* state, LitDataList* dl)
@@ -95,64 +96,96 @@ void lit_datalist_ensuresize(LitState* state, LitDataList* dl, size_t size)
 
 void lit_vallist_init(LitValueList* vl)
 {
-    lit_datalist_init(&vl->list, sizeof(LitValue));
+    vl->values = NULL;
+    vl->capacity = 0;
+    vl->count = 0;
 }
 
 void lit_vallist_destroy(LitState* state, LitValueList* vl)
 {
-    lit_datalist_destroy(state, &vl->list);
+    LIT_FREE_ARRAY(state, sizeof(LitValue), vl->values, vl->capacity);
+    lit_vallist_init(vl);
 }
 
-size_t lit_vallist_size(LitValueList* vl)
-{
-    return lit_datalist_count(&vl->list);
-}
-
-size_t lit_vallist_count(LitValueList* vl)
+void lit_vallist_setcount(LitValueList* vl, size_t nc)
 {
-    return lit_vallist_size(vl);
+    vl->count = nc;
 }
 
-size_t lit_vallist_capacity(LitValueList* vl)
+void lit_vallist_clear(LitValueList* vl)
 {
-    return lit_datalist_capacity(&vl->list);
+    vl->count = 0;
 }
 
-void lit_vallist_setcount(LitValueList* vl, size_t nc)
+void lit_vallist_deccount(LitValueList* vl)
 {
-    lit_datalist_setcount(&vl->list, nc);
+    vl->count--;
 }
 
-void lit_vallist_clear(LitValueList* vl)
+/* called by lit_vallist_push once the list is full */
+void lit_vallist_grow(LitState* state, LitValueList* vl)
 {
-    lit_datalist_setcount(&vl->list, 0);
+    size_t old_capacity;
+    old_capacity = vl->capacity;
+    vl->capacity = LIT_GROW_CAPACITY(old_capacity);
+    vl->values = (LitValue*)LIT_GROW_ARRAY(state, vl->values, sizeof(LitValue), old_capacity, vl->capacity);
 }
 
-void lit_vallist_deccount(LitValueList* vl)
+void lit_vallist_ensuresize(LitState* state, LitValueList* vl, size_t size)
 {
-    lit_datalist_deccount(&vl->list);
+    size_t i;
+    size_t old_capacity;
+    if(vl->capacity < size)
+    {
+        old_capacity = vl->capacity;
+        vl->capacity = size;
+        vl->values = (LitValue*)LIT_GROW_ARRAY(state, vl->values, sizeof(LitValue), old_capacity, size);
+    }
+    /* slots past count may be stale (pop) or never written (reserve) */
+    for(i = vl->count; i < size; i++)
+    {
+        vl->values[i] = NULL_VALUE;
+    }
+    if(vl->count < size)
+    {
+        vl->count = size;
+    }
 }
 
-void lit_vallist_ensuresize(LitState* state, LitValueList* values, size_t size)
+/* reallocates to exactly capacity slots, but never below count */
+void lit_vallist_resize(LitState* state, LitValueList* vl, size_t capacity)
 {
-    lit_datalist_ensuresize(state, &values->list, size);
+    if(capacity < vl->count)
+    {
+        capacity = vl->count;
+    }
+    if(capacity == vl->capacity)
+    {
+        return;
+    }
+    vl->values = (LitValue*)LIT_GROW_ARRAY(state, vl->values, sizeof(LitValue), vl->capacity, capacity);
+    vl->capacity = capacity;
 }
 
-
-LitValue lit_vallist_set(LitValueList* vl, size_t idx, LitValue val)
+void lit_vallist_reserve(LitState* state, LitValueList* vl, size_t size)
 {
-    lit_datalist_set(&vl->list, idx, val);
-    return val;
+    if(vl->capacity < size)
+    {
+        lit_vallist_resize(state, vl, size);
+    }
 }
 
-LitValue lit_vallist_get(LitValueList* vl, size_t idx)
+void lit_vallist_shrinktofit(LitState* state, LitValueList* vl)
 {
-    return (LitValue)lit_datalist_get(&vl->list, idx);
+    lit_vallist_resize(state, vl, vl->count);
 }
 
-void lit_vallist_push(LitState* state, LitValueList* vl, LitValue value)
+void lit_vallist_shrink(LitState* state, LitValueList* vl)
 {
-    lit_datalist_push(state, &vl->list, (intptr_t)value);
+    if(LIT_SHOULD_SHRINK(vl->count, vl->capacity))
+    {
+        lit_vallist_resize(state, vl, LIT_GROW_CAPACITY(vl->count));
+    }
 }
 
 /* ---- Array object instance functions */
@@ -178,25 +211,209 @@ LitValue lit_array_pop(LitState* state, LitArray* arr)
     {
         val = lit_vallist_get(&arr->list, lit_vallist_count(&arr->list) - 1);
         lit_vallist_deccount(&arr->list);
+        lit_vallist_shrink(state, &arr->list);
         return val;
     }
     return NULL_VALUE;
 }
 
-int lit_array_indexof(LitArray* array, LitValue value)
+/*
+* bulk methods over an array's values go through the state's thread pool, like the
+* typed arrays do: one task per LIT_POOL_CHUNK values, each leaving its result in
+* partial[chunk], folded by the caller in chunk order.
+*/
+
+typedef struct LitArrayJob LitArrayJob;
+
+struct LitArrayJob
+{
+    LitValue* values;
+    LitValue value;
+    bool max;
+    size_t from;
+    size_t to;
+    size_t chunks;
+    /* the lowest chunk indexOf has seen a match in so far */
+    size_t found;
+    /* the lowest index of a value that is not a number */
+    size_t notnumber;
+    double* partial;
+    double local[16];
+};
+
+static void array_job_range(LitArrayJob* job, size_t chunk, size_t* from, size_t* to)
+{
+    *from = job->from + chunk * LIT_POOL_CHUNK;
+    *to = (job->to - *from) < LIT_POOL_CHUNK ? job->to : *from + LIT_POOL_CHUNK;
+}
+
+/* lowers 'slot' to 'value', for tasks on other threads racing to report the first hit */
+static void array_job_lower(size_t* slot, size_t value)
+{
+    size_t seen;
+    seen = lit_atomic_load(slot, LIT_ATOMIC_RELAXED);
+    while(value < seen && !lit_atomic_cas(slot, &seen, value, LIT_ATOMIC_RELAXED))
+    {
+    }
+}
+
+static void array_task_indexof(void* data, size_t chunk)
+{
+    size_t i;
+    size_t from;
+    size_t to;
+    LitArrayJob* job;
+    job = (LitArrayJob*)data;
+    job->partial[chunk] = -1;
+    if(chunk > lit_atomic_load(&job->found, LIT_ATOMIC_RELAXED))
+    {
+        return;
+    }
+    array_job_range(job, chunk, &from, &to);
+    for(i = from; i < to; i++)
+    {
+        if(job->values[i] == job->value)
+        {
+            job->partial[chunk] = (double)i;
+            array_job_lower(&job->found, chunk);
+            return;
+        }
+    }
+}
+
+static void array_task_fill(void* data, size_t chunk)
+{
+    size_t i;
+    size_t from;
+    size_t to;
+    LitArrayJob* job;
+    job = (LitArrayJob*)data;
+    array_job_range(job, chunk, &from, &to);
+    for(i = from; i < to; i++)
+    {
+        job->values[i] = job->value;
+    }
+}
+
+static void array_task_sum(void* data, size_t chunk)
+{
+    size_t i;
+    size_t from;
+    size_t to;
+    double s0;
+    double s1;
+    LitArrayJob* job;
+    job = (LitArrayJob*)data;
+    array_job_range(job, chunk, &from, &to);
+    s0 = s1 = 0;
+    for(i = from; i + 2 <= to; i += 2)
+    {
+        if(!lit_value_isnumber(job->values[i]) || !lit_value_isnumber(job->values[i + 1]))
+        {
+            array_job_lower(&job->notnumber, lit_value_isnumber(job->values[i]) ? i + 1 : i);
+            return;
+        }
+        s0 += lit_value_asnumber(job->values[i]);
+        s1 += lit_value_asnumber(job->values[i + 1]);
+    }
+    for(; i < to; i++)
+    {
+        if(!lit_value_isnumber(job->values[i]))
+        {
+            array_job_lower(&job->notnumber, i);
+            return;
+        }
+        s0 += lit_value_asnumber(job->values[i]);
+    }
+    job->partial[chunk] = s0 + s1;
+}
+
+/* nan is skipped here; array_minmax makes the result nan when the first value is */
+static void array_task_minmax(void* data, size_t chunk)
+{
+    size_t i;
+    size_t from;
+    size_t to;
+    double v;
+    double best;
+    LitArrayJob* job;
+    job = (LitArrayJob*)data;
+    array_job_range(job, chunk, &from, &to);
+    best = NAN;
+    for(i = from; i < to; i++)
+    {
+        if(!lit_value_isnumber(job->values[i]))
+        {
+            array_job_lower(&job->notnumber, i);
+            return;
+        }
+        v = lit_value_asnumber(job->values[i]);
+        if((job->max ? (v > best) : (v < best)) || isnan(best))
+        {
+            best = v;
+        }
+    }
+    job->partial[chunk] = best;
+}
+
+static void array_job_run(LitState* state, LitArrayJob* job, LitArray* array, size_t from, size_t to, LitPoolTaskFn task)
+{
+    job->values = array->list.values;
+    job->from = from;
+    job->to = to;
+    job->found = SIZE_MAX;
+    job->notnumber = SIZE_MAX;
+    job->chunks = lit_pool_chunkcount(to - from);
+    job->partial = job->local;
+    if(job->chunks > sizeof(job->local) / sizeof(job->local[0]))
+    {
+        job->partial = (double*)malloc(job->chunks * sizeof(double));
+    }
+    lit_pool_run(state, job->chunks, task, job);
+}
+
+static void array_job_end(LitArrayJob* job)
+{
+    if(job->partial != job->local)
+    {
+        free(job->partial);
+    }
+}
+
+int lit_array_indexof(LitState* state, LitArray* array, LitValue value)
 {
     size_t i;
+    double index;
+    LitArrayJob job;
+    job.value = value;
+    array_job_run(state, &job, array, 0, lit_vallist_count(&array->list), array_task_indexof);
+    index = -1;
+    for(i = 0; i < job.chunks && index < 0; i++)
+    {
+        index = job.partial[i];
+    }
+    array_job_end(&job);
+    return (int)index;
+}
+
+/* every value of array as a double into 'into', or false if one is not a number */
+static bool array_tonumbers(LitArray* array, double* into)
+{
+    size_t i;
+    LitValue value;
     for(i = 0; i < lit_vallist_count(&array->list); i++)
     {
-        if(lit_vallist_get(&array->list, i) == value)
+        value = lit_vallist_get(&array->list, i);
+        if(!lit_value_isnumber(value))
         {
-            return (int)i;
+            return false;
         }
+        into[i] = lit_value_asnumber(value);
     }
-    return -1;
+    return true;
 }
 
-LitValue lit_array_removeat(LitArray* array, size_t index)
+LitValue lit_array_removeat(LitState* state, LitArray* array, size_t index)
 {
     size_t i;
     size_t count;
@@ -222,6 +439,7 @@ LitValue lit_array_removeat(LitArray* array, size_t index)
         lit_vallist_set(values, count - 1, NULL_VALUE);
     }
     lit_vallist_deccount(values);
+    lit_vallist_shrink(state, values);
     return value;
 }
 
@@ -329,7 +547,7 @@ static LitValue objfn_array_subscript(LitVM* vm, LitValue instance, size_t argc,
     {
         index = fmax(0, lit_vallist_count(values) + index);
     }
-    if(lit_vallist_capacity(values) <= (size_t)index)
+    if(lit_vallist_count(values) <= (size_t)index)
     {
         return NULL_VALUE;
     }
@@ -431,7 +649,7 @@ static LitValue objfn_array_indexof(LitVM* vm, LitValue instance, size_t argc, L
 {
     LIT_ENSURE_ARGS(vm->state, 1)
 
-        int index = lit_array_indexof(lit_value_asarray(instance), argv[0]);
+        int index = lit_array_indexof(vm->state, lit_value_asarray(instance), argv[0]);
     return index == -1 ? NULL_VALUE : lit_value_numbertovalue(vm->state, index);
 }
 
@@ -442,10 +660,10 @@ static LitValue objfn_array_remove(LitVM* vm, LitValue instance, size_t argc, Li
     LitArray* array;
     LIT_ENSURE_ARGS(vm->state, 1);
     array = lit_value_asarray(instance);
-    index = lit_array_indexof(array, argv[0]);
+    index = lit_array_indexof(vm->state, array, argv[0]);
     if(index != -1)
     {
-        return lit_array_removeat(array, (size_t)index);
+        return lit_array_removeat(vm->state, array, (size_t)index);
     }
     return NULL_VALUE;
 }
@@ -458,24 +676,50 @@ static LitValue objfn_array_removeat(LitVM* vm, LitValue instance, size_t argc,
     {
         return NULL_VALUE;
     }
-    return lit_array_removeat(lit_value_asarray(instance), (size_t)index);
+    return lit_array_removeat(vm->state, lit_value_asarray(instance), (size_t)index);
 }
 
 static LitValue objfn_array_contains(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
 {
     LIT_ENSURE_ARGS(vm->state, 1);
-    return lit_bool_to_value(vm->state, lit_array_indexof(lit_value_asarray(instance), argv[0]) != -1);
+    return lit_bool_to_value(vm->state, lit_array_indexof(vm->state, lit_value_asarray(instance), argv[0]) != -1);
 }
 
 static LitValue objfn_array_clear(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
 {
-    (void)vm;
     (void)argc;
     (void)argv;
     lit_vallist_clear(&lit_value_asarray(instance)->list);
+    lit_vallist_shrink(vm->state, &lit_value_asarray(instance)->list);
+    return NULL_VALUE;
+}
+
+static LitValue objfn_array_reserve(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    double size;
+    size = lit_value_checknumber(vm, argv, argc, 0);
+    if(size > 0)
+    {
+        lit_vallist_reserve(vm->state, &lit_value_asarray(instance)->list, (size_t)size);
+    }
     return NULL_VALUE;
 }
 
+static LitValue objfn_array_shrinktofit(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)argc;
+    (void)argv;
+    lit_vallist_shrinktofit(vm->state, &lit_value_asarray(instance)->list);
+    return NULL_VALUE;
+}
+
+static LitValue objfn_array_capacity(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)argc;
+    (void)argv;
+    return lit_value_numbertovalue(vm->state, lit_vallist_capacity(&lit_value_asarray(instance)->list));
+}
+
 static LitValue objfn_array_iterator(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
 {
     int number;
@@ -571,8 +815,27 @@ static LitValue objfn_array_join(LitVM* vm, LitValue instance, size_t argc, LitV
 
 static LitValue objfn_array_sort(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
 {
+    size_t i;
+    double* numbers;
+    LitArray* array;
     LitValueList* values;
-    values = &lit_value_asarray(instance)->list;
+    (void)argv;
+    array = lit_value_asarray(instance);
+    values = &array->list;
+    /* only arrays of plain numbers are sorted for now, ascending, with nan last */
+    if(argc == 0 && lit_vallist_count(values) > 1)
+    {
+        numbers = (double*)malloc(lit_vallist_count(values) * sizeof(double));
+        if(array_tonumbers(array, numbers))
+        {
+            lit_pool_sortnumbers(vm->state, numbers, lit_vallist_count(values));
+            for(i = 0; i < lit_vallist_count(values); i++)
+            {
+                lit_vallist_set(values, i, lit_value_numbertovalue(vm->state, numbers[i]));
+            }
+        }
+        free(numbers);
+    }
     /*
     if(argc == 1 && lit_is_callable_function(argv[0]))
     {
@@ -586,6 +849,101 @@ static LitValue objfn_array_sort(LitVM* vm, LitValue instance, size_t argc, LitV
     return instance;
 }
 
+static LitValue objfn_array_fill(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    double from;
+    double to;
+    LitArray* array;
+    LitArrayJob job;
+    LIT_ENSURE_MIN_ARGS(vm->state, 1);
+    array = lit_value_asarray(instance);
+    from = fmax(0, lit_value_getnumber(vm, argv, argc, 1, 0));
+    to = fmin(lit_vallist_count(&array->list), lit_value_getnumber(vm, argv, argc, 2, lit_vallist_count(&array->list)));
+    if(from < to)
+    {
+        job.value = argv[0];
+        array_job_run(vm->state, &job, array, (size_t)from, (size_t)to, array_task_fill);
+        array_job_end(&job);
+    }
+    return instance;
+}
+
+static LitValue objfn_array_sum(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    size_t i;
+    double sum;
+    LitArray* array;
+    LitArrayJob job;
+    (void)argc;
+    (void)argv;
+    array = lit_value_asarray(instance);
+    array_job_run(vm->state, &job, array, 0, lit_vallist_count(&array->list), array_task_sum);
+    sum = 0;
+    for(i = 0; i < job.chunks; i++)
+    {
+        sum += job.partial[i];
+    }
+    array_job_end(&job);
+    if(job.notnumber != SIZE_MAX)
+    {
+        lit_vm_raiseexitingerror(vm, "Array.sum: element %i is not a number", (int)job.notnumber);
+    }
+    return lit_value_numbertovalue(vm->state, sum);
+}
+
+static LitValue array_minmax(LitVM* vm, LitValue instance, bool max)
+{
+    size_t i;
+    double v;
+    double best;
+    LitArray* array;
+    LitArrayJob job;
+    job.max = max;
+    array = lit_value_asarray(instance);
+    array_job_run(vm->state, &job, array, 0, lit_vallist_count(&array->list), array_task_minmax);
+    best = 0;
+    if(job.notnumber == SIZE_MAX && job.chunks > 0)
+    {
+        /* like a plain loop would: a leading nan never compares as better, so it sticks */
+        best = lit_value_asnumber(job.values[0]);
+        if(!isnan(best))
+        {
+            for(i = 0; i < job.chunks; i++)
+            {
+                v = job.partial[i];
+                if((max ? (v > best) : (v < best)) || isnan(best))
+                {
+                    best = v;
+                }
+            }
+        }
+    }
+    array_job_end(&job);
+    if(job.notnumber != SIZE_MAX)
+    {
+        lit_vm_raiseexitingerror(vm, "Array.%s: element %i is not a number", max ? "max" : "min", (int)job.notnumber);
+    }
+    if(job.chunks == 0)
+    {
+        return NULL_VALUE;
+    }
+    return lit_value_numbertovalue(vm->state, best);
+}
+
+static LitValue objfn_array_min(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)argc;
+    (void)argv;
+    return array_minmax(vm, instance, false);
+}
+
+static LitValue objfn_array_max(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)argc;
+    (void)argv;
+    return array_minmax(vm, instance, true);
+}
+
 static LitValue objfn_array_clone(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
 {
     (void)argc;
@@ -678,7 +1036,7 @@ static LitValue objfn_array_tostring(LitVM* vm, LitValue instance, size_t argc,
     LIT_FREE(vm->state, sizeof(LitString*), values_converted);
     // should be lit_string_take, but it doesn't get picked up by the GC for some reason
     //rt = lit_string_take(vm->state, buffer, olength);
-    rt = lit_string_take(vm->state, buffer, olength, true);
+    rt = lit_string_take(vm->state, buffer, sdslen(buffer), true);
     return lit_value_objectvalue(rt);
 }
 
@@ -723,14 +1081,21 @@ void lit_open_array_library(LitState* state)
         lit_class_bindmethod(state, klass, "indexOf", objfn_array_indexof);
         lit_class_bindmethod(state, klass, "contains", objfn_array_contains);
         lit_class_bindmethod(state, klass, "clear", objfn_array_clear);
+        lit_class_bindmethod(state, klass, "reserve", objfn_array_reserve);
+        lit_class_bindmethod(state, klass, "shrinkToFit", objfn_array_shrinktofit);
         lit_class_bindmethod(state, klass, "iterator", objfn_array_iterator);
         lit_class_bindmethod(state, klass, "iteratorValue", objfn_array_iteratorvalue);
         lit_class_bindmethod(state, klass, "join", objfn_array_join);
         lit_class_bindmethod(state, klass, "sort", objfn_array_sort);
+        lit_class_bindmethod(state, klass, "fill", objfn_array_fill);
+        lit_class_bindmethod(state, klass, "sum", objfn_array_sum);
+        lit_class_bindmethod(state, klass, "min", objfn_array_min);
+        lit_class_bindmethod(state, klass, "max", objfn_array_max);
         lit_class_bindmethod(state, klass, "clone", objfn_array_clone);
         lit_class_bindmethod(state, klass, "toString", objfn_array_tostring);
         lit_class_bindmethod(state, klass, "pop", objfn_array_pop);
         lit_class_bindgetset(state, klass, "length", objfn_array_length, NULL, false);
+        lit_class_bindgetset(state, klass, "capacity", objfn_array_capacity, NULL, false);
         state->arrayvalue_class = klass;
     }
     lit_state_setglobal(state, klass->name, lit_value_objectvalue(klass));
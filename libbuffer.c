@@ -0,0 +1,510 @@
+
+#include "lit.h"
+#include "sds.h"
+#ifdef LIT_OS_UNIX_LIKE
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+#endif
+
+/*
+* Buffer: a growable byte array with separate read and write cursors.
+* reads and writes of multi-byte values are little-endian, unless the
+* optional last argument (bigEndian) is true.
+* Buffer.map(path) wraps a file read-only, through mmap where available.
+*/
+
+LitBuffer* lit_create_buffer(LitState* state, size_t capacity)
+{
+    uint8_t* data;
+    LitBuffer* buffer;
+    // allocate the bytes first, in case it triggers the GC
+    data = NULL;
+    if(capacity > 0)
+    {
+        data = (uint8_t*)LIT_ALLOCATE(state, sizeof(uint8_t), capacity);
+    }
+    buffer = (LitBuffer*)lit_gcmem_allocobject(state, sizeof(LitBuffer), LITTYPE_BUFFER, false);
+    buffer->data = data;
+    buffer->length = 0;
+    buffer->capacity = capacity;
+    buffer->readpos = 0;
+    buffer->writepos = 0;
+    buffer->readonly = false;
+    buffer->mapped = false;
+    return buffer;
+}
+
+void lit_buffer_destroy(LitState* state, LitBuffer* buffer)
+{
+    if(buffer->mapped)
+    {
+        #ifdef LIT_OS_UNIX_LIKE
+            if(buffer->data != NULL)
+            {
+                munmap(buffer->data, buffer->length);
+            }
+        #endif
+    }
+    else if(buffer->data != NULL)
+    {
+        LIT_FREE_ARRAY(state, sizeof(uint8_t), buffer->data, buffer->capacity);
+    }
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+}
+
+/* makes room for at least size bytes. mapped buffers are never resized, so check readonly first */
+void lit_buffer_ensurecapacity(LitState* state, LitBuffer* buffer, size_t size)
+{
+    size_t capacity;
+    if(buffer->capacity >= size)
+    {
+        return;
+    }
+    capacity = LIT_GROW_CAPACITY(buffer->capacity);
+    if(capacity < size)
+    {
+        capacity = size;
+    }
+    buffer->data = (uint8_t*)LIT_GROW_ARRAY(state, buffer->data, sizeof(uint8_t), buffer->capacity, capacity);
+    buffer->capacity = capacity;
+}
+
+/* moves the write cursor after count bytes were stored at it */
+void lit_buffer_commitwrite(LitBuffer* buffer, size_t count)
+{
+    buffer->writepos += count;
+    if(buffer->writepos > buffer->length)
+    {
+        buffer->length = buffer->writepos;
+    }
+}
+
+/* maps path read-only; falls back to reading the whole file where mmap is not available */
+LitBuffer* lit_buffer_mapfile(LitState* state, const char* path)
+{
+    LitBuffer* buffer;
+    #ifdef LIT_OS_UNIX_LIKE
+        int fd;
+        void* map;
+        struct stat st;
+        fd = open(path, O_RDONLY);
+        if(fd == -1)
+        {
+            return NULL;
+        }
+        if(fstat(fd, &st) == -1)
+        {
+            close(fd);
+            return NULL;
+        }
+        map = NULL;
+        if(st.st_size > 0)
+        {
+            map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(map == MAP_FAILED)
+            {
+                close(fd);
+                return NULL;
+            }
+        }
+        close(fd);
+        buffer = lit_create_buffer(state, 0);
+        buffer->data = (uint8_t*)map;
+        buffer->length = (size_t)st.st_size;
+        buffer->writepos = buffer->length;
+        buffer->mapped = true;
+    #else
+        size_t length;
+        FILE* fh;
+        fh = fopen(path, "rb");
+        if(fh == NULL)
+        {
+            return NULL;
+        }
+        fseek(fh, 0, SEEK_END);
+        length = (size_t)ftell(fh);
+        fseek(fh, 0, SEEK_SET);
+        buffer = lit_create_buffer(state, length);
+        buffer->length = fread(buffer->data, sizeof(uint8_t), length, fh);
+        buffer->writepos = buffer->length;
+        fclose(fh);
+    #endif
+    buffer->readonly = true;
+    return buffer;
+}
+
+static void buffer_checkwritable(LitVM* vm, LitBuffer* buffer)
+{
+    if(buffer->readonly)
+    {
+        lit_vm_raiseexitingerror(vm, "cannot write to a read-only Buffer");
+    }
+}
+
+static uint64_t buffer_readraw(LitVM* vm, LitBuffer* buffer, size_t size, bool bigendian)
+{
+    size_t i;
+    uint64_t value;
+    uint8_t* bytes;
+    if(buffer->readpos + size > buffer->length)
+    {
+        lit_vm_raiseexitingerror(vm, "Buffer read of %i bytes at position %i is out of range", (int)size, (int)buffer->readpos);
+    }
+    bytes = buffer->data + buffer->readpos;
+    value = 0;
+    for(i = 0; i < size; i++)
+    {
+        if(bigendian)
+        {
+            value = (value << 8) | bytes[i];
+        }
+        else
+        {
+            value |= (uint64_t)bytes[i] << (8 * i);
+        }
+    }
+    buffer->readpos += size;
+    return value;
+}
+
+static void buffer_writeraw(LitVM* vm, LitBuffer* buffer, uint64_t value, size_t size, bool bigendian)
+{
+    size_t i;
+    uint8_t* bytes;
+    buffer_checkwritable(vm, buffer);
+    lit_buffer_ensurecapacity(vm->state, buffer, buffer->writepos + size);
+    bytes = buffer->data + buffer->writepos;
+    for(i = 0; i < size; i++)
+    {
+        bytes[i] = (uint8_t)(value >> (8 * (bigendian ? (size - 1 - i) : i)));
+    }
+    lit_buffer_commitwrite(buffer, size);
+}
+
+static LitValue objfn_buffer_constructor(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    LitBuffer* buffer;
+    LitString* string;
+    (void)instance;
+    if(argc > 0 && lit_value_isstring(argv[0]))
+    {
+        string = lit_value_asstring(argv[0]);
+        buffer = lit_create_buffer(vm->state, lit_string_getlength(string));
+        memcpy(buffer->data, string->chars, lit_string_getlength(string));
+        lit_buffer_commitwrite(buffer, lit_string_getlength(string));
+        return lit_value_objectvalue(buffer);
+    }
+    return lit_value_objectvalue(lit_create_buffer(vm->state, (size_t)fmax(0, lit_value_getnumber(vm, argv, argc, 0, 0))));
+}
+
+static LitValue objfn_buffer_map(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    const char* path;
+    LitBuffer* buffer;
+    (void)instance;
+    path = lit_value_checkstring(vm, argv, argc, 0);
+    buffer = lit_buffer_mapfile(vm->state, path);
+    if(buffer == NULL)
+    {
+        lit_vm_raiseexitingerror(vm, "failed to map file '%s' (C error: %s)", path, strerror(errno));
+    }
+    return lit_value_objectvalue(buffer);
+}
+
+static LitValue objfn_buffer_subscript(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    double index;
+    LitBuffer* buffer;
+    buffer = lit_value_asbuffer(instance);
+    index = lit_value_checknumber(vm, argv, argc, 0);
+    if(index < 0)
+    {
+        index += buffer->length;
+    }
+    if(argc == 2)
+    {
+        buffer_checkwritable(vm, buffer);
+        if(!(index >= 0 && index < buffer->length))
+        {
+            lit_vm_raiseexitingerror(vm, "Buffer index %g out of range", index);
+        }
+        buffer->data[(size_t)index] = (uint8_t)lit_typedarray_toint(lit_value_checknumber(vm, argv, argc, 1));
+        return argv[1];
+    }
+    if(!(index >= 0 && index < buffer->length))
+    {
+        return NULL_VALUE;
+    }
+    return lit_value_numbertovalue(vm->state, buffer->data[(size_t)index]);
+}
+
+static LitValue objfn_buffer_reserve(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    double size;
+    LitBuffer* buffer;
+    buffer = lit_value_asbuffer(instance);
+    size = lit_value_checknumber(vm, argv, argc, 0);
+    buffer_checkwritable(vm, buffer);
+    if(size > 0)
+    {
+        lit_buffer_ensurecapacity(vm->state, buffer, (size_t)size);
+    }
+    return instance;
+}
+
+static LitValue objfn_buffer_clear(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    LitBuffer* buffer;
+    (void)argc;
+    (void)argv;
+    buffer = lit_value_asbuffer(instance);
+    buffer_checkwritable(vm, buffer);
+    buffer->length = 0;
+    buffer->readpos = 0;
+    buffer->writepos = 0;
+    return instance;
+}
+
+static LitValue objfn_buffer_readuint8(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)argc;
+    (void)argv;
+    return lit_value_numbertovalue(vm->state, (uint8_t)buffer_readraw(vm, lit_value_asbuffer(instance), 1, false));
+}
+
+static LitValue objfn_buffer_readint8(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)argc;
+    (void)argv;
+    return lit_value_numbertovalue(vm->state, (int8_t)buffer_readraw(vm, lit_value_asbuffer(instance), 1, false));
+}
+
+static LitValue objfn_buffer_readuint16(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    return lit_value_numbertovalue(vm->state, (uint16_t)buffer_readraw(vm, lit_value_asbuffer(instance), 2, lit_value_getbool(vm, argv, argc, 0, false)));
+}
+
+static LitValue objfn_buffer_readint16(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    return lit_value_numbertovalue(vm->state, (int16_t)buffer_readraw(vm, lit_value_asbuffer(instance), 2, lit_value_getbool(vm, argv, argc, 0, false)));
+}
+
+static LitValue objfn_buffer_readuint32(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    return lit_value_numbertovalue(vm->state, (uint32_t)buffer_readraw(vm, lit_value_asbuffer(instance), 4, lit_value_getbool(vm, argv, argc, 0, false)));
+}
+
+static LitValue objfn_buffer_readint32(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    return lit_value_numbertovalue(vm->state, (int32_t)buffer_readraw(vm, lit_value_asbuffer(instance), 4, lit_value_getbool(vm, argv, argc, 0, false)));
+}
+
+static LitValue objfn_buffer_readfloat32(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    float f;
+    uint32_t raw;
+    raw = (uint32_t)buffer_readraw(vm, lit_value_asbuffer(instance), 4, lit_value_getbool(vm, argv, argc, 0, false));
+    memcpy(&f, &raw, sizeof(f));
+    return lit_value_numbertovalue(vm->state, f);
+}
+
+static LitValue objfn_buffer_readfloat64(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    double d;
+    uint64_t raw;
+    raw = buffer_readraw(vm, lit_value_asbuffer(instance), 8, lit_value_getbool(vm, argv, argc, 0, false));
+    memcpy(&d, &raw, sizeof(d));
+    return lit_value_numbertovalue(vm->state, d);
+}
+
+static LitValue objfn_buffer_readstring(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    double count;
+    LitBuffer* buffer;
+    LitString* string;
+    buffer = lit_value_asbuffer(instance);
+    count = lit_value_getnumber(vm, argv, argc, 0, buffer->length - buffer->readpos);
+    if(count < 0 || buffer->readpos + (size_t)count > buffer->length)
+    {
+        lit_vm_raiseexitingerror(vm, "Buffer read of %i bytes at position %i is out of range", (int)count, (int)buffer->readpos);
+    }
+    string = lit_string_copy(vm->state, (const char*)buffer->data + buffer->readpos, (size_t)count);
+    buffer->readpos += (size_t)count;
+    return lit_value_objectvalue(string);
+}
+
+static LitValue objfn_buffer_writeuint8(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    buffer_writeraw(vm, lit_value_asbuffer(instance), (uint64_t)lit_typedarray_toint(lit_value_checknumber(vm, argv, argc, 0)), 1, false);
+    return instance;
+}
+
+static LitValue objfn_buffer_writeuint16(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    buffer_writeraw(vm, lit_value_asbuffer(instance), (uint64_t)lit_typedarray_toint(lit_value_checknumber(vm, argv, argc, 0)), 2, lit_value_getbool(vm, argv, argc, 1, false));
+    return instance;
+}
+
+static LitValue objfn_buffer_writeuint32(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    buffer_writeraw(vm, lit_value_asbuffer(instance), (uint64_t)lit_typedarray_toint(lit_value_checknumber(vm, argv, argc, 0)), 4, lit_value_getbool(vm, argv, argc, 1, false));
+    return instance;
+}
+
+static LitValue objfn_buffer_writefloat32(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    float f;
+    uint32_t raw;
+    f = (float)lit_value_checknumber(vm, argv, argc, 0);
+    memcpy(&raw, &f, sizeof(raw));
+    buffer_writeraw(vm, lit_value_asbuffer(instance), raw, 4, lit_value_getbool(vm, argv, argc, 1, false));
+    return instance;
+}
+
+static LitValue objfn_buffer_writefloat64(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    double d;
+    uint64_t raw;
+    d = lit_value_checknumber(vm, argv, argc, 0);
+    memcpy(&raw, &d, sizeof(raw));
+    buffer_writeraw(vm, lit_value_asbuffer(instance), raw, 8, lit_value_getbool(vm, argv, argc, 1, false));
+    return instance;
+}
+
+static LitValue objfn_buffer_writestring(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    size_t length;
+    LitBuffer* buffer;
+    LitString* string;
+    buffer = lit_value_asbuffer(instance);
+    lit_value_checkstring(vm, argv, argc, 0);
+    string = lit_value_asstring(argv[0]);
+    length = lit_string_getlength(string);
+    buffer_checkwritable(vm, buffer);
+    lit_buffer_ensurecapacity(vm->state, buffer, buffer->writepos + length);
+    memcpy(buffer->data + buffer->writepos, string->chars, length);
+    lit_buffer_commitwrite(buffer, length);
+    return instance;
+}
+
+static LitValue objfn_buffer_length(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)argc;
+    (void)argv;
+    return lit_value_numbertovalue(vm->state, lit_value_asbuffer(instance)->length);
+}
+
+static LitValue objfn_buffer_capacity(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)argc;
+    (void)argv;
+    return lit_value_numbertovalue(vm->state, lit_value_asbuffer(instance)->capacity);
+}
+
+static LitValue objfn_buffer_remaining(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    LitBuffer* buffer;
+    (void)argc;
+    (void)argv;
+    buffer = lit_value_asbuffer(instance);
+    return lit_value_numbertovalue(vm->state, buffer->length - buffer->readpos);
+}
+
+static LitValue objfn_buffer_readonly(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)argc;
+    (void)argv;
+    return lit_bool_to_value(vm->state, lit_value_asbuffer(instance)->readonly);
+}
+
+static LitValue objfn_buffer_position(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)argc;
+    (void)argv;
+    return lit_value_numbertovalue(vm->state, lit_value_asbuffer(instance)->readpos);
+}
+
+static LitValue objfn_buffer_set_position(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    double pos;
+    LitBuffer* buffer;
+    buffer = lit_value_asbuffer(instance);
+    pos = lit_value_checknumber(vm, argv, argc, 0);
+    buffer->readpos = (size_t)fmin(fmax(0, pos), buffer->length);
+    return argv[0];
+}
+
+static LitValue objfn_buffer_writeposition(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)argc;
+    (void)argv;
+    return lit_value_numbertovalue(vm->state, lit_value_asbuffer(instance)->writepos);
+}
+
+static LitValue objfn_buffer_set_writeposition(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    double pos;
+    LitBuffer* buffer;
+    buffer = lit_value_asbuffer(instance);
+    pos = lit_value_checknumber(vm, argv, argc, 0);
+    buffer->writepos = (size_t)fmin(fmax(0, pos), buffer->length);
+    return argv[0];
+}
+
+static LitValue objfn_buffer_tostring(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    LitBuffer* buffer;
+    (void)argc;
+    (void)argv;
+    buffer = lit_value_asbuffer(instance);
+    return lit_value_objectvalue(lit_string_format(vm->state, "Buffer(#)", (double)buffer->length));
+}
+
+void lit_open_buffer_library(LitState* state)
+{
+    LitClass* klass;
+    klass = lit_create_classobject(state, "Buffer");
+    {
+        lit_class_inheritfrom(state, klass, state->objectvalue_class);
+        lit_class_bindconstructor(state, klass, objfn_buffer_constructor);
+        lit_class_bindstaticmethod(state, klass, "map", objfn_buffer_map);
+        lit_class_bindmethod(state, klass, "[]", objfn_buffer_subscript);
+        lit_class_bindmethod(state, klass, "reserve", objfn_buffer_reserve);
+        lit_class_bindmethod(state, klass, "clear", objfn_buffer_clear);
+        lit_class_bindmethod(state, klass, "readUint8", objfn_buffer_readuint8);
+        lit_class_bindmethod(state, klass, "readInt8", objfn_buffer_readint8);
+        lit_class_bindmethod(state, klass, "readUint16", objfn_buffer_readuint16);
+        lit_class_bindmethod(state, klass, "readInt16", objfn_buffer_readint16);
+        lit_class_bindmethod(state, klass, "readUint32", objfn_buffer_readuint32);
+        lit_class_bindmethod(state, klass, "readInt32", objfn_buffer_readint32);
+        lit_class_bindmethod(state, klass, "readFloat32", objfn_buffer_readfloat32);
+        lit_class_bindmethod(state, klass, "readFloat64", objfn_buffer_readfloat64);
+        lit_class_bindmethod(state, klass, "readString", objfn_buffer_readstring);
+        /* the int writers wrap, so they serve both the signed and unsigned variants */
+        lit_class_bindmethod(state, klass, "writeUint8", objfn_buffer_writeuint8);
+        lit_class_bindmethod(state, klass, "writeInt8", objfn_buffer_writeuint8);
+        lit_class_bindmethod(state, klass, "writeUint16", objfn_buffer_writeuint16);
+        lit_class_bindmethod(state, klass, "writeInt16", objfn_buffer_writeuint16);
+        lit_class_bindmethod(state, klass, "writeUint32", objfn_buffer_writeuint32);
+        lit_class_bindmethod(state, klass, "writeInt32", objfn_buffer_writeuint32);
+        lit_class_bindmethod(state, klass, "writeFloat32", objfn_buffer_writefloat32);
+        lit_class_bindmethod(state, klass, "writeFloat64", objfn_buffer_writefloat64);
+        lit_class_bindmethod(state, klass, "writeString", objfn_buffer_writestring);
+        lit_class_bindmethod(state, klass, "toString", objfn_buffer_tostring);
+        lit_class_bindgetset(state, klass, "length", objfn_buffer_length, NULL, false);
+        lit_class_bindgetset(state, klass, "capacity", objfn_buffer_capacity, NULL, false);
+        lit_class_bindgetset(state, klass, "remaining", objfn_buffer_remaining, NULL, false);
+        lit_class_bindgetset(state, klass, "readonly", objfn_buffer_readonly, NULL, false);
+        lit_class_bindgetset(state, klass, "position", objfn_buffer_position, objfn_buffer_set_position, false);
+        lit_class_bindgetset(state, klass, "writePosition", objfn_buffer_writeposition, objfn_buffer_set_writeposition, false);
+        state->buffervalue_class = klass;
+    }
+    lit_state_setglobal(state, klass->name, lit_value_objectvalue(klass));
+    if(klass->super == NULL)
+    {
+        lit_class_inheritfrom(state, klass, state->objectvalue_class);
+    };
+}
@@ -168,7 +168,7 @@ static LitValue objfn_class_iterator(LitVM* vm, LitValue instance, size_t argc,
     LIT_ENSURE_ARGS(vm->state, 1);
     klass = lit_value_asclass(instance);
     index = argv[0] == NULL_VALUE ? -1 : lit_value_asnumber(argv[0]);
-    mthcap = (int)klass->methods.capacity;
+    mthcap = (int)klass->methods.capacity + 1;
     fields = index >= mthcap;
     value = util_table_iterator(fields ? &klass->static_fields : &klass->methods, fields ? index - mthcap : index);
     if(value == -1)
@@ -198,7 +198,7 @@ static LitValue objfn_class_iteratorvalue(LitVM* vm, LitValue instance, size_t a
     LitClass* klass;
     index = lit_value_checknumber(vm, argv, argc, 0);
     klass = lit_value_asclass(instance);
-    mthcap = klass->methods.capacity;
+    mthcap = klass->methods.capacity + 1;
     fields = index >= mthcap;
     return util_table_iterator_key(fields ? &klass->static_fields : &klass->methods, fields ? index - mthcap : index);
 }
@@ -11,14 +11,14 @@
 #endif
 #include "lit.h"
 
-static bool should_update_locals;
-
 
 void lit_open_libraries(LitState* state)
 {
     lit_open_math_library(state);
     lit_open_file_library(state);
     lit_open_gc_library(state);
+    lit_open_serializer_library(state);
+    lit_open_worker_library(state);
 }
 
 #if 0
@@ -108,7 +108,8 @@ bool util_is_fiber_done(LitFiber* fiber)
     return fiber->frame_count == 0 || fiber->abort;
 }
 
-void util_run_fiber(LitVM* vm, LitFiber* fiber, LitValue* argv, size_t argc, bool catcher)
+/* returns false, without switching to it, while the fiber still waits in a receive() */
+bool util_run_fiber(LitVM* vm, LitFiber* fiber, LitValue* argv, size_t argc, bool catcher)
 {
     bool vararg;
     int i;
@@ -121,6 +122,10 @@ void util_run_fiber(LitVM* vm, LitFiber* fiber, LitValue* argv, size_t argc, boo
     {
         lit_vm_raiseexitingerror(vm, "Fiber already finished executing");
     }
+    if(!lit_value_isnull(fiber->waiting) && !lit_worker_resume(vm, fiber))
+    {
+        return false;
+    }
     fiber->parent = vm->fiber;
     fiber->catcher = catcher;
     vm->fiber = fiber;
@@ -154,6 +159,7 @@ void util_run_fiber(LitVM* vm, LitFiber* fiber, LitValue* argv, size_t argc, boo
             }
         }
     }
+    return true;
 }
 
 static inline bool compare(LitState* state, LitValue a, LitValue b)
@@ -222,10 +228,8 @@ bool util_interpret(LitVM* vm, LitModule* module)
     return true;
 }
 
-static bool compile_and_interpret(LitVM* vm, LitString* modname, char* source, size_t len)
+static bool interpret_compiled(LitVM* vm, LitModule* module)
 {
-    LitModule* module;
-    module = lit_state_compilemodule(vm->state, modname, source, len);
     if(module == NULL)
     {
         return false;
@@ -234,6 +238,11 @@ static bool compile_and_interpret(LitVM* vm, LitString* modname, char* source, s
     return util_interpret(vm, module);
 }
 
+static bool compile_and_interpret(LitVM* vm, LitString* modname, char* source, size_t len)
+{
+    return interpret_compiled(vm, lit_state_compilemodule(vm->state, modname, source, len));
+}
+
 bool util_test_file_exists(const char* filename)
 {
     struct stat buffer;
@@ -245,6 +254,7 @@ bool util_attempt_to_require(LitVM* vm, LitValue* argv, size_t argc, const char*
 {
     bool rt;
     bool found;
+    bool mapped;
     size_t i;
     size_t flen;
     size_t length;
@@ -255,7 +265,7 @@ bool util_attempt_to_require(LitVM* vm, LitValue* argv, size_t argc, const char*
     char* modnamedotted;
     found = false;
     length = strlen(path);
-    should_update_locals = false;
+    vm->should_update_locals = false;
     if(path[length - 2] == '.' && path[length - 1] == '*')
     {
         if(folders)
@@ -368,7 +378,7 @@ bool util_attempt_to_require(LitVM* vm, LitValue* argv, size_t argc, const char*
             {
                 if(util_interpret(vm, loaded_module))
                 {
-                    should_update_locals = true;
+                    vm->should_update_locals = true;
                 }
             }
             return true;
@@ -383,16 +393,15 @@ bool util_attempt_to_require(LitVM* vm, LitValue* argv, size_t argc, const char*
             return false;
         }
     }
-    source = lit_util_readfile(modname, &flen);
+    source = lit_util_mapfile(modname, &flen, &mapped);
     if(source == NULL)
     {
         return false;
     }
-    if(compile_and_interpret(vm, name, source, flen))
+    if(interpret_compiled(vm, lit_state_compilemapped(vm->state, name, source, flen, mapped)))
     {
-        should_update_locals = true;
+        vm->should_update_locals = true;
     }
-    free(source);
     return true;
 }
 
@@ -491,7 +500,8 @@ static LitValue cfn_print(LitVM* vm, size_t argc, LitValue* argv)
     for(i = 0; i < argc; i++)
     {
         sv = lit_value_tostring(vm->state, argv[i]);
-        written += fwrite(sv->chars, sizeof(char), lit_string_getlength(sv), stdout);
+        lit_writer_writestringl(&vm->state->stdoutwriter, sv->chars, lit_string_getlength(sv));
+        written += lit_string_getlength(sv);
     }
     return lit_value_numbertovalue(vm->state, written);
 }
@@ -500,7 +510,7 @@ static LitValue cfn_println(LitVM* vm, size_t argc, LitValue* argv)
 {
     LitValue r;
     r = cfn_print(vm, argc, argv);
-    fprintf(stdout, "\n");
+    lit_writer_writebyte(&vm->state->stdoutwriter, '\n');
     return r;
 }
 
@@ -529,7 +539,7 @@ static bool cfn_require(LitVM* vm, size_t argc, LitValue* argv)
     // First lit_parser_check, if a file with this name exists in the local path
     if(util_attempt_to_require(vm, argv, argc, name->chars, ignore_previous, false))
     {
-        return should_update_locals;
+        return vm->should_update_locals;
     }
     // If not, we join the path of the current module to it (the path goes all the way from the root)
     modname = vm->fiber->module->name;
@@ -545,7 +555,7 @@ static bool cfn_require(LitVM* vm, size_t argc, LitValue* argv)
         if(util_attempt_to_require_combined(vm, argv, argc, (const char*)&buffer, name->chars, ignore_previous))
         {
             free(buffer);
-            return should_update_locals;
+            return vm->should_update_locals;
         }
         else
         {
@@ -557,10 +567,30 @@ static bool cfn_require(LitVM* vm, size_t argc, LitValue* argv)
 }
 #endif
 
+/* per-opcode counters; null unless built with LIT_OPCODE_STATS */
+static LitValue objfn_vm_stats(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)instance;
+    (void)argc;
+    (void)argv;
+    return lit_opstats_tovalue(vm->state);
+}
+
+static LitValue objfn_vm_resetstats(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)instance;
+    (void)argc;
+    (void)argv;
+    lit_opstats_reset(vm->state);
+    return NULL_VALUE;
+}
+
 void lit_open_string_library(LitState* state);
 void lit_open_array_library(LitState* state);
 void lit_open_map_library(LitState* state);
 void lit_open_range_library(LitState* state);
+void lit_open_typedarray_library(LitState* state);
+void lit_open_buffer_library(LitState* state);
 void lit_open_fiber_library(LitState* state);
 void lit_open_module_library(LitState* state);
 void lit_open_function_library(LitState* state);
@@ -582,6 +612,8 @@ void lit_open_core_library(LitState* state)
         lit_open_array_library(state);
         lit_open_map_library(state);
         lit_open_range_library(state);
+        lit_open_typedarray_library(state);
+        lit_open_buffer_library(state);
         lit_open_fiber_library(state);
         lit_open_module_library(state);
         lit_open_function_library(state);
@@ -617,6 +649,16 @@ void lit_open_core_library(LitState* state)
             lit_class_inheritfrom(state, klass, state->objectvalue_class);
         };
     }
+    {
+        klass = lit_create_classobject(state, "VM");
+        {
+            lit_class_inheritfrom(state, klass, state->objectvalue_class);
+            lit_class_bindconstructor(state, klass, util_invalid_constructor);
+            lit_class_bindstaticmethod(state, klass, "stats", objfn_vm_stats);
+            lit_class_bindstaticmethod(state, klass, "resetStats", objfn_vm_resetstats);
+        }
+        lit_state_setglobal(state, klass->name, lit_value_objectvalue(klass));
+    }
     {
         lit_state_defnativefunc(state, "time", cfn_time);
         lit_state_defnativefunc(state, "systemTime", cfn_systemTime);
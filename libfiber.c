@@ -31,7 +31,9 @@ LitFiber* lit_create_fiber(LitState* state, LitModule* module, LitFunction* func
     fiber->module = module;
     fiber->catcher = false;
     fiber->lit_emitter_raiseerror = NULL_VALUE;
+    fiber->waiting = NULL_VALUE;
     fiber->open_upvalues = NULL;
+    fiber->open_upvalue_top = 0;
     fiber->abort = false;
     frame = &fiber->frames[0];
     frame->closure = NULL;
@@ -39,25 +41,57 @@ LitFiber* lit_create_fiber(LitState* state, LitModule* module, LitFunction* func
     frame->slots = fiber->stack;
     frame->result_ignored = false;
     frame->return_to_c = false;
+    frame->tail_calls = 0;
     if(function != NULL)
     {
+        if(function->image != NULL)
+        {
+            lit_ioutil_loadconstants(state, function);
+        }
         frame->ip = function->chunk.code;
     }
     return fiber;
 }
 
+/*
+* keeps the open upvalue index as large as the stack, and points the open upvalues
+* at the (possibly moved) stack. must run after the stack itself was reallocated,
+* and after stack_top and the frames were rebased, since growing the index may collect.
+*/
+static void lit_resize_fiber_upvalues(LitState* state, LitFiber* fiber, size_t old_capacity)
+{
+    size_t i;
+    if(fiber->open_upvalues == NULL)
+    {
+        return;
+    }
+    for(i = 0; i < fiber->open_upvalue_top; i++)
+    {
+        if(fiber->open_upvalues[i] != NULL)
+        {
+            fiber->open_upvalues[i]->location = fiber->stack + i;
+        }
+    }
+    fiber->open_upvalues = (LitUpvalue**)LIT_GROW_ARRAY(state, fiber->open_upvalues, sizeof(LitUpvalue*), old_capacity, fiber->stack_capacity);
+    for(i = old_capacity; i < fiber->stack_capacity; i++)
+    {
+        fiber->open_upvalues[i] = NULL;
+    }
+}
+
 void lit_ensure_fiber_stack(LitState* state, LitFiber* fiber, size_t needed)
 {
     size_t i;
     size_t capacity;
+    size_t old_capacity;
     LitValue* old_stack;
-    LitUpvalue* upvalue;
     if(fiber->stack_capacity >= needed)
     {
         return;
     }
     capacity = (size_t)lit_util_closestpowof2((int)needed);
     old_stack = fiber->stack;
+    old_capacity = fiber->stack_capacity;
     fiber->stack = (LitValue*)lit_gcmem_memrealloc(state, fiber->stack, sizeof(LitValue) * fiber->stack_capacity, sizeof(LitValue) * capacity);
     fiber->stack_capacity = capacity;
     if(fiber->stack != old_stack)
@@ -67,12 +101,73 @@ void lit_ensure_fiber_stack(LitState* state, LitFiber* fiber, size_t needed)
             LitCallFrame* frame = &fiber->frames[i];
             frame->slots = fiber->stack + (frame->slots - old_stack);
         }
-        for(upvalue = fiber->open_upvalues; upvalue != NULL; upvalue = upvalue->next)
+        fiber->stack_top = fiber->stack + (fiber->stack_top - old_stack);
+    }
+    lit_resize_fiber_upvalues(state, fiber, old_capacity);
+}
+
+/*
+* the reverse of lit_ensure_fiber_stack: once deep recursion has unwound, give the
+* frame and stack memory back. only call this where the interpreter re-reads its
+* frame afterwards, since both arrays may move.
+*/
+void lit_shrink_fiber_stack(LitState* state, LitFiber* fiber)
+{
+    size_t i;
+    size_t needed;
+    size_t capacity;
+    size_t old_capacity;
+    LitValue* old_stack;
+    LitCallFrame* frame;
+    if(fiber->frame_capacity > LIT_INITIAL_CALL_FRAMES && LIT_SHOULD_SHRINK(fiber->frame_count, fiber->frame_capacity))
+    {
+        capacity = fiber->frame_count * 2;
+        if(capacity < LIT_INITIAL_CALL_FRAMES)
+        {
+            capacity = LIT_INITIAL_CALL_FRAMES;
+        }
+        fiber->frames = (LitCallFrame*)lit_gcmem_memrealloc(state, fiber->frames, sizeof(LitCallFrame) * fiber->frame_capacity, sizeof(LitCallFrame) * capacity);
+        fiber->frame_capacity = capacity;
+    }
+    if(fiber->frame_count == 0 || fiber->frames[fiber->frame_count - 1].function == NULL)
+    {
+        return;
+    }
+    frame = &fiber->frames[fiber->frame_count - 1];
+    needed = (size_t)(fiber->stack_top - fiber->stack) + frame->function->max_slots + 1;
+    if(!LIT_SHOULD_SHRINK(needed, fiber->stack_capacity))
+    {
+        return;
+    }
+    capacity = (size_t)lit_util_closestpowof2((int)(needed * 2));
+    old_stack = fiber->stack;
+    old_capacity = fiber->stack_capacity;
+    fiber->stack = (LitValue*)lit_gcmem_memrealloc(state, fiber->stack, sizeof(LitValue) * fiber->stack_capacity, sizeof(LitValue) * capacity);
+    fiber->stack_capacity = capacity;
+    if(fiber->stack != old_stack)
+    {
+        for(i = 0; i < fiber->frame_count; i++)
         {
-            upvalue->location = fiber->stack + (upvalue->location - old_stack);
+            frame = &fiber->frames[i];
+            frame->slots = fiber->stack + (frame->slots - old_stack);
         }
         fiber->stack_top = fiber->stack + (fiber->stack_top - old_stack);
     }
+    lit_resize_fiber_upvalues(state, fiber, old_capacity);
+}
+
+/*
+* switches back to the fiber that ran the current one, where run() returns value.
+* argv are the arguments of the primitive doing the switch.
+*/
+void lit_fiber_yieldtoparent(LitVM* vm, LitValue* argv, LitValue value)
+{
+    LitFiber* fiber;
+    fiber = vm->fiber;
+    vm->fiber = vm->fiber->parent;
+    vm->fiber->stack_top -= fiber->arg_count;
+    vm->fiber->stack_top[-1] = value;
+    argv[-1] = NULL_VALUE;
 }
 
 static LitValue objfn_fiber_constructor(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
@@ -120,17 +215,23 @@ static LitValue objfn_fiber_current(LitVM* vm, LitValue instance, size_t argc, L
 }
 
 
+/* a fiber waiting in receive() is not resumed until there is something to receive; run() returns null then */
 static bool objfn_fiber_run(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
 {
-    (void)instance;
-    util_run_fiber(vm, lit_value_asfiber(instance), argv, argc, false);
+    if(!util_run_fiber(vm, lit_value_asfiber(instance), argv, argc, false))
+    {
+        argv[-1] = NULL_VALUE;
+    }
     return true;
 }
 
 
 static bool objfn_fiber_try(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
 {
-    util_run_fiber(vm, lit_value_asfiber(instance), argv, argc, true);
+    if(!util_run_fiber(vm, lit_value_asfiber(instance), argv, argc, true))
+    {
+        argv[-1] = NULL_VALUE;
+    }
     return true;
 }
 
@@ -145,13 +246,7 @@ static bool objfn_fiber_yield(LitVM* vm, LitValue instance, size_t argc, LitValu
         return true;
     }
 
-    LitFiber* fiber = vm->fiber;
-
-    vm->fiber = vm->fiber->parent;
-    vm->fiber->stack_top -= fiber->arg_count;
-    vm->fiber->stack_top[-1] = argc == 0 ? NULL_VALUE : lit_value_objectvalue(lit_value_tostring(vm->state, argv[0]));
-
-    argv[-1] = NULL_VALUE;
+    lit_fiber_yieldtoparent(vm, argv, argc == 0 ? NULL_VALUE : lit_value_objectvalue(lit_value_tostring(vm->state, argv[0])));
     return true;
 }
 
@@ -166,13 +261,7 @@ static bool objfn_fiber_yeet(LitVM* vm, LitValue instance, size_t argc, LitValue
         return true;
     }
 
-    LitFiber* fiber = vm->fiber;
-
-    vm->fiber = vm->fiber->parent;
-    vm->fiber->stack_top -= fiber->arg_count;
-    vm->fiber->stack_top[-1] = argc == 0 ? NULL_VALUE : lit_value_objectvalue(lit_value_tostring(vm->state, argv[0]));
-
-    argv[-1] = NULL_VALUE;
+    lit_fiber_yieldtoparent(vm, argv, argc == 0 ? NULL_VALUE : lit_value_objectvalue(lit_value_tostring(vm->state, argv[0])));
     return true;
 }
 
@@ -11,6 +11,11 @@
 #include "dirwrap.h"
 #include "lit.h"
 #include "sds.h"
+#ifdef LIT_OS_UNIX_LIKE
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+#endif
 
 #if defined (S_IFDIR) && !defined (S_ISDIR)
     #define	S_ISDIR(m)	(((m)&S_IFMT) == S_IFDIR)	/* directory */
@@ -39,11 +44,6 @@ struct LitStdioHandle
 
 typedef void(*CleanupFunc)(LitState*, LitUserdata*, bool);
 
-static uint8_t g_tmpbyte;
-static uint16_t g_tmpshort;
-static uint32_t g_tmpint;
-static double g_tmpdouble;
-
 static void* lit_util_instancedataset(LitVM* vm, LitValue instance, size_t typsz, CleanupFunc cleanup)
 {
     LitUserdata* userdata = lit_create_userdata(vm->state, typsz, false);
@@ -84,6 +84,95 @@ char* lit_util_readfile(const char* path, size_t* dlen)
     return buffer;
 }
 
+/* whole pages holding length bytes and the zero byte after them */
+static size_t lit_util_mapsize(size_t length)
+{
+    #ifdef LIT_OS_UNIX_LIKE
+        size_t page;
+        page = (size_t)sysconf(_SC_PAGESIZE);
+        return (length + 1 + page - 1) / page * page;
+    #else
+        return length + 1;
+    #endif
+}
+
+/*
+* maps a source file read-only, followed by at least one zero byte (the scanner
+* stops at '\0'). falls back to lit_util_readfile where that isn't possible;
+* mapped tells lit_util_unmapfile which one it was.
+*/
+char* lit_util_mapfile(const char* path, size_t* dlen, bool* mapped)
+{
+    *mapped = false;
+    #ifdef LIT_OS_UNIX_LIKE
+        int fd;
+        size_t size;
+        size_t total;
+        void* base;
+        struct stat st;
+        fd = open(path, O_RDONLY);
+        if(fd == -1)
+        {
+            return NULL;
+        }
+        if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        {
+            close(fd);
+            return lit_util_readfile(path, dlen);
+        }
+        size = (size_t)st.st_size;
+        total = lit_util_mapsize(size);
+        // reserve zeroed pages past the end first, for when the file ends right at a page boundary
+        base = mmap(NULL, total, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(base == MAP_FAILED)
+        {
+            close(fd);
+            return lit_util_readfile(path, dlen);
+        }
+        if(mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+        {
+            munmap(base, total);
+            close(fd);
+            return lit_util_readfile(path, dlen);
+        }
+        close(fd);
+        madvise(base, size, MADV_SEQUENTIAL);
+        *dlen = size;
+        *mapped = true;
+        return (char*)base;
+    #else
+        return lit_util_readfile(path, dlen);
+    #endif
+}
+
+void lit_util_unmapfile(char* source, size_t length, bool mapped)
+{
+    if(!mapped)
+    {
+        free(source);
+        return;
+    }
+    #ifdef LIT_OS_UNIX_LIKE
+        munmap(source, lit_util_mapsize(length));
+    #endif
+}
+
+/* the stream behind a File object, for natives that read or write it themselves */
+FILE* lit_fs_getfilehandle(LitVM* vm, LitValue file)
+{
+    LitFileData* data;
+    if(!lit_value_isinstance(file))
+    {
+        lit_vm_raiseexitingerror(vm, "expected a File, got a %s", lit_tostring_typename(file));
+    }
+    data = (LitFileData*)lit_util_instancedataget(vm, file);
+    if(!data->isopen || data->handle == NULL)
+    {
+        lit_vm_raiseexitingerror(vm, "the file is closed");
+    }
+    return data->handle;
+}
+
 bool lit_fs_fileexists(const char* path)
 {
     struct stat buffer;
@@ -141,33 +230,41 @@ size_t lit_ioutil_writestring(FILE* file, LitString* string)
 uint8_t lit_ioutil_readuint8(FILE* file)
 {
     size_t rt;
+    uint8_t value;
     (void)rt;
-    rt = fread(&g_tmpbyte, sizeof(uint8_t), 1, file);
-    return g_tmpbyte;
+    value = 0;
+    rt = fread(&value, sizeof(uint8_t), 1, file);
+    return value;
 }
 
 uint16_t lit_ioutil_readuint16(FILE* file)
 {
     size_t rt;
+    uint16_t value;
     (void)rt;
-    rt = fread(&g_tmpshort, sizeof(uint16_t), 1, file);
-    return g_tmpshort;
+    value = 0;
+    rt = fread(&value, sizeof(uint16_t), 1, file);
+    return value;
 }
 
 uint32_t lit_ioutil_readuint32(FILE* file)
 {
     size_t rt;
+    uint32_t value;
     (void)rt;
-    rt = fread(&g_tmpint, sizeof(uint32_t), 1, file);
-    return g_tmpint;
+    value = 0;
+    rt = fread(&value, sizeof(uint32_t), 1, file);
+    return value;
 }
 
 double lit_ioutil_readdouble(FILE* file)
 {
     size_t rt;
+    double value;
     (void)rt;
-    rt = fread(&g_tmpdouble, sizeof(double), 1, file);
-    return g_tmpdouble;
+    value = 0;
+    rt = fread(&value, sizeof(double), 1, file);
+    return value;
 }
 
 LitString* lit_ioutil_readstring(LitState* state, FILE* file)
@@ -202,19 +299,23 @@ uint8_t lit_emufile_readuint8(LitEmulatedFile* file)
     return (uint8_t)file->source[file->position++];
 }
 
+/* the operands of | are unsequenced, so each byte is read in a statement of its own */
 uint16_t lit_emufile_readuint16(LitEmulatedFile* file)
 {
-    return (uint16_t)(lit_emufile_readuint8(file) | (lit_emufile_readuint8(file) << 8u));
+    uint16_t value;
+    value = lit_emufile_readuint8(file);
+    value |= (uint16_t)(lit_emufile_readuint8(file) << 8u);
+    return value;
 }
 
 uint32_t lit_emufile_readuint32(LitEmulatedFile* file)
 {
-    return (uint32_t)(
-        lit_emufile_readuint8(file) |
-        (lit_emufile_readuint8(file) << 8u) |
-        (lit_emufile_readuint8(file) << 16u) |
-        (lit_emufile_readuint8(file) << 24u)
-    );
+    uint32_t value;
+    value = lit_emufile_readuint8(file);
+    value |= (uint32_t)lit_emufile_readuint8(file) << 8u;
+    value |= (uint32_t)lit_emufile_readuint8(file) << 16u;
+    value |= (uint32_t)lit_emufile_readuint8(file) << 24u;
+    return value;
 }
 
 double lit_emufile_readdouble(LitEmulatedFile* file)
@@ -248,19 +349,8 @@ LitString* lit_emufile_readstring(LitState* state, LitEmulatedFile* file)
     return lit_string_take(state, line, length, false);
 }
 
-static void lit_ioutil_writechunk(FILE* file, LitChunk* chunk);
 static void lit_ioutil_readchunk(LitState* state, LitEmulatedFile* file, LitModule* module, LitChunk* chunk);
 
-static void lit_ioutil_writefunction(FILE* file, LitFunction* function)
-{
-    lit_ioutil_writechunk(file, &function->chunk);
-    lit_ioutil_writestring(file, function->name);
-    lit_ioutil_writeuint8(file, function->arg_count);
-    lit_ioutil_writeuint16(file, function->upvalue_count);
-    lit_ioutil_writeuint8(file, (uint8_t)function->vararg);
-    lit_ioutil_writeuint16(file, (uint16_t)function->max_slots);
-}
-
 static LitFunction* lit_ioutil_readfunction(LitState* state, LitEmulatedFile* file, LitModule* module)
 {
     LitFunction* function;
@@ -270,69 +360,12 @@ static LitFunction* lit_ioutil_readfunction(LitState* state, LitEmulatedFile* fi
     function->arg_count = lit_emufile_readuint8(file);
     function->upvalue_count = lit_emufile_readuint16(file);
     function->vararg = (bool)lit_emufile_readuint8(file);
+    /* version 0 did not record whether '...' is used */
+    function->vararg_used = function->vararg;
     function->max_slots = lit_emufile_readuint16(file);
     return function;
 }
 
-static void lit_ioutil_writechunk(FILE* file, LitChunk* chunk)
-{
-    size_t i;
-    size_t c;
-    LitObjType type;
-    LitValue constant;
-    lit_ioutil_writeuint32(file, chunk->count);
-    for(i = 0; i < chunk->count; i++)
-    {
-        lit_ioutil_writeuint8(file, chunk->code[i]);
-    }
-    if(chunk->has_line_info)
-    {
-        c = chunk->line_count * 2 + 2;
-        lit_ioutil_writeuint32(file, c);
-        for(i = 0; i < c; i++)
-        {
-            lit_ioutil_writeuint16(file, chunk->lines[i]);
-        }
-    }
-    else
-    {
-        lit_ioutil_writeuint32(file, 0);
-    }
-    lit_ioutil_writeuint32(file, lit_vallist_count(&chunk->constants));
-    for(i = 0; i < lit_vallist_count(&chunk->constants); i++)
-    {
-        constant = lit_vallist_get(&chunk->constants, i);
-        if(lit_value_isobject(constant))
-        {
-            type = lit_value_asobject(constant)->type;
-            lit_ioutil_writeuint8(file, (uint8_t)(type + 1));
-            switch(type)
-            {
-                case LITTYPE_STRING:
-                    {
-                        lit_ioutil_writestring(file, lit_value_asstring(constant));
-                    }
-                    break;
-                case LITTYPE_FUNCTION:
-                    {
-                        lit_ioutil_writefunction(file, lit_value_asfunction(constant));
-                    }
-                    break;
-                default:
-                    {
-                        UNREACHABLE
-                    }
-                    break;
-            }
-        }
-        else
-        {
-            lit_ioutil_writeuint8(file, 0);
-            lit_ioutil_writedouble(file, lit_value_asnumber(constant));
-        }
-    }
-}
-
 static void lit_ioutil_readchunk(LitState* state, LitEmulatedFile* file, LitModule* module, LitChunk* chunk)
 {
     size_t i;
@@ -405,56 +438,24 @@ static void lit_ioutil_readchunk(LitState* state, LitEmulatedFile* file, LitModu
     }
 }
 
-void lit_ioutil_writemodule(LitModule* module, FILE* file)
-{
-    size_t i;
-    bool disabled;
-    LitTable* privates;
-    disabled = lit_astopt_isoptenabled(LITOPTSTATE_PRIVATE_NAMES);
-    lit_ioutil_writestring(file, module->name);
-    lit_ioutil_writeuint16(file, module->private_count);
-    lit_ioutil_writeuint8(file, (uint8_t)disabled);
-    if(!disabled)
-    {
-        privates = &module->private_names->values;
-        for(i = 0; i < module->private_count; i++)
-        {
-            if(privates->entries[i].key != NULL)
-            {
-                lit_ioutil_writestring(file, privates->entries[i].key);
-                lit_ioutil_writeuint16(file, (uint16_t)lit_value_asnumber(privates->entries[i].value));
-            }
-        }
-    }
-    lit_ioutil_writefunction(file, module->main_function);
-}
-
-LitModule* lit_ioutil_readmodule(LitState* state, const char* input, size_t len)
+/* version 0 images, read field by field */
+static LitModule* lit_ioutil_readlegacy(LitState* state, const char* input, size_t len)
 {
     bool enabled;
     uint16_t i;
     uint16_t j;
     uint16_t module_count;
     uint16_t privates_count;
-    uint8_t bytecode_version;
     LitString* name;
     LitTable* privates;
     LitModule* module;
+    LitModule* first;
     LitEmulatedFile file;
     lit_emufile_init(&file, input, len);
-    if(lit_emufile_readuint16(&file) != LIT_BYTECODE_MAGIC_NUMBER)
-    {
-        lit_state_raiseerror(state, COMPILE_ERROR, "Failed to read compiled code, unknown magic number");
-        return NULL;
-    }
-    bytecode_version = lit_emufile_readuint8(&file);
-    if(bytecode_version > LIT_BYTECODE_VERSION)
-    {
-        lit_state_raiseerror(state, COMPILE_ERROR, "Failed to read compiled code, unknown bytecode version '%i'", (int)bytecode_version);
-        return NULL;
-    }
+    lit_emufile_readuint16(&file);
+    lit_emufile_readuint8(&file);
     module_count = lit_emufile_readuint16(&file);
-    LitModule* first = NULL;
+    first = NULL;
     for(j = 0; j < module_count; j++)
     {
         module = lit_create_module(state, lit_emufile_readstring(state, &file));
@@ -487,6 +488,572 @@ LitModule* lit_ioutil_readmodule(LitState* state, const char* input, size_t len)
     return first;
 }
 
+/* appends size bytes at the next multiple of alignment, and returns their offset in the image */
+static uint32_t lit_ioutil_imageappend(LitState* state, LitByteList* out, size_t base, const void* data, size_t size, size_t alignment)
+{
+    size_t i;
+    size_t offset;
+    while(out->count % alignment != 0)
+    {
+        lit_bytelist_push(state, out, 0);
+    }
+    offset = base + out->count;
+    for(i = 0; i < size; i++)
+    {
+        lit_bytelist_push(state, out, ((const uint8_t*)data)[i]);
+    }
+    return (uint32_t)offset;
+}
+
+/* strings are stored once per image, as a length followed by the characters and a terminating zero */
+static uint32_t lit_ioutil_imagestring(LitState* state, LitByteList* out, size_t base, LitTable* strings, LitString* string)
+{
+    uint32_t length;
+    uint32_t offset;
+    LitValue existing;
+    if(string == NULL)
+    {
+        return 0;
+    }
+    if(lit_table_get(strings, string, &existing))
+    {
+        return (uint32_t)lit_value_asnumber(existing);
+    }
+    length = lit_string_getlength(string);
+    offset = lit_ioutil_imageappend(state, out, base, &length, sizeof(uint32_t), 8);
+    lit_ioutil_imageappend(state, out, base, string->chars, length + 1, 1);
+    lit_table_set(state, strings, string, lit_value_numbertovalue(state, offset));
+    return offset;
+}
+
+/* lists every function reachable from the modules, parents before their children */
+static void lit_ioutil_collectfunctions(LitState* state, LitModule** modules, size_t module_count, LitValueList* functions)
+{
+    size_t i;
+    size_t j;
+    LitValue constant;
+    LitChunk* chunk;
+    LitField* field;
+    for(i = 0; i < module_count; i++)
+    {
+        lit_vallist_push(state, functions, lit_value_objectvalue(modules[i]->main_function));
+    }
+    for(i = 0; i < lit_vallist_count(functions); i++)
+    {
+        chunk = &lit_value_asfunction(lit_vallist_get(functions, i))->chunk;
+        for(j = 0; j < lit_vallist_count(&chunk->constants); j++)
+        {
+            constant = lit_vallist_get(&chunk->constants, j);
+            if(lit_value_isfunction(constant))
+            {
+                lit_vallist_push(state, functions, constant);
+            }
+            else if(lit_value_isfield(constant))
+            {
+                field = lit_value_asfield(constant);
+                if(field->getter != NULL)
+                {
+                    lit_vallist_push(state, functions, lit_value_objectvalue(field->getter));
+                }
+                if(field->setter != NULL)
+                {
+                    lit_vallist_push(state, functions, lit_value_objectvalue(field->setter));
+                }
+            }
+        }
+    }
+}
+
+static void lit_ioutil_imagefunction(LitState* state, LitByteList* out, size_t base, LitTable* strings, LitFunction* function, LitBytecodeFunction* record, uint32_t* next_function)
+{
+    size_t i;
+    size_t count;
+    LitValue constant;
+    LitChunk* chunk;
+    LitField* field;
+    LitBytecodeConstant* constants;
+    chunk = &function->chunk;
+    memset(record, 0, sizeof(LitBytecodeFunction));
+    record->name = lit_ioutil_imagestring(state, out, base, strings, function->name);
+    record->arg_count = function->arg_count;
+    record->upvalue_count = function->upvalue_count;
+    record->max_slots = (uint16_t)function->max_slots;
+    record->flags = (function->vararg ? LIT_BYTECODE_FUNCTION_VARARG : 0) | (function->vararg_used ? LIT_BYTECODE_FUNCTION_VARARG_USED : 0);
+    record->code = lit_ioutil_imageappend(state, out, base, chunk->code, chunk->count, 8);
+    record->code_count = chunk->count;
+    if(chunk->has_line_info && chunk->lines != NULL)
+    {
+        record->flags |= LIT_BYTECODE_FUNCTION_LINES;
+        record->lines = lit_ioutil_imageappend(state, out, base, chunk->lines, (chunk->line_count * 2 + 2) * sizeof(uint16_t), 8);
+        record->line_count = chunk->line_count;
+    }
+    count = lit_vallist_count(&chunk->constants);
+    if(count == 0)
+    {
+        return;
+    }
+    constants = (LitBytecodeConstant*)calloc(count, sizeof(LitBytecodeConstant));
+    for(i = 0; i < count; i++)
+    {
+        constant = lit_vallist_get(&chunk->constants, i);
+        if(lit_value_isstring(constant))
+        {
+            constants[i].type = LIT_BYTECODE_CONST_STRING;
+            constants[i].ref = lit_ioutil_imagestring(state, out, base, strings, lit_value_asstring(constant));
+        }
+        else if(lit_value_isfunction(constant))
+        {
+            constants[i].type = LIT_BYTECODE_CONST_FUNCTION;
+            constants[i].ref = (*next_function)++;
+        }
+        else if(lit_value_isfield(constant))
+        {
+            /* in the same order lit_ioutil_collectfunctions listed them */
+            field = lit_value_asfield(constant);
+            constants[i].type = LIT_BYTECODE_CONST_FIELD;
+            constants[i].ref = field->getter == NULL ? 0 : ++(*next_function);
+            constants[i].value = field->setter == NULL ? 0 : ++(*next_function);
+        }
+        else if(lit_value_isobject(constant))
+        {
+            UNREACHABLE
+        }
+        else
+        {
+            constants[i].type = LIT_BYTECODE_CONST_VALUE;
+            constants[i].value = constant;
+        }
+    }
+    record->constants = lit_ioutil_imageappend(state, out, base, constants, count * sizeof(LitBytecodeConstant), 8);
+    record->constant_count = count;
+    free(constants);
+}
+
+/* writes a version 1 image holding the given modules, the first one being the one that runs */
+bool lit_ioutil_writeimage(LitState* state, LitModule** modules, size_t module_count, FILE* file)
+{
+    bool ok;
+    bool allowed_gc;
+    size_t i;
+    size_t j;
+    size_t base;
+    uint32_t count;
+    uint32_t pair[2];
+    uint32_t next_function;
+    LitTable* privates;
+    LitTable strings;
+    LitByteList out;
+    LitValueList functions;
+    LitBytecodeHeader header;
+    LitBytecodeModule* module_records;
+    LitBytecodeFunction* function_records;
+    allowed_gc = state->allow_gc;
+    state->allow_gc = false;
+    lit_vallist_init(&functions);
+    lit_ioutil_collectfunctions(state, modules, module_count, &functions);
+    base = sizeof(LitBytecodeHeader) + module_count * sizeof(LitBytecodeModule) + lit_vallist_count(&functions) * sizeof(LitBytecodeFunction);
+    module_records = (LitBytecodeModule*)calloc(module_count, sizeof(LitBytecodeModule));
+    function_records = (LitBytecodeFunction*)calloc(lit_vallist_count(&functions), sizeof(LitBytecodeFunction));
+    lit_table_init(state, &strings);
+    lit_bytelist_init(&out);
+    for(i = 0; i < module_count; i++)
+    {
+        module_records[i].name = lit_ioutil_imagestring(state, &out, base, &strings, modules[i]->name);
+        module_records[i].main_function = i;
+        module_records[i].private_count = modules[i]->private_count;
+        if(lit_astopt_isoptenabled(state, LITOPTSTATE_PRIVATE_NAMES))
+        {
+            continue;
+        }
+        privates = &modules[i]->private_names->values;
+        /* the names go first, so that the pairs can follow the count directly */
+        for(j = 0; j < (size_t)privates->capacity; j++)
+        {
+            lit_ioutil_imagestring(state, &out, base, &strings, privates->entries[j].key);
+        }
+        count = privates->count;
+        module_records[i].private_names = lit_ioutil_imageappend(state, &out, base, &count, sizeof(uint32_t), 8);
+        for(j = 0; j < (size_t)privates->capacity; j++)
+        {
+            if(privates->entries[j].key != NULL)
+            {
+                pair[0] = lit_ioutil_imagestring(state, &out, base, &strings, privates->entries[j].key);
+                pair[1] = (uint32_t)lit_value_asnumber(privates->entries[j].value);
+                lit_ioutil_imageappend(state, &out, base, pair, sizeof(pair), sizeof(uint32_t));
+            }
+        }
+    }
+    next_function = module_count;
+    for(i = 0; i < lit_vallist_count(&functions); i++)
+    {
+        lit_ioutil_imagefunction(state, &out, base, &strings, lit_value_asfunction(lit_vallist_get(&functions, i)), &function_records[i], &next_function);
+    }
+    lit_ioutil_imageappend(state, &out, base, NULL, 0, 8);
+    memset(&header, 0, sizeof(LitBytecodeHeader));
+    header.magic = LIT_BYTECODE_MAGIC_NUMBER;
+    header.version = LIT_BYTECODE_VERSION;
+    header.size = base + out.count;
+    header.module_count = module_count;
+    header.function_count = lit_vallist_count(&functions);
+    ok = fwrite(&header, sizeof(LitBytecodeHeader), 1, file) == 1
+        && fwrite(module_records, sizeof(LitBytecodeModule), module_count, file) == module_count
+        && fwrite(function_records, sizeof(LitBytecodeFunction), header.function_count, file) == header.function_count
+        && fwrite(out.values, 1, out.count, file) == out.count;
+    free(module_records);
+    free(function_records);
+    lit_bytelist_destroy(state, &out);
+    lit_table_destroy(state, &strings);
+    lit_vallist_destroy(state, &functions);
+    state->allow_gc = allowed_gc;
+    return ok;
+}
+
+static bool lit_ioutil_checkrange(size_t length, uint32_t offset, uint64_t count, size_t size, size_t alignment)
+{
+    return offset != 0 && offset % alignment == 0 && (uint64_t)offset + count * size <= length;
+}
+
+static bool lit_ioutil_checkstring(const char* data, size_t length, uint32_t offset)
+{
+    uint32_t count;
+    if(!lit_ioutil_checkrange(length, offset, 1, sizeof(uint32_t), sizeof(uint32_t)))
+    {
+        return false;
+    }
+    memcpy(&count, data + offset, sizeof(uint32_t));
+    return (uint64_t)offset + sizeof(uint32_t) + count < length && data[offset + sizeof(uint32_t) + count] == '\0';
+}
+
+/*
+* a closure over nested is created in the code of function: it captures from function's
+* slots and upvalues, and its OP_CLOSURE takes two bytes for every one of them.
+*/
+static bool lit_ioutil_checkcaptures(const LitBytecodeFunction* function, const LitBytecodeFunction* nested)
+{
+    return nested->upvalue_count <= (uint32_t)function->max_slots + function->upvalue_count
+        && (uint64_t)nested->upvalue_count * 2 < function->code_count;
+}
+
+/*
+* checks the tables of a version 1 image in one go (offsets, counts, references, and
+* that slot and upvalue counts fit together), so nothing has to be checked again while
+* functions are created from it. the code itself is not verified: an image whose
+* bytecode was tampered with can still misbehave. returns NULL if the image is fine,
+* or what is wrong with it.
+*/
+static const char* lit_ioutil_validateimage(const char* data, size_t length)
+{
+    size_t i;
+    size_t j;
+    uint32_t count;
+    const uint32_t* pairs;
+    const LitBytecodeHeader* header;
+    const LitBytecodeModule* modules;
+    const LitBytecodeFunction* functions;
+    const LitBytecodeFunction* function;
+    const LitBytecodeConstant* constants;
+    header = (const LitBytecodeHeader*)data;
+    if(header->size != length)
+    {
+        return "the file is truncated";
+    }
+    if(sizeof(LitBytecodeHeader) + (uint64_t)header->module_count * sizeof(LitBytecodeModule) + (uint64_t)header->function_count * sizeof(LitBytecodeFunction) > length)
+    {
+        return "the module or function table is out of bounds";
+    }
+    modules = (const LitBytecodeModule*)(data + sizeof(LitBytecodeHeader));
+    functions = (const LitBytecodeFunction*)(modules + header->module_count);
+    for(i = 0; i < header->module_count; i++)
+    {
+        if(!lit_ioutil_checkstring(data, length, modules[i].name) || modules[i].main_function >= header->function_count
+           || functions[modules[i].main_function].upvalue_count != 0)
+        {
+            return "a module record is invalid";
+        }
+        if(modules[i].private_names == 0)
+        {
+            continue;
+        }
+        if(!lit_ioutil_checkrange(length, modules[i].private_names, 1, sizeof(uint32_t), 8))
+        {
+            return "a private name table is out of bounds";
+        }
+        memcpy(&count, data + modules[i].private_names, sizeof(uint32_t));
+        pairs = (const uint32_t*)(data + modules[i].private_names) + 1;
+        if(!lit_ioutil_checkrange(length, modules[i].private_names + sizeof(uint32_t), count, sizeof(uint32_t) * 2, sizeof(uint32_t)))
+        {
+            return "a private name table is out of bounds";
+        }
+        for(j = 0; j < count; j++)
+        {
+            if(!lit_ioutil_checkstring(data, length, pairs[j * 2]) || pairs[j * 2 + 1] >= modules[i].private_count)
+            {
+                return "a private name is invalid";
+            }
+        }
+    }
+    for(i = 0; i < header->function_count; i++)
+    {
+        function = &functions[i];
+        if((function->name != 0 && !lit_ioutil_checkstring(data, length, function->name))
+           || !lit_ioutil_checkrange(length, function->code, function->code_count, sizeof(uint8_t), 8) || function->code_count == 0)
+        {
+            return "a function record is invalid";
+        }
+        /* the arguments (and the function itself) live in its slots, and captures are deduplicated by (local or not, byte index) */
+        if(function->arg_count + 1 > function->max_slots || function->upvalue_count > UINT8_COUNT * 2)
+        {
+            return "a function record is invalid";
+        }
+        if((function->flags & LIT_BYTECODE_FUNCTION_LINES) != 0
+           && !lit_ioutil_checkrange(length, function->lines, (uint64_t)function->line_count * 2 + 2, sizeof(uint16_t), 8))
+        {
+            return "a line table is out of bounds";
+        }
+        if(function->constant_count == 0)
+        {
+            continue;
+        }
+        if(!lit_ioutil_checkrange(length, function->constants, function->constant_count, sizeof(LitBytecodeConstant), 8))
+        {
+            return "a constant table is out of bounds";
+        }
+        constants = (const LitBytecodeConstant*)(data + function->constants);
+        for(j = 0; j < function->constant_count; j++)
+        {
+            if((constants[j].type == LIT_BYTECODE_CONST_STRING && !lit_ioutil_checkstring(data, length, constants[j].ref))
+               || (constants[j].type == LIT_BYTECODE_CONST_FUNCTION && (constants[j].ref >= header->function_count
+                   || !lit_ioutil_checkcaptures(function, &functions[constants[j].ref])))
+               || (constants[j].type == LIT_BYTECODE_CONST_FIELD && (constants[j].ref > header->function_count || constants[j].value > header->function_count))
+               || constants[j].type > LIT_BYTECODE_CONST_FIELD)
+            {
+                return "a constant is invalid";
+            }
+        }
+    }
+    return NULL;
+}
+
+static LitString* lit_ioutil_loadstring(LitState* state, const char* data, uint32_t offset)
+{
+    uint32_t length;
+    if(offset == 0)
+    {
+        return NULL;
+    }
+    memcpy(&length, data + offset, sizeof(uint32_t));
+    return lit_string_copy(state, data + offset + sizeof(uint32_t), length);
+}
+
+/* the code and lines are used in place; the constants wait for the first call */
+static LitFunction* lit_ioutil_loadfunction(LitState* state, LitBytecodeImage* image, uint32_t index, LitModule* module)
+{
+    LitFunction* function;
+    const LitBytecodeFunction* record;
+    record = &image->functions[index];
+    function = lit_create_function(state, module);
+    function->name = lit_ioutil_loadstring(state, image->data, record->name);
+    function->arg_count = record->arg_count;
+    function->upvalue_count = record->upvalue_count;
+    function->max_slots = record->max_slots;
+    function->vararg = (record->flags & LIT_BYTECODE_FUNCTION_VARARG) != 0;
+    function->vararg_used = (record->flags & LIT_BYTECODE_FUNCTION_VARARG_USED) != 0;
+    function->chunk.mapped = true;
+    function->chunk.code = (uint8_t*)(image->data + record->code);
+    function->chunk.count = record->code_count;
+    function->chunk.has_line_info = (record->flags & LIT_BYTECODE_FUNCTION_LINES) != 0;
+    if(function->chunk.has_line_info)
+    {
+        function->chunk.lines = (uint16_t*)(image->data + record->lines);
+        function->chunk.line_count = record->line_count;
+    }
+    if(record->constant_count > 0)
+    {
+        function->image = image;
+        function->image_function = record;
+    }
+    return function;
+}
+
+/* creates the constants (and the functions nested in it) of a function loaded from an image */
+void lit_ioutil_loadconstants(LitState* state, LitFunction* function)
+{
+    bool allowed_gc;
+    size_t i;
+    LitValue value;
+    LitFunction* getter;
+    LitFunction* setter;
+    LitBytecodeImage* image;
+    const LitBytecodeFunction* record;
+    const LitBytecodeConstant* constants;
+    image = function->image;
+    record = function->image_function;
+    function->image = NULL;
+    function->image_function = NULL;
+    allowed_gc = state->allow_gc;
+    state->allow_gc = false;
+    constants = (const LitBytecodeConstant*)(image->data + record->constants);
+    lit_vallist_ensuresize(state, &function->chunk.constants, record->constant_count);
+    for(i = 0; i < record->constant_count; i++)
+    {
+        switch(constants[i].type)
+        {
+            case LIT_BYTECODE_CONST_STRING:
+                {
+                    value = lit_value_objectvalue(lit_ioutil_loadstring(state, image->data, constants[i].ref));
+                }
+                break;
+            case LIT_BYTECODE_CONST_FUNCTION:
+                {
+                    value = lit_value_objectvalue(lit_ioutil_loadfunction(state, image, constants[i].ref, function->module));
+                }
+                break;
+            case LIT_BYTECODE_CONST_FIELD:
+                {
+                    getter = constants[i].ref == 0 ? NULL : lit_ioutil_loadfunction(state, image, constants[i].ref - 1, function->module);
+                    setter = constants[i].value == 0 ? NULL : lit_ioutil_loadfunction(state, image, constants[i].value - 1, function->module);
+                    value = lit_value_objectvalue(lit_create_field(state, (LitObject*)getter, (LitObject*)setter));
+                }
+                break;
+            default:
+                {
+                    value = (LitValue)constants[i].value;
+                }
+                break;
+        }
+        lit_vallist_set(&function->chunk.constants, i, value);
+    }
+    state->allow_gc = allowed_gc;
+}
+
+bool lit_ioutil_isimage(const char* data, size_t length)
+{
+    return length >= sizeof(uint16_t) + sizeof(uint8_t) && (((uint8_t)data[1] << 8) | (uint8_t)data[0]) == LIT_BYTECODE_MAGIC_NUMBER;
+}
+
+/*
+* takes over an image read (or mapped) by lit_util_mapfile. a version 1 image is
+* validated once and then kept by the state: functions run straight from it, and
+* their strings and constants are only created on their first call.
+*/
+LitModule* lit_ioutil_loadimage(LitState* state, char* data, size_t length, bool mapped)
+{
+    bool allowed_gc;
+    size_t i;
+    size_t j;
+    uint8_t version;
+    uint32_t count;
+    char* copy;
+    const char* error;
+    const uint32_t* pairs;
+    const LitBytecodeHeader* header;
+    const LitBytecodeModule* records;
+    LitModule* module;
+    LitModule* first;
+    LitBytecodeImage* image;
+    version = (uint8_t)data[2];
+    if(version == 0)
+    {
+        first = lit_ioutil_readlegacy(state, data, length);
+        lit_util_unmapfile(data, length, mapped);
+        return first;
+    }
+    if(version > LIT_BYTECODE_VERSION)
+    {
+        lit_state_raiseerror(state, COMPILE_ERROR, "Failed to read compiled code, unknown bytecode version '%i'", (int)version);
+        lit_util_unmapfile(data, length, mapped);
+        return NULL;
+    }
+    error = length < sizeof(LitBytecodeHeader) ? "the file is truncated" : lit_ioutil_validateimage(data, length);
+    if(error != NULL)
+    {
+        lit_state_raiseerror(state, COMPILE_ERROR, "Failed to read compiled code, %s", error);
+        lit_util_unmapfile(data, length, mapped);
+        return NULL;
+    }
+    #ifdef LIT_OS_UNIX_LIKE
+        // OP_VARARG patches the argument count of the call after it, so the pages have to be copy-on-write
+        if(mapped)
+        {
+            if(mprotect(data, length, PROT_READ | PROT_WRITE) == 0)
+            {
+                madvise(data, length, MADV_NORMAL);
+            }
+            else
+            {
+                copy = (char*)malloc(length + 1);
+                memcpy(copy, data, length);
+                copy[length] = '\0';
+                lit_util_unmapfile(data, length, mapped);
+                data = copy;
+                mapped = false;
+            }
+        }
+    #endif
+    header = (const LitBytecodeHeader*)data;
+    records = (const LitBytecodeModule*)(data + sizeof(LitBytecodeHeader));
+    image = (LitBytecodeImage*)malloc(sizeof(LitBytecodeImage));
+    image->data = data;
+    image->length = length;
+    image->mapped = mapped;
+    image->functions = (const LitBytecodeFunction*)(records + header->module_count);
+    image->next = state->images;
+    state->images = image;
+    allowed_gc = state->allow_gc;
+    state->allow_gc = false;
+    first = NULL;
+    for(i = 0; i < header->module_count; i++)
+    {
+        module = lit_create_module(state, lit_ioutil_loadstring(state, data, records[i].name));
+        module->privates = LIT_ALLOCATE(state, sizeof(LitValue), records[i].private_count);
+        module->private_count = records[i].private_count;
+        for(j = 0; j < module->private_count; j++)
+        {
+            module->privates[j] = NULL_VALUE;
+        }
+        if(records[i].private_names != 0)
+        {
+            memcpy(&count, data + records[i].private_names, sizeof(uint32_t));
+            pairs = (const uint32_t*)(data + records[i].private_names) + 1;
+            for(j = 0; j < count; j++)
+            {
+                lit_table_set(state, &module->private_names->values, lit_ioutil_loadstring(state, data, pairs[j * 2]), lit_value_numbertovalue(state, pairs[j * 2 + 1]));
+            }
+        }
+        module->main_function = lit_ioutil_loadfunction(state, image, records[i].main_function, module);
+        lit_table_set(state, &state->vm->modules->values, module->name, lit_value_objectvalue(module));
+        if(i == 0)
+        {
+            first = module;
+        }
+    }
+    state->allow_gc = allowed_gc;
+    return first;
+}
+
+/* reads an image the caller keeps ownership of, so it gets its own copy */
+LitModule* lit_ioutil_readmodule(LitState* state, const char* input, size_t len)
+{
+    char* data;
+    data = (char*)malloc(len + 1);
+    memcpy(data, input, len);
+    data[len] = '\0';
+    return lit_ioutil_loadimage(state, data, len, false);
+}
+
+void lit_ioutil_releaseimages(LitState* state)
+{
+    LitBytecodeImage* image;
+    LitBytecodeImage* next;
+    for(image = state->images; image != NULL; image = next)
+    {
+        next = image->next;
+        lit_util_unmapfile(image->data, image->length, image->mapped);
+        free(image);
+    }
+    state->images = NULL;
+}
+
 
 /*
  * File
@@ -693,7 +1260,7 @@ static LitValue objmethod_file_readall(LitVM* vm, LitValue instance, size_t argc
         */
         sdsIncrLen(result->chars, actuallength);
     }
-    result->hash = lit_util_hashstring(result->chars, actuallength);
+    result->hash = lit_util_hashstring(vm->state, result->chars, actuallength);
     lit_state_regstring(vm->state, result);
     return lit_value_objectvalue(result);
 }
@@ -766,6 +1333,87 @@ static LitValue objmethod_file_readstring(LitVM* vm, LitValue instance, size_t a
     return string == NULL ? NULL_VALUE : lit_value_objectvalue(string);
 }
 
+/*
+ * ==
+ * bulk I/O: a single fread/fwrite between the file and a Buffer, or the raw bytes of a typed array
+ */
+
+static LitValue objmethod_file_readinto(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    long here;
+    long end;
+    size_t count;
+    size_t actual;
+    LitBuffer* buffer;
+    LitTypedArray* typed;
+    LitFileData* data;
+    data = (LitFileData*)lit_util_instancedataget(vm, instance);
+    if(argc > 0 && lit_value_istypedarray(argv[0]))
+    {
+        typed = lit_value_astypedarray(argv[0]);
+        actual = fread(typed->data, sizeof(uint8_t), typed->length * lit_typedarray_elemsize(typed->kind), data->handle);
+        return lit_value_numbertovalue(vm->state, actual);
+    }
+    if(argc == 0 || !lit_value_isbuffer(argv[0]))
+    {
+        lit_vm_raiseexitingerror(vm, "File.readInto() expects a Buffer or a typed array");
+    }
+    buffer = lit_value_asbuffer(argv[0]);
+    if(buffer->readonly)
+    {
+        lit_vm_raiseexitingerror(vm, "cannot read into a read-only Buffer");
+    }
+    if(argc > 1)
+    {
+        count = (size_t)fmax(0, lit_value_checknumber(vm, argv, argc, 1));
+    }
+    else
+    {
+        /* everything that is left, if the file can tell us how much that is */
+        count = LIT_FILE_READ_CHUNK;
+        here = ftell(data->handle);
+        if(here != -1 && fseek(data->handle, 0, SEEK_END) == 0)
+        {
+            end = ftell(data->handle);
+            fseek(data->handle, here, SEEK_SET);
+            count = (size_t)(end - here);
+        }
+    }
+    lit_buffer_ensurecapacity(vm->state, buffer, buffer->writepos + count);
+    actual = fread(buffer->data + buffer->writepos, sizeof(uint8_t), count, data->handle);
+    lit_buffer_commitwrite(buffer, actual);
+    return lit_value_numbertovalue(vm->state, actual);
+}
+
+static LitValue objmethod_file_writefrom(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    size_t count;
+    size_t actual;
+    LitBuffer* buffer;
+    LitTypedArray* typed;
+    LitFileData* data;
+    data = (LitFileData*)lit_util_instancedataget(vm, instance);
+    if(argc > 0 && lit_value_istypedarray(argv[0]))
+    {
+        typed = lit_value_astypedarray(argv[0]);
+        actual = fwrite(typed->data, sizeof(uint8_t), typed->length * lit_typedarray_elemsize(typed->kind), data->handle);
+        return lit_value_numbertovalue(vm->state, actual);
+    }
+    if(argc == 0 || !lit_value_isbuffer(argv[0]))
+    {
+        lit_vm_raiseexitingerror(vm, "File.writeFrom() expects a Buffer or a typed array");
+    }
+    buffer = lit_value_asbuffer(argv[0]);
+    count = buffer->length - buffer->readpos;
+    if(argc > 1)
+    {
+        count = (size_t)fmin(count, fmax(0, lit_value_checknumber(vm, argv, argc, 1)));
+    }
+    actual = fwrite(buffer->data + buffer->readpos, sizeof(uint8_t), count, data->handle);
+    buffer->readpos += actual;
+    return lit_value_numbertovalue(vm->state, actual);
+}
+
 static LitValue objmethod_file_getlastmodified(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
 {
     struct stat buffer;
@@ -943,6 +1591,8 @@ void lit_open_file_library(LitState* state)
             lit_class_bindmethod(state, klass, "readNumber", objmethod_file_readnumber);
             lit_class_bindmethod(state, klass, "readBool", objmethod_file_readbool);
             lit_class_bindmethod(state, klass, "readString", objmethod_file_readstring);
+            lit_class_bindmethod(state, klass, "readInto", objmethod_file_readinto);
+            lit_class_bindmethod(state, klass, "writeFrom", objmethod_file_writefrom);
             lit_class_bindmethod(state, klass, "getLastModified", objmethod_file_getlastmodified);
             lit_class_bindgetset(state, klass, "exists", objmethod_file_exists, NULL, false);
         }
@@ -12,6 +12,9 @@ LitFunction* lit_create_function(LitState* state, LitModule* module)
     function->max_slots = 0;
     function->module = module;
     function->vararg = false;
+    function->vararg_used = false;
+    function->image = NULL;
+    function->image_function = NULL;
     return function;
 }
 
@@ -19,17 +22,12 @@ LitClosure* lit_create_closure(LitState* state, LitFunction* function)
 {
     size_t i;
     LitClosure* closure;
-    LitUpvalue** upvalues;
-    closure = (LitClosure*)lit_gcmem_allocobject(state, sizeof(LitClosure), LITTYPE_CLOSURE, false);
-    lit_state_pushroot(state, (LitObject*)closure);
-    upvalues = LIT_ALLOCATE(state, sizeof(LitUpvalue*), function->upvalue_count);
-    lit_state_poproot(state);
+    closure = (LitClosure*)lit_gcmem_allocobject(state, sizeof(LitClosure) + sizeof(LitValue) * function->upvalue_count, LITTYPE_CLOSURE, false);
     for(i = 0; i < function->upvalue_count; i++)
     {
-        upvalues[i] = NULL;
+        closure->upvalues[i] = NULL_VALUE;
     }
     closure->function = function;
-    closure->upvalues = upvalues;
     closure->upvalue_count = function->upvalue_count;
     return closure;
 }
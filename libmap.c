@@ -6,6 +6,8 @@ void lit_table_init(LitState* state, LitTable* table)
     table->state = state;
     table->capacity = -1;
     table->count = 0;
+    table->tombstones = 0;
+    table->iterating = false;
     table->entries = NULL;
 }
 
@@ -18,32 +20,39 @@ void lit_table_destroy(LitState* state, LitTable* table)
     lit_table_init(state, table);
 }
 
+/*
+* note: table->capacity is always one less than a power of two (or -1 when empty),
+* so it doubles as the mask for indexing.
+* deletion normally shifts the rest of the probe run back (see lit_table_delete), so an
+* empty slot (NULL key, null value) terminates a probe. only while a table is iterated
+* are deleted entries left as tombstones (NULL key, true value), which probes walk past.
+*/
 static LitTableEntry* find_entry(LitTableEntry* entries, int capacity, LitString* key)
 {
-    uint32_t index;
+    uint64_t index;
     LitTableEntry* entry;
     LitTableEntry* tombstone;
-    index = key->hash % capacity;
+    index = key->hash & (uint64_t)capacity;
     tombstone = NULL;
     while(true)
     {
         entry = &entries[index];
+        if(entry->key == key)
+        {
+            return entry;
+        }
         if(entry->key == NULL)
         {
             if(lit_value_isnull(entry->value))
             {
                 return tombstone != NULL ? tombstone : entry;
             }
-            else if(tombstone == NULL)
+            if(tombstone == NULL)
             {
                 tombstone = entry;
             }
         }
-        if(entry->key == key)
-        {
-            return entry;
-        }
-        index = (index + 1) % capacity;
+        index = (index + 1) & (uint64_t)capacity;
     }
 }
 
@@ -60,6 +69,7 @@ static void adjust_capacity(LitState* state, LitTable* table, int capacity)
         entries[i].value = NULL_VALUE;
     }
     table->count = 0;
+    table->tombstones = 0;
     for(i = 0; i <= table->capacity; i++)
     {
         entry = &table->entries[i];
@@ -77,20 +87,61 @@ static void adjust_capacity(LitState* state, LitTable* table, int capacity)
     table->entries = entries;
 }
 
+/* the smallest mask whose table holds count entries without passing TABLE_MAX_LOAD */
+static int table_capacity_for(size_t count)
+{
+    size_t slots;
+    slots = 8;
+    while(count > slots * TABLE_MAX_LOAD)
+    {
+        slots *= 2;
+    }
+    return (int)slots - 1;
+}
+
+void lit_table_reserve(LitState* state, LitTable* table, size_t count)
+{
+    int capacity;
+    capacity = table_capacity_for(count);
+    if(capacity > table->capacity)
+    {
+        adjust_capacity(state, table, capacity);
+    }
+}
+
+void lit_table_shrinktofit(LitState* state, LitTable* table)
+{
+    int capacity;
+    if(table->count == 0)
+    {
+        lit_table_destroy(state, table);
+        return;
+    }
+    capacity = table_capacity_for(table->count);
+    if(capacity < table->capacity)
+    {
+        adjust_capacity(state, table, capacity);
+    }
+}
+
 bool lit_table_set(LitState* state, LitTable* table, LitString* key, LitValue value)
 {
     bool is_new;
     int capacity;
     LitTableEntry* entry;
-    if(table->count + 1 > (table->capacity + 1) * TABLE_MAX_LOAD)
+    if(table->count + table->tombstones + 1 > (table->capacity + 1) * TABLE_MAX_LOAD)
     {
         capacity = LIT_GROW_CAPACITY(table->capacity + 1) - 1;
         adjust_capacity(state, table, capacity);
     }
     entry = find_entry(table->entries, table->capacity, key);
     is_new = entry->key == NULL;
-    if(is_new && lit_value_isnull(entry->value))
+    if(is_new)
     {
+        if(!lit_value_isnull(entry->value))
+        {
+            table->tombstones--;
+        }
         table->count++;
     }
     entry->key = key;
@@ -130,6 +181,62 @@ bool lit_table_get_slot(LitTable* table, LitString* key, LitValue** value)
     return true;
 }
 
+/*
+* removes the entry at index, then walks the rest of its probe run and moves every
+* entry whose home slot is not in (hole, current] back into the hole.
+* this keeps probe runs as short as if the removed key had never been inserted.
+*/
+static void table_remove_at(LitTable* table, uint64_t index)
+{
+    uint64_t mask;
+    uint64_t hole;
+    uint64_t home;
+    uint64_t current;
+    LitTableEntry* entries;
+    entries = table->entries;
+    mask = (uint64_t)table->capacity;
+    hole = index;
+    current = index;
+    while(true)
+    {
+        current = (current + 1) & mask;
+        if(entries[current].key == NULL)
+        {
+            break;
+        }
+        home = entries[current].key->hash & mask;
+        if(hole <= current ? (hole < home && home <= current) : (hole < home || home <= current))
+        {
+            continue;
+        }
+        entries[hole] = entries[current];
+        hole = current;
+    }
+    entries[hole].key = NULL;
+    entries[hole].value = NULL_VALUE;
+    table->count--;
+}
+
+/*
+* shifting entries back would move them past a running iterator, which walks by slot
+* index, so the entry becomes a tombstone instead. a shift cannot cross a tombstone
+* either, so once there are any, every removal leaves one until the next rehash.
+* returns whether the run was shifted back (and index holds another entry now).
+*/
+static bool table_remove(LitTable* table, uint64_t index)
+{
+    if(table->iterating || table->tombstones > 0)
+    {
+        table->entries[index].key = NULL;
+        table->entries[index].value = TRUE_VALUE;
+        table->count--;
+        table->tombstones++;
+        return false;
+    }
+    table_remove_at(table, index);
+    return true;
+}
+
 bool lit_table_delete(LitTable* table, LitString* key)
 {
     LitTableEntry* entry;
@@ -142,20 +249,19 @@ bool lit_table_delete(LitTable* table, LitString* key)
     {
         return false;
     }
-    entry->key = NULL;
-    entry->value = lit_bool_to_value(table->state, true);
+    table_remove(table, (uint64_t)(entry - table->entries));
     return true;
 }
 
-LitString* lit_table_find_string(LitTable* table, const char* chars, size_t length, uint32_t hash)
+LitString* lit_table_find_string(LitTable* table, const char* chars, size_t length, uint64_t hash)
 {
-    uint32_t index;
+    uint64_t index;
     LitTableEntry* entry;
     if(table->count == 0)
     {
         return NULL;
     }
-    index = hash % table->capacity;
+    index = hash & (uint64_t)table->capacity;
     while(true)
     {
         entry = &table->entries[index];
@@ -170,7 +276,7 @@ LitString* lit_table_find_string(LitTable* table, const char* chars, size_t leng
         {
             return entry->key;
         }
-        index = (index + 1) % table->capacity;
+        index = (index + 1) & (uint64_t)table->capacity;
     }
 }
 
@@ -188,46 +294,65 @@ void lit_table_add_all(LitState* state, LitTable* from, LitTable* to)
     }
 }
 
+/*
+* compacts in place: removing an entry may shift a later one into the same slot,
+* so the slot is only stepped over once it holds a live (or no) key.
+*/
 void lit_table_removewhite(LitTable* table)
 {
     int i;
     LitTableEntry* entry;
-    for(i = 0; i <= table->capacity; i++)
+    i = 0;
+    while(i <= table->capacity)
     {
         entry = &table->entries[i];
-        if(entry->key != NULL && !entry->key->object.marked)
+        if(entry->key != NULL && !entry->key->object.marked && table_remove(table, (uint64_t)i))
         {
-            lit_table_delete(table, entry->key);
+            continue;
         }
+        i++;
+    }
+    /* only vm->strings is swept, and nothing iterates that, so it can shrink right away */
+    if(LIT_SHOULD_SHRINK((size_t)table->count, (size_t)(table->capacity + 1)))
+    {
+        adjust_capacity(table->state, table, table_capacity_for(table->count * 2));
     }
 }
 
 
+/*
+* deletes made between the first step and the end leave tombstones (see table_remove),
+* so entries never move under the iterator; they are cleared out once it is done.
+* a loop that stops early leaves the table in that mode until a later loop over it ends.
+*/
 int util_table_iterator(LitTable* table, int number)
 {
-    if(table->count == 0)
+    if(number < 0)
     {
-        return -1;
+        table->iterating = true;
     }
-    if(number >= (int)table->capacity)
+    if(table->count > 0 && number < (int)table->capacity)
     {
-        return -1;
-    }
-    number++;
-    for(; number < table->capacity; number++)
-    {
-        if(table->entries[number].key != NULL)
+        number++;
+        for(; number <= table->capacity; number++)
         {
-            return number;
+            if(table->entries[number].key != NULL)
+            {
+                return number;
+            }
         }
     }
-
+    table->iterating = false;
+    if(table->tombstones > 0)
+    {
+        adjust_capacity(table->state, table, table->capacity);
+    }
     return -1;
 }
 
 LitValue util_table_iterator_key(LitTable* table, int index)
 {
-    if(table->capacity <= index)
+    if(table->capacity < index)
     {
         return NULL_VALUE;
     }
@@ -332,10 +457,28 @@ static LitValue objfn_map_addall(LitVM* vm, LitValue instance, size_t argc, LitV
 
 static LitValue objfn_map_clear(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
 {
-    (void)vm;
     (void)argv;
     (void)argc;
-    lit_value_asmap(instance)->values.count = 0;
+    lit_table_destroy(vm->state, &lit_value_asmap(instance)->values);
+    return NULL_VALUE;
+}
+
+static LitValue objfn_map_reserve(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    double size;
+    size = lit_value_checknumber(vm, argv, argc, 0);
+    if(size > 0)
+    {
+        lit_table_reserve(vm->state, &lit_value_asmap(instance)->values, (size_t)size);
+    }
+    return NULL_VALUE;
+}
+
+static LitValue objfn_map_shrinktofit(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)argc;
+    (void)argv;
+    lit_table_shrinktofit(vm->state, &lit_value_asmap(instance)->values);
     return NULL_VALUE;
 }
 
@@ -487,6 +630,13 @@ static LitValue objfn_map_length(LitVM* vm, LitValue instance, size_t argc, LitV
     return lit_value_numbertovalue(vm->state, lit_value_asmap(instance)->values.count);
 }
 
+static LitValue objfn_map_capacity(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)argc;
+    (void)argv;
+    return lit_value_numbertovalue(vm->state, lit_value_asmap(instance)->values.capacity + 1);
+}
+
 void lit_open_map_library(LitState* state)
 {
     LitClass* klass;
@@ -497,11 +647,14 @@ void lit_open_map_library(LitState* state)
         lit_class_bindmethod(state, klass, "[]", objfn_map_subscript);
         lit_class_bindmethod(state, klass, "addAll", objfn_map_addall);
         lit_class_bindmethod(state, klass, "clear", objfn_map_clear);
+        lit_class_bindmethod(state, klass, "reserve", objfn_map_reserve);
+        lit_class_bindmethod(state, klass, "shrinkToFit", objfn_map_shrinktofit);
         lit_class_bindmethod(state, klass, "iterator", objfn_map_iterator);
         lit_class_bindmethod(state, klass, "iteratorValue", objfn_map_iteratorvalue);
         lit_class_bindmethod(state, klass, "clone", objfn_map_clone);
         lit_class_bindmethod(state, klass, "toString", objfn_map_tostring);
         lit_class_bindgetset(state, klass, "length", objfn_map_length, NULL, false);
+        lit_class_bindgetset(state, klass, "capacity", objfn_map_capacity, NULL, false);
         state->mapvalue_class = klass;
     }
     lit_state_setglobal(state, klass->name, lit_value_objectvalue(klass));
@@ -149,13 +149,11 @@ static LitValue math_exp(LitVM* vm, LitValue instance, size_t argc, LitValue* ar
  * Random
  */
 
-static size_t static_random_data;
-
 static size_t* extract_random_data(LitState* state, LitValue instance)
 {
     if(lit_value_isclass(instance))
     {
-        return &static_random_data;
+        return &state->random_seed;
     }
 
     LitValue data;
@@ -306,7 +304,7 @@ static LitValue random_pick(LitVM* vm, LitValue instance, size_t argc, LitValue*
             size_t target = value % length;
             size_t index = 0;
 
-            for(size_t i = 0; i < capacity; i++)
+            for(size_t i = 0; i <= capacity; i++)
             {
                 if(map->values.entries[i].key != NULL)
                 {
@@ -367,7 +365,7 @@ void lit_open_math_library(LitState* state)
         };
     }
     srand(time(NULL));
-    static_random_data = time(NULL);
+    state->random_seed = time(NULL);
     {
         klass = lit_create_classobject(state, "Random");
         {
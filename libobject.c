@@ -10,7 +10,6 @@ LitUpvalue* lit_create_upvalue(LitState* state, LitValue* slot)
     upvalue = (LitUpvalue*)lit_gcmem_allocobject(state, sizeof(LitUpvalue), LITTYPE_UPVALUE, false);
     upvalue->location = slot;
     upvalue->closed = NULL_VALUE;
-    upvalue->next = NULL;
     return upvalue;
 }
 
@@ -134,6 +133,10 @@ void lit_object_destroy(LitState* state, LitObject* object)
                 fiber = (LitFiber*)object;
                 LIT_FREE_ARRAY(state, sizeof(LitCallFrame), fiber->frames, fiber->frame_capacity);
                 LIT_FREE_ARRAY(state, sizeof(LitValue), fiber->stack, fiber->stack_capacity);
+                if(fiber->open_upvalues != NULL)
+                {
+                    LIT_FREE_ARRAY(state, sizeof(LitUpvalue*), fiber->open_upvalues, fiber->stack_capacity);
+                }
                 LIT_FREE(state, sizeof(LitFiber), object);
             }
             break;
@@ -147,8 +150,7 @@ void lit_object_destroy(LitState* state, LitObject* object)
         case LITTYPE_CLOSURE:
             {
                 closure = (LitClosure*)object;
-                LIT_FREE_ARRAY(state, sizeof(LitUpvalue*), closure->upvalues, closure->upvalue_count);
-                LIT_FREE(state, sizeof(LitClosure), object);
+                LIT_FREE(state, sizeof(LitClosure) + sizeof(LitValue) * closure->upvalue_count, object);
             }
             break;
         case LITTYPE_UPVALUE:
@@ -211,6 +213,18 @@ void lit_object_destroy(LitState* state, LitObject* object)
                 LIT_FREE(state, sizeof(LitRange), object);
             }
             break;
+        case LITTYPE_TYPEDARRAY:
+            {
+                lit_typedarray_destroy(state, (LitTypedArray*)object);
+                LIT_FREE(state, sizeof(LitTypedArray), object);
+            }
+            break;
+        case LITTYPE_BUFFER:
+            {
+                lit_buffer_destroy(state, (LitBuffer*)object);
+                LIT_FREE(state, sizeof(LitBuffer), object);
+            }
+            break;
         case LITTYPE_FIELD:
             {
                 LIT_FREE(state, sizeof(LitField), object);
@@ -346,7 +360,7 @@ static void fillmap(LitState* state, LitMap* destmap, LitTable* fromtbl, bool in
     LitString* key;
     LitValue val;
     (void)includenullkeys;
-    for(i=0; i<(size_t)(fromtbl->count); i++)
+    for(i=0; (int)i <= fromtbl->capacity; i++)
     {
         key = fromtbl->entries[i].key;
         if(key != NULL)
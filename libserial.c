@@ -0,0 +1,789 @@
+
+#include <stdio.h>
+#include <math.h>
+#include "lit.h"
+
+/*
+* Serializer: a compact binary form of null, bools, numbers, strings, arrays, maps
+* and ranges, that keeps shared parts and cycles.
+*
+*   var buffer = Serializer.encode([ 1, "two", { three = 3 } ])
+*   var value = Serializer.decode(buffer)
+*   Serializer.write(file, value)
+*   value = Serializer.read(file)
+*
+* every value starts with LIT_SERIAL_MAGIC and LIT_SERIAL_VERSION, then a tag byte,
+* and what follows the tag depends on it. counts, lengths and ids are varints.
+* a string that was already written is a reference to its first copy, and so is an
+* array, map or range that was (by the order they were first written). integers in
+* int32 range take 1 or 4 bytes instead of 8.
+*
+* read() and write() stream to the file with the lit_ioutil_* functions, so nothing
+* is built up in memory. numbers are written in the byte order of the machine, as
+* the bytecode images are.
+*/
+
+#define LIT_SERIAL_MAGIC 0xB5
+#define LIT_SERIAL_VERSION 1
+
+/* how many elements a count read from a file presizes at most, before they arrived */
+#define LIT_SERIAL_MAXPRESIZE 4096
+
+enum
+{
+    LITSER_NULL,
+    LITSER_TRUE,
+    LITSER_FALSE,
+    LITSER_INT8,
+    LITSER_INT32,
+    LITSER_NUMBER,
+    LITSER_STRING,
+    LITSER_STRINGREF,
+    LITSER_ARRAY,
+    LITSER_MAP,
+    LITSER_RANGE,
+    LITSER_OBJECTREF,
+};
+
+typedef struct LitSerialWriter LitSerialWriter;
+typedef struct LitSerialReader LitSerialReader;
+
+struct LitSerialWriter
+{
+    /* where to write, or NULL to build bytes */
+    FILE* file;
+    uint8_t* bytes;
+    size_t length;
+    size_t capacity;
+    /* the strings, arrays, maps and ranges written so far, open addressed */
+    LitObject** seen;
+    uint32_t* ids;
+    size_t seencount;
+    size_t seencapacity;
+    uint32_t stringcount;
+    uint32_t objectcount;
+    /* the type of what could not be written, if anything */
+    const char* failed;
+};
+
+struct LitSerialReader
+{
+    LitState* state;
+    /* where to read from, or NULL to read memory */
+    FILE* file;
+    LitEmulatedFile memory;
+    /* file mode reads string bytes into this */
+    char* scratch;
+    size_t scratchcapacity;
+    /* what the references refer to */
+    LitString** strings;
+    size_t stringcount;
+    size_t stringcapacity;
+    LitValue* objects;
+    size_t objectcount;
+    size_t objectcapacity;
+    bool failed;
+};
+
+static void lit_serialw_bytes(LitSerialWriter* writer, const void* bytes, size_t length)
+{
+    size_t capacity;
+    if(writer->file != NULL)
+    {
+        fwrite(bytes, 1, length, writer->file);
+        return;
+    }
+    if(writer->length + length > writer->capacity)
+    {
+        capacity = writer->capacity < 64 ? 64 : writer->capacity * 2;
+        while(capacity < writer->length + length)
+        {
+            capacity *= 2;
+        }
+        writer->bytes = (uint8_t*)realloc(writer->bytes, capacity);
+        writer->capacity = capacity;
+    }
+    memcpy(writer->bytes + writer->length, bytes, length);
+    writer->length += length;
+}
+
+static void lit_serialw_uint8(LitSerialWriter* writer, uint8_t value)
+{
+    if(writer->file != NULL)
+    {
+        lit_ioutil_writeuint8(writer->file, value);
+        return;
+    }
+    lit_serialw_bytes(writer, &value, sizeof(value));
+}
+
+static void lit_serialw_uint32(LitSerialWriter* writer, uint32_t value)
+{
+    if(writer->file != NULL)
+    {
+        lit_ioutil_writeuint32(writer->file, value);
+        return;
+    }
+    lit_serialw_bytes(writer, &value, sizeof(value));
+}
+
+static void lit_serialw_double(LitSerialWriter* writer, double value)
+{
+    if(writer->file != NULL)
+    {
+        lit_ioutil_writedouble(writer->file, value);
+        return;
+    }
+    lit_serialw_bytes(writer, &value, sizeof(value));
+}
+
+static void lit_serialw_varint(LitSerialWriter* writer, uint32_t value)
+{
+    size_t length;
+    uint8_t bytes[5];
+    length = 0;
+    while(value >= 0x80)
+    {
+        bytes[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    bytes[length++] = (uint8_t)value;
+    lit_serialw_bytes(writer, bytes, length);
+}
+
+static size_t lit_serialw_slot(LitObject** seen, size_t capacity, LitObject* object)
+{
+    size_t i;
+    i = (size_t)(((uintptr_t)object >> 3) * 0x9E3779B97F4A7C15ull) & (capacity - 1);
+    while(seen[i] != NULL && seen[i] != object)
+    {
+        i = (i + 1) & (capacity - 1);
+    }
+    return i;
+}
+
+/*
+* returns true and the id if object was written before. otherwise remembers it with
+* the next id from counter, which strings and the other objects have one each of.
+*/
+static bool lit_serialw_seen(LitSerialWriter* writer, LitObject* object, uint32_t* counter, uint32_t* id)
+{
+    size_t i;
+    size_t slot;
+    size_t capacity;
+    uint32_t* ids;
+    LitObject** seen;
+    if((writer->seencount + 1) * 2 > writer->seencapacity)
+    {
+        capacity = writer->seencapacity == 0 ? 16 : writer->seencapacity * 2;
+        seen = (LitObject**)calloc(capacity, sizeof(LitObject*));
+        ids = (uint32_t*)malloc(capacity * sizeof(uint32_t));
+        for(i = 0; i < writer->seencapacity; i++)
+        {
+            if(writer->seen[i] != NULL)
+            {
+                slot = lit_serialw_slot(seen, capacity, writer->seen[i]);
+                seen[slot] = writer->seen[i];
+                ids[slot] = writer->ids[i];
+            }
+        }
+        free(writer->seen);
+        free(writer->ids);
+        writer->seen = seen;
+        writer->ids = ids;
+        writer->seencapacity = capacity;
+    }
+    slot = lit_serialw_slot(writer->seen, writer->seencapacity, object);
+    if(writer->seen[slot] != NULL)
+    {
+        *id = writer->ids[slot];
+        return true;
+    }
+    writer->seen[slot] = object;
+    writer->ids[slot] = (*counter)++;
+    writer->seencount++;
+    return false;
+}
+
+/* strings are interned, so the same text is the same object */
+static void lit_serialw_string(LitSerialWriter* writer, LitString* string)
+{
+    uint32_t id;
+    if(lit_serialw_seen(writer, (LitObject*)string, &writer->stringcount, &id))
+    {
+        lit_serialw_uint8(writer, LITSER_STRINGREF);
+        lit_serialw_varint(writer, id);
+        return;
+    }
+    lit_serialw_uint8(writer, LITSER_STRING);
+    lit_serialw_varint(writer, (uint32_t)lit_string_getlength(string));
+    lit_serialw_bytes(writer, string->chars, lit_string_getlength(string));
+}
+
+static void lit_serialw_number(LitSerialWriter* writer, double number)
+{
+    int32_t integer;
+    if(number >= INT32_MIN && number <= INT32_MAX && (double)(integer = (int32_t)number) == number
+       && !(number == 0 && signbit(number)))
+    {
+        if(integer >= INT8_MIN && integer <= INT8_MAX)
+        {
+            lit_serialw_uint8(writer, LITSER_INT8);
+            lit_serialw_uint8(writer, (uint8_t)(int8_t)integer);
+        }
+        else
+        {
+            lit_serialw_uint8(writer, LITSER_INT32);
+            lit_serialw_uint32(writer, (uint32_t)integer);
+        }
+        return;
+    }
+    lit_serialw_uint8(writer, LITSER_NUMBER);
+    lit_serialw_double(writer, number);
+}
+
+static void lit_serialw_value(LitSerialWriter* writer, LitValue value)
+{
+    int i;
+    size_t j;
+    uint32_t id;
+    LitRange* range;
+    LitValueList* list;
+    LitTable* table;
+    if(writer->failed != NULL)
+    {
+        return;
+    }
+    if(lit_value_isnull(value))
+    {
+        lit_serialw_uint8(writer, LITSER_NULL);
+    }
+    else if(lit_value_isbool(value))
+    {
+        lit_serialw_uint8(writer, lit_value_asbool(value) ? LITSER_TRUE : LITSER_FALSE);
+    }
+    else if(lit_value_isnumber(value))
+    {
+        lit_serialw_number(writer, lit_value_asnumber(value));
+    }
+    else if(lit_value_isstring(value))
+    {
+        lit_serialw_string(writer, lit_value_asstring(value));
+    }
+    else if(lit_value_isarray(value) || lit_value_ismap(value) || lit_value_isrange(value))
+    {
+        if(lit_serialw_seen(writer, lit_value_asobject(value), &writer->objectcount, &id))
+        {
+            lit_serialw_uint8(writer, LITSER_OBJECTREF);
+            lit_serialw_varint(writer, id);
+        }
+        else if(lit_value_isarray(value))
+        {
+            list = &lit_value_asarray(value)->list;
+            lit_serialw_uint8(writer, LITSER_ARRAY);
+            lit_serialw_varint(writer, (uint32_t)lit_vallist_count(list));
+            for(j = 0; j < lit_vallist_count(list); j++)
+            {
+                lit_serialw_value(writer, lit_vallist_get(list, j));
+            }
+        }
+        else if(lit_value_ismap(value))
+        {
+            table = &lit_value_asmap(value)->values;
+            lit_serialw_uint8(writer, LITSER_MAP);
+            lit_serialw_varint(writer, (uint32_t)table->count);
+            for(i = 0; i <= table->capacity; i++)
+            {
+                if(table->entries[i].key != NULL)
+                {
+                    lit_serialw_string(writer, table->entries[i].key);
+                    lit_serialw_value(writer, table->entries[i].value);
+                }
+            }
+        }
+        else
+        {
+            range = lit_value_asrange(value);
+            lit_serialw_uint8(writer, LITSER_RANGE);
+            lit_serialw_double(writer, range->from);
+            lit_serialw_double(writer, range->to);
+        }
+    }
+    else
+    {
+        writer->failed = lit_tostring_typename(value);
+    }
+}
+
+static void lit_serialw_init(LitSerialWriter* writer, FILE* file)
+{
+    memset(writer, 0, sizeof(LitSerialWriter));
+    writer->file = file;
+}
+
+static void lit_serialw_run(LitSerialWriter* writer, LitValue value)
+{
+    lit_serialw_uint8(writer, LIT_SERIAL_MAGIC);
+    lit_serialw_uint8(writer, LIT_SERIAL_VERSION);
+    lit_serialw_value(writer, value);
+    free(writer->seen);
+    free(writer->ids);
+}
+
+/*
+* encodes value into malloc'd bytes, or returns NULL and sets failed to the name of
+* the type that has no encoding.
+*/
+uint8_t* lit_serial_encode(LitValue value, size_t* length, const char** failed)
+{
+    LitSerialWriter writer;
+    lit_serialw_init(&writer, NULL);
+    lit_serialw_run(&writer, value);
+    *failed = writer.failed;
+    if(writer.failed != NULL)
+    {
+        free(writer.bytes);
+        return NULL;
+    }
+    *length = writer.length;
+    return writer.bytes;
+}
+
+/* the same, to a file. what was written before finding something unencodable stays written */
+bool lit_serial_writefile(FILE* file, LitValue value, const char** failed)
+{
+    LitSerialWriter writer;
+    lit_serialw_init(&writer, file);
+    lit_serialw_run(&writer, value);
+    *failed = writer.failed;
+    return writer.failed == NULL && !ferror(file);
+}
+
+/* false once a read ran past the end */
+static bool lit_serialr_check(LitSerialReader* reader, size_t length)
+{
+    if(reader->failed)
+    {
+        return false;
+    }
+    if(reader->file != NULL)
+    {
+        return true;
+    }
+    if(length > reader->memory.length - reader->memory.position)
+    {
+        reader->failed = true;
+        return false;
+    }
+    return true;
+}
+
+/* file reads can only tell afterwards */
+static void lit_serialr_checkfile(LitSerialReader* reader)
+{
+    if(reader->file != NULL && (feof(reader->file) || ferror(reader->file)))
+    {
+        reader->failed = true;
+    }
+}
+
+static uint8_t lit_serialr_uint8(LitSerialReader* reader)
+{
+    uint8_t value;
+    if(!lit_serialr_check(reader, sizeof(value)))
+    {
+        return 0;
+    }
+    if(reader->file != NULL)
+    {
+        value = lit_ioutil_readuint8(reader->file);
+        lit_serialr_checkfile(reader);
+        return value;
+    }
+    return lit_emufile_readuint8(&reader->memory);
+}
+
+static uint32_t lit_serialr_uint32(LitSerialReader* reader)
+{
+    uint32_t value;
+    if(!lit_serialr_check(reader, sizeof(value)))
+    {
+        return 0;
+    }
+    if(reader->file != NULL)
+    {
+        value = lit_ioutil_readuint32(reader->file);
+        lit_serialr_checkfile(reader);
+        return value;
+    }
+    return lit_emufile_readuint32(&reader->memory);
+}
+
+static double lit_serialr_double(LitSerialReader* reader)
+{
+    double value;
+    if(!lit_serialr_check(reader, sizeof(value)))
+    {
+        return 0;
+    }
+    if(reader->file != NULL)
+    {
+        value = lit_ioutil_readdouble(reader->file);
+        lit_serialr_checkfile(reader);
+        return value;
+    }
+    return lit_emufile_readdouble(&reader->memory);
+}
+
+static uint32_t lit_serialr_varint(LitSerialReader* reader)
+{
+    int shift;
+    uint8_t byte;
+    uint32_t value;
+    value = 0;
+    for(shift = 0; shift < 35; shift += 7)
+    {
+        byte = lit_serialr_uint8(reader);
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        if((byte & 0x80) == 0)
+        {
+            return value;
+        }
+    }
+    reader->failed = true;
+    return 0;
+}
+
+/* how much room a count that was just read may take up front */
+static size_t lit_serialr_presize(LitSerialReader* reader, uint32_t count)
+{
+    if(reader->file != NULL)
+    {
+        return count < LIT_SERIAL_MAXPRESIZE ? count : LIT_SERIAL_MAXPRESIZE;
+    }
+    /* every element takes at least a byte, so a bad count can't allocate much */
+    if(count > reader->memory.length - reader->memory.position)
+    {
+        reader->failed = true;
+        return 0;
+    }
+    return count;
+}
+
+static LitString* lit_serialr_newstring(LitSerialReader* reader)
+{
+    uint32_t length;
+    LitString* string;
+    length = lit_serialr_varint(reader);
+    if(!lit_serialr_check(reader, length))
+    {
+        return NULL;
+    }
+    if(reader->file != NULL)
+    {
+        if(length > reader->scratchcapacity)
+        {
+            reader->scratchcapacity = length;
+            reader->scratch = (char*)realloc(reader->scratch, length);
+        }
+        if(fread(reader->scratch, 1, length, reader->file) != length)
+        {
+            reader->failed = true;
+            return NULL;
+        }
+        string = lit_string_copy(reader->state, reader->scratch, length);
+    }
+    else
+    {
+        string = lit_string_copy(reader->state, reader->memory.source + reader->memory.position, length);
+        reader->memory.position += length;
+    }
+    if(reader->stringcount == reader->stringcapacity)
+    {
+        reader->stringcapacity = reader->stringcapacity == 0 ? 16 : reader->stringcapacity * 2;
+        reader->strings = (LitString**)realloc(reader->strings, reader->stringcapacity * sizeof(LitString*));
+    }
+    reader->strings[reader->stringcount++] = string;
+    return string;
+}
+
+/* a string or a reference to one, with its tag already read */
+static LitString* lit_serialr_tagstring(LitSerialReader* reader, uint8_t tag)
+{
+    uint32_t id;
+    if(tag == LITSER_STRING)
+    {
+        return lit_serialr_newstring(reader);
+    }
+    if(tag == LITSER_STRINGREF)
+    {
+        id = lit_serialr_varint(reader);
+        if(id < reader->stringcount)
+        {
+            return reader->strings[id];
+        }
+    }
+    reader->failed = true;
+    return NULL;
+}
+
+/* ids go by first appearance, so an object is remembered before what it contains is read */
+static void lit_serialr_remember(LitSerialReader* reader, LitValue value)
+{
+    if(reader->objectcount == reader->objectcapacity)
+    {
+        reader->objectcapacity = reader->objectcapacity == 0 ? 16 : reader->objectcapacity * 2;
+        reader->objects = (LitValue*)realloc(reader->objects, reader->objectcapacity * sizeof(LitValue));
+    }
+    reader->objects[reader->objectcount++] = value;
+}
+
+static LitValue lit_serialr_value(LitSerialReader* reader)
+{
+    uint8_t tag;
+    uint32_t i;
+    uint32_t count;
+    LitArray* array;
+    LitMap* map;
+    LitRange* range;
+    LitString* key;
+    LitValue value;
+    tag = lit_serialr_uint8(reader);
+    if(reader->failed)
+    {
+        return NULL_VALUE;
+    }
+    switch(tag)
+    {
+        case LITSER_NULL:
+            return NULL_VALUE;
+        case LITSER_TRUE:
+            return TRUE_VALUE;
+        case LITSER_FALSE:
+            return FALSE_VALUE;
+        case LITSER_INT8:
+            return lit_value_numbertovalue(reader->state, (int8_t)lit_serialr_uint8(reader));
+        case LITSER_INT32:
+            return lit_value_numbertovalue(reader->state, (int32_t)lit_serialr_uint32(reader));
+        case LITSER_NUMBER:
+            return lit_value_numbertovalue(reader->state, lit_serialr_double(reader));
+        case LITSER_STRING:
+        case LITSER_STRINGREF:
+            {
+                key = lit_serialr_tagstring(reader, tag);
+                return key == NULL ? NULL_VALUE : lit_value_objectvalue(key);
+            }
+        case LITSER_ARRAY:
+            {
+                count = lit_serialr_varint(reader);
+                array = lit_create_array(reader->state);
+                lit_serialr_remember(reader, lit_value_objectvalue(array));
+                lit_vallist_reserve(reader->state, &array->list, lit_serialr_presize(reader, count));
+                for(i = 0; i < count && !reader->failed; i++)
+                {
+                    value = lit_serialr_value(reader);
+                    lit_vallist_push(reader->state, &array->list, value);
+                }
+                return lit_value_objectvalue(array);
+            }
+        case LITSER_MAP:
+            {
+                count = lit_serialr_varint(reader);
+                map = lit_create_map(reader->state);
+                lit_serialr_remember(reader, lit_value_objectvalue(map));
+                lit_table_reserve(reader->state, &map->values, lit_serialr_presize(reader, count));
+                for(i = 0; i < count && !reader->failed; i++)
+                {
+                    key = lit_serialr_tagstring(reader, lit_serialr_uint8(reader));
+                    value = lit_serialr_value(reader);
+                    if(key != NULL)
+                    {
+                        lit_map_set(reader->state, map, key, value);
+                    }
+                }
+                return lit_value_objectvalue(map);
+            }
+        case LITSER_RANGE:
+            {
+                range = lit_create_range(reader->state, 0, 0);
+                lit_serialr_remember(reader, lit_value_objectvalue(range));
+                range->from = lit_serialr_double(reader);
+                range->to = lit_serialr_double(reader);
+                return lit_value_objectvalue(range);
+            }
+        case LITSER_OBJECTREF:
+            {
+                i = lit_serialr_varint(reader);
+                if(i < reader->objectcount)
+                {
+                    return reader->objects[i];
+                }
+            }
+            break;
+        default:
+            break;
+    }
+    reader->failed = true;
+    return NULL_VALUE;
+}
+
+static bool lit_serialr_run(LitSerialReader* reader, LitValue* value)
+{
+    if(lit_serialr_uint8(reader) != LIT_SERIAL_MAGIC || lit_serialr_uint8(reader) != LIT_SERIAL_VERSION)
+    {
+        reader->failed = true;
+    }
+    *value = reader->failed ? NULL_VALUE : lit_serialr_value(reader);
+    free(reader->scratch);
+    free(reader->strings);
+    free(reader->objects);
+    if(reader->failed)
+    {
+        *value = NULL_VALUE;
+    }
+    return !reader->failed;
+}
+
+/*
+* decodes the value that bytes start with into state, with the gc off. returns how
+* many bytes it took, or 0 if they are not an encoded value.
+*/
+size_t lit_serial_decode(LitState* state, const uint8_t* bytes, size_t length, LitValue* value)
+{
+    LitSerialReader reader;
+    memset(&reader, 0, sizeof(LitSerialReader));
+    reader.state = state;
+    lit_emufile_init(&reader.memory, (const char*)bytes, length);
+    if(!lit_serialr_run(&reader, value))
+    {
+        return 0;
+    }
+    return reader.memory.position;
+}
+
+/* the same, reading one value from where file is */
+bool lit_serial_readfile(LitState* state, FILE* file, LitValue* value)
+{
+    LitSerialReader reader;
+    memset(&reader, 0, sizeof(LitSerialReader));
+    reader.state = state;
+    reader.file = file;
+    return lit_serialr_run(&reader, value);
+}
+
+/* encode(value [, buffer]): appends the encoding to buffer (a new one by default), and returns that */
+static LitValue objfn_serializer_encode(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    size_t length;
+    uint8_t* bytes;
+    const char* failed;
+    LitBuffer* buffer;
+    (void)instance;
+    buffer = NULL;
+    if(argc > 1 && lit_value_isbuffer(argv[1]))
+    {
+        buffer = lit_value_asbuffer(argv[1]);
+        if(buffer->readonly)
+        {
+            lit_vm_raiseexitingerror(vm, "Serializer.encode(): the buffer is read-only");
+        }
+    }
+    bytes = lit_serial_encode(argc > 0 ? argv[0] : NULL_VALUE, &length, &failed);
+    if(bytes == NULL)
+    {
+        lit_vm_raiseexitingerror(vm, "Serializer: cannot encode a %s", failed);
+    }
+    if(buffer == NULL)
+    {
+        buffer = lit_create_buffer(vm->state, length);
+    }
+    lit_buffer_ensurecapacity(vm->state, buffer, buffer->writepos + length);
+    memcpy(buffer->data + buffer->writepos, bytes, length);
+    lit_buffer_commitwrite(buffer, length);
+    free(bytes);
+    return lit_value_objectvalue(buffer);
+}
+
+/* decode(buffer): the value at the buffer's read position, which moves past it */
+static LitValue objfn_serializer_decode(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    size_t used;
+    LitValue value;
+    LitBuffer* buffer;
+    (void)instance;
+    if(argc < 1 || !lit_value_isbuffer(argv[0]))
+    {
+        lit_vm_raiseexitingerror(vm, "Serializer.decode() expects a Buffer");
+    }
+    buffer = lit_value_asbuffer(argv[0]);
+    if(buffer->readpos >= buffer->length)
+    {
+        return NULL_VALUE;
+    }
+    used = lit_serial_decode(vm->state, buffer->data + buffer->readpos, buffer->length - buffer->readpos, &value);
+    if(used == 0)
+    {
+        lit_vm_raiseexitingerror(vm, "Serializer: malformed or truncated data");
+    }
+    buffer->readpos += used;
+    return value;
+}
+
+/* write(file, value) */
+static LitValue objfn_serializer_write(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    FILE* file;
+    const char* failed;
+    (void)instance;
+    if(argc < 1)
+    {
+        lit_vm_raiseexitingerror(vm, "Serializer.write() expects a File and a value");
+    }
+    file = lit_fs_getfilehandle(vm, argv[0]);
+    if(!lit_serial_writefile(file, argc > 1 ? argv[1] : NULL_VALUE, &failed) && failed != NULL)
+    {
+        lit_vm_raiseexitingerror(vm, "Serializer: cannot encode a %s", failed);
+    }
+    return lit_bool_to_value(vm->state, !ferror(file));
+}
+
+/* read(file): the next value in file, or null at its end */
+static LitValue objfn_serializer_read(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    int c;
+    FILE* file;
+    LitValue value;
+    (void)instance;
+    if(argc < 1)
+    {
+        lit_vm_raiseexitingerror(vm, "Serializer.read() expects a File");
+    }
+    file = lit_fs_getfilehandle(vm, argv[0]);
+    if((c = fgetc(file)) == EOF)
+    {
+        return NULL_VALUE;
+    }
+    ungetc(c, file);
+    if(!lit_serial_readfile(vm->state, file, &value))
+    {
+        lit_vm_raiseexitingerror(vm, "Serializer: malformed or truncated data");
+    }
+    return value;
+}
+
+void lit_open_serializer_library(LitState* state)
+{
+    LitClass* klass;
+    klass = lit_create_classobject(state, "Serializer");
+    {
+        lit_class_bindstaticmethod(state, klass, "encode", objfn_serializer_encode);
+        lit_class_bindstaticmethod(state, klass, "decode", objfn_serializer_decode);
+        lit_class_bindstaticmethod(state, klass, "write", objfn_serializer_write);
+        lit_class_bindstaticmethod(state, klass, "read", objfn_serializer_read);
+    }
+    lit_state_setglobal(state, klass->name, lit_value_objectvalue(klass));
+    if(klass->super == NULL)
+    {
+        lit_class_inheritfrom(state, klass, state->objectvalue_class);
+    }
+}
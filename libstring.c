@@ -86,16 +86,145 @@ char *lit_util_inttostring(char *dest, size_t n, int x)
     return dest;
 }
 
-uint32_t lit_util_hashstring(const char* key, size_t length)
+/*
+* string hashing is based on wyhash (public domain, by Wang Yi).
+* it consumes input 8 bytes at a time (with three independent lanes for long keys),
+* which is a lot faster than the byte-at-a-time FNV-1a that was used before, and
+* since it is keyed by a per-state random seed, map keys can no longer be crafted
+* to collide on purpose.
+*/
+static const uint64_t lit_hashsecret[4] =
+{
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+};
+
+static inline void lit_util_hashmum(uint64_t* a, uint64_t* b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r;
+    r = *a;
+    r *= *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha;
+    uint64_t hb;
+    uint64_t la;
+    uint64_t lb;
+    uint64_t rh;
+    uint64_t rm0;
+    uint64_t rm1;
+    uint64_t rl;
+    uint64_t t;
+    uint64_t c;
+    uint64_t lo;
+    uint64_t hi;
+    ha = *a >> 32;
+    hb = *b >> 32;
+    la = (uint32_t)*a;
+    lb = (uint32_t)*b;
+    rh = ha * hb;
+    rm0 = ha * lb;
+    rm1 = hb * la;
+    rl = la * lb;
+    t = rl + (rm0 << 32);
+    c = t < rl;
+    lo = t + (rm1 << 32);
+    c += lo < t;
+    hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    *a = lo;
+    *b = hi;
+#endif
+}
+
+static inline uint64_t lit_util_hashmix(uint64_t a, uint64_t b)
+{
+    lit_util_hashmum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t lit_util_hashread8(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t lit_util_hashread4(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t lit_util_hashread3(const uint8_t* p, size_t k)
+{
+    return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
+
+uint64_t lit_util_hashstringseed(const char* key, size_t length, uint64_t seed)
 {
     size_t i;
-    uint32_t hash = 2166136261u;
-    for(i = 0; i < length; i++)
+    uint64_t a;
+    uint64_t b;
+    uint64_t see1;
+    uint64_t see2;
+    const uint8_t* p;
+    p = (const uint8_t*)key;
+    seed ^= lit_util_hashmix(seed ^ lit_hashsecret[0], lit_hashsecret[1]);
+    if(length <= 16)
+    {
+        if(length >= 4)
+        {
+            a = (lit_util_hashread4(p) << 32) | lit_util_hashread4(p + ((length >> 3) << 2));
+            b = (lit_util_hashread4(p + length - 4) << 32) | lit_util_hashread4(p + length - 4 - ((length >> 3) << 2));
+        }
+        else if(length > 0)
+        {
+            a = lit_util_hashread3(p, length);
+            b = 0;
+        }
+        else
+        {
+            a = 0;
+            b = 0;
+        }
+    }
+    else
     {
-        hash ^= key[i];
-        hash *= 16777619;
+        i = length;
+        if(i > 48)
+        {
+            see1 = seed;
+            see2 = seed;
+            do
+            {
+                seed = lit_util_hashmix(lit_util_hashread8(p) ^ lit_hashsecret[1], lit_util_hashread8(p + 8) ^ seed);
+                see1 = lit_util_hashmix(lit_util_hashread8(p + 16) ^ lit_hashsecret[2], lit_util_hashread8(p + 24) ^ see1);
+                see2 = lit_util_hashmix(lit_util_hashread8(p + 32) ^ lit_hashsecret[3], lit_util_hashread8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while(i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while(i > 16)
+        {
+            seed = lit_util_hashmix(lit_util_hashread8(p) ^ lit_hashsecret[1], lit_util_hashread8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = lit_util_hashread8(p + i - 16);
+        b = lit_util_hashread8(p + i - 8);
     }
-    return hash;
+    a ^= lit_hashsecret[1];
+    b ^= seed;
+    lit_util_hashmum(&a, &b);
+    return lit_util_hashmix(a ^ lit_hashsecret[0] ^ length, b ^ lit_hashsecret[1]);
+}
+
+uint64_t lit_util_hashstring(LitState* state, const char* key, size_t length)
+{
+    return lit_util_hashstringseed(key, length, state->hashseed);
 }
 
 int lit_util_decodenumbytes(uint8_t byte)
@@ -332,7 +461,7 @@ LitString* lit_string_makeempty(LitState* state, size_t length, bool reuse)
 * and $chars is appended, and finally, $chars is freed.
 * NB. do *not* actually allocate any sds instance here - this is already done in lit_string_makeempty().
 */
-LitString* lit_string_makelen(LitState* state, char* chars, size_t length, uint32_t hash, bool wassds, bool reuse)
+LitString* lit_string_makelen(LitState* state, char* chars, size_t length, uint64_t hash, bool wassds, bool reuse)
 {
     LitString* string;
     string = lit_string_makeempty(state, length, reuse);
@@ -371,8 +500,8 @@ void lit_state_regstring(LitState* state, LitString* string)
 LitString* lit_string_take(LitState* state, char* chars, size_t length, bool wassds)
 {
     bool reuse;
-    uint32_t hash;
-    hash = lit_util_hashstring(chars, length);
+    uint64_t hash;
+    hash = lit_util_hashstring(state, chars, length);
     LitString* interned;
     interned = lit_table_find_string(&state->vm->strings, chars, length, hash);
     if(interned != NULL)
@@ -380,7 +509,10 @@ LitString* lit_string_take(LitState* state, char* chars, size_t length, bool was
         if(!wassds)
         {
             LIT_FREE(state, sizeof(char), chars);
-            //sdsfree(chars);
+        }
+        else
+        {
+            sdsfree(chars);
         }
         return interned;
     }
@@ -390,10 +522,10 @@ LitString* lit_string_take(LitState* state, char* chars, size_t length, bool was
 
 LitString* lit_string_copy(LitState* state, const char* chars, size_t length)
 {
-    uint32_t hash;
+    uint64_t hash;
     char* heap_chars;
     LitString* interned;
-    hash= lit_util_hashstring(chars, length);
+    hash = lit_util_hashstring(state, chars, length);
     interned = lit_table_find_string(&state->vm->strings, chars, length, hash);
     if(interned != NULL)
     {
@@ -560,7 +692,7 @@ LitValue lit_string_format(LitState* state, const char* format, ...)
         }
     }
     va_end(arg_list);
-    result->hash = lit_util_hashstring(result->chars, lit_string_getlength(result));
+    result->hash = lit_util_hashstring(state, result->chars, lit_string_getlength(result));
     lit_state_regstring(state, result);
     state->allow_gc = was_allowed;
     return lit_value_objectvalue(result);
@@ -580,8 +712,8 @@ LitValue util_invalid_constructor(LitVM* vm, LitValue instance, size_t argc, Lit
 
 static LitValue objfn_string_plus(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
 {
+    char* chars;
     LitString* selfstr;
-    LitString* result;
     LitValue value;
     (void)argc;
     selfstr = lit_value_asstring(instance);
@@ -595,11 +727,15 @@ static LitValue objfn_string_plus(LitVM* vm, LitValue instance, size_t argc, Lit
     {
         strval = lit_value_tostring(vm->state, value);
     }
-    result = lit_string_makeempty(vm->state, lit_string_getlength(selfstr) + lit_string_getlength(strval), false);
-    lit_string_appendobj(result, selfstr);
-    lit_string_appendobj(result, strval);
-    lit_state_regstring(vm->state, result);
-    return lit_value_objectvalue(result);
+    /*
+    * go through lit_string_take, so that the result is hashed and interned like any other string.
+    * registering it with a zero hash piles every concatenation into the same bucket.
+    */
+    chars = sdsempty();
+    chars = sdsMakeRoomFor(chars, lit_string_getlength(selfstr) + lit_string_getlength(strval));
+    chars = sdscatlen(chars, selfstr->chars, lit_string_getlength(selfstr));
+    chars = sdscatlen(chars, strval->chars, lit_string_getlength(strval));
+    return lit_value_objectvalue(lit_string_take(vm->state, chars, sdslen(chars), true));
 }
 
 static LitValue objfn_string_splice(LitVM* vm, LitString* string, int from, int to)
@@ -0,0 +1,908 @@
+
+#include "lit.h"
+#include "sds.h"
+
+/*
+* Float64Array, Int32Array and Uint8Array: fixed-length arrays of raw numbers.
+* all three share the same object type (LITTYPE_TYPEDARRAY) and the same methods;
+* the class is picked from ta->kind in lit_state_getclassfor.
+* bulk methods run tight loops over the native buffer, which the compiler can vectorize,
+* split across the state's thread pool once the array is longer than LIT_POOL_CHUNK.
+*/
+
+#define TYPED_STORE_FLOAT64(dest, val) (dest) = (val)
+#define TYPED_STORE_INT32(dest, val) (dest) = (int32_t)(uint32_t)lit_typedarray_toint(val)
+#define TYPED_STORE_UINT8(dest, val) (dest) = (uint8_t)lit_typedarray_toint(val)
+
+/* applies 'op' to the elements of 'data' in [from, to), with 'rhs' as the right hand side (which may use i) */
+#define TYPED_ARITH_LOOP(data, rhs, store) \
+    switch(op) \
+    { \
+        case '+': for(i = from; i < to; i++) { store(data[i], (double)data[i] + (rhs)); } break; \
+        case '-': for(i = from; i < to; i++) { store(data[i], (double)data[i] - (rhs)); } break; \
+        case '*': for(i = from; i < to; i++) { store(data[i], (double)data[i] * (rhs)); } break; \
+        case '/': for(i = from; i < to; i++) { store(data[i], (double)data[i] / (rhs)); } break; \
+    }
+
+static const char* typed_kind_names[] =
+{
+    "Float64Array",
+    "Int32Array",
+    "Uint8Array",
+};
+
+LitTypedArray* lit_create_typedarray(LitState* state, LitTypedKind kind, size_t length)
+{
+    void* data;
+    LitTypedArray* ta;
+    // allocate the buffer first, in case it triggers the GC
+    data = NULL;
+    if(length > 0)
+    {
+        data = LIT_ALLOCATE(state, lit_typedarray_elemsize(kind), length);
+        memset(data, 0, lit_typedarray_elemsize(kind) * length);
+    }
+    ta = (LitTypedArray*)lit_gcmem_allocobject(state, sizeof(LitTypedArray), LITTYPE_TYPEDARRAY, false);
+    ta->kind = kind;
+    ta->length = length;
+    ta->data = data;
+    return ta;
+}
+
+void lit_typedarray_destroy(LitState* state, LitTypedArray* ta)
+{
+    if(ta->data != NULL)
+    {
+        LIT_FREE_ARRAY(state, lit_typedarray_elemsize(ta->kind), ta->data, ta->length);
+    }
+    ta->data = NULL;
+    ta->length = 0;
+}
+
+const char* lit_typedarray_kindname(LitTypedKind kind)
+{
+    return typed_kind_names[kind];
+}
+
+static void typed_fill(LitTypedArray* ta, double value, size_t from, size_t to)
+{
+    size_t i;
+    double* f64;
+    int32_t i32;
+    switch(ta->kind)
+    {
+        case LITTYPED_FLOAT64:
+            {
+                f64 = (double*)ta->data;
+                for(i = from; i < to; i++)
+                {
+                    f64[i] = value;
+                }
+            }
+            break;
+        case LITTYPED_INT32:
+            {
+                TYPED_STORE_INT32(i32, value);
+                for(i = from; i < to; i++)
+                {
+                    ((int32_t*)ta->data)[i] = i32;
+                }
+            }
+            break;
+        case LITTYPED_UINT8:
+            {
+                memset((uint8_t*)ta->data + from, (uint8_t)lit_typedarray_toint(value), to - from);
+            }
+            break;
+    }
+}
+
+/* op is one of '+', '-', '*' or '/'. other may be NULL, in which case scalar is used */
+static void typed_arith(LitTypedArray* ta, char op, double scalar, LitTypedArray* other, size_t from, size_t to)
+{
+    size_t i;
+    double* f64;
+    double* of64;
+    int32_t* i32;
+    uint8_t* u8;
+    switch(ta->kind)
+    {
+        case LITTYPED_FLOAT64:
+            {
+                f64 = (double*)ta->data;
+                if(other == NULL)
+                {
+                    TYPED_ARITH_LOOP(f64, scalar, TYPED_STORE_FLOAT64);
+                }
+                else if(other->kind == LITTYPED_FLOAT64)
+                {
+                    of64 = (double*)other->data;
+                    TYPED_ARITH_LOOP(f64, of64[i], TYPED_STORE_FLOAT64);
+                }
+                else
+                {
+                    TYPED_ARITH_LOOP(f64, lit_typedarray_get(other, i), TYPED_STORE_FLOAT64);
+                }
+            }
+            break;
+        case LITTYPED_INT32:
+            {
+                i32 = (int32_t*)ta->data;
+                if(other == NULL)
+                {
+                    TYPED_ARITH_LOOP(i32, scalar, TYPED_STORE_INT32);
+                }
+                else
+                {
+                    TYPED_ARITH_LOOP(i32, lit_typedarray_get(other, i), TYPED_STORE_INT32);
+                }
+            }
+            break;
+        case LITTYPED_UINT8:
+            {
+                u8 = (uint8_t*)ta->data;
+                if(other == NULL)
+                {
+                    TYPED_ARITH_LOOP(u8, scalar, TYPED_STORE_UINT8);
+                }
+                else
+                {
+                    TYPED_ARITH_LOOP(u8, lit_typedarray_get(other, i), TYPED_STORE_UINT8);
+                }
+            }
+            break;
+    }
+}
+
+static double typed_sum(LitTypedArray* ta, size_t from, size_t to)
+{
+    size_t i;
+    int64_t isum;
+    double s0;
+    double s1;
+    double s2;
+    double s3;
+    double* f64;
+    isum = 0;
+    switch(ta->kind)
+    {
+        case LITTYPED_FLOAT64:
+            {
+                // four independent accumulators, so the adds do not wait on each other
+                f64 = (double*)ta->data;
+                s0 = s1 = s2 = s3 = 0;
+                for(i = from; i + 4 <= to; i += 4)
+                {
+                    s0 += f64[i];
+                    s1 += f64[i + 1];
+                    s2 += f64[i + 2];
+                    s3 += f64[i + 3];
+                }
+                for(; i < to; i++)
+                {
+                    s0 += f64[i];
+                }
+                return (s0 + s1) + (s2 + s3);
+            }
+            break;
+        case LITTYPED_INT32:
+            {
+                for(i = from; i < to; i++)
+                {
+                    isum += ((int32_t*)ta->data)[i];
+                }
+            }
+            break;
+        case LITTYPED_UINT8:
+            {
+                for(i = from; i < to; i++)
+                {
+                    isum += ((uint8_t*)ta->data)[i];
+                }
+            }
+            break;
+    }
+    return (double)isum;
+}
+
+static double typed_dot(LitTypedArray* a, LitTypedArray* b, size_t from, size_t to)
+{
+    size_t i;
+    double s0;
+    double s1;
+    double* af64;
+    double* bf64;
+    s0 = s1 = 0;
+    if(a->kind == LITTYPED_FLOAT64 && b->kind == LITTYPED_FLOAT64)
+    {
+        af64 = (double*)a->data;
+        bf64 = (double*)b->data;
+        for(i = from; i + 2 <= to; i += 2)
+        {
+            s0 += af64[i] * bf64[i];
+            s1 += af64[i + 1] * bf64[i + 1];
+        }
+        for(; i < to; i++)
+        {
+            s0 += af64[i] * bf64[i];
+        }
+        return s0 + s1;
+    }
+    for(i = from; i < to; i++)
+    {
+        s0 += lit_typedarray_get(a, i) * lit_typedarray_get(b, i);
+    }
+    return s0;
+}
+
+/* nan is skipped here; typed_job_minmax makes the result nan when the first element is */
+static double typed_minmax(LitTypedArray* ta, bool max, size_t from, size_t to)
+{
+    size_t i;
+    double v;
+    double best;
+    best = lit_typedarray_get(ta, from);
+    if(ta->kind == LITTYPED_FLOAT64)
+    {
+        for(i = from + 1; i < to; i++)
+        {
+            v = ((double*)ta->data)[i];
+            if((max ? (v > best) : (v < best)) || isnan(best))
+            {
+                best = v;
+            }
+        }
+        return best;
+    }
+    for(i = from + 1; i < to; i++)
+    {
+        v = lit_typedarray_get(ta, i);
+        if(max ? (v > best) : (v < best))
+        {
+            best = v;
+        }
+    }
+    return best;
+}
+
+static double typed_indexof(LitTypedArray* ta, double value, size_t from, size_t to)
+{
+    size_t i;
+    double* f64;
+    if(ta->kind == LITTYPED_FLOAT64)
+    {
+        f64 = (double*)ta->data;
+        for(i = from; i < to; i++)
+        {
+            if(f64[i] == value)
+            {
+                return (double)i;
+            }
+        }
+        return -1;
+    }
+    for(i = from; i < to; i++)
+    {
+        if(lit_typedarray_get(ta, i) == value)
+        {
+            return (double)i;
+        }
+    }
+    return -1;
+}
+
+/*
+* bulk methods go through the state's thread pool (see threadpool.c). [from, to) is
+* cut into chunks of LIT_POOL_CHUNK elements, each task works on one of them and
+* leaves its result in partial[chunk], and the caller folds the partials in chunk
+* order. the chunks only depend on the length, so results are the same for any
+* number of threads.
+*/
+
+typedef struct TypedJob TypedJob;
+
+struct TypedJob
+{
+    LitTypedArray* ta;
+    LitTypedArray* other;
+    char op;
+    bool max;
+    double value;
+    size_t from;
+    size_t to;
+    size_t chunks;
+    /* the lowest chunk indexOf has seen a match in so far */
+    size_t found;
+    double* partial;
+    double local[16];
+};
+
+static void typed_job_range(TypedJob* job, size_t chunk, size_t* from, size_t* to)
+{
+    *from = job->from + chunk * LIT_POOL_CHUNK;
+    *to = (job->to - *from) < LIT_POOL_CHUNK ? job->to : *from + LIT_POOL_CHUNK;
+}
+
+static void typed_task_fill(void* data, size_t chunk)
+{
+    size_t from;
+    size_t to;
+    TypedJob* job;
+    job = (TypedJob*)data;
+    typed_job_range(job, chunk, &from, &to);
+    typed_fill(job->ta, job->value, from, to);
+}
+
+static void typed_task_arith(void* data, size_t chunk)
+{
+    size_t from;
+    size_t to;
+    TypedJob* job;
+    job = (TypedJob*)data;
+    typed_job_range(job, chunk, &from, &to);
+    typed_arith(job->ta, job->op, job->value, job->other, from, to);
+}
+
+static void typed_task_sum(void* data, size_t chunk)
+{
+    size_t from;
+    size_t to;
+    TypedJob* job;
+    job = (TypedJob*)data;
+    typed_job_range(job, chunk, &from, &to);
+    job->partial[chunk] = typed_sum(job->ta, from, to);
+}
+
+static void typed_task_dot(void* data, size_t chunk)
+{
+    size_t from;
+    size_t to;
+    TypedJob* job;
+    job = (TypedJob*)data;
+    typed_job_range(job, chunk, &from, &to);
+    job->partial[chunk] = typed_dot(job->ta, job->other, from, to);
+}
+
+static void typed_task_minmax(void* data, size_t chunk)
+{
+    size_t from;
+    size_t to;
+    TypedJob* job;
+    job = (TypedJob*)data;
+    typed_job_range(job, chunk, &from, &to);
+    job->partial[chunk] = typed_minmax(job->ta, job->max, from, to);
+}
+
+static void typed_task_indexof(void* data, size_t chunk)
+{
+    size_t from;
+    size_t to;
+    size_t found;
+    TypedJob* job;
+    job = (TypedJob*)data;
+    job->partial[chunk] = -1;
+    /* an earlier chunk already has a match, so this one cannot be the first */
+    found = lit_atomic_load(&job->found, LIT_ATOMIC_RELAXED);
+    if(chunk > found)
+    {
+        return;
+    }
+    typed_job_range(job, chunk, &from, &to);
+    job->partial[chunk] = typed_indexof(job->ta, job->value, from, to);
+    while(job->partial[chunk] >= 0 && chunk < found)
+    {
+        if(lit_atomic_cas(&job->found, &found, chunk, LIT_ATOMIC_RELAXED))
+        {
+            break;
+        }
+    }
+}
+
+static void typed_job_run(LitState* state, TypedJob* job, size_t from, size_t to, LitPoolTaskFn task)
+{
+    job->from = from;
+    job->to = to;
+    job->found = SIZE_MAX;
+    job->chunks = lit_pool_chunkcount(to - from);
+    job->partial = job->local;
+    if(job->chunks > sizeof(job->local) / sizeof(job->local[0]))
+    {
+        job->partial = (double*)malloc(job->chunks * sizeof(double));
+    }
+    lit_pool_run(state, job->chunks, task, job);
+}
+
+static void typed_job_end(TypedJob* job)
+{
+    if(job->partial != job->local)
+    {
+        free(job->partial);
+    }
+}
+
+static double typed_job_sum(TypedJob* job)
+{
+    size_t i;
+    double sum;
+    sum = 0;
+    for(i = 0; i < job->chunks; i++)
+    {
+        sum += job->partial[i];
+    }
+    typed_job_end(job);
+    return sum;
+}
+
+static double typed_job_minmax(TypedJob* job)
+{
+    size_t i;
+    double v;
+    double best;
+    /* like a plain loop would: a leading nan never compares as better, so it sticks */
+    best = lit_typedarray_get(job->ta, 0);
+    if(!isnan(best))
+    {
+        best = job->partial[0];
+        for(i = 1; i < job->chunks; i++)
+        {
+            v = job->partial[i];
+            if((job->max ? (v > best) : (v < best)) || isnan(best))
+            {
+                best = v;
+            }
+        }
+    }
+    typed_job_end(job);
+    return best;
+}
+
+static double typed_job_indexof(TypedJob* job)
+{
+    size_t i;
+    double index;
+    index = -1;
+    for(i = 0; i < job->chunks && index < 0; i++)
+    {
+        index = job->partial[i];
+    }
+    typed_job_end(job);
+    return index;
+}
+
+/* uint8 is sorted by counting, the others through lit_pool_sortnumbers */
+static void typed_sort(LitState* state, LitTypedArray* ta)
+{
+    size_t i;
+    size_t j;
+    size_t counts[256];
+    double* values;
+    uint8_t* u8;
+    switch(ta->kind)
+    {
+        case LITTYPED_FLOAT64:
+            {
+                lit_pool_sortnumbers(state, (double*)ta->data, ta->length);
+            }
+            break;
+        case LITTYPED_INT32:
+            {
+                values = (double*)malloc(ta->length * sizeof(double));
+                for(i = 0; i < ta->length; i++)
+                {
+                    values[i] = ((int32_t*)ta->data)[i];
+                }
+                lit_pool_sortnumbers(state, values, ta->length);
+                for(i = 0; i < ta->length; i++)
+                {
+                    ((int32_t*)ta->data)[i] = (int32_t)values[i];
+                }
+                free(values);
+            }
+            break;
+        case LITTYPED_UINT8:
+            {
+                u8 = (uint8_t*)ta->data;
+                memset(counts, 0, sizeof(counts));
+                for(i = 0; i < ta->length; i++)
+                {
+                    counts[u8[i]]++;
+                }
+                for(i = 0, j = 0; i < 256; i++)
+                {
+                    memset(u8 + j, (int)i, counts[i]);
+                    j += counts[i];
+                }
+            }
+            break;
+    }
+}
+
+static LitTypedArray* typed_check_other(LitVM* vm, LitTypedArray* self, LitValue value)
+{
+    LitTypedArray* other;
+    if(!lit_value_istypedarray(value))
+    {
+        lit_vm_raiseexitingerror(vm, "expected a number or a typed array as the argument");
+        return NULL;
+    }
+    other = lit_value_astypedarray(value);
+    if(other->length != self->length)
+    {
+        lit_vm_raiseexitingerror(vm, "typed array length mismatch (%i vs %i)", (int)self->length, (int)other->length);
+        return NULL;
+    }
+    return other;
+}
+
+static LitValue typed_construct(LitVM* vm, LitTypedKind kind, size_t argc, LitValue* argv)
+{
+    size_t i;
+    double length;
+    LitValueList* values;
+    LitTypedArray* ta;
+    LitTypedArray* from;
+    if(argc == 0)
+    {
+        return lit_value_objectvalue(lit_create_typedarray(vm->state, kind, 0));
+    }
+    if(lit_value_isnumber(argv[0]))
+    {
+        length = lit_value_asnumber(argv[0]);
+        if(length < 0)
+        {
+            lit_vm_raiseexitingerror(vm, "%s length must not be negative", typed_kind_names[kind]);
+        }
+        return lit_value_objectvalue(lit_create_typedarray(vm->state, kind, (size_t)length));
+    }
+    if(lit_value_isarray(argv[0]))
+    {
+        values = &lit_value_asarray(argv[0])->list;
+        ta = lit_create_typedarray(vm->state, kind, lit_vallist_count(values));
+        for(i = 0; i < ta->length; i++)
+        {
+            if(!lit_value_isnumber(lit_vallist_get(values, i)))
+            {
+                lit_vm_raiseexitingerror(vm, "%s can only hold numbers", typed_kind_names[kind]);
+            }
+            lit_typedarray_set(ta, i, lit_value_asnumber(lit_vallist_get(values, i)));
+        }
+        return lit_value_objectvalue(ta);
+    }
+    if(lit_value_istypedarray(argv[0]))
+    {
+        from = lit_value_astypedarray(argv[0]);
+        ta = lit_create_typedarray(vm->state, kind, from->length);
+        if(from->kind == kind)
+        {
+            memcpy(ta->data, from->data, lit_typedarray_elemsize(kind) * from->length);
+        }
+        else
+        {
+            for(i = 0; i < ta->length; i++)
+            {
+                lit_typedarray_set(ta, i, lit_typedarray_get(from, i));
+            }
+        }
+        return lit_value_objectvalue(ta);
+    }
+    lit_vm_raiseexitingerror(vm, "%s expects a length, an array or a typed array", typed_kind_names[kind]);
+    return NULL_VALUE;
+}
+
+static LitValue objfn_float64array_constructor(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)instance;
+    return typed_construct(vm, LITTYPED_FLOAT64, argc, argv);
+}
+
+static LitValue objfn_int32array_constructor(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)instance;
+    return typed_construct(vm, LITTYPED_INT32, argc, argv);
+}
+
+static LitValue objfn_uint8array_constructor(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)instance;
+    return typed_construct(vm, LITTYPED_UINT8, argc, argv);
+}
+
+static LitValue objfn_typedarray_subscript(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    double index;
+    LitTypedArray* ta;
+    ta = lit_value_astypedarray(instance);
+    if(argc < 1 || !lit_value_isnumber(argv[0]))
+    {
+        lit_vm_raiseexitingerror(vm, "typed array index must be a number");
+        return NULL_VALUE;
+    }
+    index = trunc(lit_value_asnumber(argv[0]));
+    if(index < 0)
+    {
+        index += ta->length;
+    }
+    if(argc == 2)
+    {
+        if(!lit_value_isnumber(argv[1]))
+        {
+            lit_vm_raiseexitingerror(vm, "%s can only hold numbers", typed_kind_names[ta->kind]);
+        }
+        if(!(index >= 0 && index < ta->length))
+        {
+            lit_vm_raiseexitingerror(vm, "%s index %g out of range", typed_kind_names[ta->kind], index);
+        }
+        lit_typedarray_set(ta, (size_t)index, lit_value_asnumber(argv[1]));
+        return argv[1];
+    }
+    if(!(index >= 0 && index < ta->length))
+    {
+        return NULL_VALUE;
+    }
+    return lit_value_numbertovalue(vm->state, lit_typedarray_get(ta, (size_t)index));
+}
+
+static LitValue objfn_typedarray_length(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)argc;
+    (void)argv;
+    return lit_value_numbertovalue(vm->state, lit_value_astypedarray(instance)->length);
+}
+
+static LitValue objfn_typedarray_bytelength(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    LitTypedArray* ta;
+    (void)argc;
+    (void)argv;
+    ta = lit_value_astypedarray(instance);
+    return lit_value_numbertovalue(vm->state, ta->length * lit_typedarray_elemsize(ta->kind));
+}
+
+static LitValue objfn_typedarray_fill(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    double from;
+    double to;
+    TypedJob job;
+    job.ta = lit_value_astypedarray(instance);
+    job.value = lit_value_checknumber(vm, argv, argc, 0);
+    from = fmax(0, lit_value_getnumber(vm, argv, argc, 1, 0));
+    to = fmin(job.ta->length, lit_value_getnumber(vm, argv, argc, 2, job.ta->length));
+    if(from < to)
+    {
+        typed_job_run(vm->state, &job, (size_t)from, (size_t)to, typed_task_fill);
+        typed_job_end(&job);
+    }
+    return instance;
+}
+
+static LitValue typed_arith_method(LitVM* vm, LitValue instance, size_t argc, LitValue* argv, char op)
+{
+    TypedJob job;
+    LIT_ENSURE_ARGS(vm->state, 1);
+    job.ta = lit_value_astypedarray(instance);
+    job.op = op;
+    job.value = 0;
+    job.other = NULL;
+    if(lit_value_isnumber(argv[0]))
+    {
+        job.value = lit_value_asnumber(argv[0]);
+    }
+    else
+    {
+        job.other = typed_check_other(vm, job.ta, argv[0]);
+    }
+    typed_job_run(vm->state, &job, 0, job.ta->length, typed_task_arith);
+    typed_job_end(&job);
+    return instance;
+}
+
+static LitValue objfn_typedarray_add(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    return typed_arith_method(vm, instance, argc, argv, '+');
+}
+
+static LitValue objfn_typedarray_sub(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    return typed_arith_method(vm, instance, argc, argv, '-');
+}
+
+static LitValue objfn_typedarray_mul(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    return typed_arith_method(vm, instance, argc, argv, '*');
+}
+
+static LitValue objfn_typedarray_div(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    return typed_arith_method(vm, instance, argc, argv, '/');
+}
+
+static LitValue objfn_typedarray_sum(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    TypedJob job;
+    (void)argc;
+    (void)argv;
+    job.ta = lit_value_astypedarray(instance);
+    typed_job_run(vm->state, &job, 0, job.ta->length, typed_task_sum);
+    return lit_value_numbertovalue(vm->state, typed_job_sum(&job));
+}
+
+static LitValue typed_minmax_method(LitVM* vm, LitValue instance, bool max)
+{
+    TypedJob job;
+    job.ta = lit_value_astypedarray(instance);
+    if(job.ta->length == 0)
+    {
+        return NULL_VALUE;
+    }
+    job.max = max;
+    typed_job_run(vm->state, &job, 0, job.ta->length, typed_task_minmax);
+    return lit_value_numbertovalue(vm->state, typed_job_minmax(&job));
+}
+
+static LitValue objfn_typedarray_min(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)argc;
+    (void)argv;
+    return typed_minmax_method(vm, instance, false);
+}
+
+static LitValue objfn_typedarray_max(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)argc;
+    (void)argv;
+    return typed_minmax_method(vm, instance, true);
+}
+
+static LitValue objfn_typedarray_dot(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    TypedJob job;
+    LIT_ENSURE_ARGS(vm->state, 1);
+    job.ta = lit_value_astypedarray(instance);
+    job.other = typed_check_other(vm, job.ta, argv[0]);
+    typed_job_run(vm->state, &job, 0, job.ta->length, typed_task_dot);
+    return lit_value_numbertovalue(vm->state, typed_job_sum(&job));
+}
+
+static LitValue objfn_typedarray_indexof(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    double index;
+    TypedJob job;
+    job.ta = lit_value_astypedarray(instance);
+    job.value = lit_value_checknumber(vm, argv, argc, 0);
+    typed_job_run(vm->state, &job, 0, job.ta->length, typed_task_indexof);
+    index = typed_job_indexof(&job);
+    return index < 0 ? NULL_VALUE : lit_value_numbertovalue(vm->state, index);
+}
+
+static LitValue objfn_typedarray_sort(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)argc;
+    (void)argv;
+    typed_sort(vm->state, lit_value_astypedarray(instance));
+    return instance;
+}
+
+static LitValue objfn_typedarray_clone(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    LitTypedArray* ta;
+    (void)argc;
+    (void)argv;
+    ta = lit_value_astypedarray(instance);
+    return typed_construct(vm, ta->kind, 1, &instance);
+}
+
+static LitValue objfn_typedarray_toarray(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    size_t i;
+    LitArray* array;
+    LitTypedArray* ta;
+    (void)argc;
+    (void)argv;
+    ta = lit_value_astypedarray(instance);
+    array = lit_create_array(vm->state);
+    lit_state_pushroot(vm->state, (LitObject*)array);
+    lit_vallist_ensuresize(vm->state, &array->list, ta->length);
+    for(i = 0; i < ta->length; i++)
+    {
+        lit_vallist_set(&array->list, i, lit_value_numbertovalue(vm->state, lit_typedarray_get(ta, i)));
+    }
+    lit_state_poproot(vm->state);
+    return lit_value_objectvalue(array);
+}
+
+static LitValue objfn_typedarray_iterator(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    int number;
+    LitTypedArray* ta;
+    LIT_ENSURE_ARGS(vm->state, 1);
+    ta = lit_value_astypedarray(instance);
+    number = 0;
+    if(lit_value_isnumber(argv[0]))
+    {
+        number = lit_value_asnumber(argv[0]);
+        if(number >= (int)ta->length - 1)
+        {
+            return NULL_VALUE;
+        }
+        number++;
+    }
+    return ta->length == 0 ? NULL_VALUE : lit_value_numbertovalue(vm->state, number);
+}
+
+static LitValue objfn_typedarray_iteratorvalue(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    size_t index;
+    LitTypedArray* ta;
+    index = lit_value_checknumber(vm, argv, argc, 0);
+    ta = lit_value_astypedarray(instance);
+    if(ta->length <= index)
+    {
+        return NULL_VALUE;
+    }
+    return lit_value_numbertovalue(vm->state, lit_typedarray_get(ta, index));
+}
+
+static LitValue objfn_typedarray_tostring(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    size_t i;
+    size_t amount;
+    char* buffer;
+    LitTypedArray* ta;
+    (void)argc;
+    (void)argv;
+    ta = lit_value_astypedarray(instance);
+    amount = ta->length > LIT_CONTAINER_OUTPUT_MAX ? LIT_CONTAINER_OUTPUT_MAX : ta->length;
+    buffer = sdscatprintf(sdsempty(), "%s(%u) [", typed_kind_names[ta->kind], (unsigned int)ta->length);
+    for(i = 0; i < amount; i++)
+    {
+        buffer = sdscatprintf(buffer, i == 0 ? "%.14g" : ", %.14g", lit_typedarray_get(ta, i));
+    }
+    if(amount < ta->length)
+    {
+        buffer = sdscat(buffer, ", ...");
+    }
+    buffer = sdscat(buffer, "]");
+    return lit_value_objectvalue(lit_string_take(vm->state, buffer, sdslen(buffer), true));
+}
+
+static LitClass* typed_open_class(LitState* state, LitTypedKind kind, LitNativeMethodFn constructor)
+{
+    LitClass* klass;
+    klass = lit_create_classobject(state, typed_kind_names[kind]);
+    {
+        lit_class_inheritfrom(state, klass, state->objectvalue_class);
+        lit_class_bindconstructor(state, klass, constructor);
+        lit_class_bindmethod(state, klass, "[]", objfn_typedarray_subscript);
+        lit_class_bindmethod(state, klass, "fill", objfn_typedarray_fill);
+        lit_class_bindmethod(state, klass, "add", objfn_typedarray_add);
+        lit_class_bindmethod(state, klass, "sub", objfn_typedarray_sub);
+        lit_class_bindmethod(state, klass, "mul", objfn_typedarray_mul);
+        lit_class_bindmethod(state, klass, "div", objfn_typedarray_div);
+        lit_class_bindmethod(state, klass, "sum", objfn_typedarray_sum);
+        lit_class_bindmethod(state, klass, "min", objfn_typedarray_min);
+        lit_class_bindmethod(state, klass, "max", objfn_typedarray_max);
+        lit_class_bindmethod(state, klass, "dot", objfn_typedarray_dot);
+        lit_class_bindmethod(state, klass, "indexOf", objfn_typedarray_indexof);
+        lit_class_bindmethod(state, klass, "sort", objfn_typedarray_sort);
+        lit_class_bindmethod(state, klass, "clone", objfn_typedarray_clone);
+        lit_class_bindmethod(state, klass, "toArray", objfn_typedarray_toarray);
+        lit_class_bindmethod(state, klass, "iterator", objfn_typedarray_iterator);
+        lit_class_bindmethod(state, klass, "iteratorValue", objfn_typedarray_iteratorvalue);
+        lit_class_bindmethod(state, klass, "toString", objfn_typedarray_tostring);
+        lit_class_bindgetset(state, klass, "length", objfn_typedarray_length, NULL, false);
+        lit_class_bindgetset(state, klass, "byteLength", objfn_typedarray_bytelength, NULL, false);
+    }
+    lit_state_setglobal(state, klass->name, lit_value_objectvalue(klass));
+    if(klass->super == NULL)
+    {
+        lit_class_inheritfrom(state, klass, state->objectvalue_class);
+    };
+    return klass;
+}
+
+void lit_open_typedarray_library(LitState* state)
+{
+    state->float64arrayvalue_class = typed_open_class(state, LITTYPED_FLOAT64, objfn_float64array_constructor);
+    state->int32arrayvalue_class = typed_open_class(state, LITTYPED_INT32, objfn_int32array_constructor);
+    state->uint8arrayvalue_class = typed_open_class(state, LITTYPED_UINT8, objfn_uint8array_constructor);
+}
@@ -0,0 +1,497 @@
+
+#include "lit.h"
+
+/*
+* Worker: runs a script in a state of its own, on a thread of its own.
+*
+*   var worker = new Worker("job.lit")
+*   worker.post([ 1, 2, 3 ])
+*   var answer = worker.receive()
+*
+* and in job.lit, Worker.receive() and Worker.post(value) talk to the state that
+* started it. messages are whatever the Serializer can encode (shared parts and
+* cycles included); the sender encodes them, so that neither state ever sees the
+* other's objects.
+*
+* receive() inside a fiber that was run by another one does not block: the fiber
+* yields null to the one that ran it, and is not resumed by run() until there is a
+* message. everywhere else, receive() waits. once the other side is gone (or closed
+* its end) and nothing is left, receive() returns null.
+*/
+
+#if defined(LIT_HAVE_THREADS)
+
+void lit_message_destroy(LitMessage* message)
+{
+    if(message != NULL)
+    {
+        free(message->bytes);
+        free(message);
+    }
+}
+
+/* serializes value; returns NULL and sets failed to the name of the type that can't be sent */
+LitMessage* lit_message_encode(LitValue value, const char** failed)
+{
+    size_t length;
+    uint8_t* bytes;
+    LitMessage* message;
+    bytes = lit_serial_encode(value, &length, failed);
+    if(bytes == NULL)
+    {
+        return NULL;
+    }
+    message = (LitMessage*)calloc(1, sizeof(LitMessage));
+    message->bytes = bytes;
+    message->length = length;
+    return message;
+}
+
+/* builds the value back in state. the caller has the gc off */
+LitValue lit_message_decode(LitState* state, LitMessage* message)
+{
+    LitValue value;
+    lit_serial_decode(state, message->bytes, message->length, &value);
+    return value;
+}
+
+/*
+* the queue is Vyukov's intrusive mpsc queue: producers swap themselves into head
+* and then link the previous node to them, the one consumer follows the links from
+* tail. a node whose link isn't set yet looks like the end of the queue for a moment.
+*/
+static void lit_msgqueue_init(LitMessageQueue* queue)
+{
+    queue->stub.next = NULL;
+    queue->head = &queue->stub;
+    queue->tail = &queue->stub;
+    queue->pending = 0;
+    queue->sleeping = false;
+    queue->closed = false;
+    lit_mutex_init(&queue->lock);
+    lit_cond_init(&queue->wake);
+}
+
+static void lit_msgqueue_link(LitMessageQueue* queue, LitMessage* message)
+{
+    LitMessage* previous;
+    lit_atomic_store(&message->next, NULL, LIT_ATOMIC_RELAXED);
+    previous = lit_atomic_exchange(&queue->head, message, LIT_ATOMIC_ACQREL);
+    lit_atomic_store(&previous->next, message, LIT_ATOMIC_RELEASE);
+}
+
+static void lit_msgqueue_wake(LitMessageQueue* queue)
+{
+    lit_mutex_lock(&queue->lock);
+    lit_cond_broadcast(&queue->wake);
+    lit_mutex_unlock(&queue->lock);
+}
+
+/* any thread; false (and the message is not taken) once the queue was closed */
+static bool lit_msgqueue_push(LitMessageQueue* queue, LitMessage* message)
+{
+    if(lit_atomic_load(&queue->closed, LIT_ATOMIC_ACQUIRE))
+    {
+        return false;
+    }
+    lit_atomic_add(&queue->pending, 1, LIT_ATOMIC_SEQCST);
+    lit_msgqueue_link(queue, message);
+    /* pairs with the consumer setting sleeping before it checks the queue a last time */
+    if(lit_atomic_load(&queue->sleeping, LIT_ATOMIC_SEQCST))
+    {
+        lit_msgqueue_wake(queue);
+    }
+    return true;
+}
+
+static LitMessage* lit_msgqueue_taken(LitMessageQueue* queue, LitMessage* message)
+{
+    lit_atomic_sub(&queue->pending, 1, LIT_ATOMIC_SEQCST);
+    return message;
+}
+
+/* the consumer only; NULL when empty, or while a push is half done */
+static LitMessage* lit_msgqueue_pop(LitMessageQueue* queue)
+{
+    LitMessage* tail;
+    LitMessage* next;
+    tail = queue->tail;
+    next = lit_atomic_load(&tail->next, LIT_ATOMIC_ACQUIRE);
+    if(tail == &queue->stub)
+    {
+        if(next == NULL)
+        {
+            return NULL;
+        }
+        queue->tail = next;
+        tail = next;
+        next = lit_atomic_load(&next->next, LIT_ATOMIC_ACQUIRE);
+    }
+    if(next != NULL)
+    {
+        queue->tail = next;
+        return lit_msgqueue_taken(queue, tail);
+    }
+    if(tail != lit_atomic_load(&queue->head, LIT_ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+    lit_msgqueue_link(queue, &queue->stub);
+    next = lit_atomic_load(&tail->next, LIT_ATOMIC_ACQUIRE);
+    if(next != NULL)
+    {
+        queue->tail = next;
+        return lit_msgqueue_taken(queue, tail);
+    }
+    return NULL;
+}
+
+static bool lit_msgqueue_isclosed(LitMessageQueue* queue)
+{
+    return lit_atomic_load(&queue->closed, LIT_ATOMIC_ACQUIRE);
+}
+
+/* the consumer only; waits for a message. NULL once the queue is closed and empty */
+static LitMessage* lit_msgqueue_wait(LitMessageQueue* queue)
+{
+    LitMessage* message;
+    while(true)
+    {
+        message = lit_msgqueue_pop(queue);
+        if(message != NULL)
+        {
+            return message;
+        }
+        if(lit_msgqueue_isclosed(queue))
+        {
+            /* whoever closed it is done pushing, so this can't see a half done push */
+            return lit_msgqueue_pop(queue);
+        }
+        lit_mutex_lock(&queue->lock);
+        lit_atomic_store(&queue->sleeping, true, LIT_ATOMIC_SEQCST);
+        if(lit_atomic_load(&queue->head, LIT_ATOMIC_SEQCST) == queue->tail && !lit_msgqueue_isclosed(queue))
+        {
+            lit_cond_wait(&queue->wake, &queue->lock);
+        }
+        lit_atomic_store(&queue->sleeping, false, LIT_ATOMIC_SEQCST);
+        lit_mutex_unlock(&queue->lock);
+    }
+}
+
+static void lit_msgqueue_close(LitMessageQueue* queue)
+{
+    lit_atomic_store(&queue->closed, true, LIT_ATOMIC_RELEASE);
+    lit_msgqueue_wake(queue);
+}
+
+/* once neither side uses it anymore */
+static void lit_msgqueue_destroy(LitMessageQueue* queue)
+{
+    LitMessage* message;
+    while((message = lit_msgqueue_pop(queue)) != NULL)
+    {
+        lit_message_destroy(message);
+    }
+    lit_mutex_destroy(&queue->lock);
+    lit_cond_destroy(&queue->wake);
+}
+
+static void lit_worker_release(LitWorker* worker)
+{
+    if(lit_atomic_sub(&worker->refs, 1, LIT_ATOMIC_ACQREL) == 0)
+    {
+        lit_msgqueue_destroy(&worker->inbox);
+        lit_msgqueue_destroy(&worker->outbox);
+        free(worker->path);
+        free(worker);
+    }
+}
+
+static void* lit_worker_main(void* data)
+{
+    LitWorker* worker;
+    LitState* state;
+    LitArray* arg_array;
+    worker = (LitWorker*)data;
+    state = lit_make_state();
+    state->config = worker->config;
+    state->worker = worker;
+    lit_open_libraries(state);
+    arg_array = lit_create_array(state);
+    lit_vallist_push(state, &arg_array->list, OBJECT_CONST_STRING(state, worker->path));
+    lit_state_setglobal(state, CONST_STRING(state, "args"), lit_value_objectvalue(arg_array));
+    worker->result = lit_state_execfile(state, worker->path).type;
+    lit_destroy_state(state);
+    lit_atomic_store(&worker->done, true, LIT_ATOMIC_RELEASE);
+    lit_msgqueue_close(&worker->outbox);
+    lit_worker_release(worker);
+    return NULL;
+}
+
+/* the parent's Worker object is gone: the worker gets no more messages, and runs on unjoined */
+static void lit_worker_cleanup(LitState* state, LitUserdata* data, bool mark)
+{
+    LitWorker* worker;
+    (void)state;
+    if(mark)
+    {
+        return;
+    }
+    worker = *(LitWorker**)data->data;
+    if(worker == NULL)
+    {
+        return;
+    }
+    lit_msgqueue_close(&worker->inbox);
+    if(!worker->joined)
+    {
+        lit_thread_detach(worker->thread);
+    }
+    lit_worker_release(worker);
+}
+
+static LitWorker* lit_worker_get(LitVM* vm, LitValue instance)
+{
+    LitValue data;
+    if(!lit_value_isinstance(instance) || !lit_table_get(&lit_value_asinstance(instance)->fields, CONST_STRING(vm->state, "_worker"), &data)
+       || !lit_value_isuserdata(data))
+    {
+        lit_vm_raiseexitingerror(vm, "not a Worker");
+    }
+    return *(LitWorker**)lit_value_asuserdata(data)->data;
+}
+
+/* in a worker's own state, what the Worker class' static methods talk to */
+static LitWorker* lit_worker_getparent(LitVM* vm)
+{
+    if(vm->state->worker == NULL)
+    {
+        lit_vm_raiseexitingerror(vm, "Worker.post() and Worker.receive() can only be used inside of a worker");
+    }
+    return vm->state->worker;
+}
+
+static bool lit_worker_post(LitVM* vm, LitMessageQueue* queue, size_t argc, LitValue* argv)
+{
+    const char* failed;
+    LitMessage* message;
+    if(argc < 1)
+    {
+        lit_vm_raiseexitingerror(vm, "post() expects a value to send");
+    }
+    message = lit_message_encode(argv[0], &failed);
+    if(message == NULL)
+    {
+        lit_vm_raiseexitingerror(vm, "cannot send a %s to a worker", failed);
+    }
+    if(!lit_msgqueue_push(queue, message))
+    {
+        lit_message_destroy(message);
+        return false;
+    }
+    return true;
+}
+
+static LitValue lit_worker_take(LitState* state, LitMessage* message)
+{
+    LitValue value;
+    if(message == NULL)
+    {
+        return NULL_VALUE;
+    }
+    value = lit_message_decode(state, message);
+    lit_message_destroy(message);
+    return value;
+}
+
+static LitMessageQueue* lit_worker_waitqueue(LitVM* vm, LitValue waiting)
+{
+    if(lit_value_isclass(waiting))
+    {
+        return &lit_worker_getparent(vm)->inbox;
+    }
+    return &lit_worker_get(vm, waiting)->outbox;
+}
+
+/*
+* what receive() does for both ends. waiting is what a suspended fiber remembers, to
+* find the queue again when it is run: the Worker object, or the Worker class.
+*/
+static bool lit_worker_receive(LitVM* vm, LitMessageQueue* queue, LitValue waiting, size_t argc, LitValue* argv)
+{
+    LitMessage* message;
+    message = lit_msgqueue_pop(queue);
+    if(message == NULL && vm->fiber->parent != NULL && !lit_msgqueue_isclosed(queue))
+    {
+        vm->fiber->waiting = waiting;
+        lit_fiber_yieldtoparent(vm, argv, NULL_VALUE);
+        return true;
+    }
+    if(message == NULL)
+    {
+        message = lit_msgqueue_wait(queue);
+    }
+    argv[-1] = lit_worker_take(vm->state, message);
+    vm->fiber->stack_top -= argc;
+    return false;
+}
+
+/* called by run() on a fiber that waits in receive(): false leaves it suspended */
+bool lit_worker_resume(LitVM* vm, LitFiber* fiber)
+{
+    LitMessage* message;
+    LitMessageQueue* queue;
+    queue = lit_worker_waitqueue(vm, fiber->waiting);
+    message = lit_msgqueue_pop(queue);
+    if(message == NULL && !lit_msgqueue_isclosed(queue))
+    {
+        return false;
+    }
+    if(message == NULL)
+    {
+        message = lit_msgqueue_pop(queue);
+    }
+    fiber->waiting = NULL_VALUE;
+    fiber->stack_top[-1] = lit_worker_take(vm->state, message);
+    return true;
+}
+
+static LitValue objfn_worker_constructor(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    const char* path;
+    LitWorker* worker;
+    LitUserdata* userdata;
+    path = lit_value_checkstring(vm, argv, argc, 0);
+    if(!lit_fs_fileexists(path))
+    {
+        lit_vm_raiseexitingerror(vm, "Worker: cannot find '%s'", path);
+    }
+    worker = (LitWorker*)calloc(1, sizeof(LitWorker));
+    worker->path = strdup(path);
+    worker->config = vm->state->config;
+    lit_msgqueue_init(&worker->inbox);
+    lit_msgqueue_init(&worker->outbox);
+    worker->refs = 2;
+    if(!lit_thread_create(&worker->thread, lit_worker_main, worker))
+    {
+        lit_msgqueue_destroy(&worker->inbox);
+        lit_msgqueue_destroy(&worker->outbox);
+        free(worker->path);
+        free(worker);
+        lit_vm_raiseexitingerror(vm, "Worker: cannot start a thread for '%s'", path);
+    }
+    userdata = lit_create_userdata(vm->state, sizeof(LitWorker*), false);
+    *(LitWorker**)userdata->data = worker;
+    userdata->cleanup_fn = lit_worker_cleanup;
+    lit_table_set(vm->state, &lit_value_asinstance(instance)->fields, CONST_STRING(vm->state, "_worker"), lit_value_objectvalue(userdata));
+    return instance;
+}
+
+/* true if the worker can still receive it */
+static LitValue objfn_worker_post(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    return lit_bool_to_value(vm->state, lit_worker_post(vm, &lit_worker_get(vm, instance)->inbox, argc, argv));
+}
+
+static bool objfn_worker_receive(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    return lit_worker_receive(vm, &lit_worker_get(vm, instance)->outbox, instance, argc, argv);
+}
+
+/* the worker's Worker.receive() returns null once it read everything that was posted before */
+static LitValue objfn_worker_close(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)argc;
+    (void)argv;
+    lit_msgqueue_close(&lit_worker_get(vm, instance)->inbox);
+    return NULL_VALUE;
+}
+
+/* waits for the worker's script to end; true if it ran without an error */
+static LitValue objfn_worker_join(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    LitWorker* worker;
+    (void)argc;
+    (void)argv;
+    worker = lit_worker_get(vm, instance);
+    if(!worker->joined)
+    {
+        lit_thread_join(worker->thread);
+        worker->joined = true;
+    }
+    return lit_bool_to_value(vm->state, worker->result == LITRESULT_OK);
+}
+
+static LitValue objfn_worker_done(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)argc;
+    (void)argv;
+    return lit_bool_to_value(vm->state, lit_atomic_load(&lit_worker_get(vm, instance)->done, LIT_ATOMIC_ACQUIRE));
+}
+
+/* how many messages from the worker wait to be received */
+static LitValue objfn_worker_pending(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)argc;
+    (void)argv;
+    return lit_value_numbertovalue(vm->state, lit_atomic_load(&lit_worker_get(vm, instance)->outbox.pending, LIT_ATOMIC_ACQUIRE));
+}
+
+static LitValue objfn_worker_static_post(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)instance;
+    return lit_bool_to_value(vm->state, lit_worker_post(vm, &lit_worker_getparent(vm)->outbox, argc, argv));
+}
+
+static bool objfn_worker_static_receive(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    return lit_worker_receive(vm, &lit_worker_getparent(vm)->inbox, instance, argc, argv);
+}
+
+static LitValue objfn_worker_static_isworker(LitVM* vm, LitValue instance, size_t argc, LitValue* argv)
+{
+    (void)instance;
+    (void)argc;
+    (void)argv;
+    return lit_bool_to_value(vm->state, vm->state->worker != NULL);
+}
+
+void lit_open_worker_library(LitState* state)
+{
+    LitClass* klass;
+    klass = lit_create_classobject(state, "Worker");
+    {
+        lit_class_bindconstructor(state, klass, objfn_worker_constructor);
+        lit_class_bindmethod(state, klass, "post", objfn_worker_post);
+        lit_class_bindprimitive(state, klass, "receive", objfn_worker_receive);
+        lit_class_bindmethod(state, klass, "close", objfn_worker_close);
+        lit_class_bindmethod(state, klass, "join", objfn_worker_join);
+        lit_class_bindgetset(state, klass, "done", objfn_worker_done, NULL, false);
+        lit_class_bindgetset(state, klass, "pending", objfn_worker_pending, NULL, false);
+        lit_class_bindstaticmethod(state, klass, "post", objfn_worker_static_post);
+        lit_class_bindstaticprimitive(state, klass, "receive", objfn_worker_static_receive);
+        lit_class_bindgetset(state, klass, "isWorker", objfn_worker_static_isworker, NULL, true);
+    }
+    lit_state_setglobal(state, klass->name, lit_value_objectvalue(klass));
+    if(klass->super == NULL)
+    {
+        lit_class_inheritfrom(state, klass, state->objectvalue_class);
+    }
+}
+
+#else
+
+/* no threads: there is no Worker class, so no fiber ever waits for one */
+bool lit_worker_resume(LitVM* vm, LitFiber* fiber)
+{
+    (void)vm;
+    fiber->waiting = NULL_VALUE;
+    return true;
+}
+
+void lit_open_worker_library(LitState* state)
+{
+    (void)state;
+}
+
+#endif
@@ -26,7 +26,7 @@
 #define LIT_VERSION_MAJOR 0
 #define LIT_VERSION_MINOR 1
 #define LIT_VERSION_STRING "0.1"
-#define LIT_BYTECODE_VERSION 0
+#define LIT_BYTECODE_VERSION 1
 
 #define TESTING
 // #define DEBUG
@@ -55,12 +55,56 @@
     #define SINGLE_LINE_MAPS_ENABLED false
 #endif
 
+/*
+* per-opcode execution counters, for VM.stats() and --opstats. kept apart from DEBUG,
+* since they are meant for optimized builds. LIT_OPCODE_CYCLES additionally times
+* every dispatch with the timestamp counter (and implies LIT_OPCODE_STATS).
+*/
+// #define LIT_OPCODE_STATS
+// #define LIT_OPCODE_CYCLES
+
+#if defined(LIT_OPCODE_CYCLES) && !defined(LIT_OPCODE_STATS)
+    #define LIT_OPCODE_STATS
+#endif
+
+/* for the few things that have to be file-scoped, but must not be shared between threads */
+#if defined(_MSC_VER)
+    #define LIT_THREADLOCAL __declspec(thread)
+#else
+    #define LIT_THREADLOCAL __thread
+#endif
+
+/* the cycle histogram buckets by log2, so this covers deltas of up to 2^31 ticks */
+#define LIT_OPSTATS_BUCKETS 32
+
 #define LIT_MAX_INTERPOLATION_NESTING 4
 
 #define LIT_GC_HEAP_GROW_FACTOR 2
-#define LIT_CALL_FRAMES_MAX (1024*8)
+/* how many collections GC.stats() remembers */
+#define LIT_GC_EVENTLOG 64
+/* log2 microsecond buckets; the last one takes every pause of 2^22us (about 4s) or more */
+#define LIT_GC_PAUSEBUCKETS 24
+/* the range the pacer keeps its grow factor in */
+#define LIT_GC_PACER_MINGROW 1.25
+#define LIT_GC_PACER_MAXGROW 16.0
+#define LIT_CALL_FRAMES_MAX (1024*256)
+/* a traceback shows this many (distinct) frames at either end of the stack, and skips the rest */
+#define LIT_TRACEBACK_EDGE 16
 #define LIT_INITIAL_CALL_FRAMES 128
 #define LIT_CONTAINER_OUTPUT_MAX 10
+/* how much File.readInto() asks for when the size of the file is unknown */
+#define LIT_FILE_READ_CHUNK (64 * 1024)
+/*
+* bulk operations on arrays and typed arrays work in chunks of this many elements,
+* at offsets that only depend on the length, so results don't depend on how many
+* threads there are. anything longer than one chunk goes to the thread pool.
+*/
+#define LIT_POOL_CHUNK (32 * 1024)
+/* the most threads lit_pool_run uses, however many cores there are */
+#define LIT_POOL_MAXTHREADS 64
+/* flags of each capture operand of OP_CLOSURE */
+#define LIT_CAPTURE_LOCAL 1
+#define LIT_CAPTURE_BYVALUE 2
 
 
 #if defined(__ANDROID__) || defined(_ANDROID_)
@@ -81,6 +125,83 @@
     #define LIT_USE_LIBREADLINE
 #endif
 
+/*
+* threads and atomics, for the few places that use them (the stress runner, workers,
+* the thread pool). they are pthreads and the gcc/clang __atomic builtins wherever
+* both exist, which defines LIT_HAVE_THREADS. everywhere else lit runs on a single
+* thread: lit_thread_create fails, locks and waits do nothing, lit_once is a flag,
+* and atomics are plain reads and writes, which is all a single thread needs.
+* lit_atomic_exchange only exists with threads.
+*/
+#if defined(LIT_OS_UNIX_LIKE) && (defined(__GNUC__) || defined(__clang__))
+    #define LIT_HAVE_THREADS
+#endif
+
+#if defined(LIT_HAVE_THREADS)
+    #include <pthread.h>
+    typedef pthread_t LitThread;
+    typedef pthread_mutex_t LitMutex;
+    typedef pthread_cond_t LitCond;
+    typedef pthread_once_t LitOnce;
+    #define LIT_ONCE_INIT PTHREAD_ONCE_INIT
+    #define lit_once(once, fn) pthread_once((once), (fn))
+    #define lit_thread_create(thread, fn, data) (pthread_create((thread), NULL, (fn), (data)) == 0)
+    #define lit_thread_join(thread) pthread_join((thread), NULL)
+    #define lit_thread_detach(thread) pthread_detach(thread)
+    #define lit_mutex_init(mutex) pthread_mutex_init((mutex), NULL)
+    #define lit_mutex_destroy(mutex) pthread_mutex_destroy(mutex)
+    #define lit_mutex_lock(mutex) pthread_mutex_lock(mutex)
+    #define lit_mutex_unlock(mutex) pthread_mutex_unlock(mutex)
+    #define lit_cond_init(cond) pthread_cond_init((cond), NULL)
+    #define lit_cond_destroy(cond) pthread_cond_destroy(cond)
+    #define lit_cond_wait(cond, mutex) pthread_cond_wait((cond), (mutex))
+    #define lit_cond_signal(cond) pthread_cond_signal(cond)
+    #define lit_cond_broadcast(cond) pthread_cond_broadcast(cond)
+    #define LIT_ATOMIC_RELAXED __ATOMIC_RELAXED
+    #define LIT_ATOMIC_ACQUIRE __ATOMIC_ACQUIRE
+    #define LIT_ATOMIC_RELEASE __ATOMIC_RELEASE
+    #define LIT_ATOMIC_ACQREL __ATOMIC_ACQ_REL
+    #define LIT_ATOMIC_SEQCST __ATOMIC_SEQ_CST
+    #define lit_atomic_load(ptr, order) __atomic_load_n((ptr), (order))
+    #define lit_atomic_store(ptr, value, order) __atomic_store_n((ptr), (value), (order))
+    #define lit_atomic_exchange(ptr, value, order) __atomic_exchange_n((ptr), (value), (order))
+    /* both return the new value */
+    #define lit_atomic_add(ptr, value, order) __atomic_add_fetch((ptr), (value), (order))
+    #define lit_atomic_sub(ptr, value, order) __atomic_sub_fetch((ptr), (value), (order))
+    /* strong compare-and-swap; on failure *expected gets the current value */
+    #define lit_atomic_cas(ptr, expected, desired, order) __atomic_compare_exchange_n((ptr), (expected), (desired), false, (order), __ATOMIC_RELAXED)
+#else
+    typedef int LitThread;
+    typedef int LitMutex;
+    typedef int LitCond;
+    typedef bool LitOnce;
+    #define LIT_ONCE_INIT false
+    #define lit_once(once, fn) ((*(once)) ? (void)0 : (*(once) = true, (fn)()))
+    #define lit_thread_create(thread, fn, data) ((void)(thread), (void)(fn), (void)(data), false)
+    #define lit_thread_join(thread) ((void)(thread))
+    #define lit_thread_detach(thread) ((void)(thread))
+    #define lit_mutex_init(mutex) ((void)(mutex))
+    #define lit_mutex_destroy(mutex) ((void)(mutex))
+    #define lit_mutex_lock(mutex) ((void)(mutex))
+    #define lit_mutex_unlock(mutex) ((void)(mutex))
+    #define lit_cond_init(cond) ((void)(cond))
+    #define lit_cond_destroy(cond) ((void)(cond))
+    #define lit_cond_wait(cond, mutex) ((void)(cond), (void)(mutex))
+    #define lit_cond_signal(cond) ((void)(cond))
+    #define lit_cond_broadcast(cond) ((void)(cond))
+    #define LIT_ATOMIC_RELAXED 0
+    #define LIT_ATOMIC_ACQUIRE 0
+    #define LIT_ATOMIC_RELEASE 0
+    #define LIT_ATOMIC_ACQREL 0
+    #define LIT_ATOMIC_SEQCST 0
+    #define lit_atomic_load(ptr, order) (*(ptr))
+    #define lit_atomic_store(ptr, value, order) (*(ptr) = (value))
+    #define lit_atomic_add(ptr, value, order) (*(ptr) += (value))
+    #define lit_atomic_sub(ptr, value, order) (*(ptr) -= (value))
+    #define lit_atomic_cas(ptr, expected, desired, order) \
+        ((*(ptr) == *(expected)) ? (*(ptr) = (desired), true) : (*(expected) = *(ptr), false))
+#endif
+
 #ifdef LIT_USE_LIBREADLINE
 #else
     #define LIT_REPL_INPUT_MAX 1024
@@ -96,6 +217,15 @@
 #define LIT_BYTECODE_END_NUMBER 2942
 #define LIT_STRING_KEY 48
 
+/* constant types and function flags of the version 1 format */
+#define LIT_BYTECODE_CONST_VALUE 0
+#define LIT_BYTECODE_CONST_STRING 1
+#define LIT_BYTECODE_CONST_FUNCTION 2
+#define LIT_BYTECODE_CONST_FIELD 3
+#define LIT_BYTECODE_FUNCTION_VARARG 1
+#define LIT_BYTECODE_FUNCTION_VARARG_USED 2
+#define LIT_BYTECODE_FUNCTION_LINES 4
+
 #define SIGN_BIT ((uint64_t)1 << 63u)
 #define QNAN ((uint64_t)0x7ffc000000000000u)
 
@@ -108,6 +238,11 @@
 #define LIT_GROW_CAPACITY(capacity) \
     ((capacity) < 8 ? 8 : (capacity)*2)
 
+/* containers give memory back once they are less than a quarter full */
+#define LIT_SHRINK_MIN_CAPACITY 64
+#define LIT_SHOULD_SHRINK(count, capacity) \
+    ((capacity) > LIT_SHRINK_MIN_CAPACITY && (count) < (capacity) / 4)
+
 #define LIT_GROW_ARRAY(state, previous, typesz, old_count, count) \
     lit_gcmem_memrealloc(state, previous, typesz * (old_count), typesz * (count))
 
@@ -202,6 +337,12 @@ typedef uint64_t LitValue;
 
 #include "prot.inc"
 
+/*
+* marks where lit_vmutil_callexitjump(vm) returns to, and is true when it got there that way.
+* setjmp() must run in the frame that is returned to, so this can't be a function.
+*/
+#define lit_vmutil_setexitjump(vm) (setjmp((vm)->exitjump) != 0)
+
 #define lit_value_objectvalue(obj) lit_value_objectvalue_actual((uintptr_t)obj)
 
 #define lit_value_istype(value, t) \
@@ -264,6 +405,16 @@ static inline bool lit_value_isrange(LitValue value)
     return lit_value_istype(value, LITTYPE_RANGE);
 }
 
+static inline bool lit_value_istypedarray(LitValue value)
+{
+    return lit_value_istype(value, LITTYPE_TYPEDARRAY);
+}
+
+static inline bool lit_value_isbuffer(LitValue value)
+{
+    return lit_value_istype(value, LITTYPE_BUFFER);
+}
+
 static inline bool lit_value_isfield(LitValue value)
 {
     return lit_value_istype(value, LITTYPE_FIELD);
@@ -360,6 +511,16 @@ static inline LitRange* lit_value_asrange(LitValue v)
     return (LitRange*)lit_value_asobject(v);
 }
 
+static inline LitTypedArray* lit_value_astypedarray(LitValue v)
+{
+    return (LitTypedArray*)lit_value_asobject(v);
+}
+
+static inline LitBuffer* lit_value_asbuffer(LitValue v)
+{
+    return (LitBuffer*)lit_value_asobject(v);
+}
+
 static inline LitField* lit_value_asfield(LitValue v)
 {
     return (LitField*)lit_value_asobject(v);
@@ -400,6 +561,87 @@ static inline LitValue lit_vm_pop(LitVM* vm)
     return rt;
 }
 
+static inline size_t lit_vallist_count(LitValueList* vl)
+{
+    return vl->count;
+}
+
+static inline size_t lit_vallist_size(LitValueList* vl)
+{
+    return vl->count;
+}
+
+static inline size_t lit_vallist_capacity(LitValueList* vl)
+{
+    return vl->capacity;
+}
+
+static inline LitValue lit_vallist_get(LitValueList* vl, size_t idx)
+{
+    return vl->values[idx];
+}
+
+static inline LitValue lit_vallist_set(LitValueList* vl, size_t idx, LitValue val)
+{
+    vl->values[idx] = val;
+    return val;
+}
+
+static inline void lit_vallist_push(LitState* state, LitValueList* vl, LitValue value)
+{
+    if(vl->capacity < (vl->count + 1))
+    {
+        lit_vallist_grow(state, vl);
+    }
+    vl->values[vl->count] = value;
+    vl->count++;
+}
+
+static inline size_t lit_typedarray_elemsize(LitTypedKind kind)
+{
+    switch(kind)
+    {
+        case LITTYPED_FLOAT64: return sizeof(double);
+        case LITTYPED_INT32: return sizeof(int32_t);
+        case LITTYPED_UINT8: return sizeof(uint8_t);
+    }
+    return 0;
+}
+
+/*
+* integer conversion wraps like a C cast would, but without the undefined behaviour
+* for nan, inf and values that do not fit into 64 bits (which all become 0).
+*/
+static inline int64_t lit_typedarray_toint(double d)
+{
+    if(!(d > -9.2e18 && d < 9.2e18))
+    {
+        return 0;
+    }
+    return (int64_t)d;
+}
+
+static inline double lit_typedarray_get(LitTypedArray* ta, size_t idx)
+{
+    switch(ta->kind)
+    {
+        case LITTYPED_FLOAT64: return ((double*)ta->data)[idx];
+        case LITTYPED_INT32: return ((int32_t*)ta->data)[idx];
+        case LITTYPED_UINT8: return ((uint8_t*)ta->data)[idx];
+    }
+    return 0;
+}
+
+static inline void lit_typedarray_set(LitTypedArray* ta, size_t idx, double val)
+{
+    switch(ta->kind)
+    {
+        case LITTYPED_FLOAT64: ((double*)ta->data)[idx] = val; break;
+        case LITTYPED_INT32: ((int32_t*)ta->data)[idx] = (int32_t)(uint32_t)lit_typedarray_toint(val); break;
+        case LITTYPED_UINT8: ((uint8_t*)ta->data)[idx] = (uint8_t)lit_typedarray_toint(val); break;
+    }
+}
+
 
 static inline bool lit_is_digit(char c)
 {
@@ -24,6 +24,12 @@
 #define LIT_EXIT_CODE_RUNTIME_ERROR 70
 #define LIT_EXIT_CODE_COMPILE_ERROR 65
 
+#define LIT_PROFILE_DEFAULTHZ 1000
+#define LIT_PROFILE_DEFAULTOUT "lit.folded"
+#define LIT_ALLOCPROFILE_DEFAULTOUT "lit.allocs"
+#define LIT_ANALYZEHEAP_TOP 20
+#define LIT_STRESS_MAXTHREADS 256
+
 enum
 {
     MAX_RESTARGS = 1024,
@@ -77,7 +83,12 @@ static bool populate_flags(int argc, int begin, char** argv, const char* expectv
         {
             fx->flags[flidx].flag = arg[1];
             fx->flags[flidx].value = NULL;
-            if(strchr(expectvalue, arg[1]) != NULL)
+            /* --name[=value] is stored as flag '-', with the text after the dashes as value */
+            if(arg[1] == '-')
+            {
+                fx->flags[flidx].value = arg + 2;
+            }
+            else if(strchr(expectvalue, arg[1]) != NULL)
             {
                 nextch = arg[2];
                 /* -e "somecode(...)" */
@@ -124,6 +135,15 @@ static void show_help()
     printf(" -i --interactive Starts an interactive shell.\n");
     printf(" -d --dump  Dumps all the bytecode chunks from the given file.\n");
     printf(" -t --time  Measures and prints the compilation timings.\n");
+    printf(" -s --stream  Compiles one top-level statement at a time, to keep memory use down on huge sources.\n");
+    printf(" --profile[=hz]  Samples the running script (default %d times a second), and writes folded stacks for flamegraph.pl on exit.\n", LIT_PROFILE_DEFAULTHZ);
+    printf(" --profile-out=[file]  Where --profile writes to (default '%s').\n", LIT_PROFILE_DEFAULTOUT);
+    printf(" --allocprofile[=bytes]  Samples an allocation every [bytes] on average (default: every one), and writes where they came from on exit.\n");
+    printf(" --allocprofile-out=[file]  Where --allocprofile writes to (default '%s').\n", LIT_ALLOCPROFILE_DEFAULTOUT);
+    printf(" --analyze-heap [file]  Reads a snapshot written by GC.snapshot(), and prints the largest objects and classes by retained size.\n");
+    printf(" --stress=[threads]  Runs each given file on that many threads at once, every one in a state of its own, and checks that they all print what a run alone printed.\n");
+    printf(" --threads=[count]  How many threads (this one included) bulk Array and typed array methods may split work across. 0, the default, is one per core.\n");
+    printf(" --opstats[=table|json]  Prints how often each opcode ran (and how long it took) to stderr on exit. Needs a build with LIT_OPCODE_STATS.\n");
     printf(" -h --help  I wonder, what this option does.\n");
     printf(" If no code to run is provided, lit will try to run either main.lbc or main.lit and, if fails, default to an interactive shell will start.\n");
 }
@@ -152,6 +172,7 @@ static void show_optimization_help()
     {
         printf("\t-O%i\t\t%s\n", i, lit_astopt_getoptleveldescr((LitOptLevel)i));
     }
+    printf("\nWithout any of these, lit uses -O%i.\n", (int)LITOPTLEVEL_DEBUG);
 }
 
 static bool match_arg(const char* arg, const char* a, const char* b)
@@ -190,14 +211,174 @@ struct Options_t
 {
     char* debugmode;
     char* codeline;
+    char* bytecodefile;
+    bool streamcompile;
+    int profilehz;
+    const char* profileout;
+    /* NULL, "table" or "json" */
+    const char* opstats;
+    /* 0 when allocations are not profiled */
+    size_t allocinterval;
+    const char* allocout;
+    /* --analyze-heap: reads a snapshot instead of running anything; "" takes the file from the arguments */
+    const char* analyzeheap;
+    /* --stress: how many threads run each file at once; 0 when not stress testing */
+    int stressthreads;
+    /* --threads: state->config.threads */
+    int threads;
 };
 
 
-static bool parse_options(Options_t* opts, Flag_t* flags, int fcnt)
+/*
+* -O<level> picks an optimization level, -O<name> and -Ono-<name> toggle a single
+* optimization, and -Oall / -Ono-all toggle all of them.
+*/
+static bool apply_optimization(LitState* state, const char* value)
+{
+    int i;
+    bool enable;
+    const char* name;
+    enable = true;
+    name = value;
+    if(strncmp(value, "no-", 3) == 0)
+    {
+        enable = false;
+        name = value + 3;
+    }
+    if(enable && strlen(name) == 1 && name[0] >= '0' && name[0] < '0' + LITOPTLEVEL_TOTAL)
+    {
+        lit_astopt_setoptlevel(state, (LitOptLevel)(name[0] - '0'));
+        return true;
+    }
+    if(strcmp(name, "all") == 0)
+    {
+        lit_astopt_setalloptenabled(state, enable);
+        return true;
+    }
+    for(i = 0; i < LITOPTSTATE_TOTAL; i++)
+    {
+        if(strcmp(lit_astopt_getoptname((LitOptimization)i), name) == 0)
+        {
+            lit_astopt_setoptenabled(state, (LitOptimization)i, enable);
+            return true;
+        }
+    }
+    fprintf(stderr, "unknown optimization '%s'\n", value);
+    return false;
+}
+
+static bool parse_longoption(Options_t* opts, const char* value)
+{
+    char* end;
+    long number;
+    if(strcmp(value, "profile") == 0)
+    {
+        opts->profilehz = LIT_PROFILE_DEFAULTHZ;
+        return true;
+    }
+    if(strncmp(value, "profile=", 8) == 0)
+    {
+        number = strtol(value + 8, &end, 10);
+        if(end == value + 8 || *end != '\0' || number <= 0 || number > 100000)
+        {
+            fprintf(stderr, "flag '--profile' expects a sampling rate between 1 and 100000\n");
+            return false;
+        }
+        opts->profilehz = (int)number;
+        return true;
+    }
+    if(strncmp(value, "profile-out=", 12) == 0 && value[12] != '\0')
+    {
+        opts->profileout = value + 12;
+        return true;
+    }
+    if(strcmp(value, "allocprofile") == 0)
+    {
+        opts->allocinterval = 1;
+        return true;
+    }
+    if(strncmp(value, "allocprofile=", 13) == 0)
+    {
+        number = strtol(value + 13, &end, 10);
+        if(end == value + 13 || *end != '\0' || number <= 0)
+        {
+            fprintf(stderr, "flag '--allocprofile' expects a positive sampling interval in bytes\n");
+            return false;
+        }
+        opts->allocinterval = (size_t)number;
+        return true;
+    }
+    if(strncmp(value, "allocprofile-out=", 17) == 0 && value[17] != '\0')
+    {
+        opts->allocout = value + 17;
+        return true;
+    }
+    if(strcmp(value, "analyze-heap") == 0)
+    {
+        opts->analyzeheap = "";
+        return true;
+    }
+    if(strncmp(value, "analyze-heap=", 13) == 0 && value[13] != '\0')
+    {
+        opts->analyzeheap = value + 13;
+        return true;
+    }
+    if(strncmp(value, "stress=", 7) == 0)
+    {
+        number = strtol(value + 7, &end, 10);
+        if(end == value + 7 || *end != '\0' || number <= 0 || number > LIT_STRESS_MAXTHREADS)
+        {
+            fprintf(stderr, "flag '--stress' expects a thread count between 1 and %d\n", LIT_STRESS_MAXTHREADS);
+            return false;
+        }
+        opts->stressthreads = (int)number;
+        return true;
+    }
+    if(strncmp(value, "threads=", 8) == 0)
+    {
+        number = strtol(value + 8, &end, 10);
+        if(end == value + 8 || *end != '\0' || number < 0 || number > LIT_POOL_MAXTHREADS)
+        {
+            fprintf(stderr, "flag '--threads' expects a thread count between 0 and %d\n", LIT_POOL_MAXTHREADS);
+            return false;
+        }
+        opts->threads = (int)number;
+        return true;
+    }
+    if(strcmp(value, "opstats") == 0 || strcmp(value, "opstats=table") == 0 || strcmp(value, "opstats=json") == 0)
+    {
+        if(!lit_opstats_enabled())
+        {
+            fprintf(stderr, "flag '--opstats' needs a build with LIT_OPCODE_STATS (make OPSTATS=1)\n");
+            return false;
+        }
+        opts->opstats = value[7] == '=' ? value + 8 : "table";
+        return true;
+    }
+    if(strcmp(value, "help") == 0)
+    {
+        show_help();
+        return false;
+    }
+    fprintf(stderr, "unknown option '--%s'\n", value);
+    return false;
+}
+
+static bool parse_options(LitState* state, Options_t* opts, Flag_t* flags, int fcnt)
 {
     int i;
     opts->codeline = NULL;
     opts->debugmode = NULL;
+    opts->bytecodefile = NULL;
+    opts->streamcompile = false;
+    opts->profilehz = 0;
+    opts->profileout = LIT_PROFILE_DEFAULTOUT;
+    opts->opstats = NULL;
+    opts->allocinterval = 0;
+    opts->allocout = LIT_ALLOCPROFILE_DEFAULTOUT;
+    opts->analyzeheap = NULL;
+    opts->stressthreads = 0;
+    opts->threads = 0;
     for(i=0; i<fcnt; i++)
     {
         switch(flags[i].flag)
@@ -228,6 +409,52 @@ static bool parse_options(Options_t* opts, Flag_t* flags, int fcnt)
                     opts->debugmode = flags[i].value;
                 }
                 break;
+            case 'O':
+                {
+                    if(flags[i].value == NULL)
+                    {
+                        fprintf(stderr, "flag '-O' expects a level (0-4) or an optimization name\n");
+                        return false;
+                    }
+                    if(strcmp(flags[i].value, "help") == 0)
+                    {
+                        show_optimization_help();
+                        return false;
+                    }
+                    if(!apply_optimization(state, flags[i].value))
+                    {
+                        return false;
+                    }
+                }
+                break;
+            case 'o':
+                {
+                    if(flags[i].value == NULL)
+                    {
+                        fprintf(stderr, "flag '-o' expects a file to save the bytecode to\n");
+                        return false;
+                    }
+                    opts->bytecodefile = flags[i].value;
+                }
+                break;
+            case 't':
+                {
+                    lit_enable_compilation_time_measurement(state);
+                }
+                break;
+            case 's':
+                {
+                    opts->streamcompile = true;
+                }
+                break;
+            case '-':
+                {
+                    if(!parse_longoption(opts, flags[i].value))
+                    {
+                        return false;
+                    }
+                }
+                break;
             default:
                 break;
         }
@@ -235,6 +462,250 @@ static bool parse_options(Options_t* opts, Flag_t* flags, int fcnt)
     return true;
 }
 
+static void write_profile(LitState* state, const char* path)
+{
+    FILE* fh;
+    fh = fopen(path, "wb");
+    if(fh == NULL)
+    {
+        fprintf(stderr, "profile: cannot open '%s' for writing: %s\n", path, strerror(errno));
+        return;
+    }
+    if(!lit_profiler_write(state, fh))
+    {
+        fprintf(stderr, "profile: failed to write '%s'\n", path);
+    }
+    fclose(fh);
+    fprintf(stderr, "profile: %llu samples written to '%s'\n", (unsigned long long)lit_profiler_samplecount(state), path);
+}
+
+static void write_allocprofile(LitState* state, const char* path)
+{
+    FILE* fh;
+    fh = fopen(path, "wb");
+    if(fh == NULL)
+    {
+        fprintf(stderr, "allocprofile: cannot open '%s' for writing: %s\n", path, strerror(errno));
+        return;
+    }
+    if(!lit_allocprof_write(state, fh))
+    {
+        fprintf(stderr, "allocprofile: failed to write '%s'\n", path);
+    }
+    fclose(fh);
+}
+
+#if defined(LIT_HAVE_THREADS)
+
+/*
+* --stress: every file is first run twice alone, then on N threads at once, each
+* in a state of its own that prints into a file of its own. a thread fails when its
+* result or its output differs from the runs alone; lines that already differed
+* between the two runs alone (timings, random numbers) are not compared.
+*/
+typedef struct StressRun_t StressRun_t;
+
+struct StressRun_t
+{
+    const char* filename;
+    const LitConfig* config;
+    FILE* out;
+    char* output;
+    LitResult result;
+    LitThread thread;
+};
+
+static void stress_print(LitState* state, const char* message)
+{
+    fputs(message, (FILE*)state->userdata);
+}
+
+static void stress_error(LitState* state, const char* message)
+{
+    fprintf((FILE*)state->userdata, "%s\n", message);
+}
+
+static void* stress_runfile(void* data)
+{
+    StressRun_t* run;
+    LitState* state;
+    LitArray* arg_array;
+    run = (StressRun_t*)data;
+    state = lit_make_state();
+    state->config = *run->config;
+    state->userdata = run->out;
+    state->print_fn = stress_print;
+    state->error_fn = stress_error;
+    lit_writer_init_file(state, &state->stdoutwriter, run->out, false);
+    lit_open_libraries(state);
+    arg_array = lit_create_array(state);
+    lit_vallist_push(state, &arg_array->list, OBJECT_CONST_STRING(state, run->filename));
+    lit_state_setglobal(state, CONST_STRING(state, "args"), lit_value_objectvalue(arg_array));
+    run->result = lit_state_execfile(state, run->filename).type;
+    lit_destroy_state(state);
+    return NULL;
+}
+
+/* reads back what the run printed; always returns a (possibly empty) string */
+static char* stress_readoutput(FILE* fh)
+{
+    long length;
+    char* buffer;
+    fflush(fh);
+    fseek(fh, 0, SEEK_END);
+    length = ftell(fh);
+    if(length < 0)
+    {
+        length = 0;
+    }
+    rewind(fh);
+    buffer = (char*)malloc(length + 1);
+    length = fread(buffer, 1, length, fh);
+    buffer[length] = '\0';
+    return buffer;
+}
+
+static size_t stress_linelength(const char* line)
+{
+    const char* end;
+    end = strchr(line, '\n');
+    return end == NULL ? strlen(line) : (size_t)(end - line);
+}
+
+static const char* stress_nextline(const char* line, size_t length)
+{
+    return line[length] == '\0' ? line + length : line + length + 1;
+}
+
+/* returns the (1-based) line where output differs from the stable lines of a and b, or 0 */
+static size_t stress_compare(const char* a, const char* b, const char* output)
+{
+    size_t line;
+    size_t alen;
+    size_t blen;
+    size_t olen;
+    for(line = 1; *a != '\0' || *output != '\0'; line++)
+    {
+        alen = stress_linelength(a);
+        blen = stress_linelength(b);
+        olen = stress_linelength(output);
+        if((*a == '\0') != (*output == '\0'))
+        {
+            return line;
+        }
+        if(alen == blen && memcmp(a, b, alen) == 0 && (alen != olen || memcmp(a, output, alen) != 0))
+        {
+            return line;
+        }
+        a = stress_nextline(a, alen);
+        b = stress_nextline(b, blen);
+        output = stress_nextline(output, olen);
+    }
+    return 0;
+}
+
+static bool stress_start(StressRun_t* run, LitState* proto, const char* filename)
+{
+    run->filename = filename;
+    run->config = &proto->config;
+    run->output = NULL;
+    run->result = LITRESULT_OK;
+    run->out = tmpfile();
+    if(run->out == NULL)
+    {
+        fprintf(stderr, "stress: cannot create a temporary file: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static void stress_finish(StressRun_t* run)
+{
+    run->output = stress_readoutput(run->out);
+    fclose(run->out);
+}
+
+static bool stress_file(LitState* proto, const char* filename, int threads)
+{
+    int i;
+    int started;
+    bool ok;
+    size_t line;
+    StressRun_t alone[2];
+    StressRun_t* runs;
+    for(i = 0; i < 2; i++)
+    {
+        if(!stress_start(&alone[i], proto, filename))
+        {
+            return false;
+        }
+        stress_runfile(&alone[i]);
+        stress_finish(&alone[i]);
+    }
+    ok = true;
+    runs = (StressRun_t*)calloc(threads, sizeof(StressRun_t));
+    for(started = 0; started < threads; started++)
+    {
+        if(!stress_start(&runs[started], proto, filename))
+        {
+            ok = false;
+            break;
+        }
+        if(!lit_thread_create(&runs[started].thread, stress_runfile, &runs[started]))
+        {
+            fprintf(stderr, "stress: cannot start thread %d\n", started);
+            fclose(runs[started].out);
+            ok = false;
+            break;
+        }
+    }
+    for(i = 0; i < started; i++)
+    {
+        lit_thread_join(runs[i].thread);
+        stress_finish(&runs[i]);
+        if(runs[i].result != alone[0].result)
+        {
+            fprintf(stderr, "stress: %s: thread %d finished with result %d instead of %d\n", filename, i, (int)runs[i].result, (int)alone[0].result);
+            ok = false;
+        }
+        else if((line = stress_compare(alone[0].output, alone[1].output, runs[i].output)) != 0)
+        {
+            fprintf(stderr, "stress: %s: thread %d printed something else on line %d\n", filename, i, (int)line);
+            ok = false;
+        }
+        free(runs[i].output);
+    }
+    free(runs);
+    free(alone[0].output);
+    free(alone[1].output);
+    return ok;
+}
+
+static LitResult run_stress(LitState* proto, char** files, int count, int threads)
+{
+    int i;
+    int failed;
+    char seed[32];
+    /* map order follows the hash seed, so all states get the same one */
+    if(getenv("LIT_HASHSEED") == NULL)
+    {
+        snprintf(seed, sizeof(seed), "%llu", (unsigned long long)proto->hashseed);
+        setenv("LIT_HASHSEED", seed, 1);
+    }
+    failed = 0;
+    for(i = 0; i < count; i++)
+    {
+        if(!stress_file(proto, files[i], threads))
+        {
+            failed++;
+        }
+    }
+    fprintf(stderr, "stress: %d of %d files ran the same on %d threads\n", count - failed, count, threads);
+    return failed == 0 ? LITRESULT_OK : LITRESULT_RUNTIME_ERROR;
+}
+
+#endif
+
 void interupt_handler(int signal_id)
 {
     (void)signal_id;
@@ -251,7 +722,7 @@ static int run_repl(LitState* state)
     repl_state = state;
     signal(SIGINT, interupt_handler);
     //signal(SIGTSTP, interupt_handler);
-    lit_astopt_setoptlevel(LITOPTLEVEL_REPL);
+    lit_astopt_setoptlevel(state, LITOPTLEVEL_REPL);
     printf("lit v%s, developed by @egordorichev\n", LIT_VERSION_STRING);
     while(true)
     {
@@ -286,16 +757,18 @@ int main(int argc, char* argv[])
     replexit = false;
     cmdfailed = false;
     result = LITRESULT_OK;
-    populate_flags(argc, 1, argv, "ed", &fx);
+    populate_flags(argc, 1, argv, "edOo", &fx);
     state = lit_make_state();
     lit_open_libraries(state);
 
-    if(!parse_options(&opts, fx.flags, fx.fcnt))
+    if(!parse_options(state, &opts, fx.flags, fx.fcnt))
     {
         cmdfailed = true;
     }
     else
     {
+        state->config.streamcompile = opts.streamcompile;
+        lit_state_setthreadcount(state, opts.threads);
         if(opts.debugmode != NULL)
         {
             dm = opts.debugmode;
@@ -314,7 +787,37 @@ int main(int argc, char* argv[])
             }
         }
     }
-    if(!cmdfailed)
+    if(!cmdfailed && opts.stressthreads > 0)
+    {
+        if(fx.poscnt == 0)
+        {
+            fprintf(stderr, "flag '--stress' expects files to run\n");
+            cmdfailed = true;
+        }
+        else
+        {
+            #if defined(LIT_HAVE_THREADS)
+                result = run_stress(state, fx.positional, fx.poscnt, opts.stressthreads);
+            #else
+                fprintf(stderr, "no thread support compiled in\n");
+                result = LITRESULT_RUNTIME_ERROR;
+            #endif
+        }
+    }
+    else if(!cmdfailed && opts.analyzeheap != NULL)
+    {
+        filename = opts.analyzeheap[0] != '\0' ? opts.analyzeheap : (fx.poscnt > 0 ? fx.positional[0] : NULL);
+        if(filename == NULL)
+        {
+            fprintf(stderr, "flag '--analyze-heap' expects a snapshot file\n");
+            cmdfailed = true;
+        }
+        else if(!lit_heapsnap_analyze(filename, stdout, LIT_ANALYZEHEAP_TOP))
+        {
+            result = LITRESULT_RUNTIME_ERROR;
+        }
+    }
+    else if(!cmdfailed)
     {
         if((fx.poscnt > 0) || (opts.codeline != NULL))
         {
@@ -324,15 +827,44 @@ int main(int argc, char* argv[])
                 lit_vallist_push(state, &arg_array->list, OBJECT_CONST_STRING(state, fx.positional[i]));
             }
             lit_state_setglobal(state, CONST_STRING(state, "args"), lit_value_objectvalue(arg_array));
+            if(opts.profilehz > 0 && !lit_profiler_start(state, opts.profilehz))
+            {
+                fprintf(stderr, lit_profiler_supported() ? "failed to start the profiler\n" : "the profiler is not supported on this platform\n");
+            }
+            if(opts.allocinterval > 0)
+            {
+                lit_allocprof_start(state, opts.allocinterval);
+            }
             if(opts.codeline)
             {
                 result = lit_state_execsource(state, "<-e>", opts.codeline, strlen(opts.codeline)).type;
             }
+            else if(opts.bytecodefile != NULL)
+            {
+                if(!lit_state_compileandsave(state, fx.positional, fx.poscnt, opts.bytecodefile))
+                {
+                    result = LITRESULT_COMPILE_ERROR;
+                }
+            }
             else
             {
                 filename = fx.positional[0];
                 result = lit_state_execfile(state, filename).type;
             }
+            if(opts.profilehz > 0)
+            {
+                lit_profiler_stop(state);
+                write_profile(state, opts.profileout);
+            }
+            if(opts.allocinterval > 0)
+            {
+                lit_allocprof_stop(state);
+                write_allocprofile(state, opts.allocout);
+            }
+            if(opts.opstats != NULL)
+            {
+                lit_opstats_write(state, stderr, strcmp(opts.opstats, "json") == 0);
+            }
         }
         else
         {
@@ -439,7 +971,7 @@ int oldmain(int argc, const char* argv[])
 
                 if(c >= '0' && c <= '4')
                 {
-                    lit_astopt_setoptlevel((LitOptLevel)(c - '0'));
+                    lit_astopt_setoptlevel(state, (LitOptLevel)(c - '0'));
                     continue;
                 }
             }
@@ -451,7 +983,7 @@ int oldmain(int argc, const char* argv[])
             }
             else if(strcmp(optimization_name, "all") == 0)
             {
-                lit_astopt_setalloptenabled(enable_optimization);
+                lit_astopt_setalloptenabled(state, enable_optimization);
             }
             else
             {
@@ -462,7 +994,7 @@ int oldmain(int argc, const char* argv[])
                     if(strcmp(lit_astopt_getoptname((LitOptimization)j), optimization_name) == 0)
                     {
                         found = true;
-                        lit_astopt_setoptenabled((LitOptimization)j, enable_optimization);
+                        lit_astopt_setoptenabled(state, (LitOptimization)j, enable_optimization);
 
                         break;
                     }
@@ -514,7 +1046,7 @@ int oldmain(int argc, const char* argv[])
         }
         else if(match_arg(arg, "-t", "--time"))
         {
-            lit_enable_compilation_time_measurement();
+            lit_enable_compilation_time_measurement(state);
         }
         else if(match_arg(arg, "-i", "--interactive"))
         {
@@ -534,7 +1066,7 @@ int oldmain(int argc, const char* argv[])
             }
 
             bytecode_file = (char*)argv[++i];
-            lit_astopt_setoptlevel(LITOPTLEVEL_EXTREME);
+            lit_astopt_setoptlevel(state, LITOPTLEVEL_EXTREME);
         }
         else if(match_arg(arg, "-p", "--pass"))
         {
@@ -0,0 +1,1031 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lit.h"
+#if defined(LIT_OS_UNIX_LIKE)
+    #include <signal.h>
+    #include <sys/time.h>
+#endif
+
+/*
+* a sampling profiler. SIGPROF only raises vm->profile_tick; the dispatch loop
+* notices it at its next safepoint (backward jumps, calls and returns) and walks
+* the fiber's frames there, since from within the handler frames and stacks may
+* be halfway through a realloc, and the live ip only exists in a register.
+* samples are aggregated per distinct stack, and written as folded stacks
+* ("frame;frame;frame count"), as read by flamegraph.pl and speedscope.
+* without SIGPROF and setitimer (anything not unix-like) lit_profiler_start fails,
+* and lit_profiler_supported says why.
+*/
+
+enum
+{
+    LIT_PROFILER_MAXHZ = 100000,
+    LIT_PROFILER_MAXFIBERS = 64,
+};
+
+#if defined(LIT_OS_UNIX_LIKE)
+
+/* signals are per process, so only one state (of any thread) can be sampled at a time */
+static LitVM* volatile profiler_vm = NULL;
+static struct sigaction profiler_oldaction;
+
+static void lit_profiler_onsignal(int sig)
+{
+    LitVM* vm;
+    (void)sig;
+    vm = profiler_vm;
+    if(vm != NULL)
+    {
+        vm->profile_tick = 1;
+    }
+}
+
+static bool lit_profiler_settimer(int hz)
+{
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    if(hz > 0)
+    {
+        timer.it_interval.tv_sec = 0;
+        timer.it_interval.tv_usec = 1000000 / hz;
+        timer.it_value = timer.it_interval;
+    }
+    return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+}
+
+bool lit_profiler_supported(void)
+{
+    return true;
+}
+
+bool lit_profiler_start(LitState* state, int hz)
+{
+    struct sigaction action;
+    LitVM* expected;
+    LitProfiler* profiler;
+    if(hz <= 0 || hz > LIT_PROFILER_MAXHZ)
+    {
+        return false;
+    }
+    profiler = state->profiler;
+    if(profiler == NULL)
+    {
+        profiler = (LitProfiler*)calloc(1, sizeof(LitProfiler));
+        if(profiler == NULL)
+        {
+            return false;
+        }
+        state->profiler = profiler;
+    }
+    expected = NULL;
+    if(!lit_atomic_cas(&profiler_vm, &expected, state->vm, LIT_ATOMIC_SEQCST))
+    {
+        return false;
+    }
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = lit_profiler_onsignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    state->vm->profile_tick = 0;
+    if(sigaction(SIGPROF, &action, &profiler_oldaction) != 0)
+    {
+        profiler_vm = NULL;
+        return false;
+    }
+    if(!lit_profiler_settimer(hz))
+    {
+        sigaction(SIGPROF, &profiler_oldaction, NULL);
+        profiler_vm = NULL;
+        return false;
+    }
+    profiler->hz = hz;
+    profiler->running = true;
+    return true;
+}
+
+/* stops sampling. what was collected stays around until the state is destroyed */
+void lit_profiler_stop(LitState* state)
+{
+    LitProfiler* profiler;
+    profiler = state->profiler;
+    if(profiler == NULL || !profiler->running)
+    {
+        return;
+    }
+    lit_profiler_settimer(0);
+    sigaction(SIGPROF, &profiler_oldaction, NULL);
+    profiler_vm = NULL;
+    state->vm->profile_tick = 0;
+    profiler->running = false;
+}
+
+#else
+
+bool lit_profiler_supported(void)
+{
+    return false;
+}
+
+bool lit_profiler_start(LitState* state, int hz)
+{
+    (void)state;
+    (void)hz;
+    return false;
+}
+
+void lit_profiler_stop(LitState* state)
+{
+    (void)state;
+}
+
+#endif
+
+void lit_profiler_destroy(LitState* state)
+{
+    size_t i;
+    LitProfiler* profiler;
+    profiler = state->profiler;
+    if(profiler == NULL)
+    {
+        return;
+    }
+    lit_profiler_stop(state);
+    for(i = 0; i < profiler->capacity; i++)
+    {
+        free(profiler->stacks[i].frames);
+    }
+    free(profiler->stacks);
+    free(profiler->scratch);
+    free(profiler);
+    state->profiler = NULL;
+}
+
+static bool lit_profiler_reserve(LitProfiler* profiler, size_t length)
+{
+    size_t capacity;
+    char* scratch;
+    if(profiler->scratch_length + length + 1 <= profiler->scratch_capacity)
+    {
+        return true;
+    }
+    capacity = profiler->scratch_capacity < 256 ? 256 : profiler->scratch_capacity;
+    while(capacity < profiler->scratch_length + length + 1)
+    {
+        capacity *= 2;
+    }
+    scratch = (char*)realloc(profiler->scratch, capacity);
+    if(scratch == NULL)
+    {
+        return false;
+    }
+    profiler->scratch = scratch;
+    profiler->scratch_capacity = capacity;
+    return true;
+}
+
+static bool lit_profiler_append(LitProfiler* profiler, const char* str, size_t length)
+{
+    if(!lit_profiler_reserve(profiler, length))
+    {
+        return false;
+    }
+    memcpy(profiler->scratch + profiler->scratch_length, str, length);
+    profiler->scratch_length += length;
+    profiler->scratch[profiler->scratch_length] = '\0';
+    return true;
+}
+
+/* a frame is written as "name (module:line)"; ';' separates frames, so it can't be in a name */
+static bool lit_profiler_appendname(LitProfiler* profiler, LitString* name, const char* fallback)
+{
+    size_t i;
+    size_t start;
+    if(name == NULL)
+    {
+        return lit_profiler_append(profiler, fallback, strlen(fallback));
+    }
+    start = profiler->scratch_length;
+    if(!lit_profiler_append(profiler, lit_string_getdata(name), lit_string_getlength(name)))
+    {
+        return false;
+    }
+    for(i = start; i < profiler->scratch_length; i++)
+    {
+        if(profiler->scratch[i] == ';' || profiler->scratch[i] == '\n')
+        {
+            profiler->scratch[i] = '_';
+        }
+    }
+    return true;
+}
+
+static bool lit_profiler_appendframe(LitProfiler* profiler, LitCallFrame* frame)
+{
+    size_t line;
+    size_t offset;
+    char buffer[32];
+    LitChunk* chunk;
+    LitFunction* function;
+    function = frame->function;
+    chunk = &function->chunk;
+    /* ip is already past the instruction that is running */
+    offset = 0;
+    if(frame->ip > chunk->code)
+    {
+        offset = (size_t)(frame->ip - chunk->code) - 1;
+    }
+    line = chunk->has_line_info ? lit_chunk_getline(chunk, offset) : 0;
+    if(profiler->scratch_length > 0 && !lit_profiler_append(profiler, ";", 1))
+    {
+        return false;
+    }
+    if(!lit_profiler_appendname(profiler, function->name, "<anonymous>") || !lit_profiler_append(profiler, " (", 2))
+    {
+        return false;
+    }
+    if(!lit_profiler_appendname(profiler, function->module != NULL ? function->module->name : NULL, "?"))
+    {
+        return false;
+    }
+    snprintf(buffer, sizeof(buffer), ":%d)", (int)line);
+    return lit_profiler_append(profiler, buffer, strlen(buffer));
+}
+
+static uint64_t lit_profiler_hash(const char* str, size_t length)
+{
+    size_t i;
+    uint64_t hash;
+    hash = 14695981039346656037ULL;
+    for(i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)str[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static LitProfileStack* lit_profiler_findslot(LitProfileStack* stacks, size_t capacity, const char* frames, size_t length, uint64_t hash)
+{
+    size_t index;
+    LitProfileStack* stack;
+    index = (size_t)hash & (capacity - 1);
+    while(true)
+    {
+        stack = &stacks[index];
+        if(stack->frames == NULL)
+        {
+            return stack;
+        }
+        if(stack->hash == hash && stack->length == length && memcmp(stack->frames, frames, length) == 0)
+        {
+            return stack;
+        }
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static bool lit_profiler_grow(LitProfiler* profiler)
+{
+    size_t i;
+    size_t capacity;
+    LitProfileStack* stacks;
+    LitProfileStack* slot;
+    capacity = profiler->capacity == 0 ? 64 : profiler->capacity * 2;
+    stacks = (LitProfileStack*)calloc(capacity, sizeof(LitProfileStack));
+    if(stacks == NULL)
+    {
+        return false;
+    }
+    for(i = 0; i < profiler->capacity; i++)
+    {
+        if(profiler->stacks[i].frames != NULL)
+        {
+            slot = lit_profiler_findslot(stacks, capacity, profiler->stacks[i].frames, profiler->stacks[i].length, profiler->stacks[i].hash);
+            *slot = profiler->stacks[i];
+        }
+    }
+    free(profiler->stacks);
+    profiler->stacks = stacks;
+    profiler->capacity = capacity;
+    return true;
+}
+
+static void lit_profiler_record(LitProfiler* profiler)
+{
+    uint64_t hash;
+    LitProfileStack* stack;
+    if((profiler->count + 1) * 4 > profiler->capacity * 3 && !lit_profiler_grow(profiler))
+    {
+        return;
+    }
+    hash = lit_profiler_hash(profiler->scratch, profiler->scratch_length);
+    stack = lit_profiler_findslot(profiler->stacks, profiler->capacity, profiler->scratch, profiler->scratch_length, hash);
+    if(stack->frames == NULL)
+    {
+        stack->frames = (char*)malloc(profiler->scratch_length + 1);
+        if(stack->frames == NULL)
+        {
+            return;
+        }
+        memcpy(stack->frames, profiler->scratch, profiler->scratch_length + 1);
+        stack->length = profiler->scratch_length;
+        stack->hash = hash;
+        stack->count = 0;
+        profiler->count++;
+    }
+    stack->count++;
+}
+
+/*
+* called by the dispatch loop once it sees vm->profile_tick, with the running
+* frame's ip written back. fibers that resumed this one come first, so that
+* stacks read from the outermost caller down.
+*/
+void lit_profiler_sample(LitState* state, LitFiber* fiber)
+{
+    size_t depth;
+    size_t fibercount;
+    LitFiber* fibers[LIT_PROFILER_MAXFIBERS];
+    LitProfiler* profiler;
+    state->vm->profile_tick = 0;
+    profiler = state->profiler;
+    if(profiler == NULL || !profiler->running)
+    {
+        return;
+    }
+    fibercount = 0;
+    while(fiber != NULL && fibercount < LIT_PROFILER_MAXFIBERS)
+    {
+        fibers[fibercount++] = fiber;
+        fiber = fiber->parent;
+    }
+    profiler->scratch_length = 0;
+    while(fibercount > 0)
+    {
+        fiber = fibers[--fibercount];
+        for(depth = 0; depth < fiber->frame_count; depth++)
+        {
+            if(!lit_profiler_appendframe(profiler, &fiber->frames[depth]))
+            {
+                return;
+            }
+        }
+    }
+    if(profiler->scratch_length == 0)
+    {
+        return;
+    }
+    profiler->samples++;
+    lit_profiler_record(profiler);
+}
+
+static int lit_profiler_compare(const void* a, const void* b)
+{
+    return strcmp((*(const LitProfileStack**)a)->frames, (*(const LitProfileStack**)b)->frames);
+}
+
+/* writes every sampled stack, sorted, as "frame;frame;frame count" lines */
+bool lit_profiler_write(LitState* state, FILE* out)
+{
+    size_t i;
+    size_t count;
+    LitProfileStack** sorted;
+    LitProfiler* profiler;
+    profiler = state->profiler;
+    if(profiler == NULL || profiler->count == 0)
+    {
+        return true;
+    }
+    sorted = (LitProfileStack**)malloc(profiler->count * sizeof(LitProfileStack*));
+    if(sorted == NULL)
+    {
+        return false;
+    }
+    count = 0;
+    for(i = 0; i < profiler->capacity; i++)
+    {
+        if(profiler->stacks[i].frames != NULL)
+        {
+            sorted[count++] = &profiler->stacks[i];
+        }
+    }
+    qsort(sorted, count, sizeof(LitProfileStack*), lit_profiler_compare);
+    for(i = 0; i < count; i++)
+    {
+        fprintf(out, "%s %llu\n", sorted[i]->frames, (unsigned long long)sorted[i]->count);
+    }
+    free(sorted);
+    return !ferror(out);
+}
+
+uint64_t lit_profiler_samplecount(LitState* state)
+{
+    return state->profiler == NULL ? 0 : state->profiler->samples;
+}
+
+/*
+* per-opcode counters, kept by the dispatch loop when built with LIT_OPCODE_STATS
+* (and timed with LIT_OPCODE_CYCLES). without them, the functions below report nothing.
+*/
+
+bool lit_opstats_enabled(void)
+{
+#ifdef LIT_OPCODE_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+void lit_opstats_reset(LitState* state)
+{
+#ifdef LIT_OPCODE_STATS
+    memset(&state->vm->opstats, 0, sizeof(state->vm->opstats));
+#else
+    (void)state;
+#endif
+}
+
+#ifdef LIT_OPCODE_STATS
+static LIT_THREADLOCAL const LitOpcodeStats* opstats_sorting;
+
+static int lit_opstats_compare(const void* a, const void* b)
+{
+    uint64_t ca;
+    uint64_t cb;
+    ca = opstats_sorting->counts[*(const int*)a];
+    cb = opstats_sorting->counts[*(const int*)b];
+    if(ca != cb)
+    {
+        return ca < cb ? 1 : -1;
+    }
+    return *(const int*)a - *(const int*)b;
+}
+
+/* the executed opcodes, most frequent first. returns how many there are */
+static int lit_opstats_sort(const LitOpcodeStats* stats, int* order, uint64_t* total)
+{
+    int i;
+    int count;
+    count = 0;
+    *total = 0;
+    for(i = 0; i < OP_TOTAL; i++)
+    {
+        if(stats->counts[i] > 0)
+        {
+            order[count++] = i;
+            *total += stats->counts[i];
+        }
+    }
+    opstats_sorting = stats;
+    qsort(order, count, sizeof(int), lit_opstats_compare);
+    return count;
+}
+#endif
+
+/* writes the counters as a table sorted by count, or as json */
+bool lit_opstats_write(LitState* state, FILE* out, bool json)
+{
+#ifdef LIT_OPCODE_STATS
+    int i;
+    int b;
+    int op;
+    int count;
+    int last;
+    int order[OP_TOTAL];
+    uint64_t total;
+    const LitOpcodeStats* stats;
+#ifdef LIT_OPCODE_CYCLES
+    const bool timed = true;
+#else
+    const bool timed = false;
+#endif
+    stats = &state->vm->opstats;
+    count = lit_opstats_sort(stats, order, &total);
+    if(json)
+    {
+        fprintf(out, "{\"total\": %llu, \"cycles\": %s, \"opcodes\": [", (unsigned long long)total, timed ? "true" : "false");
+        for(i = 0; i < count; i++)
+        {
+            op = order[i];
+            fprintf(out, "%s\n  {\"name\": \"%s\", \"count\": %llu, \"cycles\": %llu, \"histogram\": [", i == 0 ? "" : ",", lit_debug_opcodename(op),
+                    (unsigned long long)stats->counts[op], (unsigned long long)stats->cycles[op]);
+            /* trailing empty buckets are left out */
+            last = 0;
+            for(b = 0; b < LIT_OPSTATS_BUCKETS; b++)
+            {
+                if(stats->histogram[op][b] > 0)
+                {
+                    last = b + 1;
+                }
+            }
+            for(b = 0; b < last; b++)
+            {
+                fprintf(out, "%s%llu", b == 0 ? "" : ", ", (unsigned long long)stats->histogram[op][b]);
+            }
+            fprintf(out, "]}");
+        }
+        fprintf(out, "\n]}\n");
+    }
+    else
+    {
+        fprintf(out, "%-28s %14s %7s", "opcode", "count", "%");
+        fprintf(out, timed ? " %16s %10s\n" : "\n", "cycles", "cycles/op");
+        for(i = 0; i < count; i++)
+        {
+            op = order[i];
+            fprintf(out, "%-28s %14llu %6.2f%%", lit_debug_opcodename(op), (unsigned long long)stats->counts[op],
+                    100.0 * (double)stats->counts[op] / (double)total);
+            if(timed)
+            {
+                fprintf(out, " %16llu %10.1f", (unsigned long long)stats->cycles[op], (double)stats->cycles[op] / (double)stats->counts[op]);
+            }
+            fprintf(out, "\n");
+        }
+        fprintf(out, "%-28s %14llu\n", "total", (unsigned long long)total);
+    }
+    return !ferror(out);
+#else
+    (void)state;
+    (void)out;
+    (void)json;
+    return false;
+#endif
+}
+
+/*
+* the counters as a map of opcode name to {count, cycles, histogram}, for VM.stats().
+* null when the counters were not compiled in.
+*/
+LitValue lit_opstats_tovalue(LitState* state)
+{
+#ifdef LIT_OPCODE_STATS
+    int i;
+    int b;
+    int op;
+    int count;
+    int order[OP_TOTAL];
+    uint64_t total;
+    LitMap* map;
+    LitMap* entry;
+    LitArray* histogram;
+    const LitOpcodeStats* stats;
+    stats = &state->vm->opstats;
+    count = lit_opstats_sort(stats, order, &total);
+    map = lit_create_map(state);
+    lit_state_pushroot(state, (LitObject*)map);
+    for(i = 0; i < count; i++)
+    {
+        op = order[i];
+        entry = lit_create_map(state);
+        lit_map_set(state, map, CONST_STRING(state, lit_debug_opcodename(op)), lit_value_objectvalue(entry));
+        lit_map_set(state, entry, CONST_STRING(state, "count"), lit_value_numbertovalue(state, (double)stats->counts[op]));
+#ifdef LIT_OPCODE_CYCLES
+        lit_map_set(state, entry, CONST_STRING(state, "cycles"), lit_value_numbertovalue(state, (double)stats->cycles[op]));
+        histogram = lit_create_array(state);
+        lit_map_set(state, entry, CONST_STRING(state, "histogram"), lit_value_objectvalue(histogram));
+        for(b = 0; b < LIT_OPSTATS_BUCKETS; b++)
+        {
+            lit_vallist_push(state, &histogram->list, lit_value_numbertovalue(state, (double)stats->histogram[op][b]));
+        }
+#else
+        (void)b;
+        (void)histogram;
+#endif
+    }
+    lit_state_poproot(state);
+    return lit_value_objectvalue(map);
+#else
+    (void)state;
+    return NULL_VALUE;
+#endif
+}
+
+/*
+* allocation profiler. lit_gcmem_allocobject samples an object on average once every
+* 'interval' bytes (the gaps are drawn from an exponential distribution, so that
+* periodic allocation patterns don't bias it), attributes it to its type and to the
+* function and line that were running, and tracks it until it is swept, to tell how
+* many allocations outlive a collection.
+*/
+
+enum
+{
+    LIT_ALLOCPROF_FUNCTIONMAX = 256,
+};
+
+static int64_t lit_allocprof_nextgap(LitAllocProfiler* profiler)
+{
+    double unit;
+    if(profiler->interval <= 1)
+    {
+        return 1;
+    }
+    /* xorshift64* */
+    profiler->random ^= profiler->random >> 12;
+    profiler->random ^= profiler->random << 25;
+    profiler->random ^= profiler->random >> 27;
+    unit = (double)((profiler->random * 2685821657736338717ULL) >> 11) / (double)(1ULL << 53);
+    return (int64_t)(-log(1.0 - unit) * (double)profiler->interval) + 1;
+}
+
+bool lit_allocprof_start(LitState* state, size_t interval)
+{
+    LitAllocProfiler* profiler;
+    profiler = state->allocprofiler;
+    if(profiler == NULL)
+    {
+        profiler = (LitAllocProfiler*)calloc(1, sizeof(LitAllocProfiler));
+        if(profiler == NULL)
+        {
+            return false;
+        }
+        profiler->random = state->hashseed | 1;
+        state->allocprofiler = profiler;
+    }
+    profiler->interval = interval == 0 ? 1 : interval;
+    profiler->countdown = lit_allocprof_nextgap(profiler);
+    profiler->running = true;
+    return true;
+}
+
+/* stops sampling; objects sampled so far are still followed until they are freed */
+void lit_allocprof_stop(LitState* state)
+{
+    if(state->allocprofiler != NULL)
+    {
+        state->allocprofiler->running = false;
+    }
+}
+
+void lit_allocprof_destroy(LitState* state)
+{
+    size_t i;
+    LitAllocProfiler* profiler;
+    profiler = state->allocprofiler;
+    if(profiler == NULL)
+    {
+        return;
+    }
+    for(i = 0; i < profiler->site_count; i++)
+    {
+        free(profiler->sites[i].function);
+    }
+    free(profiler->sites);
+    free(profiler->site_index);
+    free(profiler->tracked);
+    free(profiler);
+    state->allocprofiler = NULL;
+}
+
+static uint64_t lit_allocprof_sitehash(LitObjType type, size_t line, const char* function)
+{
+    uint64_t hash;
+    hash = lit_profiler_hash(function, strlen(function));
+    hash ^= ((uint64_t)line << 8) | (uint64_t)type;
+    return hash * 1099511628211ULL;
+}
+
+static bool lit_allocprof_growindex(LitAllocProfiler* profiler)
+{
+    size_t i;
+    size_t slot;
+    size_t capacity;
+    uint32_t* index;
+    capacity = profiler->index_capacity == 0 ? 64 : profiler->index_capacity * 2;
+    index = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+    if(index == NULL)
+    {
+        return false;
+    }
+    for(i = 0; i < profiler->site_count; i++)
+    {
+        slot = (size_t)profiler->sites[i].hash & (capacity - 1);
+        while(index[slot] != 0)
+        {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        index[slot] = (uint32_t)i + 1;
+    }
+    free(profiler->site_index);
+    profiler->site_index = index;
+    profiler->index_capacity = capacity;
+    return true;
+}
+
+/* returns the index of the site, creating it if needed, or -1 when out of memory */
+static int64_t lit_allocprof_site(LitAllocProfiler* profiler, LitObjType type, size_t line, const char* function)
+{
+    size_t slot;
+    size_t capacity;
+    uint64_t hash;
+    LitAllocSite* site;
+    LitAllocSite* sites;
+    if((profiler->site_count + 1) * 4 > profiler->index_capacity * 3 && !lit_allocprof_growindex(profiler))
+    {
+        return -1;
+    }
+    hash = lit_allocprof_sitehash(type, line, function);
+    slot = (size_t)hash & (profiler->index_capacity - 1);
+    while(profiler->site_index[slot] != 0)
+    {
+        site = &profiler->sites[profiler->site_index[slot] - 1];
+        if(site->hash == hash && site->type == type && site->line == line && strcmp(site->function, function) == 0)
+        {
+            return profiler->site_index[slot] - 1;
+        }
+        slot = (slot + 1) & (profiler->index_capacity - 1);
+    }
+    if(profiler->site_count == profiler->site_capacity)
+    {
+        capacity = profiler->site_capacity == 0 ? 32 : profiler->site_capacity * 2;
+        sites = (LitAllocSite*)realloc(profiler->sites, capacity * sizeof(LitAllocSite));
+        if(sites == NULL)
+        {
+            return -1;
+        }
+        profiler->sites = sites;
+        profiler->site_capacity = capacity;
+    }
+    site = &profiler->sites[profiler->site_count];
+    memset(site, 0, sizeof(LitAllocSite));
+    site->function = strdup(function);
+    if(site->function == NULL)
+    {
+        return -1;
+    }
+    site->type = type;
+    site->line = line;
+    site->hash = hash;
+    profiler->site_index[slot] = (uint32_t)profiler->site_count + 1;
+    return (int64_t)profiler->site_count++;
+}
+
+static size_t lit_allocprof_slotfor(LitAllocTrack* tracked, size_t capacity, LitObject* object)
+{
+    size_t slot;
+    slot = (size_t)(((uintptr_t)object >> 4) * 11400714819323198485ULL) & (capacity - 1);
+    while(tracked[slot].object != NULL && tracked[slot].object != object)
+    {
+        slot = (slot + 1) & (capacity - 1);
+    }
+    return slot;
+}
+
+static bool lit_allocprof_track(LitAllocProfiler* profiler, LitObject* object, uint32_t site)
+{
+    size_t i;
+    size_t slot;
+    size_t capacity;
+    LitAllocTrack* tracked;
+    if((profiler->tracked_count + 1) * 4 > profiler->tracked_capacity * 3)
+    {
+        capacity = profiler->tracked_capacity == 0 ? 256 : profiler->tracked_capacity * 2;
+        tracked = (LitAllocTrack*)calloc(capacity, sizeof(LitAllocTrack));
+        if(tracked == NULL)
+        {
+            return false;
+        }
+        for(i = 0; i < profiler->tracked_capacity; i++)
+        {
+            if(profiler->tracked[i].object != NULL)
+            {
+                tracked[lit_allocprof_slotfor(tracked, capacity, profiler->tracked[i].object)] = profiler->tracked[i];
+            }
+        }
+        free(profiler->tracked);
+        profiler->tracked = tracked;
+        profiler->tracked_capacity = capacity;
+    }
+    slot = lit_allocprof_slotfor(profiler->tracked, profiler->tracked_capacity, object);
+    if(profiler->tracked[slot].object == NULL)
+    {
+        profiler->tracked_count++;
+    }
+    profiler->tracked[slot].object = object;
+    profiler->tracked[slot].site = site;
+    profiler->tracked[slot].collections = 0;
+    return true;
+}
+
+/*
+* called by lit_gcmem_allocobject once the countdown ran out. the frame's ip is
+* written back by the dispatch loop before anything that allocates.
+*/
+void lit_allocprof_sample(LitState* state, LitObject* object, size_t size, LitObjType type)
+{
+    size_t line;
+    size_t offset;
+    int64_t index;
+    double scale;
+    char function[LIT_ALLOCPROF_FUNCTIONMAX];
+    LitFiber* fiber;
+    LitCallFrame* frame;
+    LitChunk* chunk;
+    LitAllocSite* site;
+    LitAllocProfiler* profiler;
+    profiler = state->allocprofiler;
+    profiler->countdown = lit_allocprof_nextgap(profiler);
+    line = 0;
+    fiber = state->vm->fiber;
+    if(fiber != NULL && fiber->frame_count > 0)
+    {
+        frame = &fiber->frames[fiber->frame_count - 1];
+        chunk = &frame->function->chunk;
+        offset = frame->ip > chunk->code ? (size_t)(frame->ip - chunk->code) - 1 : 0;
+        line = chunk->has_line_info ? lit_chunk_getline(chunk, offset) : 0;
+        snprintf(function, sizeof(function), "%s (%s)",
+                 frame->function->name != NULL ? lit_string_getdata(frame->function->name) : "<anonymous>",
+                 frame->function->module != NULL ? lit_string_getdata(frame->function->module->name) : "?");
+    }
+    else
+    {
+        snprintf(function, sizeof(function), "<toplevel>");
+    }
+    index = lit_allocprof_site(profiler, type, line, function);
+    if(index < 0)
+    {
+        return;
+    }
+    site = &profiler->sites[index];
+    /* the chance of an object of this size being sampled is 1 - e^(-size / interval) */
+    scale = 1.0;
+    if(profiler->interval > 1)
+    {
+        scale = 1.0 / (1.0 - exp(-(double)size / (double)profiler->interval));
+    }
+    site->samples++;
+    site->sampled_bytes += size;
+    site->count += scale;
+    site->bytes += scale * (double)size;
+    lit_allocprof_track(profiler, object, (uint32_t)index);
+}
+
+/* called by the sweep for every object it frees, while an allocation profile exists */
+void lit_allocprof_onfree(LitState* state, LitObject* object)
+{
+    size_t slot;
+    size_t next;
+    size_t home;
+    LitAllocProfiler* profiler;
+    LitAllocTrack* tracked;
+    profiler = state->allocprofiler;
+    if(profiler->tracked_count == 0)
+    {
+        return;
+    }
+    tracked = profiler->tracked;
+    slot = lit_allocprof_slotfor(tracked, profiler->tracked_capacity, object);
+    if(tracked[slot].object == NULL)
+    {
+        return;
+    }
+    profiler->sites[tracked[slot].site].freed++;
+    tracked[slot].object = NULL;
+    profiler->tracked_count--;
+    /* backward shift deletion, so that lookups never need tombstones */
+    next = (slot + 1) & (profiler->tracked_capacity - 1);
+    while(tracked[next].object != NULL)
+    {
+        home = lit_allocprof_slotfor(tracked, profiler->tracked_capacity, tracked[next].object);
+        if(home != next)
+        {
+            tracked[slot] = tracked[next];
+            tracked[next].object = NULL;
+            slot = next;
+        }
+        next = (next + 1) & (profiler->tracked_capacity - 1);
+    }
+}
+
+/* called after every collection: whatever is still tracked survived it */
+void lit_allocprof_aftergc(LitState* state)
+{
+    size_t i;
+    LitAllocProfiler* profiler;
+    profiler = state->allocprofiler;
+    profiler->collections++;
+    for(i = 0; i < profiler->tracked_capacity; i++)
+    {
+        if(profiler->tracked[i].object != NULL && profiler->tracked[i].collections++ == 0)
+        {
+            profiler->sites[profiler->tracked[i].site].survived++;
+        }
+    }
+}
+
+static LIT_THREADLOCAL const LitAllocSite* allocprof_sorting;
+
+static int lit_allocprof_compare(const void* a, const void* b)
+{
+    const LitAllocSite* sa;
+    const LitAllocSite* sb;
+    sa = &allocprof_sorting[*(const size_t*)a];
+    sb = &allocprof_sorting[*(const size_t*)b];
+    if(sa->bytes != sb->bytes)
+    {
+        return sa->bytes < sb->bytes ? 1 : -1;
+    }
+    return *(const size_t*)a < *(const size_t*)b ? -1 : 1;
+}
+
+/* the site indices, by estimated bytes. the caller frees the result */
+static size_t* lit_allocprof_sorted(LitAllocProfiler* profiler)
+{
+    size_t i;
+    size_t* order;
+    order = (size_t*)malloc((profiler->site_count + 1) * sizeof(size_t));
+    if(order == NULL)
+    {
+        return NULL;
+    }
+    for(i = 0; i < profiler->site_count; i++)
+    {
+        order[i] = i;
+    }
+    allocprof_sorting = profiler->sites;
+    qsort(order, profiler->site_count, sizeof(size_t), lit_allocprof_compare);
+    return order;
+}
+
+/* writes every allocation site, most bytes first */
+bool lit_allocprof_write(LitState* state, FILE* out)
+{
+    size_t i;
+    size_t* order;
+    const LitAllocSite* site;
+    LitAllocProfiler* profiler;
+    profiler = state->allocprofiler;
+    if(profiler == NULL)
+    {
+        return false;
+    }
+    order = lit_allocprof_sorted(profiler);
+    if(order == NULL)
+    {
+        return false;
+    }
+    fprintf(out, "# sampled every %zu bytes on average, over %llu collections. count and bytes are estimates\n",
+            profiler->interval, (unsigned long long)profiler->collections);
+    fprintf(out, "%14s %12s %9s %9s %8s  %-16s %s\n", "bytes", "count", "samples", "survived", "live", "type", "site");
+    for(i = 0; i < profiler->site_count; i++)
+    {
+        site = &profiler->sites[order[i]];
+        fprintf(out, "%14.0f %12.0f %9llu %8.1f%% %8llu  %-16s %s:%d\n", site->bytes, site->count, (unsigned long long)site->samples,
+                100.0 * (double)site->survived / (double)site->samples, (unsigned long long)(site->samples - site->freed),
+                lit_tostring_objtype(site->type), site->function, (int)site->line);
+    }
+    free(order);
+    return !ferror(out);
+}
+
+/*
+* the profile as an array of maps, most bytes first. sampling is paused meanwhile,
+* so that the maps built here don't show up in it.
+*/
+LitValue lit_allocprof_tovalue(LitState* state)
+{
+    size_t i;
+    size_t count;
+    bool running;
+    size_t* order;
+    LitArray* result;
+    LitMap* entry;
+    const LitAllocSite* site;
+    LitAllocProfiler* profiler;
+    profiler = state->allocprofiler;
+    if(profiler == NULL)
+    {
+        return NULL_VALUE;
+    }
+    order = lit_allocprof_sorted(profiler);
+    if(order == NULL)
+    {
+        return NULL_VALUE;
+    }
+    running = profiler->running;
+    profiler->running = false;
+    count = profiler->site_count;
+    result = lit_create_array(state);
+    lit_state_pushroot(state, (LitObject*)result);
+    for(i = 0; i < count; i++)
+    {
+        site = &profiler->sites[order[i]];
+        entry = lit_create_map(state);
+        lit_vallist_push(state, &result->list, lit_value_objectvalue(entry));
+        lit_map_set(state, entry, CONST_STRING(state, "type"), OBJECT_CONST_STRING(state, lit_tostring_objtype(site->type)));
+        lit_map_set(state, entry, CONST_STRING(state, "function"), OBJECT_CONST_STRING(state, site->function));
+        lit_map_set(state, entry, CONST_STRING(state, "line"), lit_value_numbertovalue(state, (double)site->line));
+        lit_map_set(state, entry, CONST_STRING(state, "count"), lit_value_numbertovalue(state, site->count));
+        lit_map_set(state, entry, CONST_STRING(state, "bytes"), lit_value_numbertovalue(state, site->bytes));
+        lit_map_set(state, entry, CONST_STRING(state, "samples"), lit_value_numbertovalue(state, (double)site->samples));
+        lit_map_set(state, entry, CONST_STRING(state, "survived"), lit_value_numbertovalue(state, (double)site->survived));
+        lit_map_set(state, entry, CONST_STRING(state, "live"), lit_value_numbertovalue(state, (double)(site->samples - site->freed)));
+    }
+    lit_state_poproot(state);
+    profiler->running = running;
+    free(order);
+    return lit_value_objectvalue(result);
+}
@@ -4,12 +4,9 @@
 #include <time.h>
 #include "lit.h"
 
-static bool measure_compilation_time;
-static double last_source_time = 0;
-
-void lit_enable_compilation_time_measurement()
+void lit_enable_compilation_time_measurement(LitState* state)
 {
-    measure_compilation_time = true;
+    state->config.measurecompile = true;
 }
 
 static void lit_util_default_error(LitState* state, const char* message)
@@ -35,6 +32,10 @@ LitState* lit_make_state()
         state->config.dumpbytecode = false;
         state->config.dumpast = false;
         state->config.runafterdump = true;
+        state->config.streamcompile = false;
+        state->config.measurecompile = false;
+        state->config.threads = 0;
+        lit_astopt_setoptlevel(state, LITOPTLEVEL_DEBUG);
     }
     {
         state->classvalue_class = NULL;
@@ -48,9 +49,20 @@ LitState* lit_make_state()
         state->arrayvalue_class = NULL;
         state->mapvalue_class = NULL;
         state->rangevalue_class = NULL;
+        state->float64arrayvalue_class = NULL;
+        state->int32arrayvalue_class = NULL;
+        state->uint8arrayvalue_class = NULL;
+        state->buffervalue_class = NULL;
     }
     state->bytes_allocated = 0;
     state->next_gc = 256 * 1024;
+    lit_gcmem_initstats(state);
+    state->hashseed = lit_util_makehashseed(state);
+    state->random_seed = 0;
+    state->source_time = 0;
+    state->userdata = NULL;
+    state->worker = NULL;
+    state->pool = NULL;
     state->allow_gc = false;
     /* io stuff */
     {
@@ -74,6 +86,10 @@ LitState* lit_make_state()
     lit_emitter_init(state, state->emitter);
     state->optimizer = (LitOptimizer*)malloc(sizeof(LitOptimizer));
     lit_astopt_init(state, state->optimizer);
+    lit_astarena_init(&state->astarena);
+    state->images = NULL;
+    state->profiler = NULL;
+    state->allocprofiler = NULL;
     state->vm = (LitVM*)malloc(sizeof(LitVM));
     lit_vm_init(state, state->vm);
     lit_api_init(state);
@@ -98,8 +114,13 @@ int64_t lit_destroy_state(LitState* state)
     lit_emitter_destroy(state->emitter);
     free(state->emitter);
     free(state->optimizer);
+    lit_profiler_destroy(state);
+    lit_allocprof_destroy(state);
+    lit_pool_destroy(state);
+    lit_astarena_destroy(&state->astarena);
     lit_vm_destroy(state->vm);
     free(state->vm);
+    lit_ioutil_releaseimages(state);
     amount = state->bytes_allocated;
     free(state);
     return amount;
@@ -338,11 +359,16 @@ static inline LitCallFrame* setup_call(LitState* state, LitFunction* callee, Lit
         lit_vallist_push(vm->state, &array->list, *(fiber->stack_top - 1));
         *(fiber->stack_top - 1) = lit_value_objectvalue(array);
     }
+    if(callee->image != NULL)
+    {
+        lit_ioutil_loadconstants(vm->state, callee);
+    }
     frame->ip = callee->chunk.code;
     frame->closure = NULL;
     frame->function = callee;
     frame->result_ignored = false;
     frame->return_to_c = true;
+    frame->tail_calls = 0;
     return frame;
 }
 
@@ -398,7 +424,7 @@ LitInterpretResult lit_state_callmethod(LitState* state, LitValue instance, LitV
     vm = state->vm;
     if(lit_value_isobject(callee))
     {
-        if(lit_vmutil_setexitjump())
+        if(lit_vmutil_setexitjump(vm))
         {
             RETURN_RUNTIME_ERROR();
         }
@@ -666,6 +692,21 @@ LitClass* lit_state_getclassfor(LitState* state, LitValue value)
                     return state->rangevalue_class;
                 }
                 break;
+            case LITTYPE_TYPEDARRAY:
+                {
+                    switch(lit_value_astypedarray(value)->kind)
+                    {
+                        case LITTYPED_FLOAT64: return state->float64arrayvalue_class;
+                        case LITTYPED_INT32: return state->int32arrayvalue_class;
+                        case LITTYPED_UINT8: return state->uint8arrayvalue_class;
+                    }
+                }
+                break;
+            case LITTYPE_BUFFER:
+                {
+                    return state->buffervalue_class;
+                }
+                break;
             case LITTYPE_REFERENCE:
                 {
                     slot = lit_value_asreference(value)->slot;
@@ -691,80 +732,153 @@ LitClass* lit_state_getclassfor(LitState* state, LitValue value)
     return NULL;
 }
 
-static void free_statements(LitState* state, LitAstExprList* statements)
+/* wall time rather than clock(), which counts the cpu time of every thread in the process */
+static double lit_state_mssince(uint64_t t)
 {
-    size_t i;
-    for(i = 0; i < statements->count; i++)
+    return (double)(lit_util_nanotime() - t) / 1e6;
+}
+
+/*
+* compiles without ever holding the whole ast: every top-level statement is parsed,
+* optimized, emitted and dropped before the next one is read, so the memory used
+* is bounded by the largest statement rather than by the size of the source.
+*/
+static LitModule* lit_state_compilestream(LitState* state, LitString* module_name, const char* code)
+{
+    bool done;
+    bool stopped;
+    uint64_t t;
+    double parsing;
+    double optimization;
+    double emitting;
+    LitModule* module;
+    LitCompiler parser_compiler;
+    LitCompiler emitter_compiler;
+    LitAstExpression* statement;
+    LitAstExprList dumped;
+    LitAstArenaMark mark;
+    t = 0;
+    parsing = 0;
+    optimization = 0;
+    emitting = 0;
+    stopped = false;
+    mark = lit_astarena_mark(state);
+    lit_emitter_beginmodule(state->emitter, &emitter_compiler, module_name);
+    lit_parser_prescan(state->parser, module_name->chars, code, lit_emitter_declareprivate, state->emitter);
+    lit_astopt_beginmodule(state->optimizer, NULL);
+    lit_parser_begin(state->parser, &parser_compiler, module_name->chars, code);
+    do
     {
-        lit_ast_destroyexpression(state, statements->values[i]);
+        if(state->config.measurecompile)
+        {
+            t = lit_util_nanotime();
+        }
+        statement = lit_parser_parsenext(state->parser, &done);
+        if(state->config.measurecompile)
+        {
+            parsing += lit_state_mssince(t);
+        }
+        // after an error the rest is only parsed, to report what else is wrong
+        if(statement != NULL && !stopped && !lit_parser_haderror(state->parser))
+        {
+            if(state->config.dumpast)
+            {
+                dumped = (LitAstExprList){ 1, 1, &statement };
+                lit_towriter_ast(state, &state->stdoutwriter, &dumped);
+            }
+            if(state->config.measurecompile)
+            {
+                t = lit_util_nanotime();
+            }
+            lit_astopt_optmodstatement(state->optimizer, &statement);
+            if(state->config.measurecompile)
+            {
+                optimization += lit_state_mssince(t);
+                t = lit_util_nanotime();
+            }
+            stopped = lit_emitter_emitstatement(state->emitter, statement);
+            if(state->config.measurecompile)
+            {
+                emitting += lit_state_mssince(t);
+            }
+        }
+        lit_astarena_rewind(state, mark);
+    } while(!done);
+    lit_astopt_endmodule(state->optimizer);
+    module = lit_emitter_endmodule(state->emitter, module_name);
+    if(state->config.measurecompile)
+    {
+        printf("-----------------------\nParsing:        %gms\n", parsing);
+        printf("Optimization:   %gms\n", optimization);
+        printf("Emitting:       %gms\n", emitting);
     }
-    lit_exprlist_destroy(state, statements);
+    return lit_parser_haderror(state->parser) ? NULL : module;
 }
 
-
 LitModule* lit_state_compilemodule(LitState* state, LitString* module_name, const char* code, size_t len)
 {
-    clock_t t;
-    clock_t total_t;
+    uint64_t t;
+    uint64_t total_t;
     bool allowed_gc;
     LitModule* module;
     LitAstExprList statements;
+    LitAstArenaMark mark;
     allowed_gc = state->allow_gc;
     state->allow_gc = false;
     state->had_error = false;
     module = NULL;
+    t = 0;
+    total_t = 0;
+    if(state->config.measurecompile)
+    {
+        total_t = t = lit_util_nanotime();
+    }
     // This is a lbc format
     if((code[1] << 8 | code[0]) == LIT_BYTECODE_MAGIC_NUMBER)
     {
         module = lit_ioutil_readmodule(state, code, len);
     }
+    else if(state->config.streamcompile)
+    {
+        module = lit_state_compilestream(state, module_name, code);
+    }
     else
     {
-        t = 0;
-        total_t = 0;
-        if(measure_compilation_time)
-        {
-            total_t = t = clock();
-        }
-        if(!lit_preproc_run(state->preprocessor, code))
-        {
-            return NULL;
-        }
-        if(measure_compilation_time)
-        {
-            printf("-----------------------\nPreprocessing:  %gms\n", (double)(clock() - t) / CLOCKS_PER_SEC * 1000);
-            t = clock();
-        }
+        // everything the parser and optimizer allocate is dropped in one go once the module is emitted
+        mark = lit_astarena_mark(state);
         lit_exprlist_init(&statements);
         if(lit_parser_parsesource(state->parser, module_name->chars, code, &statements))
         {
-            free_statements(state, &statements);
+            lit_astarena_rewind(state, mark);
+            state->allow_gc = allowed_gc;
             return NULL;
         }
         if(state->config.dumpast)
         {
             lit_towriter_ast(state, &state->stdoutwriter, &statements);
         }
-        if(measure_compilation_time)
+        if(state->config.measurecompile)
         {
-            printf("Parsing:        %gms\n", (double)(clock() - t) / CLOCKS_PER_SEC * 1000);
-            t = clock();
+            printf("-----------------------\nParsing:        %gms\n", lit_state_mssince(t));
+            t = lit_util_nanotime();
         }
         lit_astopt_optast(state->optimizer, &statements);
-        if(measure_compilation_time)
+        if(state->config.measurecompile)
         {
-            printf("Optimization:   %gms\n", (double)(clock() - t) / CLOCKS_PER_SEC * 1000);
-            t = clock();
+            printf("Optimization:   %gms\n", lit_state_mssince(t));
+            t = lit_util_nanotime();
         }
         module = lit_emitter_modemit(state->emitter, &statements, module_name);
-        free_statements(state, &statements);
-        if(measure_compilation_time)
+        lit_astarena_rewind(state, mark);
+        if(state->config.measurecompile)
         {
-            printf("Emitting:       %gms\n", (double)(clock() - t) / CLOCKS_PER_SEC * 1000);
-            printf("\nTotal:          %gms\n-----------------------\n",
-                   (double)(clock() - total_t) / CLOCKS_PER_SEC * 1000 + last_source_time);
+            printf("Emitting:       %gms\n", lit_state_mssince(t));
         }
     }
+    if(state->config.measurecompile)
+    {
+        printf("\nTotal:          %gms\n-----------------------\n", lit_state_mssince(total_t) + state->source_time);
+    }
     state->allow_gc = allowed_gc;
     return state->had_error ? NULL : module;
 }
@@ -785,15 +899,31 @@ LitInterpretResult lit_state_execsource(LitState* state, const char* module_name
 }
 
 
-LitInterpretResult lit_state_internexecsource(LitState* state, LitString* module_name, const char* code, size_t len)
+/*
+* compiles a source obtained from lit_util_mapfile, and releases it. bytecode images
+* are handed over to the state instead, since their functions keep running from them.
+*/
+LitModule* lit_state_compilemapped(LitState* state, LitString* module_name, char* source, size_t len, bool mapped)
+{
+    LitModule* module;
+    if(lit_ioutil_isimage(source, len))
+    {
+        state->had_error = false;
+        module = lit_ioutil_loadimage(state, source, len, mapped);
+        return state->had_error ? NULL : module;
+    }
+    module = lit_state_compilemodule(state, module_name, source, len);
+    lit_util_unmapfile(source, len, mapped);
+    return module;
+}
+
+static LitInterpretResult lit_state_runmodule(LitState* state, LitModule* module)
 {
     intptr_t istack;
     intptr_t itop;
     intptr_t idif;
-    LitModule* module;
     LitFiber* fiber;
     LitInterpretResult result;
-    module = lit_state_compilemodule(state, module_name, code, len);
     if(module == NULL)
     {
         return (LitInterpretResult){ LITRESULT_COMPILE_ERROR, NULL_VALUE };
@@ -813,9 +943,17 @@ LitInterpretResult lit_state_internexecsource(LitState* state, LitString* module
     return result;
 }
 
+LitInterpretResult lit_state_internexecsource(LitState* state, LitString* module_name, const char* code, size_t len)
+{
+    return lit_state_runmodule(state, lit_state_compilemodule(state, module_name, code, len));
+}
+
+
 
 bool lit_state_compileandsave(LitState* state, char* files[], size_t num_files, const char* output_file)
 {
+    bool mapped;
+    bool written;
     size_t i;
     size_t len;
     char* file_name;
@@ -825,11 +963,11 @@ bool lit_state_compileandsave(LitState* state, char* files[], size_t num_files,
     LitModule* module;
     LitModule** compiled_modules;
     compiled_modules = LIT_ALLOCATE(state, sizeof(LitModule*), num_files+1);
-    lit_astopt_setoptlevel(LITOPTLEVEL_EXTREME);
+    lit_astopt_setoptlevel(state, LITOPTLEVEL_EXTREME);
     for(i = 0; i < num_files; i++)
     {
         file_name = lit_util_copystring(files[i]);
-        source = lit_util_readfile(file_name, &len);
+        source = lit_util_mapfile(file_name, &len, &mapped);
         if(source == NULL)
         {
             lit_state_raiseerror(state, COMPILE_ERROR, "failed to open file '%s' for reading", file_name);
@@ -839,7 +977,7 @@ bool lit_state_compileandsave(LitState* state, char* files[], size_t num_files,
         module_name = lit_string_copy(state, file_name, strlen(file_name));
         module = lit_state_compilemodule(state, module_name, source, len);
         compiled_modules[i] = module;
-        free((void*)source);
+        lit_util_unmapfile(source, len, mapped);
         free((void*)file_name);
         if(module == NULL)
         {
@@ -852,41 +990,38 @@ bool lit_state_compileandsave(LitState* state, char* files[], size_t num_files,
         lit_state_raiseerror(state, COMPILE_ERROR, "failed to open file '%s' for writing", output_file);
         return false;
     }
-    lit_ioutil_writeuint16(file, LIT_BYTECODE_MAGIC_NUMBER);
-    lit_ioutil_writeuint8(file, LIT_BYTECODE_VERSION);
-    lit_ioutil_writeuint16(file, num_files);
-    for(i = 0; i < num_files; i++)
-    {
-        lit_ioutil_writemodule(compiled_modules[i], file);
-    }
-    lit_ioutil_writeuint16(file, LIT_BYTECODE_END_NUMBER);
+    written = lit_ioutil_writeimage(state, compiled_modules, num_files, file);
     LIT_FREE(state, sizeof(LitModule), compiled_modules);
     fclose(file);
-    return true;
+    if(!written)
+    {
+        lit_state_raiseerror(state, COMPILE_ERROR, "failed to write bytecode to '%s'", output_file);
+    }
+    return written;
 }
 
-static char* lit_util_readsource(LitState* state, const char* file, char** patched_file_name, size_t* dlen)
+static char* lit_util_readsource(LitState* state, const char* file, char** patched_file_name, size_t* dlen, bool* mapped)
 {
-    clock_t t;
+    uint64_t t;
     size_t len;
     char* file_name;
     char* source;
     t = 0;
-    if(measure_compilation_time)
+    if(state->config.measurecompile)
     {
-        t = clock();
+        t = lit_util_nanotime();
     }
     file_name = lit_util_copystring(file);
-    source = lit_util_readfile(file_name, &len);
+    source = lit_util_mapfile(file_name, &len, mapped);
     if(source == NULL)
     {
         lit_state_raiseerror(state, RUNTIME_ERROR, "failed to open file '%s' for reading", file_name);
     }
     *dlen = len;
     file_name = lit_util_patchfilename(file_name);
-    if(measure_compilation_time)
+    if(state->config.measurecompile)
     {
-        printf("reading source: %gms\n", last_source_time = (double)(clock() - t) / CLOCKS_PER_SEC * 1000);
+        printf("reading source: %gms\n", state->source_time = lit_state_mssince(t));
     }
     *patched_file_name = file_name;
     return source;
@@ -894,30 +1029,33 @@ static char* lit_util_readsource(LitState* state, const char* file, char** patch
 
 LitInterpretResult lit_state_execfile(LitState* state, const char* file)
 {
+    bool mapped;
     size_t len;
     char* source;
     char* patched_file_name;
+    LitString* module_name;
     LitInterpretResult result;
-    source = lit_util_readsource(state, file, &patched_file_name, &len);
+    source = lit_util_readsource(state, file, &patched_file_name, &len, &mapped);
     if(source == NULL)
     {
         return INTERPRET_RUNTIME_FAIL;
     }
-    result = lit_state_execsource(state, patched_file_name, source, len);
-    free((void*)source);
+    module_name = lit_string_copy(state, patched_file_name, strlen(patched_file_name));
+    result = lit_state_runmodule(state, lit_state_compilemapped(state, module_name, source, len, mapped));
     free(patched_file_name);
     return result;
 }
 
 LitInterpretResult lit_state_dumpfile(LitState* state, const char* file)
 {
+    bool mapped;
     size_t len;
     char* patched_file_name;
     char* source;
     LitInterpretResult result;
     LitString* module_name;
     LitModule* module;
-    source = lit_util_readsource(state, file, &patched_file_name, &len);
+    source = lit_util_readsource(state, file, &patched_file_name, &len, &mapped);
     if(source == NULL)
     {
         return INTERPRET_RUNTIME_FAIL;
@@ -933,7 +1071,7 @@ LitInterpretResult lit_state_dumpfile(LitState* state, const char* file)
         lit_disassemble_module(state, module, source);
         result = (LitInterpretResult){ LITRESULT_OK, NULL_VALUE };
     }
-    free((void*)source);
+    lit_util_unmapfile(source, len, mapped);
     free((void*)patched_file_name);
     return result;
 }
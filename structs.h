@@ -4,6 +4,7 @@ enum LitOpCode
 #define OPCODE(name, effect) OP_##name,
 #include "opcodes.inc"
 #undef OPCODE
+    OP_TOTAL
 };
 
 enum LitExprType
@@ -63,10 +64,23 @@ enum LitOptimization
     LITOPTSTATE_LINE_INFO,
     LITOPTSTATE_PRIVATE_NAMES,
     LITOPTSTATE_C_FOR,
+    LITOPTSTATE_INLINE,
+    LITOPTSTATE_LICM,
+    LITOPTSTATE_CSE,
 
     LITOPTSTATE_TOTAL
 };
 
+/* what the optimizer knows about the type of a value */
+enum LitOptKind
+{
+    LITOPTKIND_UNKNOWN,
+    LITOPTKIND_NUMBER,
+    LITOPTKIND_STRING,
+    LITOPTKIND_ARRAY,
+    LITOPTKIND_MAP
+};
+
 enum LitError
 {
     // Preprocessor errors
@@ -282,12 +296,25 @@ enum LitObjType
     LITTYPE_REFERENCE,
     LITTYPE_NUMBER,
     LITTYPE_BOOL,
+    LITTYPE_TYPEDARRAY,
+    LITTYPE_BUFFER,
+};
+
+/* the number of object types; kept out of the enum, so switches over it need no case for it */
+#define LITTYPE_TOTAL (LITTYPE_BUFFER + 1)
+
+enum LitTypedKind
+{
+    LITTYPED_FLOAT64,
+    LITTYPED_INT32,
+    LITTYPED_UINT8,
 };
 
 typedef enum /**/LitOpCode LitOpCode;
 typedef enum /**/LitExprType LitExprType;
 typedef enum /**/LitOptLevel LitOptLevel;
 typedef enum /**/LitOptimization LitOptimization;
+typedef enum /**/LitOptKind LitOptKind;
 typedef enum /**/LitError LitError;
 typedef enum /**/LitPrecedence LitPrecedence;
 typedef enum /**/LitTokType LitTokType;
@@ -295,6 +322,7 @@ typedef enum /**/LitResult LitResult;
 typedef enum /**/LitErrType LitErrType;
 typedef enum /**/LitFuncType LitFuncType;
 typedef enum /**/LitObjType LitObjType;
+typedef enum /**/LitTypedKind LitTypedKind;
 typedef struct /**/LitScanner LitScanner;
 typedef struct /**/LitPreprocessor LitPreprocessor;
 typedef struct /**/LitExecState LitExecState;
@@ -326,6 +354,8 @@ typedef struct /**/LitInstance LitInstance;
 typedef struct /**/LitBoundMethod LitBoundMethod;
 typedef struct /**/LitArray LitArray;
 typedef struct /**/LitRange LitRange;
+typedef struct /**/LitTypedArray LitTypedArray;
+typedef struct /**/LitBuffer LitBuffer;
 typedef struct /**/LitField LitField;
 typedef struct /**/LitReference LitReference;
 typedef struct /**/LitToken LitToken;
@@ -334,6 +364,24 @@ typedef struct /**/LitCompilerUpvalue LitCompilerUpvalue;
 typedef struct /**/LitCompiler LitCompiler;
 typedef struct /**/LitParseRule LitParseRule;
 typedef struct /**/LitEmulatedFile LitEmulatedFile;
+typedef struct /**/LitBytecodeHeader LitBytecodeHeader;
+typedef struct /**/LitBytecodeModule LitBytecodeModule;
+typedef struct /**/LitBytecodeFunction LitBytecodeFunction;
+typedef struct /**/LitBytecodeConstant LitBytecodeConstant;
+typedef struct /**/LitBytecodeImage LitBytecodeImage;
+typedef struct /**/LitProfileStack LitProfileStack;
+typedef struct /**/LitProfiler LitProfiler;
+typedef struct /**/LitOpcodeStats LitOpcodeStats;
+typedef struct /**/LitAllocSite LitAllocSite;
+typedef struct /**/LitAllocTrack LitAllocTrack;
+typedef struct /**/LitAllocProfiler LitAllocProfiler;
+typedef struct /**/LitHeapEdges LitHeapEdges;
+typedef struct /**/LitGCEvent LitGCEvent;
+typedef struct /**/LitGCStats LitGCStats;
+typedef struct /**/LitMessage LitMessage;
+typedef struct /**/LitThreadPool LitThreadPool;
+typedef struct /**/LitMessageQueue LitMessageQueue;
+typedef struct /**/LitWorker LitWorker;
 typedef struct /**/LitVariable LitVariable;
 typedef struct /**/LitWriter LitWriter;
 typedef struct /**/LitLocal LitLocal;
@@ -344,6 +392,9 @@ typedef struct /**/LitVarList LitVarList;
 typedef struct /**/LitUintList LitUintList;
 typedef struct /**/LitValueList LitValueList;
 typedef struct /**/LitAstExprList LitAstExprList;
+typedef struct /**/LitAstArena LitAstArena;
+typedef struct /**/LitAstArenaBlock LitAstArenaBlock;
+typedef struct /**/LitAstArenaMark LitAstArenaMark;
 typedef struct /**/LitAstParamList LitAstParamList;
 typedef struct /**/LitPrivList LitPrivList;
 typedef struct /**/LitLocList LitLocList;
@@ -393,6 +444,8 @@ typedef struct /**/LitDirItem LitDirItem;
 
 typedef LitAstExpression* (*LitPrefixParseFn)(LitParser*, bool);
 typedef LitAstExpression* (*LitInfixParseFn)(LitParser*, LitAstExpression*, bool);
+/* receives the names found by lit_parser_prescan */
+typedef void (*LitDeclareFn)(void*, const char*, size_t, size_t, bool);
 
 
 typedef LitValue (*LitNativeFunctionFn)(LitVM*, size_t, LitValue*);
@@ -402,6 +455,8 @@ typedef bool (*LitPrimitiveMethodFn)(LitVM*, LitValue, size_t, LitValue*);
 typedef LitValue (*LitMapIndexFn)(LitVM*, LitMap*, LitString*, LitValue*);
 typedef void (*LitCleanupFn)(LitState*, LitUserdata*, bool mark);
 typedef void (*LitErrorFn)(LitState*, const char*);
+/* one chunk of a job on the thread pool */
+typedef void (*LitPoolTaskFn)(void*, size_t chunk);
 typedef void (*LitPrintFn)(LitState*, const char*);
 
 typedef void(*LitWriterByteFN)(LitWriter*, int);
@@ -453,9 +508,12 @@ struct LitUintList
     LitDataList list;
 };
 
+/* a LitDataList specialized for LitValue; the accessors are inlined in lit.h */
 struct LitValueList
 {
-    LitDataList list;
+    size_t capacity;
+    size_t count;
+    LitValue* values;
 };
 
 /* TODO: using DataList messes with the string its supposed to collect. no clue why, though. */
@@ -524,6 +582,12 @@ struct LitEmitter
     bool class_has_super;
     bool previous_was_expression_statement;
     int emit_reference;
+    /* the last call that could become a tail call, and the offset of its OP_CALL/OP_INVOKE */
+    LitAstExpression* last_call;
+    size_t last_call_offset;
+    /* set up by lit_emitter_beginmodule for lit_emitter_endmodule */
+    bool module_isnew;
+    size_t module_oldprivates;
 };
 
 struct LitParseRule
@@ -533,6 +597,28 @@ struct LitParseRule
     LitPrecedence precedence;
 };
 
+/*
+* ast nodes and their lists are bump-allocated in blocks, and dropped all at once
+* when the module they belong to has been emitted.
+*/
+struct LitAstArenaBlock
+{
+    LitAstArenaBlock* previous;
+    size_t capacity;
+    size_t used;
+};
+
+struct LitAstArena
+{
+    LitAstArenaBlock* current;
+};
+
+struct LitAstArenaMark
+{
+    LitAstArenaBlock* block;
+    size_t used;
+};
+
 /*
  * Expressions
  */
@@ -638,7 +724,8 @@ struct LitAstArrayExpr
 struct LitAstObjectExpr
 {
     LitAstExpression exobj;
-    LitValueList keys;
+    /* literal expressions holding the key strings */
+    LitAstExprList keys;
     LitAstExprList values;
 };
 
@@ -804,6 +891,10 @@ struct LitVariable
     bool used;
     LitValue constant_value;
     LitAstExpression** declaration;
+    /* a function declaration that calls may be replaced with (see LITOPTSTATE_INLINE) */
+    bool inlinable;
+    /* type of the initializer, which holds for as long as the name is never assigned */
+    LitOptKind kind;
 };
 
 
@@ -818,6 +909,11 @@ struct LitChunk
     size_t line_capacity;
     uint16_t* lines;
     LitValueList constants;
+    /* code and lines point into a loaded bytecode image, and are not owned by the chunk */
+    bool mapped;
+    /* open-addressed slots (constant index + 1) used while compiling, once there are enough constants */
+    uint32_t* constindex;
+    size_t constindex_capacity;
 };
 
 struct LitTableEntry
@@ -839,6 +935,12 @@ struct LitTable
     /* how many entries could be held */
     int capacity;
 
+    /* deleted entries left in place while the table was being iterated (see lit_table_delete) */
+    int tombstones;
+
+    /* set by util_table_iterator from its first step until it runs off the end */
+    bool iterating;
+
     /* the actual entries */
     LitTableEntry* entries;
 };
@@ -854,7 +956,7 @@ struct LitString
 {
     LitObject object;
     /* the hash of this string - note that it is only unique to the context! */
-    uint32_t hash;
+    uint64_t hash;
     /* this is handled by sds - use lit_string_getlength to get the length! */
     char* chars;
 };
@@ -868,7 +970,12 @@ struct LitFunction
     uint16_t upvalue_count;
     size_t max_slots;
     bool vararg;
+    /* whether the body mentions '...'; if not, calls skip packing the rest into an array */
+    bool vararg_used;
     LitModule* module;
+    /* set until the constants are materialized from the bytecode image this function was loaded from */
+    LitBytecodeImage* image;
+    const LitBytecodeFunction* image_function;
 };
 
 struct LitUpvalue
@@ -876,15 +983,19 @@ struct LitUpvalue
     LitObject object;
     LitValue* location;
     LitValue closed;
-    LitUpvalue* next;
 };
 
 struct LitClosure
 {
     LitObject object;
     LitFunction* function;
-    LitUpvalue** upvalues;
     size_t upvalue_count;
+    /*
+    * allocated along with the closure. each slot holds either a LitUpvalue (a boxed
+    * variable that can still change), or the captured value itself, when the emitter
+    * proved that the variable is never reassigned.
+    */
+    LitValue upvalues[];
 };
 
 struct LitNativeFunction
@@ -925,6 +1036,8 @@ struct LitCallFrame
     LitValue* slots;
     bool result_ignored;
     bool return_to_c;
+    /* how many frames were replaced by tail calls made from this one */
+    size_t tail_calls;
 };
 
 struct LitMap
@@ -960,9 +1073,16 @@ struct LitFiber
     size_t frame_capacity;
     size_t frame_count;
     size_t arg_count;
-    LitUpvalue* open_upvalues;
+    /*
+    * open upvalues, indexed by stack slot. allocated on the first capture, and
+    * always as large as the stack. nothing at or above open_upvalue_top is open.
+    */
+    LitUpvalue** open_upvalues;
+    size_t open_upvalue_top;
     LitModule* module;
     LitValue lit_emitter_raiseerror;
+    /* what a receive() that suspended this fiber waits on (a Worker, or the Worker class); null otherwise */
+    LitValue waiting;
     bool abort;
     bool catcher;
 };
@@ -1022,6 +1142,36 @@ struct LitRange
     double to;
 };
 
+/*
+* a fixed-length array of raw numbers. the elements live in one contiguous buffer
+* that the GC never looks into.
+*/
+struct LitTypedArray
+{
+    LitObject object;
+    LitTypedKind kind;
+    /* amount of elements */
+    size_t length;
+    /* length * lit_typedarray_elemsize(kind) bytes */
+    void* data;
+};
+
+/* a growable byte array, or a read-only view of a mapped file */
+struct LitBuffer
+{
+    LitObject object;
+    uint8_t* data;
+    /* bytes in use */
+    size_t length;
+    /* bytes allocated. 0 for mapped buffers */
+    size_t capacity;
+    size_t readpos;
+    size_t writepos;
+    bool readonly;
+    /* data comes from mmap, and is unmapped instead of freed */
+    bool mapped;
+};
+
 struct LitField
 {
     LitObject object;
@@ -1040,6 +1190,62 @@ struct LitConfig
     bool dumpbytecode;
     bool dumpast;
     bool runafterdump;
+    /* parse, optimize and emit one top-level statement at a time */
+    bool streamcompile;
+    /* print how long each compilation step took */
+    bool measurecompile;
+    /* which ast optimizations run; see lit_astopt_setoptlevel() and friends */
+    bool optimizations[LITOPTSTATE_TOTAL];
+    bool anyoptimization;
+    /* how many threads (the calling one included) native bulk operations may use. 0 is one per core */
+    int threads;
+};
+
+/* one collection, as recorded by lit_gcmem_collectgarbage. times are in nanoseconds */
+struct LitGCEvent
+{
+    /* 1 for the first collection */
+    uint64_t cycle;
+    /* marking the roots, and tracing everything they reach */
+    uint64_t mark_time;
+    /* dropping unreached strings from the interning table */
+    uint64_t strings_time;
+    uint64_t sweep_time;
+    uint64_t total_time;
+    /* how long the program ran between the previous collection and this one */
+    uint64_t mutator_time;
+    int64_t bytes_before;
+    int64_t bytes_after;
+    /* the threshold the pacer picked for the next collection */
+    int64_t next_gc;
+    uint32_t freed[LITTYPE_TOTAL];
+};
+
+struct LitGCStats
+{
+    /* the last LIT_GC_EVENTLOG collections; cycle n is at events[(n - 1) % LIT_GC_EVENTLOG] */
+    LitGCEvent events[LIT_GC_EVENTLOG];
+    /* set while a collection is running, so the sweep can count what it frees */
+    LitGCEvent* current;
+    uint64_t cycles;
+    uint64_t total_time;
+    uint64_t max_pause;
+    uint64_t objects_freed;
+    int64_t bytes_freed;
+    /* pauses, bucketed by log2 of their length in microseconds */
+    uint64_t pauses[LIT_GC_PAUSEBUCKETS];
+    /* when the state was made, and when the last collection ended */
+    uint64_t started;
+    uint64_t last_end;
+    /*
+    * the share of time the pacer aims to spend collecting, between 0 and 1.
+    * 0 keeps the heap growing by a fixed LIT_GC_HEAP_GROW_FACTOR.
+    */
+    double target_fraction;
+    /* what next_gc is set to, relative to the heap left after a collection */
+    double grow_factor;
+    /* a moving average of gc time / (gc time + mutator time) */
+    double fraction;
 };
 
 struct LitState
@@ -1048,6 +1254,8 @@ struct LitState
     LitWriter stdoutwriter;
     /* how much was allocated in total? */
     int64_t bytes_allocated;
+    /* the seed for string hashing. random per state, unless LIT_HASHSEED is set */
+    uint64_t hashseed;
     int64_t next_gc;
     bool allow_gc;
     LitValueList lightobjects;
@@ -1061,6 +1269,24 @@ struct LitState
     LitParser* parser;
     LitEmitter* emitter;
     LitOptimizer* optimizer;
+    LitAstArena astarena;
+    /* loaded bytecode images; code is executed from them directly */
+    LitBytecodeImage* images;
+    /* set while (or after) the sampling profiler ran */
+    LitProfiler* profiler;
+    /* set while (or after) allocations were being sampled */
+    LitAllocProfiler* allocprofiler;
+    LitGCStats gcstats;
+    /* what Random's static methods draw from */
+    size_t random_seed;
+    /* how long reading the last source file took, for config.measurecompile */
+    double source_time;
+    /* for the embedder (e.g. what print_fn writes to); lit never touches it */
+    void* userdata;
+    /* in the state of a worker thread, its link to the state that started it; NULL otherwise */
+    LitWorker* worker;
+    /* started by the first bulk operation big enough to split; see threadpool.c */
+    LitThreadPool* pool;
     /*
     * recursive pointer to the current VM instance.
     * using 'state->vm->state' will in turn mean this instance, etc.
@@ -1086,6 +1312,10 @@ struct LitState
     LitClass* arrayvalue_class;
     LitClass* mapvalue_class;
     LitClass* rangevalue_class;
+    LitClass* float64arrayvalue_class;
+    LitClass* int32arrayvalue_class;
+    LitClass* uint8arrayvalue_class;
+    LitClass* buffervalue_class;
     LitModule* last_module;
 };
 
@@ -1094,13 +1324,152 @@ struct LitExecState
 {
     LitValue* slots;
     LitValue* privates;
-    LitUpvalue** upvalues;
+    LitValue* upvalues;
     uint8_t* ip;
     LitCallFrame* frame;
     LitChunk* current_chunk;
 
 };
 
+/* where sampled objects were allocated: one per type, function and line */
+struct LitAllocSite
+{
+    LitObjType type;
+    size_t line;
+    /* "name (module)" of the function that was running */
+    char* function;
+    uint64_t hash;
+    uint64_t samples;
+    uint64_t sampled_bytes;
+    /* samples scaled up by the sampling interval */
+    double count;
+    double bytes;
+    /* samples that outlived at least one collection, and samples that were freed */
+    uint64_t survived;
+    uint64_t freed;
+};
+
+/* a sampled object that is still alive */
+struct LitAllocTrack
+{
+    LitObject* object;
+    uint32_t site;
+    uint32_t collections;
+};
+
+struct LitAllocProfiler
+{
+    bool running;
+    /* the mean number of bytes between samples; 1 samples every allocation */
+    size_t interval;
+    int64_t countdown;
+    uint64_t random;
+    uint64_t collections;
+    LitAllocSite* sites;
+    size_t site_count;
+    size_t site_capacity;
+    /* open addressed, site index + 1 */
+    uint32_t* site_index;
+    size_t index_capacity;
+    /* open addressed, keyed by the object pointer */
+    LitAllocTrack* tracked;
+    size_t tracked_count;
+    size_t tracked_capacity;
+};
+
+/* a value sent to or from a worker, serialized so that it belongs to neither state */
+struct LitMessage
+{
+    LitMessage* next;
+    /* from lit_serial_encode */
+    uint8_t* bytes;
+    size_t length;
+};
+
+#if defined(LIT_HAVE_THREADS)
+
+/*
+* many producers, one consumer, lock-free. the lock and condition are only
+* used to put a consumer to sleep while the queue is empty.
+*/
+struct LitMessageQueue
+{
+    /* where producers append */
+    LitMessage* head;
+    /* where the consumer takes from */
+    LitMessage* tail;
+    LitMessage stub;
+    size_t pending;
+    bool sleeping;
+    bool closed;
+    LitMutex lock;
+    LitCond wake;
+};
+
+/* shared by the Worker object in the parent and the thread running the worker */
+struct LitWorker
+{
+    char* path;
+    LitConfig config;
+    /* parent to worker */
+    LitMessageQueue inbox;
+    /* worker to parent */
+    LitMessageQueue outbox;
+    LitThread thread;
+    bool joined;
+    bool done;
+    LitResult result;
+    /* the parent's object and the thread each hold one */
+    int refs;
+};
+
+#endif
+
+/*
+* helper threads for lit_pool_run. a job is a number of chunks, that the helpers
+* and the caller take one at a time until none are left. without LIT_HAVE_THREADS
+* there are no helpers, and the caller does all of a job.
+*/
+struct LitThreadPool
+{
+    /* helper threads, not counting the caller */
+    int count;
+    LitThread* threads;
+    LitMutex lock;
+    /* a new job was posted, or the pool is shutting down */
+    LitCond wake;
+    /* the last helper left the current job */
+    LitCond done;
+    uint64_t job;
+    LitPoolTaskFn fn;
+    void* data;
+    size_t chunks;
+    /* the next chunk to take */
+    size_t next;
+    /* helpers still in the current job */
+    int busy;
+    bool quit;
+};
+
+/* the references of one object (or the roots), collected while writing a heap snapshot */
+struct LitHeapEdges
+{
+    LitObject** objects;
+    size_t count;
+    size_t capacity;
+    bool failed;
+};
+
+/* filled in by the dispatch loop when built with LIT_OPCODE_STATS */
+struct LitOpcodeStats
+{
+    uint64_t counts[OP_TOTAL];
+    /* LIT_OPCODE_CYCLES: ticks from dispatching an opcode until the next dispatch */
+    uint64_t cycles[OP_TOTAL];
+    /* the same deltas, bucketed by log2 */
+    uint64_t histogram[OP_TOTAL][LIT_OPSTATS_BUCKETS];
+};
+
 struct LitVM
 {
     /* the current state */
@@ -1114,6 +1483,17 @@ struct LitVM
     /* currently defined globals */
     LitMap* globals;
     LitFiber* fiber;
+    /* raised by the profiler's timer; the dispatch loop takes the sample at its next safepoint */
+    volatile sig_atomic_t profile_tick;
+#ifdef LIT_OPCODE_STATS
+    LitOpcodeStats opstats;
+#endif
+    /* set while taking a heap snapshot: marking records edges here instead */
+    LitHeapEdges* heapedges;
+    /* where lit_vm_raiseexitingerror() returns to; see lit_vmutil_setexitjump */
+    jmp_buf exitjump;
+    /* set by require() when the module it ran changed the caller's locals */
+    bool should_update_locals;
     // For garbage collection
     size_t gray_count;
     size_t gray_capacity;
@@ -1144,6 +1524,8 @@ struct LitLocal
     int depth;
     bool captured;
     bool constant;
+    /* set once anything assigns to (or takes a reference of) this local after its declaration */
+    bool reassigned;
 };
 
 struct LitLocList
@@ -1166,6 +1548,8 @@ struct LitCompiler
     LitFunction* function;
     LitFuncType type;
     LitCompilerUpvalue upvalues[UINT8_COUNT];
+    /* offsets of the OP_CLOSURE operands in this chunk that capture one of our locals */
+    LitUintList captures;
     LitCompiler* enclosing;
     bool skip_return;
     size_t loop_depth;
@@ -1183,6 +1567,8 @@ struct LitParser
     LitCompiler* compiler;
     uint8_t expression_root_count;
     uint8_t statement_root_count;
+    /* where a syntax error gives up on the current statement */
+    jmp_buf jmpbuffer;
 };
 
 struct LitEmulatedFile
@@ -1192,6 +1578,92 @@ struct LitEmulatedFile
     size_t position;
 };
 
+/*
+* the layout of a version 1 .lbc file: a header, the module table, the function table,
+* and then code, lines, constants and strings. every section is 8-byte aligned and
+* referred to by its offset from the start of the file, so a mapped file is validated
+* once and then used in place. offset 0 stands for "none".
+*/
+struct LitBytecodeHeader
+{
+    uint16_t magic;
+    uint8_t version;
+    uint8_t flags;
+    /* size of the whole file */
+    uint32_t size;
+    uint32_t module_count;
+    uint32_t function_count;
+};
+
+struct LitBytecodeModule
+{
+    uint32_t name;
+    uint32_t main_function;
+    uint32_t private_count;
+    /* a count followed by (name, index) pairs, or 0 when the private names were not kept */
+    uint32_t private_names;
+};
+
+struct LitBytecodeFunction
+{
+    uint32_t name;
+    uint32_t code;
+    uint32_t code_count;
+    uint32_t lines;
+    uint32_t line_count;
+    uint32_t constants;
+    uint32_t constant_count;
+    uint16_t upvalue_count;
+    uint16_t max_slots;
+    uint8_t arg_count;
+    uint8_t flags;
+    uint16_t reserved;
+    uint32_t reserved2;
+};
+
+struct LitBytecodeConstant
+{
+    uint32_t type;
+    /* string offset, function index, or the getter index + 1 of a field */
+    uint32_t ref;
+    /* anything that is not an object is stored as is; the setter index + 1 of a field */
+    uint64_t value;
+};
+
+/* a loaded image. it stays around (and mapped) for as long as the state does */
+struct LitBytecodeImage
+{
+    LitBytecodeImage* next;
+    char* data;
+    size_t length;
+    bool mapped;
+    const LitBytecodeFunction* functions;
+};
+
+/* one distinct folded stack, and how often it was sampled */
+struct LitProfileStack
+{
+    char* frames;
+    size_t length;
+    uint64_t hash;
+    uint64_t count;
+};
+
+struct LitProfiler
+{
+    int hz;
+    bool running;
+    uint64_t samples;
+    /* open addressed, keyed by the folded text of the stack */
+    LitProfileStack* stacks;
+    size_t count;
+    size_t capacity;
+    /* the sample being formatted */
+    char* scratch;
+    size_t scratch_length;
+    size_t scratch_capacity;
+};
+
 struct LitScanner
 {
     size_t line;
@@ -1202,6 +1674,9 @@ struct LitScanner
     size_t braces[LIT_MAX_INTERPOLATION_NESTING];
     size_t num_braces;
     bool had_error;
+    /* nothing but whitespace since the last newline, so '#' starts a preprocessor directive */
+    bool at_line_start;
+    LitPreprocessor* preprocessor;
 };
 
 struct LitOptimizer
@@ -1210,21 +1685,26 @@ struct LitOptimizer
     LitVarList variables;
     int depth;
     bool mark_used;
+    /* names that are assigned or referenced (ref x) anywhere in the module */
+    LitVarList assigned;
+    /* set while the result of an inlined call is optimized, so it isn't inlined into again */
+    bool inlining;
+    /* body of the function being optimized (NULL at the top level of the module), and its first variable */
+    LitAstExpression* function;
+    size_t function_base;
+    LitAstExprList* module;
+    /* number of temporaries introduced by LITOPTSTATE_LICM and LITOPTSTATE_CSE */
+    size_t temps;
 };
 
 struct LitPreprocessor
 {
     LitState* state;
     LitTable defined;
-    /*
-	 * A little bit dirty hack:
-	 * We need to store pointers (8 bytes in size),
-	 * and so that we don't have to declare a new
-	 * array type, that we will use only once,
-	 * I'm using LitValueList here, because LitValue
-	 * also has the same size (8 bytes)
-	 */
-    LitValueList open_ifs;
+    /* number of open #ifdef/#ifndef blocks */
+    int depth;
+    /* the depth of the block whose lines are being skipped, or 0 */
+    int skip_depth;
 };
 
 
@@ -0,0 +1,373 @@
+
+#include <math.h>
+#include "lit.h"
+#if defined(LIT_HAVE_THREADS)
+    #include <unistd.h>
+#endif
+
+/*
+* a fork-join pool for native bulk operations, one per state, started the first
+* time an operation has more than one chunk. a job is fn(data, chunk) for every
+* chunk; the caller works on it as well, and lit_pool_run returns once all chunks
+* are done. fn runs on other threads, so it must not allocate from the state, run
+* script code or raise errors: tasks only read and write the memory they are given,
+* and leave what they found in per-chunk slots for the caller to combine, in chunk
+* order.
+*/
+
+size_t lit_pool_chunkcount(size_t length)
+{
+    return (length + LIT_POOL_CHUNK - 1) / LIT_POOL_CHUNK;
+}
+
+/* how many threads (the caller included) jobs of state run on */
+int lit_pool_threadcount(LitState* state)
+{
+    #if defined(LIT_HAVE_THREADS)
+        long count;
+        count = state->config.threads;
+        if(count <= 0)
+        {
+            count = sysconf(_SC_NPROCESSORS_ONLN);
+        }
+        if(count < 1)
+        {
+            count = 1;
+        }
+        return count > LIT_POOL_MAXTHREADS ? LIT_POOL_MAXTHREADS : (int)count;
+    #else
+        (void)state;
+        return 1;
+    #endif
+}
+
+/* 0 picks one thread per core, 1 keeps everything on the calling thread */
+void lit_state_setthreadcount(LitState* state, int count)
+{
+    state->config.threads = count < 0 ? 0 : count;
+}
+
+static void lit_pool_work(LitThreadPool* pool)
+{
+    size_t chunk;
+    while((chunk = lit_atomic_add(&pool->next, 1, LIT_ATOMIC_RELAXED) - 1) < pool->chunks)
+    {
+        pool->fn(pool->data, chunk);
+    }
+}
+
+static void* lit_pool_main(void* data)
+{
+    uint64_t seen;
+    LitThreadPool* pool;
+    pool = (LitThreadPool*)data;
+    seen = 0;
+    lit_mutex_lock(&pool->lock);
+    while(true)
+    {
+        while(!pool->quit && pool->job == seen)
+        {
+            lit_cond_wait(&pool->wake, &pool->lock);
+        }
+        if(pool->quit)
+        {
+            break;
+        }
+        seen = pool->job;
+        lit_mutex_unlock(&pool->lock);
+        lit_pool_work(pool);
+        lit_mutex_lock(&pool->lock);
+        if(--pool->busy == 0)
+        {
+            lit_cond_signal(&pool->done);
+        }
+    }
+    lit_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static LitThreadPool* lit_pool_start(int count)
+{
+    int i;
+    LitThreadPool* pool;
+    pool = (LitThreadPool*)calloc(1, sizeof(LitThreadPool));
+    pool->threads = (LitThread*)malloc(count * sizeof(LitThread));
+    lit_mutex_init(&pool->lock);
+    lit_cond_init(&pool->wake);
+    lit_cond_init(&pool->done);
+    for(i = 0; i < count; i++)
+    {
+        if(!lit_thread_create(&pool->threads[i], lit_pool_main, pool))
+        {
+            break;
+        }
+    }
+    /* with fewer threads than asked for (none, without LIT_HAVE_THREADS), the caller just takes more chunks */
+    pool->count = i;
+    return pool;
+}
+
+void lit_pool_destroy(LitState* state)
+{
+    int i;
+    LitThreadPool* pool;
+    pool = state->pool;
+    if(pool == NULL)
+    {
+        return;
+    }
+    lit_mutex_lock(&pool->lock);
+    pool->quit = true;
+    lit_cond_broadcast(&pool->wake);
+    lit_mutex_unlock(&pool->lock);
+    for(i = 0; i < pool->count; i++)
+    {
+        lit_thread_join(pool->threads[i]);
+    }
+    lit_mutex_destroy(&pool->lock);
+    lit_cond_destroy(&pool->wake);
+    lit_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool);
+    state->pool = NULL;
+}
+
+/* runs fn(data, chunk) for every chunk below chunks, and returns when all of them are done */
+void lit_pool_run(LitState* state, size_t chunks, LitPoolTaskFn fn, void* data)
+{
+    size_t i;
+    int helpers;
+    LitThreadPool* pool;
+    helpers = lit_pool_threadcount(state) - 1;
+    if(chunks < 2 || helpers < 1)
+    {
+        for(i = 0; i < chunks; i++)
+        {
+            fn(data, i);
+        }
+        return;
+    }
+    if(state->pool != NULL && state->pool->count != helpers)
+    {
+        lit_pool_destroy(state);
+    }
+    if(state->pool == NULL)
+    {
+        state->pool = lit_pool_start(helpers);
+    }
+    pool = state->pool;
+    lit_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->data = data;
+    pool->chunks = chunks;
+    pool->next = 0;
+    pool->busy = pool->count;
+    pool->job++;
+    lit_cond_broadcast(&pool->wake);
+    lit_mutex_unlock(&pool->lock);
+    lit_pool_work(pool);
+    lit_mutex_lock(&pool->lock);
+    while(pool->busy > 0)
+    {
+        lit_cond_wait(&pool->done, &pool->lock);
+    }
+    lit_mutex_unlock(&pool->lock);
+}
+
+/*
+* sorting numbers: every chunk is sorted on its own, then runs are merged pairwise,
+* each round of merges on the pool. nan sorts after everything else, so the order
+* is total and the result is the same for any number of threads.
+*/
+
+typedef struct LitPoolSort LitPoolSort;
+
+struct LitPoolSort
+{
+    double* from;
+    double* to;
+    size_t count;
+    /* the length of the sorted runs being merged */
+    size_t width;
+};
+
+static inline bool lit_pool_before(double a, double b)
+{
+    return a < b || (isnan(b) && !isnan(a));
+}
+
+static void lit_pool_siftdown(double* values, size_t root, size_t count)
+{
+    size_t child;
+    double value;
+    value = values[root];
+    while((child = root * 2 + 1) < count)
+    {
+        if(child + 1 < count && lit_pool_before(values[child], values[child + 1]))
+        {
+            child++;
+        }
+        if(!lit_pool_before(value, values[child]))
+        {
+            break;
+        }
+        values[root] = values[child];
+        root = child;
+    }
+    values[root] = value;
+}
+
+static void lit_pool_heapsort(double* values, size_t count)
+{
+    size_t i;
+    double value;
+    for(i = count / 2; i-- > 0;)
+    {
+        lit_pool_siftdown(values, i, count);
+    }
+    for(i = count; i-- > 1;)
+    {
+        value = values[0];
+        values[0] = values[i];
+        values[i] = value;
+        lit_pool_siftdown(values, 0, i);
+    }
+}
+
+/* introsort: quicksort with a median of three, heapsort when it goes too deep */
+static void lit_pool_quicksort(double* values, size_t count, int depth)
+{
+    size_t i;
+    size_t j;
+    double pivot;
+    double value;
+    while(count > 16)
+    {
+        if(depth-- == 0)
+        {
+            lit_pool_heapsort(values, count);
+            return;
+        }
+        #define LIT_POOL_SWAP(a, b) { value = values[a]; values[a] = values[b]; values[b] = value; }
+        j = count / 2;
+        if(lit_pool_before(values[j], values[0]))
+        {
+            LIT_POOL_SWAP(j, 0);
+        }
+        if(lit_pool_before(values[count - 1], values[j]))
+        {
+            LIT_POOL_SWAP(count - 1, j);
+            if(lit_pool_before(values[j], values[0]))
+            {
+                LIT_POOL_SWAP(j, 0);
+            }
+        }
+        pivot = values[j];
+        i = 0;
+        j = count - 1;
+        while(true)
+        {
+            while(lit_pool_before(values[i], pivot))
+            {
+                i++;
+            }
+            while(lit_pool_before(pivot, values[j]))
+            {
+                j--;
+            }
+            if(i >= j)
+            {
+                break;
+            }
+            LIT_POOL_SWAP(i, j);
+            i++;
+            j--;
+        }
+        #undef LIT_POOL_SWAP
+        /* recurse into the smaller side, so the stack stays shallow */
+        if(j + 1 < count - j - 1)
+        {
+            lit_pool_quicksort(values, j + 1, depth);
+            values += j + 1;
+            count -= j + 1;
+        }
+        else
+        {
+            lit_pool_quicksort(values + j + 1, count - j - 1, depth);
+            count = j + 1;
+        }
+    }
+    for(i = 1; i < count; i++)
+    {
+        value = values[i];
+        for(j = i; j > 0 && lit_pool_before(value, values[j - 1]); j--)
+        {
+            values[j] = values[j - 1];
+        }
+        values[j] = value;
+    }
+}
+
+static void lit_pool_sortchunk(void* data, size_t chunk)
+{
+    size_t start;
+    size_t count;
+    LitPoolSort* sort;
+    sort = (LitPoolSort*)data;
+    start = chunk * LIT_POOL_CHUNK;
+    count = sort->count - start < LIT_POOL_CHUNK ? sort->count - start : LIT_POOL_CHUNK;
+    lit_pool_quicksort(sort->from + start, count, 2 * (int)log2((double)count + 1));
+}
+
+/* merges the two runs of chunk, which is a pair of runs of sort->width */
+static void lit_pool_mergechunk(void* data, size_t chunk)
+{
+    size_t i;
+    size_t j;
+    size_t k;
+    size_t mid;
+    size_t end;
+    LitPoolSort* sort;
+    sort = (LitPoolSort*)data;
+    k = chunk * sort->width * 2;
+    mid = k + sort->width < sort->count ? k + sort->width : sort->count;
+    end = mid + sort->width < sort->count ? mid + sort->width : sort->count;
+    i = k;
+    j = mid;
+    while(i < mid && j < end)
+    {
+        /* ties go to the left run, so merging is stable */
+        sort->to[k++] = lit_pool_before(sort->from[j], sort->from[i]) ? sort->from[j++] : sort->from[i++];
+    }
+    memcpy(sort->to + k, sort->from + i, (mid - i) * sizeof(double));
+    k += mid - i;
+    memcpy(sort->to + k, sort->from + j, (end - j) * sizeof(double));
+}
+
+void lit_pool_sortnumbers(LitState* state, double* values, size_t count)
+{
+    double* swap;
+    double* scratch;
+    LitPoolSort sort;
+    sort.from = values;
+    sort.count = count;
+    lit_pool_run(state, lit_pool_chunkcount(count), lit_pool_sortchunk, &sort);
+    if(count <= LIT_POOL_CHUNK)
+    {
+        return;
+    }
+    scratch = (double*)malloc(count * sizeof(double));
+    sort.to = scratch;
+    for(sort.width = LIT_POOL_CHUNK; sort.width < count; sort.width *= 2)
+    {
+        lit_pool_run(state, (count + sort.width * 2 - 1) / (sort.width * 2), lit_pool_mergechunk, &sort);
+        swap = sort.from;
+        sort.from = sort.to;
+        sort.to = swap;
+    }
+    if(sort.from != values)
+    {
+        memcpy(values, sort.from, count * sizeof(double));
+    }
+    free(scratch);
+}
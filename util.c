@@ -229,3 +229,64 @@ char* lit_util_copystring(const char* string)
     memcpy(new_string, string, length);
     return new_string;
 }
+
+/*
+* produces the per-state seed for string hashing. it is random for every state, so
+* whoever picks the keys of a map cannot aim for collisions; as a consequence, map
+* iteration order changes from run to run. setting the environment variable
+* LIT_HASHSEED to a number forces that seed instead (useful for tests and debugging).
+*/
+uint64_t lit_util_makehashseed(void* salt)
+{
+    uint64_t seed;
+    const char* env;
+    FILE* fh;
+    env = getenv("LIT_HASHSEED");
+    if(env != NULL && env[0] != '\0')
+    {
+        return (uint64_t)strtoull(env, NULL, 0);
+    }
+    seed = 0;
+    #if defined(LIT_OS_UNIX_LIKE)
+        fh = fopen("/dev/urandom", "rb");
+        if(fh != NULL)
+        {
+            if(fread(&seed, sizeof(seed), 1, fh) != 1)
+            {
+                seed = 0;
+            }
+            fclose(fh);
+        }
+    #else
+        (void)fh;
+    #endif
+    seed ^= (uint64_t)time(NULL);
+    seed ^= ((uint64_t)clock() << 32);
+    seed ^= (uint64_t)(uintptr_t)salt;
+    return lit_util_hashstringseed((const char*)&seed, sizeof(seed), (uint64_t)(uintptr_t)&lit_util_makehashseed);
+}
+
+/* how many bits value needs (0 for 0), which is the log2 bucket histograms put it in */
+int lit_util_bitlength(uint64_t value)
+{
+    int bits;
+    bits = 0;
+    while(value != 0)
+    {
+        value >>= 1;
+        bits++;
+    }
+    return bits;
+}
+
+/* a monotonic clock in nanoseconds, for timing things like gc pauses */
+uint64_t lit_util_nanotime(void)
+{
+    #if defined(LIT_OS_UNIX_LIKE)
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+    #else
+        return (uint64_t)((double)clock() / CLOCKS_PER_SEC * 1e9);
+    #endif
+}
@@ -211,6 +211,7 @@ LitString* lit_value_tostring(LitState* state, LitValue object)
     frame->slots = fiber->stack_top;
     frame->result_ignored = false;
     frame->return_to_c = true;
+    frame->tail_calls = 0;
     PUSH(lit_value_objectvalue(function));
     PUSH(object);
     result = lit_vm_execfiber(state, fiber);
@@ -4,6 +4,15 @@
 #include <string.h>
 #include <setjmp.h>
 #include "lit.h"
+#if defined(LIT_OPCODE_CYCLES)
+    #if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+        #include <x86intrin.h>
+        #define LIT_VM_HAVE_RDTSC
+    #elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        #include <intrin.h>
+        #define LIT_VM_HAVE_RDTSC
+    #endif
+#endif
 
 #define LIT_VM_INLINE
 
@@ -68,8 +77,7 @@ LitUpvalue *lit_execvm_captureupvalue(LitState *state, LitValue *local);
 void lit_vm_closeupvalues(LitVM *vm, const LitValue *last);
 LitInterpretResult lit_vm_execmodule(LitState *state, LitModule *module);
 LitInterpretResult lit_vm_execfiber(LitState *state, LitFiber *fiber);
-void lit_vmutil_callexitjump(void);
-bool lit_vmutil_setexitjump(void);
+void lit_vmutil_callexitjump(LitVM* vm);
 
 
 /*
@@ -90,6 +98,45 @@ bool lit_vmutil_setexitjump(void);
         } while(0);
 #endif
 
+/*
+* a safepoint for the sampling profiler: the timer only raises vm->profile_tick,
+* and the stack is walked here, with the running frame's ip saved first.
+*/
+#define vm_profilepoint() \
+    if(vm->profile_tick) \
+    { \
+        lit_vmexec_writeframe(&est, est.ip); \
+        lit_profiler_sample(state, fiber); \
+    }
+
+/* saves the ip before an instruction that allocates, so that allocation samples get its line */
+#define vm_allocpoint() \
+    lit_vmexec_writeframe(&est, est.ip);
+
+/*
+* per-opcode counters. with LIT_OPCODE_CYCLES, the ticks since the previous dispatch
+* are charged to the previous opcode, so an opcode that calls out (or into a nested
+* lit_vm_execfiber) includes that time.
+*/
+#if defined(LIT_OPCODE_CYCLES)
+    #define vm_countopcode(op) \
+        { \
+            opticks = lit_vmstats_readticks(); \
+            if(lastop < OP_TOTAL) \
+            { \
+                lit_vmstats_addcycles(&vm->opstats, lastop, opticks - lastticks); \
+            } \
+            lastticks = opticks; \
+            lastop = (op); \
+            vm->opstats.counts[lastop]++; \
+        }
+#elif defined(LIT_OPCODE_STATS)
+    #define vm_countopcode(op) \
+        vm->opstats.counts[(op)]++;
+#else
+    #define vm_countopcode(op)
+#endif
+
 // the following macros cannot be turned into a function without
 // breaking everything
 
@@ -123,8 +170,10 @@ bool lit_vmutil_setexitjump(void);
 * likewise, any macro that uses vm_recoverstate can't be turned into
 * a function.
 */
+/*
+* the frame's ip is saved by lit_vm_callvalue, before the call may grow (and move) fiber->frames.
+*/
 #define vm_recoverstate(fiber, est) \
-    lit_vmexec_writeframe(&est, est.ip); \
     fiber = vm->fiber; \
     if(fiber == NULL) \
     { \
@@ -262,11 +311,11 @@ bool lit_vmutil_setexitjump(void);
     uint8_t argc = lit_vmexec_readbyte(&est); \
     LitString* mthname = lit_vmexec_readstringlong(&est); \
     LitValue receiver = lit_vmexec_peek(fiber, argc); \
+    lit_vmexec_writeframe(&est, est.ip); \
     if(lit_value_isnull(receiver)) \
     { \
         vmexec_raiseerrorfmt("cannot index a null value with '%s'", mthname->chars); \
     } \
-    lit_vmexec_writeframe(&est, est.ip); \
     if(lit_value_isclass(receiver)) \
     { \
         vmexec_advinvokefromclass(lit_value_asclass(receiver), mthname, argc, true, static_fields, ignoring, receiver); \
@@ -295,8 +344,6 @@ bool lit_vmutil_setexitjump(void);
         vmexec_advinvokefromclass(type, mthname, argc, true, methods, ignoring, receiver); \
     }
 
-static jmp_buf jump_buffer;
-
 LIT_VM_INLINE uint16_t lit_vmexec_readshort(LitExecState* est)
 {
     est->ip += 2u;
@@ -384,11 +431,45 @@ void lit_vmexec_resetstack(LitVM* vm)
     }
 }
 
+#if defined(LIT_OPCODE_CYCLES)
+/* the timestamp counter where there is one, otherwise monotonic nanoseconds (or clock() ticks) */
+static inline uint64_t lit_vmstats_readticks(void)
+{
+    #if defined(LIT_VM_HAVE_RDTSC)
+        return __rdtsc();
+    #elif defined(CLOCK_MONOTONIC)
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+    #else
+        return (uint64_t)clock();
+    #endif
+}
+
+static inline void lit_vmstats_addcycles(LitOpcodeStats* stats, int op, uint64_t delta)
+{
+    int bucket;
+    bucket = lit_util_bitlength(delta);
+    if(bucket >= LIT_OPSTATS_BUCKETS)
+    {
+        bucket = LIT_OPSTATS_BUCKETS - 1;
+    }
+    stats->cycles[op] += delta;
+    stats->histogram[op][bucket]++;
+}
+#endif
+
 void lit_vmexec_resetvm(LitState* state, LitVM* vm)
 {
     vm->state = state;
     vm->objects = NULL;
     vm->fiber = NULL;
+    vm->profile_tick = 0;
+    vm->heapedges = NULL;
+    vm->should_update_locals = false;
+#ifdef LIT_OPCODE_STATS
+    memset(&vm->opstats, 0, sizeof(vm->opstats));
+#endif
     vm->gray_stack = NULL;
     vm->gray_count = 0;
     vm->gray_capacity = 0;
@@ -439,17 +520,101 @@ void lit_vm_tracestack(LitVM* vm, LitWriter* wr)
     lit_writer_writeformat(wr, "\n");
 }
 
-bool lit_vm_handleruntimeerror(LitVM* vm, LitString* error_string)
+/* with a NULL buffer, the traceback writers below only measure */
+#define LIT_TRACEBACK_AT \
+    (buffer == NULL ? NULL : buffer + length), (buffer == NULL ? 0 : capacity - length)
+
+/* two frames print the same traceback line if they stopped at the same instruction */
+static bool lit_vm_sameframe(LitCallFrame* a, LitCallFrame* b)
+{
+    return a->function == b->function && a->ip == b->ip && a->tail_calls == 0 && b->tail_calls == 0;
+}
+
+static size_t lit_vm_writeframe(char* buffer, size_t capacity, LitCallFrame* frame, size_t repeats)
+{
+    size_t length;
+    const char* name;
+    LitChunk* chunk;
+    length = 0;
+    chunk = &frame->function->chunk;
+    name = frame->function->name == NULL ? "unknown" : frame->function->name->chars;
+    if(chunk->has_line_info)
+    {
+        length += snprintf(LIT_TRACEBACK_AT, "[line %d] in %s()\n", (int)lit_chunk_getline(chunk, frame->ip - chunk->code - 1), name);
+    }
+    else
+    {
+        length += snprintf(LIT_TRACEBACK_AT, "\tin %s()\n", name);
+    }
+    if(frame->tail_calls > 0)
+    {
+        length += snprintf(LIT_TRACEBACK_AT, "\t(%d tail calls elided)\n", (int)frame->tail_calls);
+    }
+    if(repeats > 1)
+    {
+        length += snprintf(LIT_TRACEBACK_AT, "\t(repeated %d more times)\n", (int)(repeats - 1));
+    }
+    return length;
+}
+
+/*
+* writes the traceback of fiber, innermost frame first, and returns its length.
+* a run of the same frame (plain recursion) takes a single line, and of deeper
+* stacks (mutual recursion) only LIT_TRACEBACK_EDGE runs at either end are shown.
+*/
+static size_t lit_vm_writetraceback(LitFiber* fiber, char* buffer, size_t capacity)
 {
     int i;
-    int count;
+    int first;
+    size_t run;
+    size_t runs;
+    size_t skipped;
+    size_t length;
+    LitCallFrame* frames;
+    frames = fiber->frames;
+    runs = 0;
+    for(i = (int)fiber->frame_count - 1; i >= 0; i--)
+    {
+        if(i == (int)fiber->frame_count - 1 || !lit_vm_sameframe(&frames[i], &frames[i + 1]))
+        {
+            runs++;
+        }
+    }
+    length = 0;
+    run = 0;
+    skipped = 0;
+    for(i = (int)fiber->frame_count - 1; i >= 0; i = first - 1)
+    {
+        first = i;
+        while(first > 0 && lit_vm_sameframe(&frames[first - 1], &frames[i]))
+        {
+            first--;
+        }
+        if(run < LIT_TRACEBACK_EDGE || run + LIT_TRACEBACK_EDGE >= runs)
+        {
+            if(skipped > 0)
+            {
+                length += snprintf(LIT_TRACEBACK_AT, "\t... %d more frames\n", (int)skipped);
+                skipped = 0;
+            }
+            length += lit_vm_writeframe(LIT_TRACEBACK_AT, &frames[i], (size_t)(i - first + 1));
+        }
+        else
+        {
+            skipped += (size_t)(i - first + 1);
+        }
+        run++;
+    }
+    return length;
+}
+
+#undef LIT_TRACEBACK_AT
+
+bool lit_vm_handleruntimeerror(LitVM* vm, LitString* error_string)
+{
     size_t length;
     char* start;
     char* buffer;
-    const char* name;
-    LitCallFrame* frame;
-    LitFunction* function;
-    LitChunk* chunk;
     LitValue lit_emitter_raiseerror;
     LitFiber* fiber;
     LitFiber* caller;
@@ -477,44 +642,14 @@ bool lit_vm_handleruntimeerror(LitVM* vm, LitString* error_string)
         fiber->parent->abort = true;
     }
     // Maan, formatting c strings is hard...
-    count = (int)fiber->frame_count - 1;
     length = snprintf(NULL, 0, "%s%s\n", COLOR_RED, error_string->chars);
-    for(i = count; i >= 0; i--)
-    {
-        frame = &fiber->frames[i];
-        function = frame->function;
-        chunk = &function->chunk;
-        name = function->name == NULL ? "unknown" : function->name->chars;
-
-        if(chunk->has_line_info)
-        {
-            length += snprintf(NULL, 0, "[line %d] in %s()\n", (int)lit_chunk_getline(chunk, frame->ip - chunk->code - 1), name);
-        }
-        else
-        {
-            length += snprintf(NULL, 0, "\tin %s()\n", name);
-        }
-    }
+    length += lit_vm_writetraceback(fiber, NULL, 0);
     length += snprintf(NULL, 0, "%s", COLOR_RESET);
     buffer = (char*)malloc(length + 1);
     buffer[length] = '\0';
     start = buffer + sprintf(buffer, "%s%s\n", COLOR_RED, error_string->chars);
-    for(i = count; i >= 0; i--)
-    {
-        frame = &fiber->frames[i];
-        function = frame->function;
-        chunk = &function->chunk;
-        name = function->name == NULL ? "unknown" : function->name->chars;
-        if(chunk->has_line_info)
-        {
-            start += sprintf(start, "[line %d] in %s()\n", (int)lit_chunk_getline(chunk, frame->ip - chunk->code - 1), name);
-        }
-        else
-        {
-            start += sprintf(start, "\tin %s()\n", name);
-        }
-    }
-    start += sprintf(start, "%s", COLOR_RESET);
+    start += lit_vm_writetraceback(fiber, start, length + 1 - (size_t)(start - buffer));
+    sprintf(start, "%s", COLOR_RESET);
     lit_state_raiseerror(vm->state, RUNTIME_ERROR, buffer);
     free(buffer);
     lit_vmexec_resetstack(vm);
@@ -551,36 +686,89 @@ bool lit_vm_raiseexitingerror(LitVM* vm, const char* format, ...)
     va_start(args, format);
     result = lit_vm_vraiseerror(vm, format, args);
     va_end(args);
-    lit_vmutil_callexitjump();
+    lit_vmutil_callexitjump(vm);
     return result;
 }
 
+/*
+* pushes a frame for a fixed-arity script function called with exactly its arity,
+* when the frame and value stacks already have room. returns false if any of the
+* arity, vararg, growth or constant loading in lit_vm_callcallable is needed.
+*/
+LIT_VM_INLINE bool lit_vmexec_callfixed(LitFiber* fiber, LitFunction* function, LitClosure* closure, uint8_t argc)
+{
+    LitCallFrame* frame;
+    if(argc != function->arg_count || function->vararg || function->image != NULL || fiber->frame_count == fiber->frame_capacity
+       || (size_t)(fiber->stack_top - fiber->stack) + function->max_slots > fiber->stack_capacity)
+    {
+        return false;
+    }
+    frame = &fiber->frames[fiber->frame_count++];
+    frame->function = function;
+    frame->closure = closure;
+    frame->ip = function->chunk.code;
+    frame->slots = fiber->stack_top - argc - 1;
+    frame->result_ignored = false;
+    frame->return_to_c = false;
+    frame->tail_calls = 0;
+    return true;
+}
+
+/*
+* packs the trailing vararg_count values on the stack into the rest parameter.
+* functions that never mention '...' get null instead, and no array is allocated.
+*/
+static void lit_vmexec_packvarargs(LitVM* vm, LitFunction* function, size_t vararg_count)
+{
+    size_t i;
+    LitArray* array;
+    LitFiber* fiber;
+    fiber = vm->fiber;
+    if(!function->vararg_used)
+    {
+        fiber->stack_top -= vararg_count;
+        lit_vm_push(vm, NULL_VALUE);
+        return;
+    }
+    array = lit_create_array(vm->state);
+    lit_state_pushroot(vm->state, (LitObject*)array);
+    lit_vallist_ensuresize(vm->state, &array->list, vararg_count);
+    lit_state_poproot(vm->state);
+    for(i = 0; i < vararg_count; i++)
+    {
+        lit_vallist_set(&array->list, i, fiber->stack_top[(int)i - (int)vararg_count]);
+    }
+    fiber->stack_top -= vararg_count;
+    lit_vm_push(vm, lit_value_objectvalue(array));
+}
+
 bool lit_vm_callcallable(LitVM* vm, LitFunction* function, LitClosure* closure, uint8_t argc)
 {
-    bool vararg;
     size_t amount;
     size_t i;
     size_t osize;
     size_t newcapacity;
     size_t newsize;
-    size_t vararg_count;
     size_t function_arg_count;
     LitCallFrame* frame;
     LitFiber* fiber;
-    LitArray* array;
     fiber = vm->fiber;
-
-    #if 0
-    //if(fiber->frame_count == LIT_CALL_FRAMES_MAX)
-    //{
-        //lit_vm_raiseerror(vm, "lit_vm_callcallable stack overflow");
-        //return true;
-    //}
-    #endif
+    if(function->image != NULL)
+    {
+        lit_ioutil_loadconstants(vm->state, function);
+    }
+    if(lit_vmexec_callfixed(fiber, function, closure, argc))
+    {
+        return true;
+    }
     if(fiber->frame_count + 1 > fiber->frame_capacity)
     {
-        //newcapacity = fmin(LIT_CALL_FRAMES_MAX, fiber->frame_capacity * 2);
-        newcapacity = (fiber->frame_capacity * 2);
+        if(fiber->frame_capacity >= LIT_CALL_FRAMES_MAX)
+        {
+            lit_vm_raiseerror(vm, "stack overflow");
+            return true;
+        }
+        newcapacity = fmin(LIT_CALL_FRAMES_MAX, fiber->frame_capacity * 2);
         newsize = (sizeof(LitCallFrame) * newcapacity);
         osize = (sizeof(LitCallFrame) * fiber->frame_capacity);
         fiber->frames = (LitCallFrame*)lit_gcmem_memrealloc(vm->state, fiber->frames, osize, newsize);
@@ -596,49 +784,70 @@ bool lit_vm_callcallable(LitVM* vm, LitFunction* function, LitClosure* closure,
     frame->slots = fiber->stack_top - argc - 1;
     frame->result_ignored = false;
     frame->return_to_c = false;
-    if(argc != function_arg_count)
+    frame->tail_calls = 0;
+    if(argc < function_arg_count)
     {
-        vararg = function->vararg;
-        if(argc < function_arg_count)
+        amount = (int)function_arg_count - argc - (function->vararg ? 1 : 0);
+        for(i = 0; i < amount; i++)
         {
-            amount = (int)function_arg_count - argc - (vararg ? 1 : 0);
-            for(i = 0; i < amount; i++)
-            {
-                lit_vm_push(vm, NULL_VALUE);
-            }
-            if(vararg)
-            {
-                lit_vm_push(vm, lit_value_objectvalue(lit_create_array(vm->state)));
-            }
+            lit_vm_push(vm, NULL_VALUE);
         }
-        else if(function->vararg)
+        if(function->vararg)
         {
-            array = lit_create_array(vm->state);
-            vararg_count = argc - function_arg_count + 1;
-            lit_state_pushroot(vm->state, (LitObject*)array);
-            lit_vallist_ensuresize(vm->state, &array->list, vararg_count);
-            lit_state_poproot(vm->state);
-            for(i = 0; i < vararg_count; i++)
-            {
-                lit_vallist_set(&array->list, i, vm->fiber->stack_top[(int)i - (int)vararg_count]);
-            }
-            vm->fiber->stack_top -= vararg_count;
-            lit_vm_push(vm, lit_value_objectvalue(array));
-        }
-        else
-        {
-            vm->fiber->stack_top -= (argc - function_arg_count);
+            lit_vmexec_packvarargs(vm, function, 0);
         }
     }
     else if(function->vararg)
     {
-        array = lit_create_array(vm->state);
-        vararg_count = argc - function_arg_count + 1;
-        lit_state_pushroot(vm->state, (LitObject*)array);
-        lit_vallist_push(vm->state, &array->list, *(fiber->stack_top - 1));
-        *(fiber->stack_top - 1) = lit_value_objectvalue(array);
-        lit_state_poproot(vm->state);
+        lit_vmexec_packvarargs(vm, function, argc - function_arg_count + 1);
+    }
+    else if(argc > function_arg_count)
+    {
+        fiber->stack_top -= (argc - function_arg_count);
+    }
+    return true;
+}
+
+/*
+* replaces the current frame with a call to callee, whose arguments sit at the top of the stack.
+* only script functions can be called this way - natives, classes and bound methods
+* return false, and the caller falls back to a regular call followed by OP_RETURN.
+*/
+static bool lit_vmexec_tailcall(LitVM* vm, LitFiber* fiber, LitExecState* est, LitValue callee, uint8_t argc)
+{
+    bool result_ignored;
+    bool return_to_c;
+    size_t tail_calls;
+    LitFunction* function;
+    LitClosure* closure;
+    LitCallFrame* frame;
+    if(lit_value_isclosure(callee))
+    {
+        closure = lit_value_asclosure(callee);
+        function = closure->function;
+    }
+    else if(lit_value_isfunction(callee))
+    {
+        closure = NULL;
+        function = lit_value_asfunction(callee);
     }
+    else
+    {
+        return false;
+    }
+    frame = est->frame;
+    result_ignored = frame->result_ignored;
+    return_to_c = frame->return_to_c;
+    tail_calls = frame->tail_calls + 1;
+    lit_vm_closeupvalues(vm, est->slots);
+    memmove(est->slots, fiber->stack_top - argc - 1, sizeof(LitValue) * (argc + 1));
+    fiber->stack_top = est->slots + argc + 1;
+    fiber->frame_count--;
+    lit_vm_callcallable(vm, function, closure, argc);
+    frame = &fiber->frames[fiber->frame_count - 1];
+    frame->result_ignored = result_ignored;
+    frame->return_to_c = return_to_c;
+    frame->tail_calls = tail_calls;
     return true;
 }
 
@@ -668,25 +877,25 @@ bool lit_vm_callvalue(LitVM* vm, LitFiber* fiber, LitExecState* est, LitValue ca
     LitInstance* instance;
     LitClass* klass;
     (void)valfiber;
+    lit_vmexec_writeframe(est, est->ip);
     if(lit_value_isobject(callee))
     {
-        if(lit_vmutil_setexitjump())
+        /* script functions never leave through the exit jump, so they skip the setjmp */
+        if(lit_value_isclosure(callee))
+        {
+            closure = lit_value_asclosure(callee);
+            return lit_vm_callcallable(vm, closure->function, closure, argc);
+        }
+        if(lit_value_isfunction(callee))
+        {
+            return lit_vm_callcallable(vm, lit_value_asfunction(callee), NULL, argc);
+        }
+        if(lit_vmutil_setexitjump(vm))
         {
             return true;
         }
         switch(lit_value_type(callee))
         {
-            case LITTYPE_FUNCTION:
-                {
-                    return lit_vm_callcallable(vm, lit_value_asfunction(callee), NULL, argc);
-                }
-                break;
-            case LITTYPE_CLOSURE:
-                {
-                    closure = lit_value_asclosure(callee);
-                    return lit_vm_callcallable(vm, closure->function, closure, argc);
-                }
-                break;
             case LITTYPE_NATIVE_FUNCTION:
                 {
                     vm_pushgc(vm->state, false)
@@ -802,7 +1011,7 @@ bool lit_vm_callvalue(LitVM* vm, LitFiber* fiber, LitExecState* est, LitValue ca
     /*
     LitValue* slots;
     LitValue* privates;
-    LitUpvalue** upvalues;
+    LitValue* upvalues;
     uint8_t* ip;
     LitCallFrame* frame;
     LitChunk* current_chunk;
@@ -841,45 +1050,57 @@ bool lit_vm_callvalue(LitVM* vm, LitFiber* fiber, LitExecState* est, LitValue ca
 
 LitUpvalue* lit_execvm_captureupvalue(LitState* state, LitValue* local)
 {
+    size_t i;
+    size_t slot;
+    LitFiber* fiber;
     LitUpvalue* upvalue;
-    LitUpvalue* created_upvalue;
-    LitUpvalue* previous_upvalue;
-    previous_upvalue = NULL;
-    upvalue = state->vm->fiber->open_upvalues;
-    while(upvalue != NULL && upvalue->location > local)
+    fiber = state->vm->fiber;
+    slot = (size_t)(local - fiber->stack);
+    if(fiber->open_upvalues == NULL)
     {
-        previous_upvalue = upvalue;
-        upvalue = upvalue->next;
+        fiber->open_upvalues = (LitUpvalue**)LIT_ALLOCATE(state, sizeof(LitUpvalue*), fiber->stack_capacity);
+        for(i = 0; i < fiber->stack_capacity; i++)
+        {
+            fiber->open_upvalues[i] = NULL;
+        }
     }
-    if(upvalue != NULL && upvalue->location == local)
+    upvalue = fiber->open_upvalues[slot];
+    if(upvalue != NULL)
     {
         return upvalue;
     }
-    created_upvalue = lit_create_upvalue(state, local);
-    created_upvalue->next = upvalue;
-    if(previous_upvalue == NULL)
+    upvalue = lit_create_upvalue(state, local);
+    fiber->open_upvalues[slot] = upvalue;
+    if(slot >= fiber->open_upvalue_top)
     {
-        state->vm->fiber->open_upvalues = created_upvalue;
+        fiber->open_upvalue_top = slot + 1;
     }
-    else
-    {
-        previous_upvalue->next = created_upvalue;
-    }
-    return created_upvalue;
+    return upvalue;
 }
 
 void lit_vm_closeupvalues(LitVM* vm, const LitValue* last)
 {
+    size_t i;
+    size_t from;
     LitFiber* fiber;
     LitUpvalue* upvalue;
     fiber = vm->fiber;
-    while(fiber->open_upvalues != NULL && fiber->open_upvalues->location >= last)
+    from = (size_t)(last - fiber->stack);
+    if(from >= fiber->open_upvalue_top)
+    {
+        return;
+    }
+    for(i = from; i < fiber->open_upvalue_top; i++)
     {
-        upvalue = fiber->open_upvalues;
-        upvalue->closed = *upvalue->location;
-        upvalue->location = &upvalue->closed;
-        fiber->open_upvalues = upvalue->next;
+        upvalue = fiber->open_upvalues[i];
+        if(upvalue != NULL)
+        {
+            upvalue->closed = *upvalue->location;
+            upvalue->location = &upvalue->closed;
+            fiber->open_upvalues[i] = NULL;
+        }
     }
+    fiber->open_upvalue_top = from;
 }
 
 LitInterpretResult lit_vm_execmodule(LitState* state, LitModule* module)
@@ -943,8 +1164,17 @@ LitInterpretResult lit_vm_execfiber(LitState* state, LitFiber* fiber)
     LitValue peeked;
     LitValue* pval;
     LitValueList* values;
+    LitTypedArray* typed;
+    double numidx;
     LitExecState est;
     LitVM* vm;
+#if defined(LIT_OPCODE_CYCLES)
+    int lastop;
+    uint64_t opticks;
+    uint64_t lastticks;
+    lastop = OP_TOTAL;
+    lastticks = 0;
+#endif
 
     (void)instruction;
     vm = state->vm;
@@ -986,6 +1216,7 @@ LitInterpretResult lit_vm_execfiber(LitState* state, LitFiber* fiber)
         }
 #endif
 
+        vm_countopcode(*est.ip);
         #ifdef LIT_USE_COMPUTEDGOTO
             #ifdef LIT_TRACE_EXECUTION
                 instruction = *est.ip++;
@@ -1018,6 +1249,7 @@ LitInterpretResult lit_vm_execfiber(LitState* state, LitFiber* fiber)
             }
             op_case(OP_RETURN)
             {
+                vm_profilepoint();
                 result = lit_vmexec_pop(fiber);
                 lit_vm_closeupvalues(vm, est.slots);
                 lit_vmexec_writeframe(&est, est.ip);
@@ -1058,6 +1290,10 @@ LitInterpretResult lit_vm_execfiber(LitState* state, LitFiber* fiber)
                 {
                     lit_vmexec_push(fiber, result);
                 }
+                if(fiber->frame_capacity > LIT_INITIAL_CALL_FRAMES && fiber->frame_count < fiber->frame_capacity / 4)
+                {
+                    lit_shrink_fiber_stack(state, fiber);
+                }
                 lit_vmexec_readframe(fiber, &est);
                 vm_traceframe(fiber);
                 continue;
@@ -1089,11 +1325,13 @@ LitInterpretResult lit_vm_execfiber(LitState* state, LitFiber* fiber)
             }
             op_case(OP_ARRAY)
             {
+                vm_allocpoint();
                 lit_vmexec_push(fiber, lit_value_objectvalue(lit_create_array(state)));
                 continue;
             }
             op_case(OP_OBJECT)
             {
+                vm_allocpoint();
                 // TODO: use object, or map for literal '{...}' constructs?
                 // objects would be more general-purpose, but don't implement anything map-like.
                 //lit_vmexec_push(fiber, lit_value_objectvalue(lit_create_instance(state, state->objectvalue_class)));
@@ -1103,6 +1341,7 @@ LitInterpretResult lit_vm_execfiber(LitState* state, LitFiber* fiber)
             }
             op_case(OP_RANGE)
             {
+                vm_allocpoint();
                 a = lit_vmexec_pop(fiber);
                 b = lit_vmexec_pop(fiber);
                 if(!lit_value_isnumber(a) || !lit_value_isnumber(b))
@@ -1360,13 +1599,19 @@ LitInterpretResult lit_vm_execfiber(LitState* state, LitFiber* fiber)
             }
             op_case(OP_SET_UPVALUE)
             {
+                // only variables that get reassigned are boxed, so this is always an upvalue
                 index = lit_vmexec_readbyte(&est);
-                *est.upvalues[index]->location = lit_vmexec_peek(fiber, 0);
+                *lit_value_asupvalue(est.upvalues[index])->location = lit_vmexec_peek(fiber, 0);
                 continue;
             }
             op_case(OP_GET_UPVALUE)
             {
-                lit_vmexec_push(fiber, *est.upvalues[lit_vmexec_readbyte(&est)]->location);
+                value = est.upvalues[lit_vmexec_readbyte(&est)];
+                if(lit_value_isupvalue(value))
+                {
+                    value = *lit_value_asupvalue(value)->location;
+                }
+                lit_vmexec_push(fiber, value);
                 continue;
             }
 
@@ -1405,6 +1650,7 @@ LitInterpretResult lit_vm_execfiber(LitState* state, LitFiber* fiber)
             }
             op_case(OP_JUMP_BACK)
             {
+                vm_profilepoint();
                 offset = lit_vmexec_readshort(&est);
                 est.ip -= offset;
                 continue;
@@ -1450,14 +1696,47 @@ LitInterpretResult lit_vm_execfiber(LitState* state, LitFiber* fiber)
             }
             op_case(OP_CALL)
             {
+                vm_profilepoint();
                 argc = lit_vmexec_readbyte(&est);
                 lit_vmexec_writeframe(&est, est.ip);
                 peeked = lit_vmexec_peek(fiber, argc);
+                function = NULL;
+                if(lit_value_isclosure(peeked))
+                {
+                    closure = lit_value_asclosure(peeked);
+                    function = closure->function;
+                }
+                else if(lit_value_isfunction(peeked))
+                {
+                    closure = NULL;
+                    function = lit_value_asfunction(peeked);
+                }
+                if(function != NULL && lit_vmexec_callfixed(fiber, function, closure, argc))
+                {
+                    lit_vmexec_readframe(fiber, &est);
+                    vm_traceframe(fiber);
+                    continue;
+                }
+                vm_callvalue(peeked, argc);
+                continue;
+            }
+            op_case(OP_TAIL_CALL)
+            {
+                argc = lit_vmexec_readbyte(&est);
+                lit_vmexec_writeframe(&est, est.ip);
+                peeked = lit_vmexec_peek(fiber, argc);
+                if(lit_vmexec_tailcall(vm, fiber, &est, peeked, argc))
+                {
+                    lit_vmexec_readframe(fiber, &est);
+                    vm_traceframe(fiber);
+                    continue;
+                }
                 vm_callvalue(peeked, argc);
                 continue;
             }
             op_case(OP_CLOSURE)
             {
+                vm_allocpoint();
                 function = lit_value_asfunction(lit_vmexec_readconstantlong(&est));
                 closure = lit_create_closure(state, function);
                 lit_vmexec_push(fiber, lit_value_objectvalue(closure));
@@ -1465,9 +1744,13 @@ LitInterpretResult lit_vm_execfiber(LitState* state, LitFiber* fiber)
                 {
                     is_local = lit_vmexec_readbyte(&est);
                     index = lit_vmexec_readbyte(&est);
-                    if(is_local)
+                    if(is_local & LIT_CAPTURE_BYVALUE)
+                    {
+                        closure->upvalues[i] = est.frame->slots[index];
+                    }
+                    else if(is_local & LIT_CAPTURE_LOCAL)
                     {
-                        closure->upvalues[i] = lit_execvm_captureupvalue(state, est.frame->slots + index);
+                        closure->upvalues[i] = lit_value_objectvalue(lit_execvm_captureupvalue(state, est.frame->slots + index));
                     }
                     else
                     {
@@ -1484,6 +1767,7 @@ LitInterpretResult lit_vm_execfiber(LitState* state, LitFiber* fiber)
             }
             op_case(OP_CLASS)
             {
+                vm_allocpoint();
                 name = lit_vmexec_readstringlong(&est);
                 klassobj = lit_create_class(state, name);
                 lit_vmexec_push(fiber, lit_value_objectvalue(klassobj));
@@ -1706,11 +1990,158 @@ LitInterpretResult lit_vm_execfiber(LitState* state, LitFiber* fiber)
             }
             op_case(OP_SUBSCRIPT_GET)
             {
+                /*
+                * the builtin containers can't have their "[]" overridden, so the common cases are
+                * handled right here. anything else (ranges, out of bounds indexes, wrapped maps,
+                * user classes) still goes through the "[]" method.
+                */
+                object = lit_vmexec_peek(fiber, 1);
+                arg = lit_vmexec_peek(fiber, 0);
+                if(lit_value_isobject(object) && lit_value_asobject(object) != NULL)
+                {
+                    switch(lit_value_asobject(object)->type)
+                    {
+                        case LITTYPE_ARRAY:
+                            {
+                                if(lit_value_isnumber(arg))
+                                {
+                                    values = &lit_value_asarray(object)->list;
+                                    numidx = trunc(lit_value_asnumber(arg));
+                                    if(numidx < 0)
+                                    {
+                                        numidx += lit_vallist_count(values);
+                                    }
+                                    if(numidx >= 0 && numidx < lit_vallist_count(values))
+                                    {
+                                        lit_vmexec_drop(fiber);
+                                        fiber->stack_top[-1] = lit_vallist_get(values, (size_t)numidx);
+                                        continue;
+                                    }
+                                }
+                            }
+                            break;
+                        case LITTYPE_MAP:
+                            {
+                                if(lit_value_isstring(arg) && lit_value_asmap(object)->index_fn == NULL)
+                                {
+                                    if(!lit_table_get(&lit_value_asmap(object)->values, lit_value_asstring(arg), &value))
+                                    {
+                                        value = NULL_VALUE;
+                                    }
+                                    lit_vmexec_drop(fiber);
+                                    fiber->stack_top[-1] = value;
+                                    continue;
+                                }
+                            }
+                            break;
+                        case LITTYPE_STRING:
+                            {
+                                if(lit_value_isnumber(arg) && lit_value_asnumber(arg) >= 0)
+                                {
+                                    name = lit_value_asstring(object);
+                                    name = lit_ustring_codepointat(state, name, lit_util_ucharoffset(name->chars, (int)lit_value_asnumber(arg)));
+                                    lit_vmexec_drop(fiber);
+                                    fiber->stack_top[-1] = name == NULL ? NULL_VALUE : lit_value_objectvalue(name);
+                                    continue;
+                                }
+                            }
+                            break;
+                        case LITTYPE_TYPEDARRAY:
+                            {
+                                if(lit_value_isnumber(arg))
+                                {
+                                    typed = lit_value_astypedarray(object);
+                                    numidx = trunc(lit_value_asnumber(arg));
+                                    if(numidx < 0)
+                                    {
+                                        numidx += typed->length;
+                                    }
+                                    lit_vmexec_drop(fiber);
+                                    if(numidx >= 0 && numidx < typed->length)
+                                    {
+                                        fiber->stack_top[-1] = lit_value_numbertovalue(state, lit_typedarray_get(typed, (size_t)numidx));
+                                    }
+                                    else
+                                    {
+                                        fiber->stack_top[-1] = NULL_VALUE;
+                                    }
+                                    continue;
+                                }
+                            }
+                            break;
+                        default:
+                            break;
+                    }
+                }
                 vm_invokemethod(lit_vmexec_peek(fiber, 1), "[]", 1);
                 continue;
             }
             op_case(OP_SUBSCRIPT_SET)
             {
+                // see OP_SUBSCRIPT_GET
+                object = lit_vmexec_peek(fiber, 2);
+                arg = lit_vmexec_peek(fiber, 1);
+                value = lit_vmexec_peek(fiber, 0);
+                if(lit_value_isobject(object) && lit_value_asobject(object) != NULL)
+                {
+                    switch(lit_value_asobject(object)->type)
+                    {
+                        case LITTYPE_ARRAY:
+                            {
+                                if(lit_value_isnumber(arg))
+                                {
+                                    values = &lit_value_asarray(object)->list;
+                                    numidx = trunc(lit_value_asnumber(arg));
+                                    if(numidx < 0)
+                                    {
+                                        numidx += lit_vallist_count(values);
+                                    }
+                                    if(numidx >= 0 && numidx < lit_vallist_count(values))
+                                    {
+                                        lit_vallist_set(values, (size_t)numidx, value);
+                                        lit_vmexec_dropn(fiber, 2);
+                                        fiber->stack_top[-1] = value;
+                                        continue;
+                                    }
+                                }
+                            }
+                            break;
+                        case LITTYPE_MAP:
+                            {
+                                if(lit_value_isstring(arg) && lit_value_asmap(object)->index_fn == NULL)
+                                {
+                                    // may grow the table, so everything stays on the stack until it is done
+                                    lit_map_set(state, lit_value_asmap(object), lit_value_asstring(arg), value);
+                                    lit_vmexec_dropn(fiber, 2);
+                                    fiber->stack_top[-1] = value;
+                                    continue;
+                                }
+                            }
+                            break;
+                        case LITTYPE_TYPEDARRAY:
+                            {
+                                if(lit_value_isnumber(arg) && lit_value_isnumber(value))
+                                {
+                                    typed = lit_value_astypedarray(object);
+                                    numidx = trunc(lit_value_asnumber(arg));
+                                    if(numidx < 0)
+                                    {
+                                        numidx += typed->length;
+                                    }
+                                    if(numidx >= 0 && numidx < typed->length)
+                                    {
+                                        lit_typedarray_set(typed, (size_t)numidx, lit_value_asnumber(value));
+                                        lit_vmexec_dropn(fiber, 2);
+                                        fiber->stack_top[-1] = value;
+                                        continue;
+                                    }
+                                }
+                            }
+                            break;
+                        default:
+                            break;
+                    }
+                }
                 vm_invokemethod(lit_vmexec_peek(fiber, 2), "[]", 2);
                 continue;
             }
@@ -1771,6 +2202,32 @@ LitInterpretResult lit_vm_execfiber(LitState* state, LitFiber* fiber)
                 vm_invokeoperation(false);
                 continue;
             }
+            op_case(OP_TAIL_INVOKE)
+            {
+                /* operands are only consumed here when the method resolves to a script function */
+                argc = est.ip[0];
+                peeked = lit_vmexec_peek(fiber, argc);
+                if(lit_value_isinstance(peeked))
+                {
+                    mthname = lit_value_asstring(lit_vallist_get(&est.current_chunk->constants, (uint16_t)((est.ip[1] << 8) | est.ip[2])));
+                    instobj = lit_value_asinstance(peeked);
+                    if(!lit_table_get(&instobj->fields, mthname, &value)
+                       && lit_table_get(&instobj->klass->methods, mthname, &value)
+                       && (lit_value_isclosure(value) || lit_value_isfunction(value)))
+                    {
+                        est.ip += 3;
+                        lit_vmexec_writeframe(&est, est.ip);
+                        lit_vmexec_tailcall(vm, fiber, &est, value, argc);
+                        lit_vmexec_readframe(fiber, &est);
+                        vm_traceframe(fiber);
+                        continue;
+                    }
+                }
+                {
+                    vm_invokeoperation(false);
+                }
+                continue;
+            }
             op_case(OP_INVOKE_IGNORING)
             {
                 vm_invokeoperation(true);
@@ -1863,6 +2320,7 @@ LitInterpretResult lit_vm_execfiber(LitState* state, LitFiber* fiber)
             }
             op_case(OP_VARARG)
             {
+                vm_allocpoint();
                 slot = est.slots[lit_vmexec_readbyte(&est)];
                 if(!lit_value_isarray(slot))
                 {
@@ -1881,6 +2339,7 @@ LitInterpretResult lit_vm_execfiber(LitState* state, LitFiber* fiber)
 
             op_case(OP_REFERENCE_GLOBAL)
             {
+                vm_allocpoint();
                 name = lit_vmexec_readstringlong(&est);
                 if(lit_table_get_slot(&vm->globals->values, name, &pval))
                 {
@@ -1894,21 +2353,25 @@ LitInterpretResult lit_vm_execfiber(LitState* state, LitFiber* fiber)
             }
             op_case(OP_REFERENCE_PRIVATE)
             {
+                vm_allocpoint();
                 lit_vmexec_push(fiber, lit_value_objectvalue(lit_create_reference(state, &est.privates[lit_vmexec_readshort(&est)])));
                 continue;
             }
             op_case(OP_REFERENCE_LOCAL)
             {
+                vm_allocpoint();
                 lit_vmexec_push(fiber, lit_value_objectvalue(lit_create_reference(state, &est.slots[lit_vmexec_readshort(&est)])));
                 continue;
             }
             op_case(OP_REFERENCE_UPVALUE)
             {
-                lit_vmexec_push(fiber, lit_value_objectvalue(lit_create_reference(state, est.upvalues[lit_vmexec_readbyte(&est)]->location)));
+                vm_allocpoint();
+                lit_vmexec_push(fiber, lit_value_objectvalue(lit_create_reference(state, lit_value_asupvalue(est.upvalues[lit_vmexec_readbyte(&est)])->location)));
                 continue;
             }
             op_case(OP_REFERENCE_FIELD)
             {
+                vm_allocpoint();
                 object = lit_vmexec_peek(fiber, 1);
                 if(lit_value_isnull(object))
                 {
@@ -1954,14 +2417,9 @@ LitInterpretResult lit_vm_execfiber(LitState* state, LitFiber* fiber)
 }
 
 
-void lit_vmutil_callexitjump()
-{
-    longjmp(jump_buffer, 1);
-}
-
-bool lit_vmutil_setexitjump()
+void lit_vmutil_callexitjump(LitVM* vm)
 {
-    return setjmp(jump_buffer);
+    longjmp(vm->exitjump, 1);
 }
 
 
@@ -122,7 +122,11 @@ static const char* lit_object_type_names[] =
     "userdata",
     "range",
     "field",
-    "reference"
+    "reference",
+    "number",
+    "bool",
+    "typedarray",
+    "buffer"
 };
 
 
@@ -166,7 +170,7 @@ static void print_map(LitState* state, LitWriter* wr, LitMap* map, size_t size)
     had_before = false;
     if(size > 0)
     {
-        for(i = 0; i < (size_t)map->values.capacity; i++)
+        for(i = 0; i <= (size_t)map->values.capacity; i++)
         {
             entry = &map->values.entries[i];
             if(entry->key != NULL)
@@ -208,6 +212,7 @@ void lit_towriter_object(LitState* state, LitWriter* wr, LitValue value)
     LitMap* map;
     LitArray* array;
     LitRange* range;
+    LitTypedArray* typed;
     LitValue* slot;
     LitObject* obj;
     LitUpvalue* upvalue;
@@ -335,6 +340,17 @@ void lit_towriter_object(LitState* state, LitWriter* wr, LitValue value)
                     lit_writer_writeformat(wr, "%g .. %g", range->from, range->to);
                 }
                 break;
+            case LITTYPE_TYPEDARRAY:
+                {
+                    typed = lit_value_astypedarray(value);
+                    lit_writer_writeformat(wr, "%s(%u)", lit_typedarray_kindname(typed->kind), (unsigned int)typed->length);
+                }
+                break;
+            case LITTYPE_BUFFER:
+                {
+                    lit_writer_writeformat(wr, "Buffer(%u)", (unsigned int)lit_value_asbuffer(value)->length);
+                }
+                break;
             case LITTYPE_FIELD:
                 {
                     lit_writer_writeformat(wr, "field");
@@ -437,11 +453,20 @@ const char* lit_tostring_typename(LitValue value)
     }
     else if(lit_value_isobject(value))
     {
-        return lit_object_type_names[lit_value_type(value)];
+        return lit_tostring_objtype(lit_value_type(value));
     }
     return "unknown";
 }
 
+const char* lit_tostring_objtype(LitObjType type)
+{
+    if(type < LITTYPE_STRING || type > LITTYPE_BUFFER)
+    {
+        return "unknown";
+    }
+    return lit_object_type_names[type - LITTYPE_STRING];
+}
+
 const char* lit_tostring_exprtype(LitExprType t)
 {
     switch(t)
@@ -705,12 +730,12 @@ void lit_towriter_expr(LitState* state, LitWriter* wr, LitAstExpression* expr)
             {
                 as_type(exobj, expr, LitAstObjectExpr);
                 lit_writer_writeformat(wr, "{");
-                for(i=0; i<lit_vallist_count(&exobj->keys); i++)
+                for(i=0; i<exobj->keys.count; i++)
                 {
-                    lit_towriter_value(state, wr, lit_vallist_get(&exobj->keys, i));
+                    lit_towriter_expr(state, wr, exobj->keys.values[i]);
                     lit_writer_writeformat(wr, ": ");
                     lit_towriter_expr(state, wr, exobj->values.values[i]);
-                    if((i+1) < lit_vallist_count(&exobj->keys))
+                    if((i+1) < exobj->keys.count)
                     {
                         lit_writer_writeformat(wr, ", ");
                     }